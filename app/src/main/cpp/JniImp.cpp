@@ -3,6 +3,33 @@
 //
 #include "jni.h"
 #include "utils/LogUtil.h"
+#include "buffer/DrmBufferPool.h"
+#include "buffer/DrmFormat.h"
+#include "buffer/RawImageFile.h"
+#include "buffer/RawVideoReader.h"
+#include "render/EglImageCache.h"
+#include "render/Compositor.h"
+#include "render/OsdInstancedRenderer.h"
+#include "render/OsdAtlas.h"
+#include "render/FramePacer.h"
+#include "render/GpuTimer.h"
+#include "render/CpuCompositor.h"
+#include "render/GlWorkerPool.h"
+#include "render/MosaicCompositor.h"
+#include "render/GpuScaler.h"
+#include "render/RenderService.h"
+#include "utils/ProgramBinaryCache.h"
+#include "utils/AsyncDumpWriter.h"
+#include "utils/FrameContainer.h"
+#include "utils/ImageConverter.h"
+#include "utils/ImageCopier.h"
+#include "utils/NativeImagePool.h"
+#include "libsync.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
 
 #define NATIVE_TEST_CLASS_NAME "com/hikvision/jni/MyTest"
 
@@ -67,8 +94,28 @@ typedef struct rk_texture_s{
 	int fbo_id;
 	int drm_fd;
 	void * drm_viraddr;
+	DrmBuffer * drm_buf;
 } rk_texture_t;
 
+//正在被 dump 写线程读的 dma-buf, release 回调之前不能改写或还给缓冲池
+static std::mutex g_dump_mutex;
+static std::condition_variable g_dump_cond;
+static std::multiset<DrmBuffer *> g_dump_pending;
+
+static void release_rk_texture_dump(void * opaque)
+{
+	std::lock_guard<std::mutex> lock(g_dump_mutex);
+	g_dump_pending.erase(g_dump_pending.find((DrmBuffer *)opaque));
+	g_dump_cond.notify_all();
+}
+
+//改写或释放 rk_texture 的 buffer 之前调用, 等它上面还没写完的 dump
+void wait_rk_texture_dump(rk_texture_t * rk_texture)
+{
+	std::unique_lock<std::mutex> lock(g_dump_mutex);
+	while(rk_texture->drm_buf && g_dump_pending.count(rk_texture->drm_buf)) g_dump_cond.wait(lock);
+}
+
 
 static void printGLString(const char *name, GLenum s) {
 	// fprintf(stderr, "printGLString %s, %d\n", name, s);
@@ -91,156 +138,13 @@ static void checkGlError(const char* op) {
 	}
 }
 
-static const char gVertexShader[] =
-		"#version 310 es \n"
-		"in vec4 vPosition;\n"
-		"in vec2 osdtexCoords;\n"
-		"in vec2 bgtexCoords;\n"
-		"out vec2 osdTexCoords;\n"
-		"out vec2 bgTexCoords;\n"
-		"void main() {\n"
-		"    osdTexCoords = osdtexCoords;\n"
-		"    bgTexCoords = bgtexCoords;\n"
-		"    gl_Position = vPosition;\n"
-		"}\n";
-
-//    "attribute vec4 vPosition;\n"
-//    "attribute vec2 texCoords;"
-//    "varying vec2 outTexCoords;"
-
-//    "void main() {\n"
-//    "    outTexCoords = texCoords;\n"
-//    "    gl_Position = vPosition;\n"
-//    "}\n";
-
-static const char gFragmentShader[] =
-		"#version 310 es \n"
-		"#extension GL_OES_EGL_image_external : require \n"
-		"#extension GL_EXT_YUV_target : require \n"
-		"precision mediump float;\n"
-		"uniform __samplerExternal2DY2YEXT osdTexture;\n"
-		"uniform __samplerExternal2DY2YEXT bgTexture;\n"
-		"yuvCscStandardEXT conv_standard = itu_601;\n"  //itu_601_full_range  itu_709  itu_601
-		"in vec2 osdTexCoords;\n"
-		"in vec2 bgTexCoords;\n"
-		"out vec4 FragColor;\n"
-		"void main() {\n"
-		"   vec4 osdColor=texture(osdTexture, osdTexCoords);\n"
-		"   vec3 osdColor_yuv=rgb_2_yuv(texture(osdTexture, osdTexCoords).xyz,conv_standard);\n"
-
-		"   vec4 bgColor=texture(bgTexture, bgTexCoords);\n"
-		"   FragColor=vec4(bgColor.xyz*(1.0-osdColor.a) + osdColor_yuv.xyz*osdColor.a,1.0);\n"
-		"}\n";
-
-//    "#extension GL_OES_EGL_image_external : require\n"
-//    "precision mediump float;\n"
-//    "uniform samplerExternalOES outTexture;"
-//    "varying vec2 outTexCoords;"
-//    "void main() {\n"
-//    //"  gl_FragColor = vec4(0.0, 1.0, 0.0, 1.0);\n"
-//    "    gl_FragColor = texture2D(outTexture, outTexCoords);"
-//    "}\n";
-
-
-GLuint loadShader(GLenum shaderType, const char* pSource) {
-	GLuint shader = glCreateShader(shaderType);
-	if (shader) {
-		glShaderSource(shader, 1, &pSource, NULL);
-		glCompileShader(shader);
-		GLint compiled = 0;
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-		if (!compiled) {
-			GLint infoLen = 0;
-			glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLen);
-			if (infoLen) {
-				char* buf = (char*) malloc(infoLen);
-				if (buf) {
-					glGetShaderInfoLog(shader, infoLen, NULL, buf);
-					fprintf(stderr, "Could not compile shader %d:\n%s\n",
-							shaderType, buf);
-					free(buf);
-				}
-				glDeleteShader(shader);
-				shader = 0;
-			}
-		}
-	}
-	return shader;
-}
-
-GLuint createProgram(const char* pVertexSource, const char* pFragmentSource) {
-	GLuint vertexShader = loadShader(GL_VERTEX_SHADER, pVertexSource);
-	if (!vertexShader) {
-		return 0;
-	}
-
-	GLuint pixelShader = loadShader(GL_FRAGMENT_SHADER, pFragmentSource);
-	if (!pixelShader) {
-		return 0;
-	}
-
-	GLuint program = glCreateProgram();
-	if (program) {
-		glAttachShader(program, vertexShader);
-		checkGlError("glAttachShader");
-		glAttachShader(program, pixelShader);
-		checkGlError("glAttachShader");
-		glLinkProgram(program);
-		GLint linkStatus = GL_FALSE;
-		glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
-		if (linkStatus != GL_TRUE) {
-			GLint bufLength = 0;
-			glGetProgramiv(program, GL_INFO_LOG_LENGTH, &bufLength);
-			if (bufLength) {
-				char* buf = (char*) malloc(bufLength);
-				if (buf) {
-					glGetProgramInfoLog(program, bufLength, NULL, buf);
-					fprintf(stderr, "Could not link program:\n%s\n", buf);
-					free(buf);
-				}
-			}
-			glDeleteProgram(program);
-			program = 0;
-		}
-	}
-	return program;
-}
-
-GLuint gProgram;
-GLuint gvPositionHandle;
-GLuint gosdTexCoordsHandle;
-GLuint gbgTexCoordsHandle;
-GLuint gosdTextureSamplerHandle;
-GLuint gbgTextureSamplerHandle;
+Compositor gCompositor;
 
 bool setupGraphics(int w, int h) {
-	gProgram = createProgram(gVertexShader, gFragmentShader);
-	if (!gProgram) {
+	//shader 按图层数由 Compositor 按需生成
+	if (gCompositor.Init()) {
 		return false;
 	}
-	gvPositionHandle = glGetAttribLocation(gProgram, "vPosition");
-	checkGlError("glGetAttribLocation");
-	fprintf(stderr, "glGetAttribLocation(\"vPosition\") = %d\n",
-			gvPositionHandle);
-	printf("rk-debug[%s %d]  gvPositionHandle:%d \n",__FUNCTION__,__LINE__,gvPositionHandle);
-
-	gosdTexCoordsHandle = glGetAttribLocation(gProgram, "osdtexCoords");
-	checkGlError("glGetAttribLocation");
-	printf("rk-debug[%s %d]  gosdTexCoordsHandle:%d \n",__FUNCTION__,__LINE__,gosdTexCoordsHandle);
-
-	gbgTexCoordsHandle = glGetAttribLocation(gProgram, "bgtexCoords");
-	checkGlError("glGetAttribLocation");
-	printf("rk-debug[%s %d]  gbgTexCoordsHandle:%d \n",__FUNCTION__,__LINE__,gbgTexCoordsHandle);
-
-	gosdTextureSamplerHandle = glGetUniformLocation(gProgram, "osdTexture");
-	checkGlError("glGetAttribLocation");
-	printf("rk-debug[%s %d]  gosdTextureSamplerHandle:%d \n",__FUNCTION__,__LINE__,gosdTextureSamplerHandle);
-	gbgTextureSamplerHandle = glGetUniformLocation(gProgram, "bgTexture");
-	checkGlError("glGetAttribLocation");
-	printf("rk-debug[%s %d]  gbgTextureSamplerHandle:%d \n",__FUNCTION__,__LINE__,gbgTextureSamplerHandle);
-
-	glActiveTexture(GL_TEXTURE0);
-
 
 	glViewport(0, 0, w, h);
 	checkGlError("glViewport");
@@ -248,104 +152,38 @@ bool setupGraphics(int w, int h) {
 }
 
 
-//const GLfloat gTriangleVertices[] = {
-//    -0.5f, 0.5f,
-//    -0.5f, -0.5f,
-//    0.5f, -0.5f,
-//    0.5f, 0.5f,
-//};
-
-//const GLfloat gtexVertices[] = {
-//    0.0f, 1.0f,
-//    0.0f, 0.0f,
-//    1.0f, 0.0f,
-//    1.0f, 1.0f,
-//};
-
-GLfloat * gTriangleVertices = NULL;
-
-GLfloat * gRGBATexVertices = NULL;
-GLfloat * gYUVTexVertices = NULL;
-
-void caculate_Vertex_coordinates(GLfloat * gVertexPoint, float display_w, float display_h, float x,float y,float w,float h)
-{
-	//归一化至顶点坐标系
-	gVertexPoint[0]=(x/display_w)     * 2.0f-1.0f;
-	gVertexPoint[1]=(y/display_h)     * 2.0f-1.0f;
-	gVertexPoint[2]=(x/display_w)     * 2.0f-1.0f;
-	gVertexPoint[3]=((y + h)/display_h) * 2.0f-1.0f;
-	gVertexPoint[4]=((x + w)/display_w) * 2.0f-1.0f;
-	gVertexPoint[5]=((y + h)/display_h) * 2.0f-1.0f;
-	gVertexPoint[6]=((x + w)/display_w) * 2.0f-1.0f;
-	gVertexPoint[7]=(y/display_h)     * 2.0f-1.0f;
-
-	for(int i=0;i<4;i++)
-		printf("gVertexPoint_%d=(%f,%f) \n",i,gVertexPoint[i*2],gVertexPoint[i*2+1]);
-}
-
-void caculate_Texture_coordinates(GLfloat * gTexturePoint, float display_w, float display_h, float x,float y,float w,float h)
-{
-	//归一化至纹理坐标系
-	gTexturePoint[0]=(x/display_w);
-	gTexturePoint[1]=(y/display_h);
-	gTexturePoint[2]=(x/display_w);
-	gTexturePoint[3]=((y + h)/display_h);
-	gTexturePoint[4]=((x + w)/display_w);
-	gTexturePoint[5]=((y + h)/display_h);
-	gTexturePoint[6]=((x + w)/display_w);
-	gTexturePoint[7]=(y/display_h);
-
-	for(int i=0;i<4;i++)
-		printf("gTexturePoint%d=(%f,%f) \n",i,gTexturePoint[i*2],gTexturePoint[i*2+1]);
-
-}
-
-
-void renderFrame(rk_texture_t * src_texture,rk_texture_t * dst_texture) {
-
-//        //由于fbo背景,这里不进行clearcolor
-//        glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
-//        checkGlError("glClearColor");
-//        glClear( GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-//        checkGlError("glClear");
-
-	glUseProgram(gProgram);
-	checkGlError("glUseProgram");
-
-	{
-		glVertexAttribPointer(gvPositionHandle, 2, GL_FLOAT, GL_FALSE, 0, gTriangleVertices);
-		checkGlError("glVertexAttribPointer");
-		glEnableVertexAttribArray(gvPositionHandle);
-		checkGlError("glEnableVertexAttribArray");
-		glVertexAttribPointer(gosdTexCoordsHandle, 2, GL_FLOAT, GL_FALSE,0, gRGBATexVertices);
-		checkGlError("glVertexAttribPointer");
-		glEnableVertexAttribArray(gosdTexCoordsHandle);
-		checkGlError("glEnableVertexAttribArray");
-		glVertexAttribPointer(gbgTexCoordsHandle, 2, GL_FLOAT, GL_FALSE,0, gYUVTexVertices);
-		checkGlError("glVertexAttribPointer");
-		glEnableVertexAttribArray(gbgTexCoordsHandle);
-		checkGlError("glEnableVertexAttribArray");
-
-
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_EXTERNAL_OES, src_texture->texture_id);
-		checkGlError("glBindTexture");
-		glUniform1i(gosdTextureSamplerHandle, 0);
-		checkGlError("glUniform1i");
-
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_EXTERNAL_OES, dst_texture->texture_id);
-		checkGlError("glBindTexture");
-		glUniform1i(gbgTextureSamplerHandle, 1);
-		checkGlError("glUniform1i");
-
-
-		printf("rk-debug[%s %d]  \n",__FUNCTION__,__LINE__);
-		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-		checkGlError("glDrawArrays");
-
-	}
-
+//把 src 作为一个 OSD 图层贴到 dst 的 (x, y) 处, 多图层请直接使用 gCompositor.Compose.
+//src_version/dst_version 为两者的内容版本, 开启损伤跟踪时两者都没变的帧会被跳过
+void renderFrame(rk_texture_t * src_texture,rk_texture_t * dst_texture, int x, int y,
+				 uint64_t src_version = 0, uint64_t dst_version = 0) {
+
+	const DrmFormatInfo * src_info = DrmFormat::Find(src_texture->drm_format);
+	wait_rk_texture_dump(dst_texture);
+
+	CompositorLayer layer;
+	memset(&layer, 0, sizeof(layer));
+	layer.texture_id = src_texture->texture_id;
+	layer.tex_w = src_texture->w;
+	layer.tex_h = src_texture->h;
+	layer.is_yuv = src_info ? src_info->is_yuv : 0;
+	layer.src_w = src_texture->w;
+	layer.src_h = src_texture->h;
+	layer.dst_x = x;
+	layer.dst_y = y;
+	layer.dst_w = src_texture->w;
+	layer.dst_h = src_texture->h;
+	layer.alpha = 1.0f;
+	layer.version = src_version;
+
+	CompositorTarget target;
+	target.texture_id = dst_texture->texture_id;
+	target.fbo_id = dst_texture->fbo_id;
+	target.w = dst_texture->w;
+	target.h = dst_texture->h;
+	target.version = dst_version;
+
+	gCompositor.Compose(target, &layer, 1);
+	checkGlError("renderFrame");
 }
 
 
@@ -362,138 +200,158 @@ static void checkEglError(const char* op, EGLBoolean returnVal = EGL_TRUE) {
 }
 
 
-int read_img_from_file(void * buffer,const char* file_path, int rw, int rh, int vw, float format_size)
+//读原始文件的第 frame_index 帧到 buffer, buffer 按 DrmFormat::GetLayout 的 stride 排布
+int read_img_from_file(void * buffer,const char* file_path, int rw, int rh, const DrmFormatInfo * info, int frame_index = 0)
 {
-	FILE * pfile = NULL;
-	char layername[100] ;
-	sprintf(layername,"%s",file_path);
-
-	pfile = fopen(layername,"rb");
-	if(pfile)
+	RawImageFile file;
+	if(file.Open(file_path, info, rw, rh) < 0)
 	{
-		if(rw == vw)   //实宽虚宽相等,一次性读入.
-		{
-			//int size =src.w*src.h*(src.is_afbc?2:1)* get_format_size(src.drm_format);
-			int size = rw*rh*format_size;
-			int fret= fread((void *)buffer,1,size,pfile);
-			LOGCATD("rk-debug read %s Success size:%d fread_size=%d\n",layername,size,fret);
-
-		}else {    //实宽虚宽不等,逐行读取.
-			for(int i = 0;i < rh;i++)
-			{
-				int stride = vw * format_size;
-				char * temp_addr = (char *)buffer + i * stride;
-				fseek (pfile, i * rw * format_size, SEEK_SET);
-				int fret= fread((void *)temp_addr,1,rw * format_size,pfile);
-				LOGCATD("rk-debug read %s Success fread_size=%d\n",layername,fret);
-			}
-		}
-
-		fclose(pfile);
-	}else{
-		LOGCATD("rk-debug Could not open file:%s !\n",layername);
+		LOGCATD("rk-debug Could not open file:%s !\n",file_path);
 		return -1;
 	}
-	return 0;
+
+	int ret = file.ReadFrame(frame_index, buffer);
+	LOGCATD("rk-debug read %s frame %d/%d size:%u ret=%d\n",file_path,frame_index,file.GetFrameCount(),file.GetFrameSize(),ret);
+	return ret;
 }
 
+static AsyncDumpWriter * create_dump_writer()
+{
+	AsyncDumpWriter * writer = new AsyncDumpWriter(4, DUMP_DROP_OLDEST);
+	writer->SetDirectory("/data/dump");
+	writer->SetFileMode(DUMP_FILE_CONTAINER);
+	return writer;
+}
+
+AsyncDumpWriter * get_dump_writer()
+{
+	//dump 在独立线程写文件, 渲染线程只排队; 积压超过 4 帧时丢弃最早的.
+	//同名的帧追加到同一个 container, 文件头里带格式/stride/modifier, 可原样回放.
+	//渲染线程和流式回放都会调用, 与 get_render_service 一样用局部静态变量保证只创建一个
+	static AsyncDumpWriter * writer = create_dump_writer();
+	return writer;
+}
 
-int dumpPixels_new(int index,int inWindowWidth,int inWindowHeight,void * pPixelDataFront,const char * format,int size){
-	char file_name[100];
-	sprintf(file_name,"/data/dump/dumplayer_%d_%dx%d_%s.bin",index,inWindowWidth,inWindowHeight,format);
-	if(1)
+//按 create_texture_fbo_img 导入时的排布描述 rk_texture 的一帧, addr 为这一帧数据的映射地址.
+//afbc 数据作为一整块写出, 行数按 DumpSize / pitch 计算
+static void describe_rk_texture(const rk_texture_t * rk_texture, void * addr, DumpFrameDesc * desc)
+{
+	const DrmFormatInfo * info = DrmFormat::Find(rk_texture->drm_format);
+	DrmFormatLayout layout;
+	DrmFormat::GetLayout(info, rk_texture->w, rk_texture->h, &layout);
+	memset(desc, 0, sizeof(*desc));
+	desc->fourcc = info->fourcc;
+	desc->width = rk_texture->w;
+	desc->height = rk_texture->h;
+	desc->num_planes = info->num_planes;
+	if(DrmFormat::UseAfbc(info, rk_texture->is_afbc))
+	{
+		desc->modifier = DrmFormat::Modifier(info, 0, rk_texture->is_afbc);
+		desc->num_planes = 1;
+		desc->planes[0].data = (const uint8_t *)addr;
+		desc->planes[0].stride = layout.pitches[0];
+		desc->planes[0].row_bytes = layout.pitches[0];
+		desc->planes[0].rows = DrmFormat::DumpSize(info, rk_texture->w, rk_texture->h, 1) / layout.pitches[0];
+		return;
+	}
+	for(int i = 0;i < info->num_planes;i++)
 	{
-		FILE *file = fopen(file_name, "wb");
-		if (!file)
-		{
-			printf("Could not open /%s \n",file_name);
-			return -1;
-		} else {
-			printf("open %s and write ok\n",file_name);
-		}
-		fwrite(pPixelDataFront, size, 1, file);
-		fclose(file);
+		desc->planes[i].data = (const uint8_t *)addr + layout.offsets[i];
+		desc->planes[i].stride = layout.pitches[i];
+		desc->planes[i].row_bytes = DrmFormat::PlaneRowBytes(info, i, rk_texture->w);
+		desc->planes[i].rows = layout.heights[i];
 	}
+}
 
+//把 rk_texture 当前的内容追加到 /data/dump/<name>. 不拷贝: buffer 连同 fence_fd(写 buffer 的 sync_file, 所有权交给 writer)
+//直接交给写线程, 写完之前调用方不能改写/释放它, 需要时用 wait_rk_texture_dump 等
+int dump_rk_texture_frame(rk_texture_t * rk_texture, const char * name, uint64_t frame_index, int fence_fd = -1)
+{
+	if(!DrmFormat::Find(rk_texture->drm_format) || !rk_texture->drm_viraddr || !rk_texture->drm_buf)
+	{
+		printf("rk-debug[%s %d] unsupport format:0x%x \n",__FUNCTION__,__LINE__,rk_texture->drm_format);
+		if(fence_fd >= 0) close(fence_fd);
+		return -1;
+	}
+
+	DumpFrameDesc desc;
+	describe_rk_texture(rk_texture, rk_texture->drm_viraddr, &desc);
+	desc.frame_index = frame_index;
+	{
+		std::lock_guard<std::mutex> lock(g_dump_mutex);
+		g_dump_pending.insert(rk_texture->drm_buf);
+	}
+	//丢弃时 release 也会被调用, 不用另外清理
+	if(get_dump_writer()->Submit(desc, name, release_rk_texture_dump, rk_texture->drm_buf, fence_fd) < 0)
+	{
+		printf("dump %s frame %llu dropped\n",name,(unsigned long long)frame_index);
+		return -1;
+	}
 	return 0;
 }
 
+//流式回放中被 dump 的帧, 写完后由写线程还给 reader
+struct stream_dump_ref_t
+{
+	RawVideoReader * reader;
+	RawVideoFrame frame;
+};
 
-void *alloc_drm_buf(int *fd,int in_w, int in_h, int in_bpp)
+static void release_stream_dump(void * opaque)
 {
-	printf("rk-debug[%s %d] *fd:%d w:%d h:%d in_bpp:%d \n",__FUNCTION__,__LINE__,*fd,in_w,in_h,in_bpp);
+	stream_dump_ref_t * ref = (stream_dump_ref_t *)opaque;
+	ref->reader->ReleaseFrame(ref->frame);
+	delete ref;
+}
 
-	static const char* card = "/dev/dri/card0";
-	int drm_fd = -1;
-	int flag = O_RDWR;
-	int ret;
-	void *map = NULL;
 
-	void *vir_addr = NULL;
-	struct drm_prime_handle fd_args;
-	struct drm_mode_map_dumb mmap_arg;
-	struct drm_mode_destroy_dumb destory_arg;
+EglImageCache * get_egl_image_cache()
+{
+	static EglImageCache * cache = new EglImageCache(16);
+	return cache;
+}
 
-	struct drm_mode_create_dumb alloc_arg;
+static void on_drm_buffer_free(DrmBuffer * buf, void * opaque)
+{
+	//dma-buf 销毁后 inode 可能被复用, 必须让缓存里对应的纹理失效
+	get_egl_image_cache()->Invalidate(buf->prime_fd);
+}
 
-	drm_fd = open(card, flag);
-	if(drm_fd < 0)
-	{
-		printf("failed to open %s\n", card);
-		return NULL;
+static DrmBufferPool * create_drm_buffer_pool()
+{
+	DumbBufferBackend * dumb = new DumbBufferBackend("/dev/dri/card0");
+	DrmBufferPool * pool = NULL;
+	if(dumb->IsOpen()) {
+		pool = new DrmBufferPool(dumb);
+	} else {
+		//没有 DRM 节点时退回 memfd, 仅 CPU 路径(读文件/dump)可用, EGL 无法导入
+		LOGCATE("rk-debug[%s %d] /dev/dri/card0 unavailable, fall back to memfd backend\n",__FUNCTION__,__LINE__);
+		delete dumb;
+		pool = new DrmBufferPool(new MemfdBufferBackend());
 	}
+	pool->SetFreeListener(on_drm_buffer_free, NULL);
+	return pool;
+}
 
-	memset(&alloc_arg, 0, sizeof(alloc_arg));
-	alloc_arg.bpp = in_bpp;
-	alloc_arg.width = in_w;
-	alloc_arg.height = in_h;
-
-	ret = drmIoctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &alloc_arg);
-	if (ret) {
-		printf("failed to create dumb buffer: %s\n", strerror(errno));
-		return NULL;
-	}
+DrmBufferPool * get_drm_buffer_pool()
+{
+	//持久化 DRM fd, 释放的 buffer 按 (w,h,bpp,afbc) 回收复用
+	static DrmBufferPool * pool = create_drm_buffer_pool();
+	return pool;
+}
 
-	memset(&fd_args, 0, sizeof(fd_args));
-	fd_args.fd = -1;
-	fd_args.handle = alloc_arg.handle;;
-	fd_args.flags = 0;
-	ret = drmIoctl(drm_fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &fd_args);
-	if (ret)
+void *alloc_drm_buf(rk_texture_t * rk_texture,int in_w, int in_h, int in_bpp)
+{
+	DrmBuffer * buf = get_drm_buffer_pool()->Acquire(in_w, in_h, in_bpp, rk_texture->is_afbc);
+	if(!buf)
 	{
-		printf("rk-debug handle_to_fd failed ret=%d,err=%s, handle=%x \n",ret,strerror(errno),fd_args.handle);
+		printf("rk-debug[%s %d] alloc failed w:%d h:%d in_bpp:%d \n",__FUNCTION__,__LINE__,in_w,in_h,in_bpp);
+		rk_texture->drm_fd = -1;
 		return NULL;
 	}
-	printf("Dump fd = %d \n",fd_args.fd);
-	*fd = fd_args.fd;
-
-	//handle to Virtual address
-	memset(&mmap_arg, 0, sizeof(mmap_arg));
-	mmap_arg.handle = alloc_arg.handle;
-
-	ret = drmIoctl(drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &mmap_arg);
-	if (ret) {
-		printf("failed to create map dumb: %s\n", strerror(errno));
-		vir_addr = NULL;
-		goto destory_dumb;
-	}
-	vir_addr = map = mmap64(0, alloc_arg.size, PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd, mmap_arg.offset);
-	if (map == MAP_FAILED) {
-		printf("failed to mmap buffer: %s\n", strerror(errno));
-		vir_addr = NULL;
-		goto destory_dumb;
-	}
-	printf("alloc map=%p \n",map);
-	close(drm_fd);
-	return vir_addr;
-destory_dumb:
-	memset(&destory_arg, 0, sizeof(destory_arg));
-	destory_arg.handle = alloc_arg.handle;
-	int fdd = *fd ;
-	ret = drmIoctl(fdd, DRM_IOCTL_MODE_DESTROY_DUMB, &destory_arg);
-	if (ret)
-		printf("failed to destory dumb %d\n", ret);
-	return vir_addr;
+	rk_texture->drm_buf = buf;
+	rk_texture->drm_fd = buf->prime_fd;
+	return buf->vir_addr;
 }
 
 EGLDisplay initEGLContex()
@@ -612,352 +470,216 @@ int dump_rk_texture(rk_texture_t * rk_texture)
 }
 
 
-float get_format_size(int in_format)
+int create_drm_fd(rk_texture_t * rk_texture)
 {
-	//create img
-	switch(in_format){
-		case DRM_FORMAT_ABGR8888:
-			return 4.0;
-			break;
-		case DRM_FORMAT_BGR888:
-		case DRM_FORMAT_RGB888:
-			return 3.0;
-			break;
-		case DRM_FORMAT_RGBA5551:
-			return 2.0;
-			break;
-		case DRM_FORMAT_YUYV:
-			return 2.0;
-			break;
-		case DRM_FORMAT_NV12:
-		case DRM_FORMAT_YUV420_8BIT:
-			return 1.5;
-			break;
-		default :
-			return 0;
+	const DrmFormatInfo * info = DrmFormat::Find(rk_texture->drm_format);
+	if(!info)
+	{
+		LOGCATE("rk-debug[%s %d] error in_format unSupport:0x%x \n",__FUNCTION__,__LINE__,rk_texture->drm_format);
+		return -1;
 	}
 
+	//按 stride 对齐后的虚宽申请, 与 EGL 导入时的 pitch 一致; afbc bpp 先按照2倍申请
+	rk_texture->drm_viraddr = alloc_drm_buf(rk_texture, DrmFormat::AlignedWidth(info, rk_texture->w), rk_texture->h,
+											DrmFormat::AllocBpp(info, rk_texture->is_afbc));
+	return rk_texture->drm_viraddr ? 0 : -1;
 }
 
+int release_drm_fd(rk_texture_t * rk_texture)
+{
+	if(!rk_texture->drm_buf)
+		return -1;
 
-int create_drm_fd(rk_texture_t * rk_texture)
+	wait_rk_texture_dump(rk_texture);
+	get_drm_buffer_pool()->Release(rk_texture->drm_buf);
+	rk_texture->drm_buf = NULL;
+	rk_texture->drm_fd = -1;
+	rk_texture->drm_viraddr = NULL;
+	return 0;
+}
+
+
+
+//按 rk_texture 的格式/宽高把 drm_fd 导入成纹理(need_fbo 时带 FBO), 结果写回 texture_id/fbo_id
+//purge 为 false 时不在当前线程删除缓存里待删的 GL 对象, 共享 context 的工作线程导入时使用
+static int import_rk_texture(EGLDisplay dpy,rk_texture_t * rk_texture, bool purge = true)
 {
 	int in_format = rk_texture->drm_format;
 	int is_afbc = rk_texture->is_afbc;
 	int textureW = rk_texture->w;
 	int textureH = rk_texture->h;
 
+	DmaBufImportDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.fd = rk_texture->drm_fd;
+	desc.width = textureW;
+	desc.height = textureH;
+	desc.fourcc = in_format;
+	desc.need_fbo = rk_texture->need_fbo;
+
+	const DrmFormatInfo * info = DrmFormat::Find(in_format);
+	if(!info)
+	{
+		LOGCATE("rk-debug[%s %d] error in_format unSupport:0x%x \n",__FUNCTION__,__LINE__,in_format);
+		return -1;
+	}
 
 	//create img
-	switch(in_format){
-		case DRM_FORMAT_ABGR8888:
-			rk_texture->drm_viraddr = alloc_drm_buf(&(rk_texture->drm_fd),textureW,textureH,is_afbc?64:32); //afbc bpp 先按照2倍申请
-			break;
-		case DRM_FORMAT_BGR888:
-		case DRM_FORMAT_RGB888:
-			rk_texture->drm_viraddr = alloc_drm_buf(&(rk_texture->drm_fd),textureW,textureH,is_afbc?48:24); //afbc bpp 先按照2倍申请
-			break;
-		case DRM_FORMAT_RGBA5551:
-			rk_texture->drm_viraddr = alloc_drm_buf(&(rk_texture->drm_fd),ALIGN(textureW,16),textureH,16); //无afbc ,16bit=2Byte
-			break;
-		case DRM_FORMAT_YUYV:
-			rk_texture->drm_viraddr = alloc_drm_buf(&(rk_texture->drm_fd),textureW,textureH,is_afbc?32:16); //afbc bpp 先按照2倍申请
-			break;
-		case DRM_FORMAT_NV12:
-		case DRM_FORMAT_YUV420_8BIT:
-
-			rk_texture->drm_viraddr = alloc_drm_buf(&(rk_texture->drm_fd),textureW,textureH,is_afbc?24:12); //afbc bpp 先按照2倍申请
-			break;
+	DrmFormatLayout layout;
+	DrmFormat::GetLayout(info, textureW, textureH, &layout);
+	desc.num_planes = info->num_planes;
+	for(int i = 0;i < info->num_planes;i++)
+	{
+		desc.offsets[i] = layout.offsets[i];
+		desc.pitches[i] = layout.pitches[i];
+		desc.modifiers[i] = DrmFormat::Modifier(info, i, is_afbc);
 	}
+
+	//同一个 dma-buf 重复导入时直接复用已有的 texture/FBO
+	ImportedTexture tex;
+	if(get_egl_image_cache()->Import(dpy, desc, &tex, purge))
+	{
+		LOGCATE("rk-debug eglCreateImageKHR NULL \n ");
+		return -1;
+	}
+	rk_texture->texture_id = tex.texture_id;
+	rk_texture->fbo_id = tex.fbo_id;
 	return 0;
 }
 
-
+//GlWorkerPool 任务: 在工作线程的共享 context 里导入一路输入, 只建纹理不建 FBO
+static int import_channel_task(EGLDisplay dpy, void * opaque)
+{
+	rk_texture_t * rk_texture = (rk_texture_t *)opaque;
+	if(rk_texture->need_fbo)
+		return -1;
+	return import_rk_texture(dpy, rk_texture, false);
+}
 
 int create_texture_fbo_img(EGLDisplay dpy,rk_texture_t * rk_texture)
 {
-
-	EGLImageKHR img = NULL;
-	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
-	PFNEGLCREATEIMAGEKHRPROC create_image;
-	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
-	create_image = (PFNEGLCREATEIMAGEKHRPROC) eglGetProcAddress("eglCreateImageKHR");
-	image_target_texture_2d = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC) eglGetProcAddress("glEGLImageTargetTexture2DOES");
-	destroy_image = (PFNEGLDESTROYIMAGEKHRPROC) eglGetProcAddress("eglDestroyImageKHR");
-
-	int in_format = rk_texture->drm_format;
-	int is_afbc = rk_texture->is_afbc;
-	GLuint * p_texture_id =(GLuint *) &(rk_texture->texture_id);
-	GLuint * p_fbo_id = (GLuint *)&(rk_texture->fbo_id);
-	int fd = rk_texture->drm_fd;
-	int textureW = rk_texture->w;
-	int textureH = rk_texture->h;
-	int is_need_fbo = rk_texture->need_fbo;
-
-	LOGCATD("rk-debug[%s %d] rk_texture:%p t:%p p_texture_id:%p \n",__FUNCTION__,__LINE__,rk_texture,&(rk_texture->texture_id),p_texture_id);
-
-
 	if(dump_rk_texture(rk_texture))
 	{
 		LOGCATD("rk-debug[%s %d] rk_texture == NULL \n",__FUNCTION__,__LINE__);
+		return -1;
 	}
 
-	//create img
-	switch(in_format){
-		case DRM_FORMAT_ABGR8888:
-		{
-			int stride = ALIGN(textureW, 32) * 4;
-
-			EGLint attr[] = {
-					EGL_WIDTH, textureW,
-					EGL_HEIGHT, textureH,
-					EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_ABGR8888,
-					EGL_DMA_BUF_PLANE0_FD_EXT, fd,
-					EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-					EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT:EGL_NONE, static_cast<EGLint>(is_afbc?((AFBC_FORMAT_MOD_SPARSE | AFBC_FORMAT_MOD_BLOCK_SIZE_16x16)&0xffffffff):EGL_NONE), //rk支持afbc默认格式
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT:EGL_NONE, is_afbc?(0x08<<24):EGL_NONE,  //ARM平台标志位
-					EGL_NONE
-			};
-			img = create_image(dpy, EGL_NO_CONTEXT,EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL, attr);
-			ECHK(img);
-			if(img == EGL_NO_IMAGE_KHR)
-			{
-				LOGCATD("rk-debug eglCreateImageKHR NULL \n ");
-				return -1;
-			}
-		}
-			break;
-		case DRM_FORMAT_BGR888:
-		case DRM_FORMAT_RGB888:
-		{
-			int stride = ALIGN(textureW, 32) * 3;
-
-			EGLint attr[] = {
-					EGL_WIDTH, textureW,
-					EGL_HEIGHT, textureH,
-					EGL_LINUX_DRM_FOURCC_EXT, in_format,
-					EGL_DMA_BUF_PLANE0_FD_EXT, fd,
-					EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-					EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT:EGL_NONE, static_cast<EGLint>(is_afbc?((AFBC_FORMAT_MOD_SPARSE | AFBC_FORMAT_MOD_BLOCK_SIZE_16x16)&0xffffffff):EGL_NONE), //rk支持afbc默认格式
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT:EGL_NONE, is_afbc?(0x08<<24):EGL_NONE,  //ARM平台标志位
-					EGL_NONE
-			};
-			img = create_image(dpy, EGL_NO_CONTEXT,EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL, attr);
-			ECHK(img);
-			if(img == EGL_NO_IMAGE_KHR)
-			{
-				LOGCATE("rk-debug eglCreateImageKHR NULL \n ");
-				return -1;
-			}
-		}
-			break;
-
-
-		case DRM_FORMAT_RGBA5551:
-		{
-			int stride = ALIGN(textureW, 16) * 2;  //stride 16对齐后 * 2Byte
-			//int stride = textureW;
-			EGLint attr[] = {
-					EGL_WIDTH, textureW,
-					EGL_HEIGHT, textureH,
-					EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_RGBA5551,
-					EGL_DMA_BUF_PLANE0_FD_EXT, fd,
-					EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-					EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT:EGL_NONE, static_cast<EGLint>(is_afbc?((AFBC_FORMAT_MOD_SPARSE | AFBC_FORMAT_MOD_BLOCK_SIZE_16x16)&0xffffffff):EGL_NONE), //rk支持afbc默认格式
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT:EGL_NONE, is_afbc?(0x08<<24):EGL_NONE,  //ARM平台标志位
-					EGL_NONE
-			};
-			img = create_image(dpy, EGL_NO_CONTEXT,EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL, attr);
-			ECHK(img);
-			if(img == EGL_NO_IMAGE_KHR)
-			{
-				LOGCATE("rk-debug eglCreateImageKHR NULL \n ");
-				return -1;
-			}
-		}
-			break;
-		case DRM_FORMAT_YUYV:
-		{
-			int stride = ALIGN(textureW, 32) * 2;
-
-			EGLint attr[] = {
-					EGL_WIDTH, textureW,
-					EGL_HEIGHT, textureH,
-					EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_YUYV,
-					EGL_DMA_BUF_PLANE0_FD_EXT, fd,
-					EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-					EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT:EGL_NONE, static_cast<EGLint>(is_afbc?((AFBC_FORMAT_MOD_SPARSE | AFBC_FORMAT_MOD_BLOCK_SIZE_16x16)&0xffffffff):EGL_NONE), //rk支持afbc默认格式
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT:EGL_NONE, is_afbc?(0x08<<24):EGL_NONE,  //ARM平台标志位
-					EGL_NONE
-			};
-			img = create_image(dpy, EGL_NO_CONTEXT,EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL, attr);
-			ECHK(img);
-			if(img == EGL_NO_IMAGE_KHR)
-			{
-				LOGCATE("rk-debug eglCreateImageKHR NULL \n ");
-				return -1;
-			}
-		}
-			break;
-		case DRM_FORMAT_YUV420_8BIT: //该格式仅支持afbc，不支持linear
-		{
-			int stride = ALIGN(textureW, 32) * 1;
-
-			EGLint attr[] = {
-					EGL_WIDTH, textureW,
-					EGL_HEIGHT, textureH,
-					EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_YUV420_8BIT,
-					EGL_DMA_BUF_PLANE0_FD_EXT, fd,
-					EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-					EGL_DMA_BUF_PLANE0_PITCH_EXT, stride, //该格式afbc 无所谓stride 为1还是2
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT:EGL_NONE, static_cast<EGLint>(is_afbc?((AFBC_FORMAT_MOD_SPARSE | AFBC_FORMAT_MOD_BLOCK_SIZE_16x16)&0xffffffff):EGL_NONE), //rk支持afbc默认格式
-					is_afbc?EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT:EGL_NONE, is_afbc?(0x08<<24):EGL_NONE,  //ARM平台标志位
-					EGL_NONE
-			};
-			img = create_image(dpy, EGL_NO_CONTEXT,EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL, attr);
-			ECHK(img);
-			if(img == EGL_NO_IMAGE_KHR)
-			{
-				LOGCATE("rk-debug eglCreateImageKHR NULL \n ");
-				return -1;
-			}
-		}
-			break;
-
-		case DRM_FORMAT_NV12:
-		{
-			int stride = ALIGN(textureW, 32) * 1;
-			if(!is_afbc)
-			{
-				EGLint attr[] = {
-						EGL_WIDTH, textureW,
-						EGL_HEIGHT, textureH,
-						EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_NV12,
-						EGL_DMA_BUF_PLANE0_FD_EXT, fd,
-						EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-						EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
-						EGL_DMA_BUF_PLANE1_FD_EXT, fd,
-						EGL_DMA_BUF_PLANE1_OFFSET_EXT, stride*textureH,
-						EGL_DMA_BUF_PLANE1_PITCH_EXT, stride,
-						EGL_NONE
-				};
-				img = create_image(dpy, EGL_NO_CONTEXT,EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL, attr);
-				ECHK(img);
-				if(img == EGL_NO_IMAGE_KHR)
-				{
-					LOGCATE("rk-debug eglCreateImageKHR NULL \n ");
-					return -1;
-				}
-
-
-			}else {
-				EGLint attr[] = {
-						EGL_WIDTH, textureW,
-						EGL_HEIGHT, textureH,
-						EGL_LINUX_DRM_FOURCC_EXT, DRM_FORMAT_NV12,
-
-						EGL_DMA_BUF_PLANE0_FD_EXT, fd,
-						EGL_DMA_BUF_PLANE0_OFFSET_EXT, 0,
-						EGL_DMA_BUF_PLANE0_PITCH_EXT, stride,
-						EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, ((AFBC_FORMAT_MOD_SPARSE | AFBC_FORMAT_MOD_BLOCK_SIZE_32x8)&0xffffffff), //rk支持afbc默认格式
-						EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, (0x08<<24),  //ARM平台标志位
-
-						EGL_DMA_BUF_PLANE1_FD_EXT, fd,
-						EGL_DMA_BUF_PLANE1_OFFSET_EXT, stride*textureH,
-						EGL_DMA_BUF_PLANE1_PITCH_EXT, stride,
-						EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT, ((AFBC_FORMAT_MOD_SPARSE | AFBC_FORMAT_MOD_BLOCK_SIZE_64x4)&0xffffffff), //rk支持afbc默认格式
-						EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT, (0x08<<24),  //ARM平台标志位
-
-						EGL_NONE
-				};
-				img = create_image(dpy, EGL_NO_CONTEXT,EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL, attr);
-				ECHK(img);
-				if(img == EGL_NO_IMAGE_KHR)
-				{
-					LOGCATE("rk-debug eglCreateImageKHR NULL \n ");
-					return -1;
-				}
-				LOGCATD("rk-debug[%s %d] nv12 afbc is fault!\n",__FUNCTION__,__LINE__);
-			}
-		}
-			break;
-		default:
-			LOGCATE("rk-debug[%s %d] error in_format unSupport:0x%x \n",__FUNCTION__,__LINE__,in_format);
-
+	if(import_rk_texture(dpy, rk_texture))
+	{
+		return -1;
 	}
 
+	dump_rk_texture(rk_texture);
+	return 0;
+}
 
-	if(!is_need_fbo)
+//从 FrameContainer 取第 index 帧, 按记录里的格式/宽高/modifier 申请 dma-buf 并导入.
+//记录的数据就是导入时的排布, 核对 pitch/offset 一致后整块拷贝, 不做逐行重排
+int replay_container_frame(EGLDisplay dpy, const char * path, int index, rk_texture_t * rk_texture)
+{
+	FrameContainerReader reader;
+	FrameContainerFrame frame;
+	if(reader.Open(path) < 0 || reader.GetFrame(index, &frame) < 0)
 	{
-		GCHK(glActiveTexture(GL_TEXTURE0));
-		GCHK(glGenTextures(1, p_texture_id));
-		printf("rk-debug[%s %d] p_texture_id:%d \n",__FUNCTION__,__LINE__,*p_texture_id);
-		GCHK(glBindTexture(GL_TEXTURE_EXTERNAL_OES, *p_texture_id));
-		GCHK(glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-		GCHK(glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
-		GCHK(image_target_texture_2d(GL_TEXTURE_EXTERNAL_OES, img));
-
-	}else{
-		GCHK(glActiveTexture(GL_TEXTURE1));
-		GCHK(glGenTextures(1, p_texture_id));
-		printf("rk-debug[%s %d] p_texture_id:%d \n",__FUNCTION__,__LINE__,*p_texture_id);
-		GCHK(glBindTexture(GL_TEXTURE_EXTERNAL_OES, *p_texture_id));
-		GCHK(glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
-		GCHK(glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
-		GCHK(image_target_texture_2d(GL_TEXTURE_EXTERNAL_OES, img));
-
-		glGenFramebuffers(1, p_fbo_id);
-		glBindFramebuffer(GL_FRAMEBUFFER, *p_fbo_id);
-		printf("rk-debug[%s %d] p_fbo_id:%d \n",__FUNCTION__,__LINE__,*p_fbo_id);
-		GCHK(glFramebufferTexture2D(GL_FRAMEBUFFER,
-									GL_COLOR_ATTACHMENT0, GL_TEXTURE_EXTERNAL_OES, *p_texture_id, 0));
-		if(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
-			LOGCATD("rk_debug create fbo success!\n");
-		else
-			LOGCATE("rk_debug create fbo failed!\n");
+		LOGCATE("rk-debug[%s %d] no frame %d in %s\n",__FUNCTION__,__LINE__,index,path);
+		return -1;
 	}
 
-	destroy_image(dpy,img);
+	const FrameRecordHeader * record = frame.record;
+	const DrmFormatInfo * info = DrmFormat::Find(record->fourcc);
+	if(!info)
+	{
+		LOGCATE("rk-debug[%s %d] error in_format unSupport:0x%x \n",__FUNCTION__,__LINE__,record->fourcc);
+		return -1;
+	}
 
-	if(dump_rk_texture(rk_texture))
+	memset(rk_texture, 0, sizeof(*rk_texture));
+	rk_texture->w = record->width;
+	rk_texture->h = record->height;
+	rk_texture->drm_format = record->fourcc;
+	rk_texture->is_afbc = record->modifier != DRM_FORMAT_MOD_LINEAR && record->modifier != DRM_FORMAT_MOD_INVALID;
+	rk_texture->need_fbo = 0;
+
+	DrmFormatLayout layout;
+	DrmFormat::GetLayout(info, rk_texture->w, rk_texture->h, &layout);
+	bool afbc = DrmFormat::UseAfbc(info, rk_texture->is_afbc);
+	uint32_t planes = afbc ? 1 : info->num_planes;
+	bool same_layout = record->num_planes == planes;
+	for(uint32_t i = 0;same_layout && i < planes;i++)
 	{
-		LOGCATE("rk-debug[%s %d] rk_texture == NULL \n",__FUNCTION__,__LINE__);
+		same_layout = record->offsets[i] == layout.offsets[i] && record->pitches[i] == layout.pitches[i];
+	}
+	if(!same_layout || (afbc && record->modifier != DrmFormat::Modifier(info, 0, 1)))
+	{
+		LOGCATE("rk-debug[%s %d] %s frame %d layout does not match this build\n",__FUNCTION__,__LINE__,path,index);
+		return -1;
 	}
 
+	if(create_drm_fd(rk_texture) < 0 || rk_texture->drm_buf->size < record->data_size)
+	{
+		release_drm_fd(rk_texture);
+		return -1;
+	}
+	memcpy(rk_texture->drm_viraddr, frame.data, record->data_size);
 
+	if(create_texture_fbo_img(dpy, rk_texture) < 0)
+	{
+		release_drm_fd(rk_texture);
+		return -1;
+	}
+	printf("rk-debug[%s %d] replay %s frame %d(index %llu) %s %dx%d modifier=0x%llx tex:%d\n",__FUNCTION__,__LINE__,
+		   path,index,(unsigned long long)record->frame_index,info->name,rk_texture->w,rk_texture->h,
+		   (unsigned long long)record->modifier,rk_texture->texture_id);
 	return 0;
 }
 
 int destory_texture_fbo_img(EGLDisplay dpy,rk_texture_t * rk_texture)
 {
-	GLuint * p_texture_id = (GLuint *) &(rk_texture->texture_id);
-	GLuint * p_fbo_id = (GLuint *) &(rk_texture->fbo_id);
-	int is_need_fbo = rk_texture->need_fbo;
+	ImportedTexture tex;
+	tex.texture_id = rk_texture->texture_id;
+	tex.fbo_id = rk_texture->fbo_id;
 
-	glDeleteTextures(1,p_texture_id);
+	//纹理/FBO 归缓存所有, 这里只释放引用; 真正删除发生在 buffer 销毁或 LRU 淘汰时
+	get_egl_image_cache()->Release(tex);
 
-	if(is_need_fbo)
-		glDeleteFramebuffers(1,p_fbo_id);
-
-	printf("rk-debug[%s %d] delete tex:%d fbo:%d\n",__FUNCTION__,__LINE__,*p_texture_id,*p_fbo_id);
+	printf("rk-debug[%s %d] release tex:%d fbo:%d\n",__FUNCTION__,__LINE__,rk_texture->texture_id,rk_texture->fbo_id);
+	rk_texture->texture_id = 0;
+	rk_texture->fbo_id = 0;
 
 	return 0;
 }
 
 
-/*
-  * Class:     com_hikvision_jni_MyCam
-  * Method:    startPreview
-  * Signature: (Landroid/view/SurfaceHolder;)V
-  */
- JNIEXPORT void JNICALL helloWorld(JNIEnv *env, jobject instance)
- {
-     LOGCATE("helloworld");
-	 EGLDisplay dpy = initEGLContex();
+static RenderService * create_render_service()
+{
+	RenderService * service = new RenderService(64);
+	if(service->Start(initEGLContex, 2) < 0) {
+		LOGCATE("rk-debug[%s %d] start render service failed\n",__FUNCTION__,__LINE__);
+	}
+	return service;
+}
+
+RenderService * get_render_service()
+{
+	//EGL context 只存在于渲染线程, JNI 线程只往队列里投任务, 不等 GPU.
+	//局部静态变量的初始化是线程安全的, 多个 JNI 线程同时进来也只会启动一个渲染线程
+	static RenderService * service = create_render_service();
+	return service;
+}
+
+static void on_demo_done(void * opaque, uint64_t job_id, int result, int fence_fd)
+{
+	LOGCATE("rk-debug demo job %llu finished, result=%d\n",(unsigned long long)job_id,result);
+	if(fence_fd >= 0) {
+		close(fence_fd);
+	}
+	get_render_service()->DumpStats();
+}
+
+//原 helloWorld 的整个流程, 在渲染线程上执行
+static int run_demo(RenderService * service, void * opaque)
+{
+	 EGLDisplay dpy = service->GetDisplay();
 
 	 rk_texture_t src={0};
 	 rk_texture_t win={0};
@@ -979,8 +701,8 @@ int destory_texture_fbo_img(EGLDisplay dpy,rk_texture_t * rk_texture)
 	 create_drm_fd(&src);
 	 create_drm_fd(&win);
 
-	 read_img_from_file(src.drm_viraddr,"/data/600_48_5551.rgba", src.w, src.h, ALIGN(src.w,16),get_format_size(src.drm_format));
-	 read_img_from_file(win.drm_viraddr,"/data/Capt_Chn0_1920x1080.yuv", win.w, win.h, ALIGN(win.w,16),get_format_size(win.drm_format));
+	 read_img_from_file(src.drm_viraddr,"/data/600_48_5551.rgba", src.w, src.h, DrmFormat::Find(src.drm_format));
+	 read_img_from_file(win.drm_viraddr,"/data/Capt_Chn0_1920x1080.yuv", win.w, win.h, DrmFormat::Find(win.drm_format));
 
 
 	 create_texture_fbo_img(dpy, &src);
@@ -991,104 +713,584 @@ int destory_texture_fbo_img(EGLDisplay dpy,rk_texture_t * rk_texture)
 	 int h = win.h;
 
 
-	 gTriangleVertices = (GLfloat *)malloc(4*sizeof(GLfloat)*2);
-	 gRGBATexVertices = (GLfloat *)malloc(4*sizeof(GLfloat)*2);
-	 gYUVTexVertices = (GLfloat *)malloc(4*sizeof(GLfloat)*2);
-
-
-	 caculate_Vertex_coordinates(gTriangleVertices,win.w,win.h,100,200,src.w,src.h);
-	 caculate_Texture_coordinates(gRGBATexVertices,src.w,src.h,0,0,src.w,src.h);
-	 caculate_Texture_coordinates(gYUVTexVertices,win.w,win.h,100,200,src.w,src.h);
-
-
+	 //shader 编译结果按驱动版本缓存到磁盘, 第二次启动起直接加载二进制
+	 if(ProgramBinaryCache::GetInstance()->SetDirectory("/data/dump/program_cache") < 0) {
+		 LOGCATE("rk-debug[%s %d] program binary cache disabled, shaders compile from source\n",__FUNCTION__,__LINE__);
+	 }
 
 	 if(!setupGraphics(w, h)) {
 		 LOGCATE("Could not set up graphics.\n");
 	 }
 
+	 //合成 pass 的 GPU/CPU 耗时分布, 扩展不可用时只有 CPU 提交时间
+	 GpuTimer gpu_timer;
+	 gpu_timer.Init();
+	 gCompositor.SetTimer(&gpu_timer);
+
 
 	 struct timeval tpend1, tpend2;
 	 float usec1 = 0;
 
+	 //每帧插 fence 代替 glFinish, 最多 2 帧在飞; win_fence_fd 为最近一次写 win 的 sync_file
+	 FramePacer pacer;
+	 pacer.Init(dpy, 2);
+	 int win_fence_fd = -1;
+
+	 //回放 win 的源文件: read-ahead 线程把帧读进 ring 里的 dma-buf, 每帧把 OSD 合成到读出的帧上.
+	 //单帧文件会循环读同一帧. 帧要等 GPU 用完(fence signal)才能还给 reader 重新填充
+	 const int stream_frames = 1800;
+	 const int stream_dump_interval = 600;
+	 RawVideoReader reader(get_drm_buffer_pool(), 4);
+	 std::deque<std::pair<RawVideoFrame, int> > stream_in_flight;
+	 float stream_submit_ms = 0;
+	 int streamed = 0;
+	 if(reader.Open("/data/Capt_Chn0_1920x1080.yuv", DrmFormat::Find(win.drm_format), win.w, win.h) == 0) {
+		 for (int i = 0; i < stream_frames; i++) {
+			 RawVideoFrame frame;
+			 if(reader.AcquireFrame(&frame, 1000) < 0) {
+				 break;
+			 }
+
+			 gettimeofday(&tpend1, NULL);
+			 rk_texture_t frame_tex = win;
+			 frame_tex.drm_buf = frame.buf;
+			 frame_tex.drm_fd = frame.buf->prime_fd;
+			 frame_tex.drm_viraddr = frame.buf->vir_addr;
+			 int fence_fd = -1;
+			 if(import_rk_texture(dpy, &frame_tex) == 0) {
+				 renderFrame(&src,&frame_tex,100,200);
+				 ImportedTexture tex = { (GLuint)frame_tex.texture_id, (GLuint)frame_tex.fbo_id };
+				 get_egl_image_cache()->Release(tex);
+			 }
+			 pacer.EndFrame(&fence_fd);
+			 gettimeofday(&tpend2, NULL);
+			 stream_submit_ms += 1000.0 * (tpend2.tv_sec - tpend1.tv_sec) + (tpend2.tv_usec - tpend1.tv_usec) / 1000.0;
+			 streamed++;
+
+			 //每 stream_dump_interval 帧 dump 一帧: 帧连同 fence 直接交给写线程, 写完才还给 reader
+			 if(stream_dump_interval > 0 && i % stream_dump_interval == 0) {
+				 if(fence_fd < 0) {
+					 pacer.WaitIdle();
+				 }
+				 stream_dump_ref_t * ref = new stream_dump_ref_t();
+				 ref->reader = &reader;
+				 ref->frame = frame;
+				 DumpFrameDesc desc;
+				 describe_rk_texture(&win, frame.buf->vir_addr, &desc);
+				 desc.frame_index = frame.sequence;
+				 get_dump_writer()->Submit(desc, "stream.rkfc", release_stream_dump, ref, fence_fd);
+				 continue;
+			 }
+
+			 //ring 共 4 帧, 最多留 2 帧给 GPU, 其余尽快还给 read-ahead
+			 stream_in_flight.push_back(std::make_pair(frame, fence_fd));
+			 if(stream_in_flight.size() > 2) {
+				 std::pair<RawVideoFrame, int> done = stream_in_flight.front();
+				 stream_in_flight.pop_front();
+				 if(done.second >= 0) {
+					 sync_wait(done.second, -1);
+					 close(done.second);
+				 } else {
+					 pacer.WaitIdle();
+				 }
+				 reader.ReleaseFrame(done.first);
+			 }
+		 }
+		 //还留给 GPU 的帧: 各自的 fence 合并成一个 sync_file, 等一次后一起还给 reader;
+		 //有帧没有 sync_file 或合并失败时退回等所有在飞帧
+		 int drain_fence_fd = -1;
+		 bool drain_idle = false;
+		 for (size_t k = 0; k < stream_in_flight.size(); k++) {
+			 if(stream_in_flight[k].second < 0 || FramePacer::Accumulate(&drain_fence_fd, stream_in_flight[k].second) < 0) {
+				 drain_idle = true;
+			 }
+		 }
+		 if(drain_fence_fd >= 0) {
+			 sync_wait(drain_fence_fd, -1);
+			 close(drain_fence_fd);
+		 }
+		 if(drain_idle) {
+			 pacer.WaitIdle();
+		 }
+		 while(!stream_in_flight.empty()) {
+			 if(stream_in_flight.front().second >= 0) close(stream_in_flight.front().second);
+			 reader.ReleaseFrame(stream_in_flight.front().first);
+			 stream_in_flight.pop_front();
+		 }
+		 pacer.WaitIdle();
+		 printf("rk-debug[%s %d] streamed %d frames, avg submit time=%f ms\n",__FUNCTION__,__LINE__,
+				streamed,streamed ? stream_submit_ms / streamed : 0.0f);
+		 //写线程手里可能还有 ring 里的帧
+		 get_dump_writer()->Flush();
+		 reader.DumpStats();
+		 reader.Close();
+	 }
+
+	 //多路输入的导入耗时: 渲染线程串行导入 vs 共享 context 的工作线程并行导入, 按路数统计.
+	 //每轮前让缓存失效, 保证每次都真正走 eglCreateImageKHR
+	 {
+		 GlWorkerPool workers;
+		 if(workers.Init(dpy, eglGetCurrentContext(), 4) == 0) {
+			 const int channel_counts[] = { 1, 4, 8, 16 };
+			 const int max_channels = 16;
+			 rk_texture_t chans[max_channels];
+			 GlTask tasks[max_channels];
+			 for (size_t c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); c++) {
+				 int count = channel_counts[c];
+				 int created = 0;
+				 for (; created < count; created++) {
+					 memset(&chans[created], 0, sizeof(rk_texture_t));
+					 chans[created].w = win.w;
+					 chans[created].h = win.h;
+					 chans[created].drm_format = win.drm_format;
+					 if(create_drm_fd(&chans[created]) < 0) break;
+				 }
+				 if(created < count) {
+					 for (int i = 0; i < created; i++) release_drm_fd(&chans[i]);
+					 break;
+				 }
+
+				 float serial_ms = 0, parallel_ms = 0;
+				 for (int pass = 0; pass < 2; pass++) {
+					 for (int i = 0; i < count; i++) get_egl_image_cache()->Invalidate(chans[i].drm_fd);
+					 get_egl_image_cache()->Purge();
+
+					 gettimeofday(&tpend1, NULL);
+					 if(pass == 0) {
+						 for (int i = 0; i < count; i++) import_rk_texture(dpy, &chans[i]);
+					 } else {
+						 bool accepted[max_channels];
+						 for (int i = 0; i < count; i++) {
+							 tasks[i].run = import_channel_task;
+							 tasks[i].opaque = &chans[i];
+							 accepted[i] = workers.Submit(&tasks[i]) == 0;
+							 if(!accepted[i]) {
+								 LOGCATE("rk-debug[%s %d] submit import task %d failed\n",__FUNCTION__,__LINE__,i);
+							 }
+						 }
+						 //fence 发布之后纹理才能在本 context 采样; 没提交成功的任务不会完成, 不能等
+						 for (int i = 0; i < count; i++) {
+							 if(accepted[i]) workers.Wait(&tasks[i]);
+						 }
+					 }
+					 gettimeofday(&tpend2, NULL);
+					 float ms = 1000.0 * (tpend2.tv_sec - tpend1.tv_sec) + (tpend2.tv_usec - tpend1.tv_usec) / 1000.0;
+					 if(pass == 0) serial_ms = ms; else parallel_ms = ms;
+
+					 for (int i = 0; i < count; i++) {
+						 ImportedTexture tex = { (GLuint)chans[i].texture_id, (GLuint)chans[i].fbo_id };
+						 if(tex.texture_id) get_egl_image_cache()->Release(tex);
+						 chans[i].texture_id = 0;
+					 }
+				 }
+				 printf("rk-debug import %d channels: serial %.2f ms, %d workers %.2f ms (x%.2f)\n",count,serial_ms,
+						workers.GetThreadCount(),parallel_ms,parallel_ms > 0 ? serial_ms / parallel_ms : 0.0f);
+				 for (int i = 0; i < count; i++) release_drm_fd(&chans[i]);
+			 }
+			 workers.DumpStats();
+			 workers.Destroy();
+		 }
+	 }
 
-	 for (int i = 0; i < 1; i++) {
-		 gettimeofday(&tpend1, NULL);
+	 //最后一帧合成到 win 上, 供下面 dump 和后续 benchmark 使用
+	 gettimeofday(&tpend1, NULL);
+	 renderFrame(&src,&win,100,200);
+	 pacer.EndFrame(&win_fence_fd);
+	 gettimeofday(&tpend2, NULL);
+	 usec1 = 1000.0 * (tpend2.tv_sec - tpend1.tv_sec) + (tpend2.tv_usec - tpend1.tv_usec) / 1000.0;
+	 printf("rk-debug[%s %d]  renderFrame win submit time=%f ms\n",__FUNCTION__,__LINE__,usec1);
+
+	 //dump result: win 连同它自己的 fence 交给写线程, 渲染线程不等 GPU; 没有 sync_file 时先等所有在飞帧.
+	 //写完后从 container 原样回放一次, 确认格式/stride/modifier 都能从文件还原
+	 if(win_fence_fd < 0) {
+		 pacer.WaitIdle();
+	 }
+	 const DrmFormatInfo * win_info = DrmFormat::Find(win.drm_format);
+	 int win_dumped = dump_rk_texture_frame(&win, "dumplayer.rkfc", 1, win_fence_fd) == 0;
+	 win_fence_fd = -1;
+	 if(win_dumped) {
+		 get_dump_writer()->CloseContainers();
+		 rk_texture_t replay = {0};
+		 if(replay_container_frame(dpy, "/data/dump/dumplayer.rkfc", 0, &replay) == 0) {
+			 destory_texture_fbo_img(dpy, &replay);
+			 release_drm_fd(&replay);
+		 }
+	 }
+	 //下面的 CPU 路径要读 win: dump 写完时 fence 已经 signal, 没提交成功时 fence 已被关闭, 等所有在飞帧
+	 if(win_dumped) {
+		 wait_rk_texture_dump(&win);
+	 } else {
+		 pacer.WaitIdle();
+	 }
 
-//create_texture_fbo_img(dpy, &src);
+	 //CPU 参考实现: 在 win 的拷贝上做同样的混合, 与 GL 路径对比吞吐
+	 if(win_info && win.drm_format == DRM_FORMAT_NV12 && !DrmFormat::UseAfbc(win_info, win.is_afbc)) {
+		 DrmFormatLayout win_layout, src_layout;
+		 DrmFormat::GetLayout(win_info, win.w, win.h, &win_layout);
+		 DrmFormat::GetLayout(DrmFormat::Find(src.drm_format), src.w, src.h, &src_layout);
+		 uint8_t *copy = (uint8_t *)malloc(win_layout.size);
+		 if(copy) {
+			 memcpy(copy, win.drm_viraddr, win_layout.size);
+			 CpuNv12Target target = { copy, copy + win_layout.offsets[1], (int)win_layout.pitches[0],
+									   (int)win_layout.pitches[1], win.w, win.h };
+			 CpuOsdLayer layer = { (const uint8_t *)src.drm_viraddr, (uint32_t)src.drm_format, (int)src_layout.pitches[0],
+								   src.w, src.h, 100, 200, 1.0f };
+			 CpuCompositor cpu;
+			 cpu.Benchmark(target, &layer, 1, 100);
+			 free(copy);
+		 }
+	 }
 
-//        if(i%2 == 1) {
-		 renderFrame(&src,&win);
-		 glFinish();
-//        }else {
-//            glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
-//            checkGlError("glClearColor");
-//            glClear( GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-//            checkGlError("glClear");
-//            glFinish();
-//        }
+	 //NativeImage 各格式互转的吞吐, 各 SIMD 级别分别统计
+	 {
+		 ImageConverter converter;
+		 converter.Benchmark(w, h, 5);
+	 }
 
-//destory_texture_fbo_img(dpy, &src);
+	 //4K NV12/P010 整帧拷贝: 单线程、线程池分行带、non-temporal store 的带宽
+	 {
+		 ImageCopier copier;
+		 copier.Benchmark(IMAGE_FORMAT_NV12, 3840, 2160, 20);
+		 copier.Benchmark(IMAGE_FORMAT_P010, 3840, 2160, 20);
+	 }
 
-		 gettimeofday(&tpend2, NULL);
-		 usec1 = 1000.0 * (tpend2.tv_sec - tpend1.tv_sec) + (tpend2.tv_usec - tpend1.tv_usec) / 1000.0;
-		 printf("rk-debug[%s %d]  renderFrame i:%d use time=%f ms\n",__FUNCTION__,__LINE__,i,usec1);
+	 //采集 -> 转换 -> 消费 三级流水线, 帧在各级之间 move; 预热后 allocations 不应再增长
+	 if(win.drm_format == DRM_FORMAT_NV12 && !win.is_afbc) {
+		 DrmFormatLayout layout;
+		 DrmFormat::GetLayout(DrmFormat::Find(win.drm_format), w, h, &layout);
+		 NativeImage capture;
+		 capture.width = w;
+		 capture.height = h;
+		 capture.format = IMAGE_FORMAT_NV12;
+		 capture.ppPlane[0] = (uint8_t *)win.drm_viraddr;
+		 capture.ppPlane[1] = capture.ppPlane[0] + layout.offsets[1];
+		 capture.pLineSize[0] = layout.pitches[0];
+		 capture.pLineSize[1] = layout.pitches[1];
+
+		 NativeImagePool frame_pool;
+		 frame_pool.Preallocate(IMAGE_FORMAT_NV12, w, h, 3);
+		 frame_pool.Preallocate(IMAGE_FORMAT_RGBA, w, h, 3);
+		 ImageCopier copier;
+		 ImageConverter converter;
+		 std::deque<NativeFrame> consumer;
+		 uint64_t warm_allocs = 0;
+		 for (int f = 0; f < 60; f++) {
+			 NativeFrame yuv = frame_pool.Acquire(IMAGE_FORMAT_NV12, w, h);
+			 NativeFrame rgba = frame_pool.Acquire(IMAGE_FORMAT_RGBA, w, h);
+			 if (!yuv.IsValid() || !rgba.IsValid()) break;
+			 copier.Copy(&capture, yuv.Image());
+			 converter.Convert(yuv.Image(), rgba.Image());
+			 consumer.push_back(std::move(rgba));
+			 if (consumer.size() > 2) consumer.pop_front();
+			 if (f == 9) warm_allocs = frame_pool.GetStats().allocations;
+		 }
+		 consumer.clear();
+		 printf("rk-debug frame pool: %llu allocations after warm-up\n",
+				(unsigned long long)(frame_pool.GetStats().allocations - warm_allocs));
+		 frame_pool.Trim();
+		 frame_pool.DumpStats();
+	 }
 
-		 if(i%1000 == 0&&i>10000){
-			 sleep(5);
+	 //对比每帧 glFinish 与 fence 节奏控制的吞吐
+	 {
+		 const int frames = 100;
+		 struct timeval t0, t1;
+		 gettimeofday(&t0, NULL);
+		 for (int f = 0; f < frames; f++) {
+			 renderFrame(&src,&win,100,200);
+			 glFinish();
 		 }
+		 gettimeofday(&t1, NULL);
+		 long finish_us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec);
 
+		 gettimeofday(&t0, NULL);
+		 for (int f = 0; f < frames; f++) {
+			 renderFrame(&src,&win,100,200);
+			 pacer.EndFrame();
+		 }
+		 pacer.WaitIdle();
+		 gettimeofday(&t1, NULL);
+		 long paced_us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec);
+
+		 printf("rk-debug glFinish: %.1f frames/s, %s pacing: %.1f frames/s\n",
+				finish_us > 0 ? frames * 1000000.0 / finish_us : 0.0, pacer.GetModeName(),
+				paced_us > 0 ? frames * 1000000.0 / paced_us : 0.0);
+		 pacer.DumpStats();
 	 }
 
-	 glFinish();
-//    while(1){}
-
-	 //dump result
-	 switch(win.drm_format){
-		 case DRM_FORMAT_ABGR8888:
-			 if(win.is_afbc)
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"ABGR8888_afbc",w*h*8);
-			 else
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"ABGR8888",w*h*4);
-			 break;
-		 case DRM_FORMAT_BGR888:
-			 if(win.is_afbc)
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"BGR888_afbc",w*h*6);
-			 else
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"BGR888",w*h*3);
-			 break;
-		 case DRM_FORMAT_RGB888:
-			 if(win.is_afbc)
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"RGB888_afbc",w*h*6);
-			 else
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"RGB888",w*h*3);
-			 break;
-
-		 case DRM_FORMAT_YUYV:
-			 if(win.is_afbc)
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"YUYV_afbc",w*h*4);
-			 else
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"YUYV",w*h*2);
-			 break;
-
-		 case DRM_FORMAT_NV12:
-			 if(win.is_afbc)
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"nv12_afbc",w*h*3);
-			 else
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"nv12",w*h*3/2);
-			 break;
-
-		 case DRM_FORMAT_YUV420_8BIT:
-			 if(win.is_afbc)
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"YUV420I_afbc",w*h*3);
-			 else
-				 dumpPixels_new(1,w,h,win.drm_viraddr,"YUV420I",w*h*3/2);
-			 break;
-
-		 default :
-			 printf("rk-debug[%s %d] unsupport format:0x%x \n",__FUNCTION__,__LINE__,win.drm_format);
+	 //16 个 OSD 平铺在背景上, 对比单 pass 多图层合成与逐层合成
+	 {
+		 const int bench_layers = 16;
+		 CompositorLayer layers[bench_layers];
+		 memset(layers, 0, sizeof(layers));
+		 for (int i = 0; i < bench_layers; i++) {
+			 layers[i].texture_id = src.texture_id;
+			 layers[i].tex_w = src.w;
+			 layers[i].tex_h = src.h;
+			 layers[i].src_w = src.w;
+			 layers[i].src_h = src.h;
+			 layers[i].dst_x = (i % 3) * (w / 3);
+			 layers[i].dst_y = (i / 3) * (h / 6);
+			 layers[i].dst_w = src.w;
+			 layers[i].dst_h = src.h;
+			 layers[i].z = i;
+			 layers[i].alpha = 1.0f;
+		 }
+		 CompositorTarget target = { (GLuint)win.texture_id, (GLuint)win.fbo_id, win.w, win.h };
+		 gCompositor.Benchmark(target, layers, bench_layers, 100);
+	 }
 
+	 //src 切成 8 段打包进 atlas, 64 个小 label 一次实例化绘制; 每帧只改写其中一段模拟时钟跳变
+	 {
+		 const int label_count = 64;
+		 const int slice_count = 8;
+		 const int slice_w = src.w / slice_count;
+		 const DrmFormatInfo * src_info = DrmFormat::Find(src.drm_format);
+		 DrmFormatLayout src_layout;
+		 DrmFormat::GetLayout(src_info, src.w, src.h, &src_layout);
+		 const int bpp = DrmFormat::BitsPerPixel(src_info) / 8;
+
+		 OsdAtlas atlas(get_drm_buffer_pool(), get_egl_image_cache(), src.drm_format, 1024, 512);
+		 OsdInstancedRenderer osd;
+		 int slots[slice_count];
+		 if (atlas.Init(dpy) == 0 && osd.Init(label_count) == 0) {
+			 for (int i = 0; i < slice_count; i++) {
+				 slots[i] = atlas.Alloc(slice_w, src.h);
+				 atlas.Update(slots[i], (char *)src.drm_viraddr + i * slice_w * bpp, src_layout.pitches[0]);
+			 }
+
+			 OsdLabel labels[label_count];
+			 for (int i = 0; i < label_count; i++) {
+				 atlas.FillLabel(slots[i % slice_count], (i % 8) * (w / 8), (i / 8) * (h / 8), 1.0f, &labels[i]);
+			 }
+
+			 CompositorTarget target = { (GLuint)win.texture_id, (GLuint)win.fbo_id, win.w, win.h };
+			 const int frames = 100;
+			 struct timeval t0, t1;
+			 gettimeofday(&t0, NULL);
+			 for (int f = 0; f < frames; f++) {
+				 //最后一段在两种内容间切换, 其余段不变
+				 int from = (f & 1) ? 0 : slice_count - 1;
+				 atlas.Update(slots[slice_count - 1], (char *)src.drm_viraddr + from * slice_w * bpp, src_layout.pitches[0]);
+				 osd.Draw(target, atlas.GetPageTexture(0), atlas.GetPageWidth(), atlas.GetPageHeight(), 0, labels, label_count);
+			 }
+			 glFinish();
+			 gettimeofday(&t1, NULL);
+			 long us = (t1.tv_sec - t0.tv_sec) * 1000000L + (t1.tv_usec - t0.tv_usec);
+			 printf("rk-debug instanced %d labels: %.1f frames/s\n", label_count, us > 0 ? frames * 1000000.0 / us : 0.0);
+			 atlas.DumpStats();
+		 }
+		 osd.Destroy();
+		 atlas.Destroy();
 	 }
 
+	 //NVR 画面分割: 4/9/16 路 1080p 拼到一块 4K NV12 上, 每路带一个 OSD, 分别测所有路都更新和只有一路更新时的输出帧率
+	 {
+		 const int max_channels = 16;
+		 const int channel_counts[] = { 4, 9, 16 };
+		 rk_texture_t mosaic = {0};
+		 mosaic.w = 3840;
+		 mosaic.h = 2160;
+		 mosaic.need_fbo = 1;
+		 mosaic.drm_format = DRM_FORMAT_NV12;
+		 DrmFormatLayout win_layout;
+		 DrmFormat::GetLayout(DrmFormat::Find(win.drm_format), win.w, win.h, &win_layout);
+		 rk_texture_t inputs[max_channels];
+		 int input_count = 0;
+		 for (; input_count < max_channels; input_count++) {
+			 memset(&inputs[input_count], 0, sizeof(rk_texture_t));
+			 inputs[input_count].w = win.w;
+			 inputs[input_count].h = win.h;
+			 inputs[input_count].drm_format = win.drm_format;
+			 if(create_drm_fd(&inputs[input_count]) < 0) break;
+			 memcpy(inputs[input_count].drm_viraddr, win.drm_viraddr, win_layout.size);
+			 if(create_texture_fbo_img(dpy, &inputs[input_count]) < 0) {
+				 release_drm_fd(&inputs[input_count]);
+				 break;
+			 }
+		 }
+
+		 MosaicCompositor mosaic_compositor;
+		 OsdAtlas atlas(get_drm_buffer_pool(), get_egl_image_cache(), src.drm_format, 1024, 512);
+		 if(input_count == max_channels && create_drm_fd(&mosaic) == 0 && create_texture_fbo_img(dpy, &mosaic) == 0 &&
+			mosaic_compositor.Init() == 0 && atlas.Init(dpy) == 0) {
+			 const DrmFormatInfo * src_info = DrmFormat::Find(src.drm_format);
+			 DrmFormatLayout src_layout;
+			 DrmFormat::GetLayout(src_info, src.w, src.h, &src_layout);
+			 int slot = atlas.Alloc(src.w, src.h);
+			 atlas.Update(slot, src.drm_viraddr, src_layout.pitches[0]);
+			 MosaicOsdSource osd_source = { atlas.GetPageTexture(0), atlas.GetPageWidth(), atlas.GetPageHeight(), 0 };
+
+			 CompositorTarget target = { (GLuint)mosaic.texture_id, (GLuint)mosaic.fbo_id, mosaic.w, mosaic.h };
+			 MosaicTile tiles[max_channels];
+			 for (size_t c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); c++) {
+				 int count = channel_counts[c];
+				 memset(tiles, 0, sizeof(tiles));
+				 MosaicCompositor::GridLayout(count, mosaic.w, mosaic.h, tiles);
+				 for (int i = 0; i < count; i++) {
+					 tiles[i].texture_id = inputs[i].texture_id;
+					 tiles[i].tex_w = inputs[i].w;
+					 tiles[i].tex_h = inputs[i].h;
+					 tiles[i].is_yuv = 1;
+					 atlas.FillLabel(slot, 16, 16, 1.0f, &tiles[i].osd);
+				 }
+				 mosaic_compositor.Benchmark(target, tiles, count, &osd_source, 100);
+			 }
+			 mosaic_compositor.DumpStats();
+		 }
+		 mosaic_compositor.Destroy();
+		 atlas.Destroy();
+		 if(mosaic.drm_buf) {
+			 destory_texture_fbo_img(dpy, &mosaic);
+			 release_drm_fd(&mosaic);
+		 }
+		 for (int i = 0; i < input_count; i++) {
+			 destory_texture_fbo_img(dpy, &inputs[i]);
+			 release_drm_fd(&inputs[i]);
+		 }
+	 }
+
+	 //多码流缩放: 先把 win 放大成一路 4K 源, 再缩到 1080p/720p/CIF 三路子码流, 每种滤波器各跑 100 帧
+	 {
+		 const int frames = 100;
+		 const int sizes[][2] = { { 1920, 1080 }, { 1280, 720 }, { 352, 288 } };
+		 const int output_count = sizeof(sizes) / sizeof(sizes[0]);
+		 const GpuScalerFilter filters[] = { GPU_SCALER_BILINEAR, GPU_SCALER_BICUBIC, GPU_SCALER_LANCZOS };
+		 rk_texture_t main_stream = {0};
+		 main_stream.w = 3840;
+		 main_stream.h = 2160;
+		 main_stream.need_fbo = 1;
+		 main_stream.drm_format = DRM_FORMAT_NV12;
+		 rk_texture_t sub_streams[output_count];
+		 int sub_count = 0;
+		 for (; sub_count < output_count; sub_count++) {
+			 memset(&sub_streams[sub_count], 0, sizeof(rk_texture_t));
+			 sub_streams[sub_count].w = sizes[sub_count][0];
+			 sub_streams[sub_count].h = sizes[sub_count][1];
+			 sub_streams[sub_count].need_fbo = 1;
+			 sub_streams[sub_count].drm_format = DRM_FORMAT_NV12;
+			 if(create_drm_fd(&sub_streams[sub_count]) < 0) break;
+			 if(create_texture_fbo_img(dpy, &sub_streams[sub_count]) < 0) {
+				 release_drm_fd(&sub_streams[sub_count]);
+				 break;
+			 }
+		 }
+
+		 GpuScaler scaler;
+		 if(sub_count == output_count && create_drm_fd(&main_stream) == 0 && create_texture_fbo_img(dpy, &main_stream) == 0 &&
+			scaler.Init() == 0) {
+			 GpuScalerSource fill_source = { (GLuint)win.texture_id, win.w, win.h, 1 };
+			 GpuScalerOutput fill_output = { (GLuint)main_stream.fbo_id, main_stream.w, main_stream.h, GPU_SCALER_LANCZOS };
+			 scaler.Scale(fill_source, &fill_output, 1);
+			 glFinish();
+
+			 GpuScalerSource source = { (GLuint)main_stream.texture_id, main_stream.w, main_stream.h, 1 };
+			 GpuScalerOutput outputs[output_count];
+			 for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++) {
+				 for (int i = 0; i < output_count; i++) {
+					 outputs[i].fbo_id = sub_streams[i].fbo_id;
+					 outputs[i].w = sub_streams[i].w;
+					 outputs[i].h = sub_streams[i].h;
+					 outputs[i].filter = filters[f];
+				 }
+				 gettimeofday(&tpend1, NULL);
+				 for (int i = 0; i < frames; i++) {
+					 scaler.Scale(source, outputs, output_count);
+				 }
+				 glFinish();
+				 gettimeofday(&tpend2, NULL);
+				 usec1 = 1000.0 * (tpend2.tv_sec - tpend1.tv_sec) + (tpend2.tv_usec - tpend1.tv_usec) / 1000.0;
+				 printf("rk-debug[%s %d] scale 4K -> %d streams, %s: %f ms/frame\n",__FUNCTION__,__LINE__,
+						output_count,GpuScaler::GetFilterName(filters[f]),usec1 / frames);
+			 }
+			 //最后一轮是 Lanczos, dump 最小的一路看抽取后的细节
+			 dump_rk_texture_frame(&sub_streams[output_count - 1], "dumpscaler.rkfc", 1);
+			 scaler.DumpStats();
+		 }
+		 scaler.Destroy();
+		 if(main_stream.drm_buf) {
+			 destory_texture_fbo_img(dpy, &main_stream);
+			 release_drm_fd(&main_stream);
+		 }
+		 for (int i = 0; i < sub_count; i++) {
+			 destory_texture_fbo_img(dpy, &sub_streams[i]);
+			 release_drm_fd(&sub_streams[i]);
+		 }
+	 }
+
+	 //静态场景: 背景不变, OSD 每 25 帧变一次(模拟时间戳跳秒, 右半边交替清空/还原), 第 150 帧起 OSD 挪到右边.
+	 //开启损伤跟踪后没有变化的帧不提交绘制, 直接重发上一帧的 fence; 变化的区域先从背景副本恢复再混合,
+	 //OSD 的旧内容和旧位置不会留下残影. 统计里看每帧实际重画的像素比例, 最后一帧 dump 出来检查
+	 {
+		 const int frames = 300;
+		 uint64_t osd_version = 0;
+		 DrmFormatLayout src_layout;
+		 DrmFormat::GetLayout(DrmFormat::Find(src.drm_format), src.w, src.h, &src_layout);
+		 uint8_t * src_orig = (uint8_t *)malloc(src_layout.size);
+		 if(src_orig) {
+			 memcpy(src_orig, src.drm_viraddr, src_layout.size);
+		 }
+
+		 //损伤跟踪要求开始时 target 上是干净的背景, 前面的 benchmark 已经在 win 上混合过 OSD
+		 pacer.WaitIdle();
+		 wait_rk_texture_dump(&win);
+		 read_img_from_file(win.drm_viraddr,"/data/Capt_Chn0_1920x1080.yuv", win.w, win.h, DrmFormat::Find(win.drm_format));
+		 gCompositor.SetDamageTracking(true);
+		 gettimeofday(&tpend1, NULL);
+		 for (int i = 0; i < frames; i++) {
+			 if(i % 25 == 0 && i > 0 && src_orig) {
+				 //GPU 还可能在读 src, 改内容之前先等在飞帧
+				 pacer.WaitIdle();
+				 memcpy(src.drm_viraddr, src_orig, src_layout.size);
+				 if(osd_version % 2 == 0) {
+					 int bpp = DrmFormat::PlaneRowBytes(DrmFormat::Find(src.drm_format), 0, src.w) / src.w;
+					 for (int row = 0; row < src.h; row++) {
+						 memset((uint8_t *)src.drm_viraddr + row * src_layout.pitches[0] + (src.w / 2) * bpp, 0, (src.w - src.w / 2) * bpp);
+					 }
+				 }
+			 }
+			 if(i % 25 == 0) {
+				 osd_version++;
+			 }
+			 renderFrame(&src,&win,i < frames / 2 ? 100 : 400,200,osd_version,1);
+			 int fence_fd = -1;
+			 if(gCompositor.LastFrameSkipped()) {
+				 pacer.RepeatFrame(&fence_fd);
+			 } else {
+				 pacer.EndFrame(&fence_fd);
+			 }
+			 //fence 通常交给编码/显示, 这里没有下游, 直接关闭
+			 if(fence_fd >= 0) {
+				 close(fence_fd);
+			 }
+		 }
+		 pacer.WaitIdle();
+		 gettimeofday(&tpend2, NULL);
+		 usec1 = 1000.0 * (tpend2.tv_sec - tpend1.tv_sec) + (tpend2.tv_usec - tpend1.tv_usec) / 1000.0;
+		 printf("rk-debug[%s %d] static scene %d frames with damage tracking: %f ms/frame\n",__FUNCTION__,__LINE__,frames,usec1 / frames);
+		 dump_rk_texture_frame(&win, "dumpstatic.rkfc", frames);
+		 gCompositor.DumpDamageStats();
+		 pacer.DumpStats();
+		 gCompositor.SetDamageTracking(false);
+		 if(src_orig) {
+			 memcpy(src.drm_viraddr, src_orig, src_layout.size);
+			 free(src_orig);
+		 }
+	 }
+
+	 gpu_timer.DumpStats();
+	 ProgramBinaryCache::GetInstance()->DumpStats();
+	 gCompositor.SetTimer(NULL);
+	 gpu_timer.Destroy();
+	 pacer.Destroy();
+	 destory_texture_fbo_img(dpy, &src);
+	 destory_texture_fbo_img(dpy, &win);
+	 release_drm_fd(&src);
+	 release_drm_fd(&win);
+	 get_dump_writer()->Flush();
+	 get_dump_writer()->DumpStats();
+	 get_drm_buffer_pool()->DumpStats();
+	 get_egl_image_cache()->DumpStats();
 
 
 #if 0 //read rgba pixel
@@ -1097,6 +1299,22 @@ int destory_texture_fbo_img(EGLDisplay dpy,rk_texture_t * rk_texture)
     glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pPixelDataFront);
     dumpPixels(1,w,h,pPixelDataFront);
 #endif
+
+	 return 0;
+}
+
+/*
+  * Class:     com_hikvision_jni_MyCam
+  * Method:    startPreview
+  * Signature: (Landroid/view/SurfaceHolder;)V
+  */
+ JNIEXPORT void JNICALL helloWorld(JNIEnv *env, jobject instance)
+ {
+     LOGCATE("helloworld");
+	 //立即返回, 完成后在渲染线程回调 on_demo_done
+	 if(!get_render_service()->Submit(run_demo, on_demo_done, NULL, RENDER_JOB_FENCE)) {
+		 LOGCATE("rk-debug[%s %d] render queue full or service not running\n",__FUNCTION__,__LINE__);
+	 }
  }
 
 
@@ -0,0 +1,28 @@
+//
+// RenderServiceBench.cpp
+//
+
+#include "render/RenderService.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * 渲染队列的独立压测程序, 不经过 JVM, 也不创建 EGL context (headless 模式).
+ * 用法: render_service_bench [producers] [jobs], 完成数与提交数不符时返回非 0.
+ * 详细统计打在 logcat 里.
+ */
+int main(int argc, char **argv)
+{
+	int producers = argc > 1 ? atoi(argv[1]) : 4;
+	int jobs = argc > 2 ? atoi(argv[2]) : 100000;
+	if (producers < 1 || jobs < 1)
+	{
+		fprintf(stderr, "usage: %s [producers] [jobs]\n", argv[0]);
+		return 2;
+	}
+
+	int ret = RenderService::Benchmark(producers, jobs);
+	printf("render_service_bench producers=%d jobs=%d: %s\n", producers, jobs, ret == 0 ? "OK" : "MISMATCH");
+	return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,457 @@
+//
+// DrmBufferPool.cpp
+//
+
+#include "DrmBufferPool.h"
+#include "utils/LogUtil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <xf86drm.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#define POOL_ALIGN(_v, _d) (((_v) + ((_d) - 1)) & ~((_d) - 1))
+
+DumbBufferBackend::DumbBufferBackend(const char *card)
+{
+	m_DrmFd = open(card, O_RDWR | O_CLOEXEC);
+	if (m_DrmFd < 0)
+	{
+		LOGCATE("DumbBufferBackend failed to open %s: %s", card, strerror(errno));
+	}
+}
+
+DumbBufferBackend::~DumbBufferBackend()
+{
+	if (m_DrmFd >= 0)
+	{
+		close(m_DrmFd);
+		m_DrmFd = -1;
+	}
+}
+
+int DumbBufferBackend::Alloc(DrmBuffer *buf)
+{
+	if (m_DrmFd < 0) return -1;
+
+	struct drm_mode_create_dumb alloc_arg;
+	memset(&alloc_arg, 0, sizeof(alloc_arg));
+	alloc_arg.bpp = buf->bpp;
+	alloc_arg.width = buf->w;
+	alloc_arg.height = buf->h;
+
+	int ret = drmIoctl(m_DrmFd, DRM_IOCTL_MODE_CREATE_DUMB, &alloc_arg);
+	if (ret)
+	{
+		LOGCATE("DumbBufferBackend::Alloc failed to create dumb buffer: %s", strerror(errno));
+		return -1;
+	}
+	buf->handle = alloc_arg.handle;
+	buf->pitch = alloc_arg.pitch;
+	buf->size = alloc_arg.size;
+
+	struct drm_prime_handle fd_args;
+	memset(&fd_args, 0, sizeof(fd_args));
+	fd_args.fd = -1;
+	fd_args.handle = alloc_arg.handle;
+	fd_args.flags = DRM_CLOEXEC | DRM_RDWR;
+	ret = drmIoctl(m_DrmFd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &fd_args);
+	if (ret)
+	{
+		LOGCATE("DumbBufferBackend::Alloc handle_to_fd failed: %s, handle=%x", strerror(errno), alloc_arg.handle);
+		Free(buf);
+		return -1;
+	}
+	buf->prime_fd = fd_args.fd;
+
+	struct drm_mode_map_dumb mmap_arg;
+	memset(&mmap_arg, 0, sizeof(mmap_arg));
+	mmap_arg.handle = alloc_arg.handle;
+	ret = drmIoctl(m_DrmFd, DRM_IOCTL_MODE_MAP_DUMB, &mmap_arg);
+	if (ret)
+	{
+		LOGCATE("DumbBufferBackend::Alloc failed to map dumb: %s", strerror(errno));
+		Free(buf);
+		return -1;
+	}
+
+	void *map = mmap64(0, alloc_arg.size, PROT_READ | PROT_WRITE, MAP_SHARED, m_DrmFd, mmap_arg.offset);
+	if (map == MAP_FAILED)
+	{
+		LOGCATE("DumbBufferBackend::Alloc failed to mmap buffer: %s", strerror(errno));
+		Free(buf);
+		return -1;
+	}
+	buf->vir_addr = map;
+	return 0;
+}
+
+void DumbBufferBackend::Free(DrmBuffer *buf)
+{
+	if (buf->vir_addr)
+	{
+		munmap(buf->vir_addr, buf->size);
+		buf->vir_addr = NULL;
+	}
+	if (buf->prime_fd >= 0)
+	{
+		close(buf->prime_fd);
+		buf->prime_fd = -1;
+	}
+	if (buf->handle && m_DrmFd >= 0)
+	{
+		struct drm_mode_destroy_dumb destroy_arg;
+		memset(&destroy_arg, 0, sizeof(destroy_arg));
+		destroy_arg.handle = buf->handle;
+		if (drmIoctl(m_DrmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_arg))
+		{
+			LOGCATE("DumbBufferBackend::Free failed to destroy dumb: %s", strerror(errno));
+		}
+		buf->handle = 0;
+	}
+}
+
+int MemfdBufferBackend::Alloc(DrmBuffer *buf)
+{
+	//与 dumb buffer 一样按 64 字节对齐 pitch
+	buf->pitch = POOL_ALIGN((uint32_t)((buf->w * buf->bpp + 7) / 8), 64u);
+	buf->size = (uint64_t)buf->pitch * buf->h;
+	buf->handle = 0;
+
+	int fd = (int)syscall(__NR_memfd_create, "drm-buffer-pool", MFD_CLOEXEC);
+	if (fd < 0)
+	{
+		LOGCATE("MemfdBufferBackend::Alloc memfd_create failed: %s", strerror(errno));
+		return -1;
+	}
+	if (ftruncate(fd, (off_t)buf->size) != 0)
+	{
+		LOGCATE("MemfdBufferBackend::Alloc ftruncate failed: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(0, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		LOGCATE("MemfdBufferBackend::Alloc mmap failed: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	buf->prime_fd = fd;
+	buf->vir_addr = map;
+	return 0;
+}
+
+void MemfdBufferBackend::Free(DrmBuffer *buf)
+{
+	if (buf->vir_addr)
+	{
+		munmap(buf->vir_addr, buf->size);
+		buf->vir_addr = NULL;
+	}
+	if (buf->prime_fd >= 0)
+	{
+		close(buf->prime_fd);
+		buf->prime_fd = -1;
+	}
+}
+
+static uint64_t NowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+DrmBufferPool::DrmBufferPool(DrmBufferBackend *backend, int max_cached_per_key, uint64_t max_cached_bytes)
+{
+	m_Backend = backend;
+	m_MaxCachedPerKey = max_cached_per_key;
+	m_MaxCachedBytes = max_cached_bytes;
+	m_FreeListener = NULL;
+	m_FreeListenerOpaque = NULL;
+	m_CachedBytes = 0;
+	m_InUse = 0;
+	m_Hits = 0;
+	m_Misses = 0;
+	m_Evictions = 0;
+	m_AllocFailures = 0;
+}
+
+DrmBufferPool::~DrmBufferPool()
+{
+	Trim(0);
+	if (m_InUse)
+	{
+		LOGCATE("DrmBufferPool::~DrmBufferPool %u buffers still in use", m_InUse);
+	}
+}
+
+DrmBuffer *DrmBufferPool::Acquire(int w, int h, int bpp, int is_afbc)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		for (std::list<DrmBuffer *>::iterator it = m_Idle.begin(); it != m_Idle.end(); ++it)
+		{
+			DrmBuffer *buf = *it;
+			if (buf->w == w && buf->h == h && buf->bpp == bpp && buf->is_afbc == is_afbc)
+			{
+				m_Idle.erase(it);
+				m_CachedBytes -= buf->size;
+				m_InUse++;
+				m_Hits++;
+				return buf;
+			}
+		}
+		m_Misses++;
+	}
+
+	//真正的分配不持锁, 避免 ioctl 阻塞其它线程的命中路径
+	DrmBuffer *buf = new DrmBuffer();
+	buf->w = w;
+	buf->h = h;
+	buf->bpp = bpp;
+	buf->is_afbc = is_afbc;
+	if (m_Backend == NULL || m_Backend->Alloc(buf) != 0)
+	{
+		delete buf;
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_AllocFailures++;
+		return NULL;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_InUse++;
+	return buf;
+}
+
+void DrmBufferPool::Release(DrmBuffer *buf)
+{
+	if (buf == NULL) return;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_InUse--;
+	m_Idle.push_front(buf);
+	m_CachedBytes += buf->size;
+
+	//同 key 的空闲 buffer 超过上限时淘汰最旧的一个
+	int same_key = 0;
+	std::list<DrmBuffer *>::iterator oldest = m_Idle.end();
+	for (std::list<DrmBuffer *>::iterator it = m_Idle.begin(); it != m_Idle.end(); ++it)
+	{
+		DrmBuffer *b = *it;
+		if (b->w == buf->w && b->h == buf->h && b->bpp == buf->bpp && b->is_afbc == buf->is_afbc)
+		{
+			same_key++;
+			oldest = it;
+		}
+	}
+	if (same_key > m_MaxCachedPerKey)
+	{
+		EvictLocked(oldest);
+	}
+
+	while (m_CachedBytes > m_MaxCachedBytes && !m_Idle.empty())
+	{
+		EvictLocked(--m_Idle.end());
+	}
+}
+
+void DrmBufferPool::Trim(uint64_t target_bytes)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	while (m_CachedBytes > target_bytes && !m_Idle.empty())
+	{
+		EvictLocked(--m_Idle.end());
+	}
+}
+
+void DrmBufferPool::SetFreeListener(DrmBufferFreeListener listener, void *opaque)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_FreeListener = listener;
+	m_FreeListenerOpaque = opaque;
+}
+
+void DrmBufferPool::EvictLocked(std::list<DrmBuffer *>::iterator it)
+{
+	DrmBuffer *buf = *it;
+	m_Idle.erase(it);
+	m_CachedBytes -= buf->size;
+	m_Evictions++;
+	if (m_FreeListener)
+		m_FreeListener(buf, m_FreeListenerOpaque);
+	m_Backend->Free(buf);
+	delete buf;
+}
+
+DrmBufferPoolStats DrmBufferPool::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	DrmBufferPoolStats stats;
+	stats.hits = m_Hits;
+	stats.misses = m_Misses;
+	stats.evictions = m_Evictions;
+	stats.alloc_failures = m_AllocFailures;
+	stats.in_use = m_InUse;
+	stats.cached = (uint32_t)m_Idle.size();
+	stats.cached_bytes = m_CachedBytes;
+	return stats;
+}
+
+void DrmBufferPool::DumpStats()
+{
+	DrmBufferPoolStats stats = GetStats();
+	LOGCATD("DrmBufferPool[%s] hits=%llu misses=%llu evictions=%llu alloc_failures=%llu in_use=%u cached=%u cached_bytes=%llu",
+			m_Backend ? m_Backend->Name() : "none",
+			(unsigned long long)stats.hits, (unsigned long long)stats.misses,
+			(unsigned long long)stats.evictions, (unsigned long long)stats.alloc_failures,
+			stats.in_use, stats.cached, (unsigned long long)stats.cached_bytes);
+}
+
+//写入 buf 的内容必须能从导出的 fd 重新映射后读到, 否则这个 fd 交给下游也没有意义
+static int check_exported_fd(DrmBuffer *buf, uint8_t seed)
+{
+	uint8_t *p = (uint8_t *)buf->vir_addr;
+	for (uint64_t i = 0; i < buf->size; i += 4096) p[i] = (uint8_t)(seed + i / 4096);
+	p[buf->size - 1] = seed;
+
+	void *map = mmap(0, buf->size, PROT_READ, MAP_SHARED, buf->prime_fd, 0);
+	if (map == MAP_FAILED)
+	{
+		LOGCATE("DrmBufferPool::SelfTest mmap exported fd %d failed: %s", buf->prime_fd, strerror(errno));
+		return -1;
+	}
+	const uint8_t *q = (const uint8_t *)map;
+	int ret = 0;
+	for (uint64_t i = 0; i < buf->size && ret == 0; i += 4096)
+	{
+		if (q[i] != (uint8_t)(seed + i / 4096)) ret = -1;
+	}
+	if (q[buf->size - 1] != seed) ret = -1;
+	munmap(map, buf->size);
+	if (ret < 0)
+	{
+		LOGCATE("DrmBufferPool::SelfTest exported fd %d content mismatch", buf->prime_fd);
+	}
+	return ret;
+}
+
+int DrmBufferPool::SelfTest(DrmBufferBackend *backend)
+{
+	if (backend == NULL) return -1;
+
+	const int sizes[][3] = { { 1920, 1080, 8 }, { 1280, 720, 16 }, { 352, 288, 32 } };
+	const int count = sizeof(sizes) / sizeof(sizes[0]);
+	int ret = 0;
+	{
+		DrmBufferPool pool(backend, 1);
+		DrmBuffer *bufs[count];
+		for (int i = 0; i < count; i++)
+		{
+			bufs[i] = pool.Acquire(sizes[i][0], sizes[i][1], sizes[i][2], 0);
+			if (bufs[i] == NULL || bufs[i]->prime_fd < 0 || bufs[i]->vir_addr == NULL ||
+				bufs[i]->pitch < (uint32_t)(sizes[i][0] * sizes[i][2] / 8) ||
+				bufs[i]->size < (uint64_t)bufs[i]->pitch * sizes[i][1])
+			{
+				LOGCATE("DrmBufferPool::SelfTest[%s] alloc %dx%d bpp=%d failed", backend->Name(), sizes[i][0],
+						sizes[i][1], sizes[i][2]);
+				for (int j = 0; j < i; j++) pool.Release(bufs[j]);
+				if (bufs[i]) pool.Release(bufs[i]);
+				return -1;
+			}
+			if (check_exported_fd(bufs[i], (uint8_t)(i * 37 + 1)) < 0) ret = -1;
+		}
+
+		//放回后同 key 再申请必须命中, 拿到的是同一块 buffer
+		DrmBuffer *first = bufs[0];
+		for (int i = 0; i < count; i++) pool.Release(bufs[i]);
+		DrmBuffer *again = pool.Acquire(sizes[0][0], sizes[0][1], sizes[0][2], 0);
+		if (again != first) ret = -1;
+		if (again && check_exported_fd(again, 0x5a) < 0) ret = -1;
+
+		//单 key 上限为 1: 同 key 的第二块放回时淘汰一块
+		DrmBuffer *extra = pool.Acquire(sizes[0][0], sizes[0][1], sizes[0][2], 0);
+		pool.Release(again);
+		pool.Release(extra);
+
+		DrmBufferPoolStats stats = pool.GetStats();
+		if (stats.hits != 1 || stats.misses != count + 1 || stats.evictions != 1 || stats.in_use != 0 ||
+			stats.alloc_failures != 0)
+		{
+			ret = -1;
+		}
+		pool.Trim(0);
+		stats = pool.GetStats();
+		if (stats.cached != 0 || stats.cached_bytes != 0) ret = -1;
+		pool.DumpStats();
+	}
+
+	LOGCATE("DrmBufferPool::SelfTest[%s] %s", backend->Name(), ret == 0 ? "OK" : "FAILED");
+	return ret;
+}
+
+int DrmBufferPool::Benchmark(DrmBufferBackend *backend, int iterations, DrmBufferPoolBenchResult *result)
+{
+	if (backend == NULL) return -1;
+	if (iterations < 1) iterations = 1;
+
+	//1080p NV12 大小的 buffer, 每次写一个字节, 让 mmap 真正建立映射
+	const int w = 1920, h = 1080 * 3 / 2, bpp = 8;
+
+	uint64_t start = NowUs();
+	for (int i = 0; i < iterations; i++)
+	{
+		DrmBuffer buf;
+		buf.w = w;
+		buf.h = h;
+		buf.bpp = bpp;
+		if (backend->Alloc(&buf) != 0)
+		{
+			LOGCATE("DrmBufferPool::Benchmark[%s] direct alloc failed at %d", backend->Name(), i);
+			return -1;
+		}
+		((uint8_t *)buf.vir_addr)[0] = (uint8_t)i;
+		backend->Free(&buf);
+	}
+	uint64_t direct_us = NowUs() - start;
+
+	DrmBufferPool pool(backend);
+	start = NowUs();
+	for (int i = 0; i < iterations; i++)
+	{
+		DrmBuffer *buf = pool.Acquire(w, h, bpp, 0);
+		if (buf == NULL)
+		{
+			LOGCATE("DrmBufferPool::Benchmark[%s] pool acquire failed at %d", backend->Name(), i);
+			return -1;
+		}
+		((uint8_t *)buf->vir_addr)[0] = (uint8_t)i;
+		pool.Release(buf);
+	}
+	uint64_t pool_us = NowUs() - start;
+	pool.Trim(0);
+
+	DrmBufferPoolStats stats = pool.GetStats();
+	LOGCATE("DrmBufferPool::Benchmark[%s] %dx%d bpp=%d x%d: direct %.2fus/op, pool %.2fus/op (x%.1f) "
+			"hits=%llu misses=%llu evictions=%llu",
+			backend->Name(), w, h, bpp, iterations, (double) direct_us / iterations, (double) pool_us / iterations,
+			pool_us ? (double) direct_us / pool_us : 0.0, (unsigned long long) stats.hits,
+			(unsigned long long) stats.misses, (unsigned long long) stats.evictions);
+	if (result)
+	{
+		result->direct_us = (double) direct_us / iterations;
+		result->pool_us = (double) pool_us / iterations;
+		result->stats = stats;
+	}
+	return 0;
+}
@@ -0,0 +1,144 @@
+//
+// DrmBufferPool.h
+//
+
+#ifndef DRMDEMO_DRM_BUFFER_POOL_H
+#define DRMDEMO_DRM_BUFFER_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <list>
+#include <mutex>
+
+struct DrmBuffer
+{
+	int w;
+	int h;
+	int bpp;            //申请时的bpp, afbc 已按2倍计算
+	int is_afbc;
+	uint32_t handle;    //GEM handle, memfd 后端为0
+	uint32_t pitch;
+	uint64_t size;
+	int prime_fd;       //dma-buf fd (memfd 后端为 memfd)
+	void *vir_addr;
+
+	DrmBuffer()
+	{
+		w = h = bpp = is_afbc = 0;
+		handle = pitch = 0;
+		size = 0;
+		prime_fd = -1;
+		vir_addr = NULL;
+	}
+};
+
+/*
+ * 分配后端: 负责真正的 create/export/mmap 以及销毁.
+ * Alloc 时 buf 的 w/h/bpp 已填好, 后端填其余字段.
+ */
+class DrmBufferBackend
+{
+public:
+	virtual ~DrmBufferBackend() {}
+	virtual const char *Name() const = 0;
+	virtual int Alloc(DrmBuffer *buf) = 0;
+	virtual void Free(DrmBuffer *buf) = 0;
+};
+
+//dumb buffer 后端, 整个生命周期只打开一次 /dev/dri/cardX
+class DumbBufferBackend : public DrmBufferBackend
+{
+public:
+	explicit DumbBufferBackend(const char *card = "/dev/dri/card0");
+	virtual ~DumbBufferBackend();
+
+	bool IsOpen() const { return m_DrmFd >= 0; }
+	virtual const char *Name() const { return "dumb"; }
+	virtual int Alloc(DrmBuffer *buf);
+	virtual void Free(DrmBuffer *buf);
+
+private:
+	int m_DrmFd;
+};
+
+//memfd 替身后端, 用于没有 DRM 节点的机器上测试/benchmark 缓冲池, 导出的 fd 不能给 EGL 导入
+class MemfdBufferBackend : public DrmBufferBackend
+{
+public:
+	virtual const char *Name() const { return "memfd"; }
+	virtual int Alloc(DrmBuffer *buf);
+	virtual void Free(DrmBuffer *buf);
+};
+
+struct DrmBufferPoolStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t alloc_failures;
+	uint32_t in_use;
+	uint32_t cached;
+	uint64_t cached_bytes;
+};
+
+struct DrmBufferPoolBenchResult
+{
+	double direct_us;       //直接走 backend 时每次 分配+释放 的耗时
+	double pool_us;         //经缓冲池时每次 Acquire+Release 的耗时
+	DrmBufferPoolStats stats;
+};
+
+//buffer 真正销毁前回调, 用于让持有该 dma-buf 导入结果的缓存失效
+typedef void (*DrmBufferFreeListener)(DrmBuffer *buf, void *opaque);
+
+/*
+ * 按 (w, h, bpp, afbc) 复用 dma-buf. Release 的 buffer 放回空闲链表(最近释放的在前),
+ * 超过单 key 上限或总字节上限时从最久未用的开始淘汰.
+ */
+class DrmBufferPool
+{
+public:
+	DrmBufferPool(DrmBufferBackend *backend, int max_cached_per_key = 4,
+				  uint64_t max_cached_bytes = 64ull * 1024 * 1024);
+	~DrmBufferPool();
+
+	DrmBuffer *Acquire(int w, int h, int bpp, int is_afbc);
+	void Release(DrmBuffer *buf);
+
+	//淘汰空闲 buffer 直到缓存字节数 <= target_bytes
+	void Trim(uint64_t target_bytes);
+
+	void SetFreeListener(DrmBufferFreeListener listener, void *opaque);
+
+	DrmBufferBackend *GetBackend() const { return m_Backend; }
+	DrmBufferPoolStats GetStats();
+	void DumpStats();
+
+	//在 backend 上走一遍 分配 -> 写入 -> 经导出的 fd 重新 mmap 校验 -> 释放复用 -> 淘汰, 并核对计数.
+	//不依赖 EGL, 没有 DRM 节点时用 MemfdBufferBackend 跑. 全部通过返回 0
+	static int SelfTest(DrmBufferBackend *backend);
+
+	//同一 key 反复申请/释放 iterations 次: 经缓冲池(命中路径)与直接走 backend 的 create/export/mmap/destroy 对比,
+	//结果写进 result(可为 NULL)并打到 logcat. 后端分配失败返回 -1
+	static int Benchmark(DrmBufferBackend *backend, int iterations, DrmBufferPoolBenchResult *result = NULL);
+
+private:
+	void EvictLocked(std::list<DrmBuffer *>::iterator it);
+
+	DrmBufferBackend *m_Backend;
+	int m_MaxCachedPerKey;
+	uint64_t m_MaxCachedBytes;
+	DrmBufferFreeListener m_FreeListener;
+	void *m_FreeListenerOpaque;
+
+	std::mutex m_Mutex;
+	std::list<DrmBuffer *> m_Idle;
+	uint64_t m_CachedBytes;
+	uint32_t m_InUse;
+	uint64_t m_Hits;
+	uint64_t m_Misses;
+	uint64_t m_Evictions;
+	uint64_t m_AllocFailures;
+};
+
+#endif //DRMDEMO_DRM_BUFFER_POOL_H
@@ -0,0 +1,170 @@
+//
+// DrmFormat.h
+//
+
+#ifndef DRMDEMO_DRM_FORMAT_H
+#define DRMDEMO_DRM_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <drm/drm_fourcc.h>
+
+#define DRM_FORMAT_MAX_PLANES 3
+
+#define RK_AFBC_MOD(_block) DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_SPARSE | (_block)) //ARM平台标志位 + rk支持afbc默认格式
+#define RK_AFBC_MOD_16x16   RK_AFBC_MOD(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16)
+
+/*
+ * 单个 plane 的布局: 每 block_w 个采样点占 bytes_per_block 字节,
+ * 采样点在水平/垂直方向相对亮度分别做 hsub/vsub 倍下采样.
+ * 例: NV12 的 UV plane 为 {2, 2, 1, 2}, YUYV 为 {1, 1, 2, 4}.
+ */
+struct DrmPlaneInfo
+{
+	uint8_t hsub;
+	uint8_t vsub;
+	uint8_t block_w;
+	uint8_t bytes_per_block;
+};
+
+struct DrmFormatInfo
+{
+	uint32_t fourcc;
+	const char *name;           //dump 文件名里使用的格式名
+	uint8_t is_yuv;
+	uint8_t num_planes;
+	DrmPlaneInfo planes[DRM_FORMAT_MAX_PLANES];
+	uint8_t pitch_align;        //stride 按像素对齐的粒度
+	uint8_t afbc;               //0: 仅 linear, 1: 支持 afbc, 2: 仅支持 afbc
+	uint64_t afbc_modifiers[DRM_FORMAT_MAX_PLANES];
+};
+
+//一块 buffer 中各 plane 的实际排布
+struct DrmFormatLayout
+{
+	uint32_t pitches[DRM_FORMAT_MAX_PLANES];
+	uint32_t offsets[DRM_FORMAT_MAX_PLANES];
+	uint32_t heights[DRM_FORMAT_MAX_PLANES];
+	uint32_t size;
+};
+
+static constexpr DrmFormatInfo kDrmFormatTable[] = {
+	//fourcc                  name          yuv planes {hsub, vsub, block_w, bytes}   align afbc afbc modifiers
+	{ DRM_FORMAT_ABGR8888,     "ABGR8888",   0, 1, { {1, 1, 1, 4} },                 32, 1, { RK_AFBC_MOD_16x16 } },
+	{ DRM_FORMAT_BGR888,       "BGR888",     0, 1, { {1, 1, 1, 3} },                 32, 1, { RK_AFBC_MOD_16x16 } },
+	{ DRM_FORMAT_RGB888,       "RGB888",     0, 1, { {1, 1, 1, 3} },                 32, 1, { RK_AFBC_MOD_16x16 } },
+	{ DRM_FORMAT_RGBA5551,     "RGBA5551",   0, 1, { {1, 1, 1, 2} },                 16, 0, { 0 } },
+	{ DRM_FORMAT_YUYV,         "YUYV",       1, 1, { {1, 1, 2, 4} },                 32, 1, { RK_AFBC_MOD_16x16 } },
+	{ DRM_FORMAT_Y210,         "Y210",       1, 1, { {1, 1, 2, 8} },                 32, 1, { RK_AFBC_MOD_16x16 } },
+	{ DRM_FORMAT_NV12,         "nv12",       1, 2, { {1, 1, 1, 1}, {2, 2, 1, 2} },   32, 1,
+	  { RK_AFBC_MOD(AFBC_FORMAT_MOD_BLOCK_SIZE_32x8), RK_AFBC_MOD(AFBC_FORMAT_MOD_BLOCK_SIZE_64x4) } },
+	{ DRM_FORMAT_NV16,         "nv16",       1, 2, { {1, 1, 1, 1}, {2, 1, 1, 2} },   32, 0, { 0 } },
+	{ DRM_FORMAT_NV24,         "nv24",       1, 2, { {1, 1, 1, 1}, {1, 1, 1, 2} },   32, 0, { 0 } },
+	{ DRM_FORMAT_P010,         "p010",       1, 2, { {1, 1, 1, 2}, {2, 2, 1, 4} },   32, 0, { 0 } },
+	{ DRM_FORMAT_YUV420_8BIT,  "YUV420I",    1, 1, { {1, 1, 2, 3} },                 32, 2, { RK_AFBC_MOD_16x16 } }, //12bit/pixel
+	{ DRM_FORMAT_YUV420_10BIT, "YUV420I_10", 1, 1, { {1, 1, 8, 15} },                32, 2, { RK_AFBC_MOD_16x16 } }, //15bit/pixel
+};
+
+class DrmFormat
+{
+public:
+	static const DrmFormatInfo *Find(uint32_t fourcc)
+	{
+		for (size_t i = 0; i < sizeof(kDrmFormatTable) / sizeof(kDrmFormatTable[0]); i++)
+		{
+			if (kDrmFormatTable[i].fourcc == fourcc) return &kDrmFormatTable[i];
+		}
+		return NULL;
+	}
+
+	static bool UseAfbc(const DrmFormatInfo *info, int is_afbc)
+	{
+		return info->afbc == 2 || (info->afbc == 1 && is_afbc);
+	}
+
+	//width 个像素在该 plane 上占的字节数(向上取整到整块)
+	static uint32_t PlaneRowBytes(const DrmFormatInfo *info, int plane, uint32_t width)
+	{
+		const DrmPlaneInfo &p = info->planes[plane];
+		uint32_t samples = (width + p.hsub - 1) / p.hsub;
+		return (samples + p.block_w - 1) / p.block_w * p.bytes_per_block;
+	}
+
+	static uint32_t PlaneHeight(const DrmFormatInfo *info, int plane, uint32_t height)
+	{
+		const DrmPlaneInfo &p = info->planes[plane];
+		return (height + p.vsub - 1) / p.vsub;
+	}
+
+	static uint32_t AlignedWidth(const DrmFormatInfo *info, uint32_t width)
+	{
+		return (width + info->pitch_align - 1) / info->pitch_align * info->pitch_align;
+	}
+
+	//平均每像素 bit 数, 所有 plane 之和
+	static uint32_t BitsPerPixel(const DrmFormatInfo *info)
+	{
+		uint32_t bits = 0;
+		for (int i = 0; i < info->num_planes; i++)
+		{
+			const DrmPlaneInfo &p = info->planes[i];
+			bits += p.bytes_per_block * 8 / (p.block_w * p.hsub * p.vsub);
+		}
+		return bits;
+	}
+
+	//dumb buffer 申请用的 bpp, afbc bpp 先按照2倍申请
+	static uint32_t AllocBpp(const DrmFormatInfo *info, int is_afbc)
+	{
+		uint32_t bpp = BitsPerPixel(info);
+		return UseAfbc(info, is_afbc) ? bpp * 2 : bpp;
+	}
+
+	static uint64_t Modifier(const DrmFormatInfo *info, int plane, int is_afbc)
+	{
+		return UseAfbc(info, is_afbc) ? info->afbc_modifiers[plane] : DRM_FORMAT_MOD_INVALID;
+	}
+
+	//按 pitch_align 对齐 stride 后各 plane 的 pitch/offset, 与 EGL 导入使用的排布一致
+	static void GetLayout(const DrmFormatInfo *info, uint32_t width, uint32_t height, DrmFormatLayout *layout)
+	{
+		uint32_t aligned_w = AlignedWidth(info, width);
+		uint32_t offset = 0;
+		for (int i = 0; i < DRM_FORMAT_MAX_PLANES; i++)
+		{
+			if (i < info->num_planes)
+			{
+				layout->pitches[i] = PlaneRowBytes(info, i, aligned_w);
+				layout->heights[i] = PlaneHeight(info, i, height);
+				layout->offsets[i] = offset;
+				offset += layout->pitches[i] * layout->heights[i];
+			}
+			else
+			{
+				layout->pitches[i] = layout->offsets[i] = layout->heights[i] = 0;
+			}
+		}
+		layout->size = offset;
+	}
+
+	//紧凑排布(无 stride 填充)时一帧的字节数, 即原始 yuv/rgb 文件中一帧的大小
+	static uint32_t FrameSize(const DrmFormatInfo *info, uint32_t width, uint32_t height)
+	{
+		uint32_t size = 0;
+		for (int i = 0; i < info->num_planes; i++)
+		{
+			size += PlaneRowBytes(info, i, width) * PlaneHeight(info, i, height);
+		}
+		return size;
+	}
+
+	//dump 的字节数: afbc 按申请的 2 倍 bpp 计算, linear 为紧凑帧大小
+	static uint32_t DumpSize(const DrmFormatInfo *info, uint32_t width, uint32_t height, int is_afbc)
+	{
+		if (UseAfbc(info, is_afbc))
+			return (uint32_t)((uint64_t)width * height * AllocBpp(info, is_afbc) / 8);
+		return FrameSize(info, width, height);
+	}
+};
+
+#endif //DRMDEMO_DRM_FORMAT_H
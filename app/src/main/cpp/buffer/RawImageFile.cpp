@@ -0,0 +1,176 @@
+//
+// RawImageFile.cpp
+//
+
+#include "RawImageFile.h"
+#include "utils/LogUtil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <functional>
+
+RawImageFile::RawImageFile()
+{
+	m_Info = NULL;
+	m_Width = m_Height = 0;
+	m_Data = NULL;
+	m_MapSize = 0;
+	m_FrameSize = 0;
+	m_FrameCount = 0;
+}
+
+RawImageFile::~RawImageFile()
+{
+	Close();
+}
+
+int RawImageFile::Open(const char *path, const DrmFormatInfo *info, int width, int height)
+{
+	Close();
+	if (!path || !info || width <= 0 || height <= 0) return -1;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		LOGCATE("RawImageFile::Open %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+
+	struct stat st;
+	uint32_t frame_size = DrmFormat::FrameSize(info, width, height);
+	if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < frame_size)
+	{
+		LOGCATE("RawImageFile::Open %s size=%lld smaller than one %s %dx%d frame(%u)", path,
+				(long long) st.st_size, info->name, width, height, frame_size);
+		close(fd);
+		return -1;
+	}
+
+	//映射建立后 fd 就不再需要了
+	void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		LOGCATE("RawImageFile::Open mmap %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+	madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+
+	m_Info = info;
+	m_Width = width;
+	m_Height = height;
+	m_Data = (uint8_t *) data;
+	m_MapSize = (size_t) st.st_size;
+	m_FrameSize = frame_size;
+	m_FrameCount = (int) (m_MapSize / frame_size);
+	if (m_MapSize % frame_size)
+	{
+		LOGCATE("RawImageFile::Open %s has %zu trailing bytes, ignored", path, m_MapSize % frame_size);
+	}
+	return 0;
+}
+
+void RawImageFile::Close()
+{
+	if (m_Data) munmap(m_Data, m_MapSize);
+	m_Data = NULL;
+	m_MapSize = 0;
+	m_FrameSize = 0;
+	m_FrameCount = 0;
+}
+
+const uint8_t *RawImageFile::GetFrame(int index) const
+{
+	if (!m_Data || index < 0 || index >= m_FrameCount) return NULL;
+	return m_Data + (size_t) index * m_FrameSize;
+}
+
+void RawImageFile::Prefetch(int index)
+{
+	const uint8_t *frame = GetFrame(index);
+	if (!frame) return;
+
+	//madvise 的地址要按页对齐
+	uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+	uintptr_t begin = (uintptr_t) frame & ~(page - 1);
+	madvise((void *) begin, (uintptr_t) frame + m_FrameSize - begin, MADV_WILLNEED);
+}
+
+int RawImageFile::ReadFrame(int index, void *dst, const DrmFormatLayout &layout, ThreadPool *pool)
+{
+	const uint8_t *frame = GetFrame(index);
+	if (!frame || !dst)
+	{
+		LOGCATE("RawImageFile::ReadFrame index=%d out of range(%d frames)", index, m_FrameCount);
+		return -1;
+	}
+
+	const uint8_t *src_planes[DRM_FORMAT_MAX_PLANES];
+	uint32_t row_bytes[DRM_FORMAT_MAX_PLANES];
+	const uint8_t *src = frame;
+	for (int p = 0; p < m_Info->num_planes; p++)
+	{
+		row_bytes[p] = DrmFormat::PlaneRowBytes(m_Info, p, m_Width);
+		if (layout.pitches[p] < row_bytes[p] || layout.heights[p] < DrmFormat::PlaneHeight(m_Info, p, m_Height))
+		{
+			LOGCATE("RawImageFile::ReadFrame plane %d pitch=%u smaller than %u bytes", p, layout.pitches[p], row_bytes[p]);
+			return -1;
+		}
+		src_planes[p] = src;
+		src += (size_t) row_bytes[p] * DrmFormat::PlaneHeight(m_Info, p, m_Height);
+	}
+
+	int bands = 1;
+	if (m_FrameSize >= RAW_IMAGE_PARALLEL_MIN_BYTES)
+	{
+		if (!pool) pool = ThreadPool::GetDefault();
+		bands = pool->GetConcurrency() * 2;
+	}
+
+	std::function<void(int)> task = [&](int task_index) {
+		int p = task_index / bands;
+		int band = task_index % bands;
+		uint32_t rows = DrmFormat::PlaneHeight(m_Info, p, m_Height);
+		uint32_t row0 = (uint32_t) ((uint64_t) rows * band / bands);
+		uint32_t row1 = (uint32_t) ((uint64_t) rows * (band + 1) / bands);
+		if (row0 >= row1) return;
+
+		const uint8_t *s = src_planes[p] + (size_t) row0 * row_bytes[p];
+		uint8_t *d = (uint8_t *) dst + layout.offsets[p] + (size_t) row0 * layout.pitches[p];
+		if (layout.pitches[p] == row_bytes[p])
+		{
+			//实宽虚宽相等, 整段拷贝
+			memcpy(d, s, (size_t) row_bytes[p] * (row1 - row0));
+			return;
+		}
+		for (uint32_t row = row0; row < row1; row++)
+		{
+			memcpy(d, s, row_bytes[p]);
+			s += row_bytes[p];
+			d += layout.pitches[p];
+		}
+	};
+
+	if (bands == 1)
+	{
+		for (int p = 0; p < m_Info->num_planes; p++) task(p);
+	}
+	else
+	{
+		pool->ParallelFor(m_Info->num_planes * bands, task);
+	}
+	return 0;
+}
+
+int RawImageFile::ReadFrame(int index, void *dst, ThreadPool *pool)
+{
+	if (!m_Info) return -1;
+	DrmFormatLayout layout;
+	DrmFormat::GetLayout(m_Info, m_Width, m_Height, &layout);
+	return ReadFrame(index, dst, layout, pool);
+}
@@ -0,0 +1,62 @@
+//
+// RawImageFile.h
+//
+
+#ifndef DRMDEMO_RAW_IMAGE_FILE_H
+#define DRMDEMO_RAW_IMAGE_FILE_H
+
+#include "DrmFormat.h"
+#include "utils/ThreadPool.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RAW_IMAGE_PARALLEL_MIN_BYTES (1 << 20)      //小于 1MB 的帧单线程拷贝
+
+/*
+ * 原始 yuv/rgb 文件(多帧紧凑排列, 无 stride 填充)的只读映射.
+ * 整个文件 mmap 一次并设置 MADV_SEQUENTIAL, 按帧号随机访问时对目标帧再做 MADV_WILLNEED.
+ * ReadFrame 把紧凑的行直接展开拷到按 layout 排布的目标内存(一般是 dma-buf 的映射),
+ * 不经过 stdio 缓冲; 大帧按行带在线程池上并行, 缺页也随之分摊到多个线程.
+ * 文件末尾不足一帧的部分忽略.
+ */
+class RawImageFile
+{
+public:
+	RawImageFile();
+	~RawImageFile();
+
+	//width/height 为实宽实高; 返回 0 成功, 文件不足一帧时返回 -1
+	int Open(const char *path, const DrmFormatInfo *info, int width, int height);
+	void Close();
+
+	bool IsOpen() const { return m_Data != NULL; }
+	int GetFrameCount() const { return m_FrameCount; }
+	uint32_t GetFrameSize() const { return m_FrameSize; }
+
+	//第 index 帧在映射里的紧凑数据, 只读; 目标 stride 与文件一致时可直接使用, 不用拷贝
+	const uint8_t *GetFrame(int index) const;
+
+	//提示内核预读第 index 帧, 顺序回放时在处理当前帧前调用下一帧
+	void Prefetch(int index);
+
+	//第 index 帧按 layout 的 pitches/offsets 拷到 dst; pool 为 NULL 时使用 ThreadPool::GetDefault()
+	int ReadFrame(int index, void *dst, const DrmFormatLayout &layout, ThreadPool *pool = NULL);
+
+	//dst 使用 DrmFormat::GetLayout 的默认排布
+	int ReadFrame(int index, void *dst, ThreadPool *pool = NULL);
+
+private:
+	RawImageFile(const RawImageFile &);
+	RawImageFile &operator=(const RawImageFile &);
+
+	const DrmFormatInfo *m_Info;
+	int m_Width;
+	int m_Height;
+	uint8_t *m_Data;
+	size_t m_MapSize;
+	uint32_t m_FrameSize;
+	int m_FrameCount;
+};
+
+#endif //DRMDEMO_RAW_IMAGE_FILE_H
@@ -0,0 +1,318 @@
+//
+// RawVideoReader.cpp
+//
+
+#include "RawVideoReader.h"
+#include "utils/LogUtil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static uint64_t NowUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+RawVideoReader::RawVideoReader(DrmBufferPool *pool, int ring_size)
+{
+	m_Pool = pool;
+	m_RingSize = std::max(2, std::min(ring_size, RAW_VIDEO_MAX_RING));
+	m_Info = NULL;
+	m_Width = m_Height = 0;
+	m_Loop = true;
+	m_Fd = -1;
+	m_FrameSize = 0;
+	m_FrameCount = 0;
+	memset(&m_Layout, 0, sizeof(m_Layout));
+	m_Stop = false;
+	m_Eof = false;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_OpenUs = 0;
+}
+
+RawVideoReader::~RawVideoReader()
+{
+	Close();
+}
+
+int RawVideoReader::Open(const char *path, const DrmFormatInfo *info, int width, int height, bool loop)
+{
+	Close();
+	if (!m_Pool || !path || !info || width <= 0 || height <= 0 || info->afbc == 2) return -1;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		LOGCATE("RawVideoReader::Open %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+	struct stat st;
+	uint32_t frame_size = DrmFormat::FrameSize(info, width, height);
+	if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < frame_size)
+	{
+		LOGCATE("RawVideoReader::Open %s size=%lld smaller than one %s %dx%d frame(%u)", path,
+				(long long) st.st_size, info->name, width, height, frame_size);
+		close(fd);
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	//与 create_drm_fd 相同的申请方式, 导入时的 pitch 才能对上
+	DrmFormat::GetLayout(info, width, height, &m_Layout);
+	for (int i = 0; i < m_RingSize; i++)
+	{
+		DrmBuffer *buf = m_Pool->Acquire(DrmFormat::AlignedWidth(info, width), height, DrmFormat::AllocBpp(info, 0), 0);
+		if (!buf) break;
+		if (buf->size < m_Layout.size)
+		{
+			m_Pool->Release(buf);
+			break;
+		}
+		m_Buffers.push_back(buf);
+		m_Free.push_back(buf);
+	}
+	if ((int) m_Buffers.size() < 2)
+	{
+		LOGCATE("RawVideoReader::Open only %zu/%d ring buffers", m_Buffers.size(), m_RingSize);
+		for (size_t i = 0; i < m_Buffers.size(); i++) m_Pool->Release(m_Buffers[i]);
+		m_Buffers.clear();
+		m_Free.clear();
+		close(fd);
+		return -1;
+	}
+
+	m_Info = info;
+	m_Width = width;
+	m_Height = height;
+	m_Loop = loop;
+	m_Fd = fd;
+	m_FrameSize = frame_size;
+	m_FrameCount = (int) ((uint64_t) st.st_size / frame_size);
+	m_Stop = false;
+	m_Eof = false;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_OpenUs = NowUs();
+	m_Thread = std::thread(&RawVideoReader::ReadLoop, this);
+
+	LOGCATE("RawVideoReader::Open %s %s %dx%d frames=%d ring=%zu", path, info->name, width, height,
+			m_FrameCount, m_Buffers.size());
+	return 0;
+}
+
+void RawVideoReader::Close()
+{
+	if (m_Fd < 0) return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_FreeCond.notify_all();
+	m_Thread.join();
+
+	size_t outstanding = m_Buffers.size() - m_Free.size() - m_Ready.size();
+	if (outstanding)
+	{
+		LOGCATE("RawVideoReader::Close %zu frames not released", outstanding);
+	}
+	for (size_t i = 0; i < m_Buffers.size(); i++) m_Pool->Release(m_Buffers[i]);
+	m_Buffers.clear();
+	m_Free.clear();
+	m_Ready.clear();
+
+	close(m_Fd);
+	m_Fd = -1;
+}
+
+//把 iov 描述的目标全部读满, 短读时接着读剩下的部分
+static int PreadvFull(int fd, struct iovec *iov, int count, off_t *offset, uint64_t *io_us)
+{
+	while (count > 0)
+	{
+		uint64_t t0 = NowUs();
+		ssize_t n = preadv(fd, iov, count, *offset);
+		*io_us += NowUs() - t0;
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return -1;
+		if (n == 0)
+		{
+			errno = 0;
+			return -1;
+		}
+
+		*offset += n;
+		while (count > 0 && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (uint8_t *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+int RawVideoReader::ReadFrameInto(int index, DrmBuffer *buf, uint64_t *io_us)
+{
+	//每行一个 iovec, 由内核直接按目标 stride 展开; pitch 与行字节数相等的 plane 合并成一个
+	struct iovec iov[IOV_MAX];
+	int count = 0;
+	off_t offset = (off_t) index * m_FrameSize;
+
+	for (int p = 0; p < m_Info->num_planes; p++)
+	{
+		uint32_t row_bytes = DrmFormat::PlaneRowBytes(m_Info, p, m_Width);
+		uint32_t rows = DrmFormat::PlaneHeight(m_Info, p, m_Height);
+		uint8_t *dst = (uint8_t *) buf->vir_addr + m_Layout.offsets[p];
+		if (m_Layout.pitches[p] == row_bytes)
+		{
+			row_bytes *= rows;
+			rows = 1;
+		}
+		for (uint32_t row = 0; row < rows; row++)
+		{
+			if (count == IOV_MAX)
+			{
+				if (PreadvFull(m_Fd, iov, count, &offset, io_us) < 0) return -1;
+				count = 0;
+			}
+			iov[count].iov_base = dst + (size_t) row * m_Layout.pitches[p];
+			iov[count].iov_len = row_bytes;
+			count++;
+		}
+	}
+	return PreadvFull(m_Fd, iov, count, &offset, io_us);
+}
+
+void RawVideoReader::ReadLoop()
+{
+	int index = 0;
+	uint64_t sequence = 0;
+	while (true)
+	{
+		DrmBuffer *buf = NULL;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			if (m_Free.empty() && !m_Stop)
+			{
+				uint64_t t0 = NowUs();
+				m_FreeCond.wait(lock, [this] { return !m_Free.empty() || m_Stop; });
+				m_Stats.ring_full_us += NowUs() - t0;
+			}
+			if (m_Stop) break;
+			buf = m_Free.front();
+			m_Free.pop_front();
+		}
+
+		uint64_t io_us = 0;
+		int ret = ReadFrameInto(index, buf, &io_us);
+		int err = ret < 0 ? errno : 0;
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Stats.io_us += io_us;
+		if (ret < 0)
+		{
+			LOGCATE("RawVideoReader::ReadLoop frame %d read failed: %s", index, err ? strerror(err) : "short file");
+			m_Stats.read_errors++;
+			m_Free.push_back(buf);
+			break;
+		}
+		RawVideoFrame frame = { buf, index, sequence++ };
+		m_Ready.push_back(frame);
+		m_Stats.frames_read++;
+		m_Stats.bytes_read += m_FrameSize;
+		lock.unlock();
+		m_ReadyCond.notify_one();
+
+		if (++index >= m_FrameCount)
+		{
+			if (!m_Loop) break;
+			index = 0;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Eof = true;
+	}
+	m_ReadyCond.notify_all();
+}
+
+int RawVideoReader::AcquireFrame(RawVideoFrame *frame, int timeout_ms)
+{
+	if (m_Fd < 0 || !frame) return -1;
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	if (m_Ready.empty() && !m_Eof)
+	{
+		//read-ahead 没跟上; 第一帧之前的等待是启动预读, 不算 underrun
+		if (m_Stats.frames_delivered) m_Stats.underruns++;
+		uint64_t t0 = NowUs();
+		std::function<bool()> ready = [this] { return !m_Ready.empty() || m_Eof; };
+		if (timeout_ms < 0)
+		{
+			m_ReadyCond.wait(lock, ready);
+		}
+		else
+		{
+			m_ReadyCond.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+		}
+		m_Stats.consumer_wait_us += NowUs() - t0;
+	}
+	if (m_Ready.empty()) return -1;
+
+	*frame = m_Ready.front();
+	m_Ready.pop_front();
+	m_Stats.frames_delivered++;
+	return 0;
+}
+
+void RawVideoReader::ReleaseFrame(const RawVideoFrame &frame)
+{
+	if (!frame.buf) return;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Free.push_back(frame.buf);
+	}
+	m_FreeCond.notify_one();
+}
+
+RawVideoReaderStats RawVideoReader::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	RawVideoReaderStats stats = m_Stats;
+	stats.elapsed_us = m_OpenUs ? NowUs() - m_OpenUs : 0;
+	return stats;
+}
+
+void RawVideoReader::DumpStats()
+{
+	RawVideoReaderStats s = GetStats();
+	double secs = s.elapsed_us / 1000000.0;
+	LOGCATE("RawVideoReader delivered=%llu(%.1f frames/s) read=%llu(%.1f MB/s while reading) io=%.1fms ring_full=%.1fms "
+			"underruns=%llu consumer_wait=%.1fms errors=%llu",
+			(unsigned long long) s.frames_delivered, secs > 0 ? s.frames_delivered / secs : 0.0,
+			(unsigned long long) s.frames_read, s.io_us ? s.bytes_read / (double) s.io_us : 0.0,
+			s.io_us / 1000.0, s.ring_full_us / 1000.0, (unsigned long long) s.underruns,
+			s.consumer_wait_us / 1000.0, (unsigned long long) s.read_errors);
+}
@@ -0,0 +1,100 @@
+//
+// RawVideoReader.h
+//
+
+#ifndef DRMDEMO_RAW_VIDEO_READER_H
+#define DRMDEMO_RAW_VIDEO_READER_H
+
+#include "DrmBufferPool.h"
+#include "DrmFormat.h"
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define RAW_VIDEO_MAX_RING 16
+
+//ring 里一帧已读好的数据
+struct RawVideoFrame
+{
+	DrmBuffer *buf;
+	int index;              //文件中的帧号
+	uint64_t sequence;      //从 Open 开始的序号, 循环播放时继续递增
+};
+
+struct RawVideoReaderStats
+{
+	uint64_t frames_read;
+	uint64_t frames_delivered;
+	uint64_t bytes_read;
+	uint64_t io_us;             //read-ahead 线程在 preadv 里的时间
+	uint64_t ring_full_us;      //read-ahead 线程等空闲 buffer 的时间, 越大说明 I/O 越富余
+	uint64_t underruns;         //消费者取帧时 ring 为空的次数
+	uint64_t consumer_wait_us;  //消费者因 underrun 阻塞的总时间
+	uint64_t read_errors;
+	uint64_t elapsed_us;        //Open 至今
+};
+
+/*
+ * 多帧原始 yuv/rgb 文件的流式读取. Open 时从 DrmBufferPool 取 ring_size 个 dma-buf,
+ * 后台 read-ahead 线程用 preadv 按目标 stride 把每行直接读进空闲 buffer, 读好的帧排队等消费者取走.
+ * 消费者用完(GPU 也不再访问)后 ReleaseFrame 归还, buffer 才会被再次填充.
+ * 布局与 DrmFormat::GetLayout 一致, 可以直接按 create_texture_fbo_img 的方式导入. 不支持 afbc.
+ * Close 之前需归还所有取走的帧.
+ */
+class RawVideoReader
+{
+public:
+	RawVideoReader(DrmBufferPool *pool, int ring_size = 4);
+	~RawVideoReader();
+
+	//width/height 为实宽实高; loop 为 true 时读到文件末尾后从第 0 帧继续
+	int Open(const char *path, const DrmFormatInfo *info, int width, int height, bool loop = true);
+	void Close();
+
+	bool IsOpen() const { return m_Fd >= 0; }
+	int GetFrameCount() const { return m_FrameCount; }
+
+	//取下一帧, 最多等 timeout_ms (<0 一直等); 不循环时读完所有帧、超时或读错误时返回 -1
+	int AcquireFrame(RawVideoFrame *frame, int timeout_ms = -1);
+	void ReleaseFrame(const RawVideoFrame &frame);
+
+	RawVideoReaderStats GetStats();
+	void DumpStats();
+
+private:
+	RawVideoReader(const RawVideoReader &);
+	RawVideoReader &operator=(const RawVideoReader &);
+
+	void ReadLoop();
+	int ReadFrameInto(int index, DrmBuffer *buf, uint64_t *io_us);
+
+	DrmBufferPool *m_Pool;
+	int m_RingSize;
+	const DrmFormatInfo *m_Info;
+	int m_Width;
+	int m_Height;
+	bool m_Loop;
+	int m_Fd;
+	uint32_t m_FrameSize;
+	int m_FrameCount;
+	DrmFormatLayout m_Layout;
+
+	std::thread m_Thread;
+	std::mutex m_Mutex;
+	std::condition_variable m_ReadyCond;    //有新帧或读线程结束
+	std::condition_variable m_FreeCond;     //有空闲 buffer 或要求退出
+	std::vector<DrmBuffer *> m_Buffers;
+	std::deque<DrmBuffer *> m_Free;
+	std::deque<RawVideoFrame> m_Ready;
+	bool m_Stop;
+	bool m_Eof;                             //读线程已退出(读完或出错)
+
+	RawVideoReaderStats m_Stats;
+	uint64_t m_OpenUs;
+};
+
+#endif //DRMDEMO_RAW_VIDEO_READER_H
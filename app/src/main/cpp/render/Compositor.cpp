@@ -0,0 +1,782 @@
+//
+// Compositor.cpp
+//
+
+#include "Compositor.h"
+#include "utils/GLUtils.h"
+#include "utils/LogUtil.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <time.h>
+
+static const char kCompositorVertexShader[] =
+		"#version 310 es \n"
+		"layout(location = 0) in vec4 vPosition;\n"     //QUAD_ATTRIB_POSITION
+		"layout(location = 1) in vec2 bgtexCoords;\n"   //QUAD_ATTRIB_TEXCOORD
+		"out vec2 bgTexCoords;\n"
+		"void main() {\n"
+		"    bgTexCoords = bgtexCoords;\n"
+		"    gl_Position = vPosition;\n"
+		"}\n";
+
+static const char kCompositorFragmentHeader[] =
+		"#version 310 es \n"
+		"#extension GL_OES_EGL_image_external : require \n"
+		"#extension GL_EXT_YUV_target : require \n"
+		"precision highp float;\n"                      //4K 下 mediump 的纹理坐标精度不够
+		"uniform __samplerExternal2DY2YEXT bgTexture;\n"
+		"yuvCscStandardEXT conv_standard = itu_601;\n"  //itu_601_full_range  itu_709  itu_601
+		"in vec2 bgTexCoords;\n"
+		"out vec4 FragColor;\n";
+
+//背景副本的拷贝: 按目标纹理坐标原样取一个像素, 不做颜色转换
+static const char kCompositorSaveShader[] =
+		"#version 310 es \n"
+		"#extension GL_OES_EGL_image_external : require \n"
+		"#extension GL_EXT_YUV_target : require \n"
+		"precision highp float;\n"
+		"uniform __samplerExternal2DY2YEXT srcTexture;\n"
+		"in vec2 bgTexCoords;\n"
+		"out vec4 FragColor;\n"
+		"void main() {\n"
+		"    FragColor = vec4(texture(srcTexture, bgTexCoords).xyz, 1.0);\n"
+		"}\n";
+
+static const char kCompositorRestoreShader[] =
+		"#version 310 es \n"
+		"#extension GL_EXT_YUV_target : require \n"
+		"precision highp float;\n"
+		"uniform highp sampler2D srcTexture;\n"
+		"in vec2 bgTexCoords;\n"
+		"out vec4 FragColor;\n"
+		"void main() {\n"
+		"    FragColor = vec4(texture(srcTexture, bgTexCoords).xyz, 1.0);\n"
+		"}\n";
+
+static bool CompareLayerZ(const CompositorLayer *a, const CompositorLayer *b)
+{
+	return a->z < b->z;
+}
+
+static int64_t CompositorNowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+//std140 下 count 层参数块的大小: osdRect[count] + osdXform[count] + osdAlpha[ceil(count / 4)], 均为 vec4
+static int ParamBlockSize(int count)
+{
+	return (2 * count + (count + 3) / 4) * 4 * (int) sizeof(GLfloat);
+}
+
+//生成 count 层的片元着色器, yuv_mask 的第 i 位表示第 i 层已是 YUV
+static std::string BuildFragmentShader(int count, uint32_t yuv_mask, bool use_ubo)
+{
+	std::string src = kCompositorFragmentHeader;
+	char line[256];
+
+	for (int i = 0; i < count; i++)
+	{
+		snprintf(line, sizeof(line), "uniform __samplerExternal2DY2YEXT osdTexture%d;\n", i);
+		src += line;
+	}
+	if (use_ubo)
+	{
+		//alpha 四个一组打包成 vec4, 避免 std140 下 float 数组每个元素占 16 字节
+		snprintf(line, sizeof(line),
+				 "layout(std140) uniform OsdParams {\n"
+				 "   vec4 osdRect[%d];\n"
+				 "   vec4 osdXform[%d];\n"
+				 "   vec4 osdAlpha[%d];\n"
+				 "};\n",
+				 count, count, (count + 3) / 4);
+	}
+	else
+	{
+		snprintf(line, sizeof(line),
+				 "uniform vec4 osdRect[%d];\n"      //dst 区域, 背景纹理坐标 (x0, y0, x1, y1)
+				 "uniform vec4 osdXform[%d];\n"     //osd 纹理坐标 = bgTexCoords * xy + zw
+				 "uniform float osdAlpha[%d];\n",
+				 count, count, count);
+	}
+	src += line;
+
+	src += "void main() {\n"
+		   "   vec3 color = texture(bgTexture, bgTexCoords).xyz;\n"
+		   "   vec4 osd;\n"
+		   "   float a;\n";
+	for (int i = 0; i < count; i++)
+	{
+		char alpha[32];
+		if (use_ubo)
+			snprintf(alpha, sizeof(alpha), "osdAlpha[%d].%c", i / 4, "xyzw"[i % 4]);
+		else
+			snprintf(alpha, sizeof(alpha), "osdAlpha[%d]", i);
+		snprintf(line, sizeof(line),
+				 "   osd = texture(osdTexture%d, bgTexCoords * osdXform[%d].xy + osdXform[%d].zw);\n"
+				 "   a = osd.a * %s * step(osdRect[%d].x, bgTexCoords.x) * step(bgTexCoords.x, osdRect[%d].z)"
+				 " * step(osdRect[%d].y, bgTexCoords.y) * step(bgTexCoords.y, osdRect[%d].w);\n",
+				 i, i, i, alpha, i, i, i, i);
+		src += line;
+		if (yuv_mask & (1u << i))
+			src += "   color = mix(color, osd.xyz, a);\n";
+		else
+			src += "   color = mix(color, rgb_2_yuv(osd.xyz, conv_standard), a);\n";
+	}
+	src += "   FragColor = vec4(color, 1.0);\n"
+		   "}\n";
+	return src;
+}
+
+Compositor::Compositor()
+{
+	m_MaxLayersPerPass = 0;
+	m_LastPassCount = 0;
+	m_Timer = NULL;
+	m_UseUbo = false;
+	m_Ubo = 0;
+	m_UboStride = 0;
+	m_UboCapacity = 0;
+	m_DamageTracking = false;
+	m_HaveDamageState = false;
+	m_ClipToDamage = false;
+	m_LastSkipped = false;
+	m_RestoreDamage = false;
+	m_SaveProgram = 0;
+	m_RestoreProgram = 0;
+	m_SaveTexture = 0;
+	m_SaveFbo = 0;
+	m_SaveW = 0;
+	m_SaveH = 0;
+	memset(&m_LastTarget, 0, sizeof(m_LastTarget));
+	memset(&m_DamageStats, 0, sizeof(m_DamageStats));
+}
+
+Compositor::~Compositor()
+{
+	if (!m_Programs.empty())
+	{
+		LOGCATE("Compositor::~Compositor %zu programs not destroyed", m_Programs.size());
+	}
+}
+
+int Compositor::Init(int max_layers_per_pass, bool use_ubo)
+{
+	if (max_layers_per_pass <= 0)
+	{
+		GLint units = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+		max_layers_per_pass = units - 1; //留一个给背景
+	}
+	m_MaxLayersPerPass = std::max(1, std::min(max_layers_per_pass, COMPOSITOR_MAX_LAYERS_PER_PASS));
+
+	m_UseUbo = use_ubo;
+	if (m_UseUbo)
+	{
+		GLint align = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+		if (align <= 0) align = 256;
+		int block = ParamBlockSize(COMPOSITOR_MAX_LAYERS_PER_PASS);
+		m_UboStride = (block + align - 1) / align * align;
+		glGenBuffers(1, &m_Ubo);
+	}
+	LOGCATD("Compositor::Init max_layers_per_pass=%d ubo=%d stride=%d", m_MaxLayersPerPass, m_UseUbo, m_UboStride);
+	if (m_Geometry.Init(COMPOSITOR_MAX_QUADS) < 0) return -1;
+	return m_CopyGeometry.Init(COMPOSITOR_MAX_COPY_QUADS);
+}
+
+void Compositor::Destroy()
+{
+	for (std::map<uint32_t, Program>::iterator it = m_Programs.begin(); it != m_Programs.end(); ++it)
+	{
+		GLUtils::DeleteProgram(it->second.program);
+	}
+	m_Programs.clear();
+	m_Geometry.Destroy();
+	m_CopyGeometry.Destroy();
+	if (m_SaveProgram) GLUtils::DeleteProgram(m_SaveProgram);
+	if (m_RestoreProgram) GLUtils::DeleteProgram(m_RestoreProgram);
+	if (m_SaveFbo) glDeleteFramebuffers(1, &m_SaveFbo);
+	if (m_SaveTexture) glDeleteTextures(1, &m_SaveTexture);
+	m_SaveProgram = m_RestoreProgram = 0;
+	m_SaveFbo = m_SaveTexture = 0;
+	m_SaveW = m_SaveH = 0;
+	m_Saved.clear();
+	m_HaveDamageState = false;
+	if (m_Ubo) glDeleteBuffers(1, &m_Ubo);
+	m_Ubo = 0;
+	m_UboCapacity = 0;
+	m_UboData.clear();
+}
+
+Compositor::Program *Compositor::GetProgram(int count, uint32_t yuv_mask)
+{
+	uint32_t key = ((uint32_t) count << 16) | yuv_mask;
+	std::map<uint32_t, Program>::iterator it = m_Programs.find(key);
+	if (it != m_Programs.end())
+		return &it->second;
+
+	std::string fragment = BuildFragmentShader(count, yuv_mask, m_UseUbo);
+	Program prog;
+	prog.program = GLUtils::CreateProgram(kCompositorVertexShader, fragment.c_str());
+	if (!prog.program)
+	{
+		LOGCATE("Compositor::GetProgram create program failed, count=%d yuv_mask=0x%x", count, yuv_mask);
+		return NULL;
+	}
+
+	prog.bg_sampler_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("bgTexture"));
+	for (int i = 0; i < COMPOSITOR_MAX_LAYERS_PER_PASS; i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "osdTexture%d", i);
+		prog.osd_sampler_loc[i] = i < count ? GLUtils::GetUniformLocation(prog.program, name) : -1;
+	}
+	prog.rect_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("osdRect"));
+	prog.xform_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("osdXform"));
+	prog.alpha_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("osdAlpha"));
+	prog.ubo_size = 0;
+
+	//纹理单元固定: 第 i 层用 i, 背景用 count, 只需设置一次
+	glUseProgram(prog.program);
+	for (int i = 0; i < count; i++)
+	{
+		glUniform1i(prog.osd_sampler_loc[i], i);
+	}
+	glUniform1i(prog.bg_sampler_loc, count);
+
+	if (m_UseUbo)
+	{
+		GLuint block = glGetUniformBlockIndex(prog.program, "OsdParams");
+		if (block == GL_INVALID_INDEX)
+		{
+			LOGCATE("Compositor::GetProgram OsdParams block not found, count=%d", count);
+			GLUtils::DeleteProgram(prog.program);
+			return NULL;
+		}
+		glUniformBlockBinding(prog.program, block, COMPOSITOR_UBO_BINDING);
+		glGetActiveUniformBlockiv(prog.program, block, GL_UNIFORM_BLOCK_DATA_SIZE, &prog.ubo_size);
+	}
+
+	return &(m_Programs[key] = prog);
+}
+
+int Compositor::Compose(const CompositorTarget &target, const CompositorLayer *layers, int count)
+{
+	return ComposeBatched(target, layers, count, m_MaxLayersPerPass);
+}
+
+int Compositor::ComposePerLayer(const CompositorTarget &target, const CompositorLayer *layers, int count)
+{
+	return ComposeBatched(target, layers, count, 1);
+}
+
+static bool SameLayer(const CompositorLayer &a, const CompositorLayer &b)
+{
+	return a.texture_id == b.texture_id && a.version == b.version && a.tex_w == b.tex_w && a.tex_h == b.tex_h &&
+		   a.is_yuv == b.is_yuv && a.src_x == b.src_x && a.src_y == b.src_y && a.src_w == b.src_w && a.src_h == b.src_h &&
+		   a.dst_x == b.dst_x && a.dst_y == b.dst_y && a.dst_w == b.dst_w && a.dst_h == b.dst_h &&
+		   a.z == b.z && a.alpha == b.alpha;
+}
+
+static uint64_t RectArea(const std::vector<QuadRect> &rects)
+{
+	uint64_t area = 0;
+	for (size_t i = 0; i < rects.size(); i++)
+	{
+		area += (uint64_t) (rects[i].x1 - rects[i].x0) * (rects[i].y1 - rects[i].y0);
+	}
+	return area;
+}
+
+//rect 减去 holes 后剩下的部分(互不重叠)追加到 out
+static void SubtractRects(const QuadRect &rect, const std::vector<QuadRect> &holes, std::vector<QuadRect> &out)
+{
+	std::vector<QuadRect> pieces(1, rect), next;
+	for (size_t h = 0; h < holes.size() && !pieces.empty(); h++)
+	{
+		const QuadRect &s = holes[h];
+		next.clear();
+		for (size_t i = 0; i < pieces.size(); i++)
+		{
+			const QuadRect &p = pieces[i];
+			if (s.x1 <= p.x0 || s.x0 >= p.x1 || s.y1 <= p.y0 || s.y0 >= p.y1)
+			{
+				next.push_back(p);
+				continue;
+			}
+			//上下两条整宽, 中间一带左右两块
+			int y0 = std::max(p.y0, s.y0), y1 = std::min(p.y1, s.y1);
+			QuadRect top = { p.x0, p.y0, p.x1, s.y0 };
+			QuadRect bottom = { p.x0, s.y1, p.x1, p.y1 };
+			QuadRect left = { p.x0, y0, s.x0, y1 };
+			QuadRect right = { s.x1, y0, p.x1, y1 };
+			if (p.y0 < s.y0) next.push_back(top);
+			if (s.y1 < p.y1) next.push_back(bottom);
+			if (p.x0 < s.x0) next.push_back(left);
+			if (s.x1 < p.x1) next.push_back(right);
+		}
+		pieces.swap(next);
+	}
+	out.insert(out.end(), pieces.begin(), pieces.end());
+}
+
+void Compositor::SetDamageTracking(bool enable)
+{
+	m_DamageTracking = enable;
+	m_HaveDamageState = false;
+	m_LastSkipped = false;
+}
+
+//图层在目标上的可见矩形, 完全不可见时返回 false
+bool Compositor::ClipLayerRect(const CompositorTarget &target, const CompositorLayer &layer, QuadRect *rect) const
+{
+	if (layer.alpha <= 0.0f || layer.dst_w <= 0 || layer.dst_h <= 0) return false;
+	rect->x0 = std::max(layer.dst_x, 0);
+	rect->y0 = std::max(layer.dst_y, 0);
+	rect->x1 = std::min(layer.dst_x + layer.dst_w, target.w);
+	rect->y1 = std::min(layer.dst_y + layer.dst_h, target.h);
+	return rect->x0 < rect->x1 && rect->y0 < rect->y1;
+}
+
+//m_ClipToDamage 时把 rect 与各重画区域求交后追加, 否则原样追加
+void Compositor::AddClippedRect(const QuadRect &rect, std::vector<QuadRect> &out) const
+{
+	if (!m_ClipToDamage)
+	{
+		out.push_back(rect);
+		return;
+	}
+	for (size_t i = 0; i < m_Damage.size(); i++)
+	{
+		QuadRect r = { std::max(rect.x0, m_Damage[i].x0), std::max(rect.y0, m_Damage[i].y0),
+					   std::min(rect.x1, m_Damage[i].x1), std::min(rect.y1, m_Damage[i].y1) };
+		if (r.x0 < r.x1 && r.y0 < r.y1) out.push_back(r);
+	}
+}
+
+//与上一次 Compose 比较, 把需要重画的区域写入 m_Damage, 没有任何需要重画的区域时返回 false
+bool Compositor::ComputeDamage(const CompositorTarget &target, const CompositorLayer *layers, int count)
+{
+	//背景换了: target 上是干净的新背景, 画出当前所有图层即可, 之前的副本作废
+	bool background_changed = !m_HaveDamageState || target.texture_id != m_LastTarget.texture_id ||
+							  target.fbo_id != m_LastTarget.fbo_id || target.w != m_LastTarget.w ||
+							  target.h != m_LastTarget.h || target.version != m_LastTarget.version;
+
+	m_DamageRaw.clear();
+	QuadRect r;
+	if (background_changed)
+	{
+		m_Saved.clear();
+		for (int i = 0; i < count; i++)
+		{
+			if (ClipLayerRect(target, layers[i], &r)) m_DamageRaw.push_back(r);
+		}
+	}
+	else
+	{
+		//变化、增加或删除的图层: 旧位置要恢复背景, 新位置要重画
+		int last_count = (int) m_LastLayers.size();
+		for (int i = 0; i < std::max(count, last_count); i++)
+		{
+			if (i < count && i < last_count && SameLayer(layers[i], m_LastLayers[i])) continue;
+			if (i < last_count && ClipLayerRect(target, m_LastLayers[i], &r)) m_DamageRaw.push_back(r);
+			if (i < count && ClipLayerRect(target, layers[i], &r)) m_DamageRaw.push_back(r);
+		}
+	}
+	m_RestoreDamage = !background_changed;
+
+	m_LastTarget = target;
+	m_LastLayers.assign(layers, layers + count);
+	m_HaveDamageState = true;
+
+	m_Damage.clear();
+	if (!m_DamageRaw.empty())
+		QuadGeometry::Disjoint(&m_DamageRaw[0], (int) m_DamageRaw.size(), m_Damage);
+	return !m_Damage.empty();
+}
+
+int Compositor::EnsureSaveSurface(int w, int h)
+{
+	if (m_SaveTexture && m_SaveW == w && m_SaveH == h) return 0;
+	if (m_SaveFbo) glDeleteFramebuffers(1, &m_SaveFbo);
+	if (m_SaveTexture) glDeleteTextures(1, &m_SaveTexture);
+	m_SaveFbo = m_SaveTexture = 0;
+	m_SaveW = m_SaveH = 0;
+
+	glGenTextures(1, &m_SaveTexture);
+	glBindTexture(GL_TEXTURE_2D, m_SaveTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &m_SaveFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_SaveFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_SaveTexture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		LOGCATE("Compositor::EnsureSaveSurface %dx%d fbo incomplete", w, h);
+		glDeleteFramebuffers(1, &m_SaveFbo);
+		glDeleteTextures(1, &m_SaveTexture);
+		m_SaveFbo = m_SaveTexture = 0;
+		return -1;
+	}
+	m_SaveW = w;
+	m_SaveH = h;
+	return 0;
+}
+
+GLuint Compositor::GetCopyProgram(bool restore)
+{
+	GLuint &program = restore ? m_RestoreProgram : m_SaveProgram;
+	if (program) return program;
+
+	program = GLUtils::CreateProgram(kCompositorVertexShader, restore ? kCompositorRestoreShader : kCompositorSaveShader);
+	if (!program)
+	{
+		LOGCATE("Compositor::GetCopyProgram create %s program failed", restore ? "restore" : "save");
+		return 0;
+	}
+	glUseProgram(program);
+	glUniform1i(GLUtils::GetUniformLocation(program, GL_UNIFORM_ID("srcTexture")), 0);
+	return program;
+}
+
+//按目标纹理坐标把 texture 的 rects 区域原样画到当前 FBO, 两边尺寸相同
+void Compositor::CopyRects(GLuint program, GLenum tex_target, GLuint texture, const std::vector<QuadRect> &rects, int w, int h)
+{
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(tex_target, texture);
+	for (size_t first = 0; first < rects.size(); first += COMPOSITOR_MAX_COPY_QUADS)
+	{
+		int n = (int) std::min((size_t) COMPOSITOR_MAX_COPY_QUADS, rects.size() - first);
+		for (int i = 0; i < n; i++)
+		{
+			m_CopyGeometry.SetQuad(i, rects[first + i], w, h);
+		}
+		m_CopyGeometry.SetCount(n);
+		m_CopyGeometry.Bind();
+		m_CopyGeometry.Draw(0, n);
+		m_CopyGeometry.Unbind();
+	}
+}
+
+//重画区域中还没有被任何图层覆盖过的部分在 target 上仍是干净的背景, 先拷进副本;
+//背景没换时再从副本把整个重画区域恢复回 target, 之后的混合就从干净的背景开始
+int Compositor::RestoreDamage(const CompositorTarget &target)
+{
+	m_ToSave.clear();
+	for (size_t i = 0; i < m_Damage.size(); i++)
+	{
+		SubtractRects(m_Damage[i], m_Saved, m_ToSave);
+	}
+	if (m_ToSave.empty() && !m_RestoreDamage) return 0;
+
+	GLuint save_program = GetCopyProgram(false);
+	GLuint restore_program = GetCopyProgram(true);
+	if (!save_program || !restore_program || EnsureSaveSurface(target.w, target.h) < 0) return -1;
+
+	if (!m_ToSave.empty())
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, m_SaveFbo);
+		glViewport(0, 0, target.w, target.h);
+		CopyRects(save_program, GL_TEXTURE_EXTERNAL_OES, target.texture_id, m_ToSave, target.w, target.h);
+		m_DamageStats.saved_pixels += RectArea(m_ToSave);
+
+		//图层来回移动时副本区域会切得很碎, 超过一定数量时重新合并
+		m_Saved.insert(m_Saved.end(), m_ToSave.begin(), m_ToSave.end());
+		if (m_Saved.size() > COMPOSITOR_MAX_COPY_QUADS)
+		{
+			std::vector<QuadRect> saved;
+			QuadGeometry::Disjoint(&m_Saved[0], (int) m_Saved.size(), saved);
+			m_Saved.swap(saved);
+		}
+	}
+
+	if (m_RestoreDamage)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, target.fbo_id);
+		glViewport(0, 0, target.w, target.h);
+		CopyRects(restore_program, GL_TEXTURE_2D, m_SaveTexture, m_Damage, target.w, target.h);
+	}
+	return 0;
+}
+
+int Compositor::ComposeBatched(const CompositorTarget &target, const CompositorLayer *layers, int count, int batch)
+{
+	m_LastPassCount = 0;
+	m_LastSkipped = false;
+	m_ClipToDamage = false;
+
+	//ComposePerLayer 只用于对比, 不参与损伤跟踪
+	if (m_DamageTracking && batch > 1)
+	{
+		uint64_t target_pixels = (uint64_t) std::max(target.w, 0) * std::max(target.h, 0);
+		m_DamageStats.frames++;
+		m_DamageStats.target_pixels += target_pixels;
+		if (!ComputeDamage(target, layers, count))
+		{
+			m_LastSkipped = true;
+			m_DamageStats.skipped_frames++;
+			m_DamageStats.last_touched_pct = 0.0f;
+			return 0;
+		}
+		m_ClipToDamage = true;
+
+		//重画区域整块先恢复成背景, 再混合其中的图层
+		uint64_t touched = RectArea(m_Damage);
+		m_DamageStats.touched_pixels += touched;
+		m_DamageStats.last_touched_pct = target_pixels ? 100.0f * touched / target_pixels : 0.0f;
+		if (RestoreDamage(target) < 0)
+		{
+			//副本不可用时无法局部重画, 下一帧按背景已变化处理
+			m_HaveDamageState = false;
+			return -1;
+		}
+	}
+
+	if (count <= 0) return 0;
+	if (batch <= 0) batch = 1;
+
+	m_Sorted.clear();
+	for (int i = 0; i < count; i++)
+	{
+		if (layers[i].alpha > 0.0f && layers[i].dst_w > 0 && layers[i].dst_h > 0)
+			m_Sorted.push_back(&layers[i]);
+	}
+	std::stable_sort(m_Sorted.begin(), m_Sorted.end(), CompareLayerZ);
+
+	//先算出所有 pass 的 uniform 和 quad, 一次性上传顶点后再逐 pass 绘制
+	m_Passes.clear();
+	int quad = 0;
+	for (size_t start = 0; start < m_Sorted.size(); start += batch)
+	{
+		int n = (int) std::min((size_t) batch, m_Sorted.size() - start);
+		Pass pass;
+		if (PreparePass(target, (int) start, n, &quad, &pass))
+			return -1;
+		if (pass.quad_count > 0)
+			m_Passes.push_back(pass);
+	}
+	m_Geometry.SetCount(quad);
+	if (m_UseUbo)
+		UploadParams();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo_id);
+	glViewport(0, 0, target.w, target.h);
+	if (m_ClipToDamage)
+	{
+		//quad 已经裁剪到重画区域, scissor 再按外接矩形兜底
+		QuadRect bbox = m_Damage[0];
+		for (size_t i = 1; i < m_Damage.size(); i++)
+		{
+			bbox.x0 = std::min(bbox.x0, m_Damage[i].x0);
+			bbox.y0 = std::min(bbox.y0, m_Damage[i].y0);
+			bbox.x1 = std::max(bbox.x1, m_Damage[i].x1);
+			bbox.y1 = std::max(bbox.y1, m_Damage[i].y1);
+		}
+		glEnable(GL_SCISSOR_TEST);
+		glScissor(bbox.x0, bbox.y0, bbox.x1 - bbox.x0, bbox.y1 - bbox.y0);
+	}
+	m_Geometry.Bind();
+	for (size_t i = 0; i < m_Passes.size(); i++)
+	{
+#if GPU_TIMER_ENABLE
+		char pass_name[32] = "compose.per_layer";
+		if (m_Timer && batch > 1) snprintf(pass_name, sizeof(pass_name), "compose.pass%d", (int) i);
+		GPU_TIMER_SCOPE(m_Timer, pass_name);
+#endif
+		DrawPass(target, m_Passes[i]);
+		m_LastPassCount++;
+	}
+	m_Geometry.Unbind();
+	if (m_ClipToDamage) glDisable(GL_SCISSOR_TEST);
+	GLUtils::CheckGLError("Compositor::Compose");
+	return 0;
+}
+
+int Compositor::PreparePass(const CompositorTarget &target, int first_layer, int count, int *quad, Pass *pass)
+{
+	const CompositorLayer **layers = &m_Sorted[first_layer];
+	uint32_t yuv_mask = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (layers[i]->is_yuv) yuv_mask |= 1u << i;
+	}
+
+	pass->prog = GetProgram(count, yuv_mask);
+	if (!pass->prog) return -1;
+	pass->first_layer = first_layer;
+	pass->layer_count = count;
+
+	float bw = (float) target.w;
+	float bh = (float) target.h;
+	QuadRect bbox = { target.w, target.h, 0, 0 };
+	m_Rects.clear();
+	for (int i = 0; i < count; i++)
+	{
+		const CompositorLayer *l = layers[i];
+		float sx = (float) l->src_w / l->dst_w;
+		float sy = (float) l->src_h / l->dst_h;
+
+		pass->rect[i * 4 + 0] = l->dst_x / bw;
+		pass->rect[i * 4 + 1] = l->dst_y / bh;
+		pass->rect[i * 4 + 2] = (l->dst_x + l->dst_w) / bw;
+		pass->rect[i * 4 + 3] = (l->dst_y + l->dst_h) / bh;
+
+		pass->xform[i * 4 + 0] = bw * sx / l->tex_w;
+		pass->xform[i * 4 + 1] = bh * sy / l->tex_h;
+		pass->xform[i * 4 + 2] = (l->src_x - l->dst_x * sx) / l->tex_w;
+		pass->xform[i * 4 + 3] = (l->src_y - l->dst_y * sy) / l->tex_h;
+
+		pass->alpha[i] = l->alpha;
+
+		QuadRect r;
+		if (!ClipLayerRect(target, *l, &r)) continue;
+		size_t first = m_Rects.size();
+		AddClippedRect(r, m_Rects);
+		for (size_t k = first; k < m_Rects.size(); k++)
+		{
+			bbox.x0 = std::min(bbox.x0, m_Rects[k].x0);
+			bbox.y0 = std::min(bbox.y0, m_Rects[k].y0);
+			bbox.x1 = std::max(bbox.x1, m_Rects[k].x1);
+			bbox.y1 = std::max(bbox.y1, m_Rects[k].y1);
+		}
+	}
+
+	//重叠的图层矩形拆成互不重叠的 quad, 每个像素只被画一次; quad 不够用时退回外接矩形
+	m_Disjoint.clear();
+	if (!m_Rects.empty())
+		QuadGeometry::Disjoint(&m_Rects[0], (int) m_Rects.size(), m_Disjoint);
+	if (*quad + (int) m_Disjoint.size() > m_Geometry.GetMaxQuads())
+	{
+		m_Disjoint.clear();
+		if (!m_Rects.empty() && *quad < m_Geometry.GetMaxQuads())
+			m_Disjoint.push_back(bbox);
+		else if (!m_Rects.empty())
+			LOGCATE("Compositor::PreparePass out of quads, %d layers dropped", count);
+	}
+
+	pass->first_quad = *quad;
+	pass->quad_count = (int) m_Disjoint.size();
+	for (size_t i = 0; i < m_Disjoint.size(); i++)
+	{
+		m_Geometry.SetQuad((*quad)++, m_Disjoint[i], target.w, target.h);
+	}
+	return 0;
+}
+
+//按 std140 布局把所有 pass 的参数拼进一块内存, 一次写入 UBO
+void Compositor::UploadParams()
+{
+	int passes = (int) m_Passes.size();
+	if (passes == 0) return;
+
+	m_UboData.assign((size_t) passes * m_UboStride, 0);
+	for (int p = 0; p < passes; p++)
+	{
+		Pass &pass = m_Passes[p];
+		int count = pass.layer_count;
+		pass.ubo_offset = p * m_UboStride;
+		uint8_t *dst = &m_UboData[pass.ubo_offset];
+		memcpy(dst, pass.rect, count * 4 * sizeof(GLfloat));
+		memcpy(dst + count * 4 * sizeof(GLfloat), pass.xform, count * 4 * sizeof(GLfloat));
+		memcpy(dst + count * 8 * sizeof(GLfloat), pass.alpha, count * sizeof(GLfloat));
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, m_Ubo);
+	if (passes > m_UboCapacity)
+	{
+		m_UboCapacity = std::max(passes, m_UboCapacity * 2);
+		glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr) m_UboCapacity * m_UboStride, NULL, GL_DYNAMIC_DRAW);
+	}
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, (GLsizeiptr) m_UboData.size(), &m_UboData[0]);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void Compositor::DrawPass(const CompositorTarget &target, const Pass &pass)
+{
+	const Program *prog = pass.prog;
+	const CompositorLayer **layers = &m_Sorted[pass.first_layer];
+	int count = pass.layer_count;
+
+	glUseProgram(prog->program);
+
+	for (int i = 0; i < count; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_EXTERNAL_OES, layers[i]->texture_id);
+	}
+	glActiveTexture(GL_TEXTURE0 + count);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, target.texture_id);
+
+	if (m_UseUbo)
+	{
+		glBindBufferRange(GL_UNIFORM_BUFFER, COMPOSITOR_UBO_BINDING, m_Ubo, pass.ubo_offset, prog->ubo_size);
+	}
+	else
+	{
+		glUniform4fv(prog->rect_loc, count, pass.rect);
+		glUniform4fv(prog->xform_loc, count, pass.xform);
+		glUniform1fv(prog->alpha_loc, count, pass.alpha);
+	}
+
+	m_Geometry.Draw(pass.first_quad, pass.quad_count);
+}
+
+void Compositor::DumpDamageStats() const
+{
+	const CompositorDamageStats &s = m_DamageStats;
+	LOGCATE("Compositor::DumpDamageStats frames=%llu skipped=%llu (%.1f%%) touched avg=%.2f%% last=%.2f%% saved=%llu px",
+			(unsigned long long) s.frames, (unsigned long long) s.skipped_frames,
+			s.frames ? 100.0 * s.skipped_frames / s.frames : 0.0,
+			s.target_pixels ? 100.0 * s.touched_pixels / s.target_pixels : 0.0, s.last_touched_pct,
+			(unsigned long long) s.saved_pixels);
+}
+
+void Compositor::Benchmark(const CompositorTarget &target, const CompositorLayer *layers, int count, int frames)
+{
+	if (frames <= 0) return;
+
+	//计时时每帧都要真正绘制
+	bool tracking = m_DamageTracking;
+	m_DamageTracking = false;
+
+	//先各跑一帧, 把 shader 编译排除在计时之外
+	Compose(target, layers, count);
+	ComposePerLayer(target, layers, count);
+	glFinish();
+
+	int64_t t0 = CompositorNowUs();
+	for (int i = 0; i < frames; i++)
+	{
+		Compose(target, layers, count);
+		glFinish();
+	}
+	int64_t t1 = CompositorNowUs();
+	int batched_passes = m_LastPassCount;
+
+	for (int i = 0; i < frames; i++)
+	{
+		ComposePerLayer(target, layers, count);
+		glFinish();
+	}
+	int64_t t2 = CompositorNowUs();
+
+	double batched_fps = frames * 1000000.0 / std::max<int64_t>(t1 - t0, 1);
+	double per_layer_fps = frames * 1000000.0 / std::max<int64_t>(t2 - t1, 1);
+	LOGCATE("Compositor::Benchmark %dx%d layers=%d frames=%d: single-pass %d passes %.1f fps, per-layer %d passes %.1f fps (x%.2f)",
+			target.w, target.h, count, frames, batched_passes, batched_fps, m_LastPassCount, per_layer_fps,
+			batched_fps / std::max(per_layer_fps, 0.001));
+	m_DamageTracking = tracking;
+	m_HaveDamageState = false;
+}
@@ -0,0 +1,180 @@
+//
+// Compositor.h
+//
+
+#ifndef DRMDEMO_COMPOSITOR_H
+#define DRMDEMO_COMPOSITOR_H
+
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include "QuadGeometry.h"
+#include "GpuTimer.h"
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#define COMPOSITOR_MAX_LAYERS_PER_PASS 15
+#define COMPOSITOR_MAX_QUADS           256
+#define COMPOSITOR_UBO_BINDING         0
+#define COMPOSITOR_MAX_COPY_QUADS      64      //保存/恢复背景每次 draw 的 quad 数
+
+//一个 OSD 图层: 取 layer 纹理中 src 区域, 贴到背景的 dst 区域
+struct CompositorLayer
+{
+	GLuint texture_id;      //GL_TEXTURE_EXTERNAL_OES
+	int tex_w;
+	int tex_h;
+	int is_yuv;             //纹理本身是 YUV 时不再做 rgb_2_yuv
+	int src_x, src_y, src_w, src_h;
+	int dst_x, dst_y, dst_w, dst_h;
+	int z;                  //z 大的在上
+	float alpha;            //整层透明度, 与像素 alpha 相乘
+	uint64_t version;       //内容版本, 纹理内容改变时递增; 损伤跟踪据此判断图层是否需要重画
+};
+
+struct CompositorTarget
+{
+	GLuint texture_id;      //背景纹理, 同时挂在 fbo_id 上, 合成结果写回背景
+	GLuint fbo_id;
+	int w;
+	int h;
+	uint64_t version;       //背景内容版本, 换了新的背景帧时递增, 此时所有图层区域都要重画
+};
+
+struct CompositorDamageStats
+{
+	uint64_t frames;            //开启损伤跟踪后的 Compose 次数
+	uint64_t skipped_frames;    //背景和所有图层都没变, 没有提交任何绘制
+	uint64_t touched_pixels;    //实际重画(恢复背景后重新混合)的像素数累计
+	uint64_t saved_pixels;      //第一次被图层覆盖前拷进背景副本的像素数累计
+	uint64_t target_pixels;     //目标像素数累计, 与上一项之比即平均重画比例
+	float last_touched_pct;
+};
+
+/*
+ * 多图层合成: 按 z 排序后每 N 层(受 sampler 数限制)合成一个 pass,
+ * 每个 pass 把图层矩形拆成互不重叠的 quad 一次画完, 片元内依次混合落在其中的图层.
+ * 所有 pass 的 quad 放在同一个常驻 VBO 中, 只有变化的部分会重新上传.
+ * 不同层数/YUV 组合的 shader 按需生成并缓存.
+ * use_ubo 时各 pass 的参数放在同一个 uniform buffer 的不同区段, 每帧一次 glBufferSubData 写完.
+ *
+ * 开启损伤跟踪后, Compose 按图层下标记住上一次的参数和版本号:
+ * 背景版本变化时重画所有图层区域; 否则只重画参数或版本变化、增加或删除的图层的新旧位置
+ * (合并成互不重叠的矩形, quad 裁剪到这些矩形并用 scissor 限定); 什么都没变时整帧跳过,
+ * 调用方用 FramePacer::RepeatFrame 重发上一帧的 fence.
+ * 合成是在背景上原地混合的, 所以每块像素第一次被图层覆盖之前先拷进一张与目标同尺寸的背景副本
+ * (RGBA8, 存 YUV 值), 之后重画时先从副本恢复重画区域, 再把落在其中的所有图层按 z 重新混合,
+ * 图层内容变化、移动或删除都不会留下旧像素. 开启跟踪、InvalidateDamage 之后以及背景版本变化时,
+ * target 上必须是干净的背景.
+ */
+class Compositor
+{
+public:
+	Compositor();
+	~Compositor();
+
+	//max_layers_per_pass 为 0 时按 GL_MAX_TEXTURE_IMAGE_UNITS 推算
+	int Init(int max_layers_per_pass = 0, bool use_ubo = true);
+	void Destroy();
+
+	int Compose(const CompositorTarget &target, const CompositorLayer *layers, int count);
+
+	//旧 renderFrame 的做法: 每层单独一个 pass, 仅用于对比
+	int ComposePerLayer(const CompositorTarget &target, const CompositorLayer *layers, int count);
+
+	int GetMaxLayersPerPass() const { return m_MaxLayersPerPass; }
+	int GetLastPassCount() const { return m_LastPassCount; }
+
+	//设置后每个 pass 按 compose.passN 计时, 传 NULL 关闭
+	void SetTimer(GpuTimer *timer) { m_Timer = timer; }
+
+	//只对 Compose 生效, ComposePerLayer/Benchmark 仍然每次全画
+	void SetDamageTracking(bool enable);
+	//下一次 Compose 按背景已变化处理, 调用方需已把 target 换成/恢复成干净的背景
+	void InvalidateDamage() { m_HaveDamageState = false; }
+	//上一次 Compose 是否因为没有变化而跳过
+	bool LastFrameSkipped() const { return m_LastSkipped; }
+	CompositorDamageStats GetDamageStats() const { return m_DamageStats; }
+	void DumpDamageStats() const;
+
+	//分别用单 pass 合成和逐层合成跑 frames 帧, 打印 frames/s
+	void Benchmark(const CompositorTarget &target, const CompositorLayer *layers, int count, int frames);
+
+private:
+	struct Program
+	{
+		GLuint program;
+		GLint bg_sampler_loc;
+		GLint osd_sampler_loc[COMPOSITOR_MAX_LAYERS_PER_PASS];
+		GLint rect_loc;
+		GLint xform_loc;
+		GLint alpha_loc;
+		GLint ubo_size;
+	};
+
+	struct Pass
+	{
+		Program *prog;
+		int first_layer;
+		int layer_count;
+		int first_quad;
+		int quad_count;
+		int ubo_offset;
+		GLfloat rect[COMPOSITOR_MAX_LAYERS_PER_PASS * 4];
+		GLfloat xform[COMPOSITOR_MAX_LAYERS_PER_PASS * 4];
+		GLfloat alpha[COMPOSITOR_MAX_LAYERS_PER_PASS];
+	};
+
+	int ComposeBatched(const CompositorTarget &target, const CompositorLayer *layers, int count, int batch);
+	bool ComputeDamage(const CompositorTarget &target, const CompositorLayer *layers, int count);
+	int RestoreDamage(const CompositorTarget &target);
+	int EnsureSaveSurface(int w, int h);
+	GLuint GetCopyProgram(bool restore);
+	void CopyRects(GLuint program, GLenum tex_target, GLuint texture, const std::vector<QuadRect> &rects, int w, int h);
+	bool ClipLayerRect(const CompositorTarget &target, const CompositorLayer &layer, QuadRect *rect) const;
+	void AddClippedRect(const QuadRect &rect, std::vector<QuadRect> &out) const;
+	int PreparePass(const CompositorTarget &target, int first_layer, int count, int *quad, Pass *pass);
+	void UploadParams();
+	void DrawPass(const CompositorTarget &target, const Pass &pass);
+	Program *GetProgram(int count, uint32_t yuv_mask);
+
+	int m_MaxLayersPerPass;
+	int m_LastPassCount;
+	std::map<uint32_t, Program> m_Programs;  //key: count << 16 | yuv_mask
+	std::vector<const CompositorLayer *> m_Sorted;
+	std::vector<Pass> m_Passes;
+	std::vector<QuadRect> m_Rects;
+	std::vector<QuadRect> m_Disjoint;
+	QuadGeometry m_Geometry;
+	GpuTimer *m_Timer;
+
+	bool m_UseUbo;
+	GLuint m_Ubo;
+	int m_UboStride;                            //每个 pass 的区段大小, 已按 GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 对齐
+	int m_UboCapacity;                          //m_Ubo 当前能放下的 pass 数
+	std::vector<uint8_t> m_UboData;
+
+	bool m_DamageTracking;
+	bool m_HaveDamageState;
+	bool m_ClipToDamage;                        //本次 Compose 的 quad 需裁剪到 m_Damage
+	bool m_LastSkipped;
+	bool m_RestoreDamage;                       //背景没换, 重画区域要先从副本恢复
+	CompositorTarget m_LastTarget;
+	std::vector<CompositorLayer> m_LastLayers;  //按调用方传入的下标保存
+	std::vector<QuadRect> m_DamageRaw;
+	std::vector<QuadRect> m_Damage;             //互不重叠的重画区域
+	std::vector<QuadRect> m_Saved;              //当前背景已拷进副本的区域, 互不重叠
+	std::vector<QuadRect> m_ToSave;
+	QuadGeometry m_CopyGeometry;
+	GLuint m_SaveProgram;                       //目标 -> 副本
+	GLuint m_RestoreProgram;                    //副本 -> 目标
+	GLuint m_SaveTexture;
+	GLuint m_SaveFbo;
+	int m_SaveW;
+	int m_SaveH;
+	CompositorDamageStats m_DamageStats;
+};
+
+#endif //DRMDEMO_COMPOSITOR_H
@@ -0,0 +1,491 @@
+//
+// CpuCompositor.cpp
+//
+
+#include "CpuCompositor.h"
+#include "utils/LogUtil.h"
+
+#include <drm/drm_fourcc.h>
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_COMPOSITOR_X86 1
+#define CPU_COMPOSITOR_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define CPU_COMPOSITOR_NEON 1
+#endif
+
+/*
+ * 所有实现使用同一套整数公式, 保证逐字节一致:
+ * Y = ((66R + 129G + 25B + 128) >> 8) + 16
+ * U = ((-38R - 74G + 112B + 128) >> 8) + 128
+ * V = ((112R - 94G - 18B + 128) >> 8) + 128
+ * out = (bg * (256 - a') + fg * a' + 128) >> 8, a' = a + (a >> 7), 把 0..255 映射到 0..256
+ * 不复用 ImageConverter: 源是 NativeImage 不支持的 RGBA5551, 颜色转换与混合逐行融合在一起,
+ * 且这里的 8 位系数是对照 shader 结果定下的, 换成 ImageConverter 的 Q13 系数会改变参考输出
+ */
+typedef void (*RgbToYuvFn)(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+						   uint8_t *y, uint8_t *u, uint8_t *v, int n);
+typedef void (*BlendFn)(const uint8_t *bg, const uint8_t *fg, const uint8_t *a, uint8_t *out, int n);
+
+struct CpuBlendKernels
+{
+	RgbToYuvFn rgb_to_yuv;
+	BlendFn blend;
+};
+
+static void RgbToYuvScalar(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+						   uint8_t *y, uint8_t *u, uint8_t *v, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		int R = r[i], G = g[i], B = b[i];
+		y[i] = (uint8_t) (((66 * R + 129 * G + 25 * B + 128) >> 8) + 16);
+		u[i] = (uint8_t) (((-38 * R - 74 * G + 112 * B + 128) >> 8) + 128);
+		v[i] = (uint8_t) (((112 * R - 94 * G - 18 * B + 128) >> 8) + 128);
+	}
+}
+
+static void BlendScalar(const uint8_t *bg, const uint8_t *fg, const uint8_t *a, uint8_t *out, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		int w = a[i] + (a[i] >> 7);
+		out[i] = (uint8_t) ((bg[i] * (256 - w) + fg[i] * w + 128) >> 8);
+	}
+}
+
+#ifdef CPU_COMPOSITOR_X86
+CPU_COMPOSITOR_TARGET("sse4.1")
+static inline void RgbToYuv8Sse41(__m128i r, __m128i g, __m128i b, __m128i *y, __m128i *u, __m128i *v)
+{
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i yy = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+							   _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), c128));
+	*y = _mm_add_epi16(_mm_srli_epi16(yy, 8), _mm_set1_epi16(16));
+
+	__m128i uu = _mm_sub_epi16(_mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(112)), _mm_mullo_epi16(r, _mm_set1_epi16(38))),
+							   _mm_sub_epi16(_mm_mullo_epi16(g, _mm_set1_epi16(74)), c128));
+	*u = _mm_add_epi16(_mm_srai_epi16(uu, 8), c128);
+
+	__m128i vv = _mm_sub_epi16(_mm_sub_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(112)), _mm_mullo_epi16(g, _mm_set1_epi16(94))),
+							   _mm_sub_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(18)), c128));
+	*v = _mm_add_epi16(_mm_srai_epi16(vv, 8), c128);
+}
+
+CPU_COMPOSITOR_TARGET("sse4.1")
+static void RgbToYuvSse41(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+						  uint8_t *y, uint8_t *u, uint8_t *v, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i r8 = _mm_loadu_si128((const __m128i *) (r + i));
+		__m128i g8 = _mm_loadu_si128((const __m128i *) (g + i));
+		__m128i b8 = _mm_loadu_si128((const __m128i *) (b + i));
+		__m128i y0, u0, v0, y1, u1, v1;
+		RgbToYuv8Sse41(_mm_cvtepu8_epi16(r8), _mm_cvtepu8_epi16(g8), _mm_cvtepu8_epi16(b8), &y0, &u0, &v0);
+		RgbToYuv8Sse41(_mm_cvtepu8_epi16(_mm_srli_si128(r8, 8)), _mm_cvtepu8_epi16(_mm_srli_si128(g8, 8)),
+					   _mm_cvtepu8_epi16(_mm_srli_si128(b8, 8)), &y1, &u1, &v1);
+		_mm_storeu_si128((__m128i *) (y + i), _mm_packus_epi16(y0, y1));
+		_mm_storeu_si128((__m128i *) (u + i), _mm_packus_epi16(u0, u1));
+		_mm_storeu_si128((__m128i *) (v + i), _mm_packus_epi16(v0, v1));
+	}
+	RgbToYuvScalar(r + i, g + i, b + i, y + i, u + i, v + i, n - i);
+}
+
+CPU_COMPOSITOR_TARGET("sse4.1")
+static inline __m128i Blend8Sse41(__m128i bg, __m128i fg, __m128i a)
+{
+	a = _mm_add_epi16(a, _mm_srli_epi16(a, 7));
+	__m128i inv = _mm_sub_epi16(_mm_set1_epi16(256), a);
+	__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(bg, inv), _mm_mullo_epi16(fg, a)), _mm_set1_epi16(128));
+	return _mm_srli_epi16(sum, 8);
+}
+
+CPU_COMPOSITOR_TARGET("sse4.1")
+static void BlendSse41(const uint8_t *bg, const uint8_t *fg, const uint8_t *a, uint8_t *out, int n)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i bg8 = _mm_loadu_si128((const __m128i *) (bg + i));
+		__m128i fg8 = _mm_loadu_si128((const __m128i *) (fg + i));
+		__m128i a8 = _mm_loadu_si128((const __m128i *) (a + i));
+		__m128i lo = Blend8Sse41(_mm_cvtepu8_epi16(bg8), _mm_cvtepu8_epi16(fg8), _mm_cvtepu8_epi16(a8));
+		__m128i hi = Blend8Sse41(_mm_cvtepu8_epi16(_mm_srli_si128(bg8, 8)), _mm_cvtepu8_epi16(_mm_srli_si128(fg8, 8)),
+								 _mm_cvtepu8_epi16(_mm_srli_si128(a8, 8)));
+		_mm_storeu_si128((__m128i *) (out + i), _mm_packus_epi16(lo, hi));
+	}
+	BlendScalar(bg + i, fg + i, a + i, out + i, n - i);
+}
+
+CPU_COMPOSITOR_TARGET("avx2")
+static inline void RgbToYuv16Avx2(__m256i r, __m256i g, __m256i b, __m256i *y, __m256i *u, __m256i *v)
+{
+	const __m256i c128 = _mm256_set1_epi16(128);
+	__m256i yy = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(66)), _mm256_mullo_epi16(g, _mm256_set1_epi16(129))),
+								  _mm256_add_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(25)), c128));
+	*y = _mm256_add_epi16(_mm256_srli_epi16(yy, 8), _mm256_set1_epi16(16));
+
+	__m256i uu = _mm256_sub_epi16(_mm256_sub_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(112)), _mm256_mullo_epi16(r, _mm256_set1_epi16(38))),
+								  _mm256_sub_epi16(_mm256_mullo_epi16(g, _mm256_set1_epi16(74)), c128));
+	*u = _mm256_add_epi16(_mm256_srai_epi16(uu, 8), c128);
+
+	__m256i vv = _mm256_sub_epi16(_mm256_sub_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(112)), _mm256_mullo_epi16(g, _mm256_set1_epi16(94))),
+								  _mm256_sub_epi16(_mm256_mullo_epi16(b, _mm256_set1_epi16(18)), c128));
+	*v = _mm256_add_epi16(_mm256_srai_epi16(vv, 8), c128);
+}
+
+//packus 在 128 位 lane 内交错, 需要再按 64 位重排回原顺序
+CPU_COMPOSITOR_TARGET("avx2")
+static inline __m256i PackAvx2(__m256i lo, __m256i hi)
+{
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+}
+
+CPU_COMPOSITOR_TARGET("avx2")
+static void RgbToYuvAvx2(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+						 uint8_t *y, uint8_t *u, uint8_t *v, int n)
+{
+	int i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		__m256i y0, u0, v0, y1, u1, v1;
+		RgbToYuv16Avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (r + i))),
+					   _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (g + i))),
+					   _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (b + i))), &y0, &u0, &v0);
+		RgbToYuv16Avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (r + i + 16))),
+					   _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (g + i + 16))),
+					   _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (b + i + 16))), &y1, &u1, &v1);
+		_mm256_storeu_si256((__m256i *) (y + i), PackAvx2(y0, y1));
+		_mm256_storeu_si256((__m256i *) (u + i), PackAvx2(u0, u1));
+		_mm256_storeu_si256((__m256i *) (v + i), PackAvx2(v0, v1));
+	}
+	RgbToYuvScalar(r + i, g + i, b + i, y + i, u + i, v + i, n - i);
+}
+
+CPU_COMPOSITOR_TARGET("avx2")
+static inline __m256i Blend16Avx2(__m256i bg, __m256i fg, __m256i a)
+{
+	a = _mm256_add_epi16(a, _mm256_srli_epi16(a, 7));
+	__m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(256), a);
+	__m256i sum = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(bg, inv), _mm256_mullo_epi16(fg, a)),
+								   _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(sum, 8);
+}
+
+CPU_COMPOSITOR_TARGET("avx2")
+static void BlendAvx2(const uint8_t *bg, const uint8_t *fg, const uint8_t *a, uint8_t *out, int n)
+{
+	int i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		__m256i lo = Blend16Avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (bg + i))),
+								 _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (fg + i))),
+								 _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (a + i))));
+		__m256i hi = Blend16Avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (bg + i + 16))),
+								 _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (fg + i + 16))),
+								 _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (a + i + 16))));
+		_mm256_storeu_si256((__m256i *) (out + i), PackAvx2(lo, hi));
+	}
+	BlendScalar(bg + i, fg + i, a + i, out + i, n - i);
+}
+#endif //CPU_COMPOSITOR_X86
+
+#ifdef CPU_COMPOSITOR_NEON
+static void RgbToYuvNeon(const uint8_t *r, const uint8_t *g, const uint8_t *b,
+						 uint8_t *y, uint8_t *u, uint8_t *v, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint8x8_t r8 = vld1_u8(r + i), g8 = vld1_u8(g + i), b8 = vld1_u8(b + i);
+
+		uint16x8_t yy = vmull_u8(r8, vdup_n_u8(66));
+		yy = vmlal_u8(yy, g8, vdup_n_u8(129));
+		yy = vmlal_u8(yy, b8, vdup_n_u8(25));
+		vst1_u8(y + i, vadd_u8(vrshrn_n_u16(yy, 8), vdup_n_u8(16)));
+
+		//按 u16 回绕计算, 真值在 int16 范围内, 重解释为 s16 即为正确结果
+		uint16x8_t uu = vmull_u8(b8, vdup_n_u8(112));
+		uu = vmlsl_u8(uu, r8, vdup_n_u8(38));
+		uu = vmlsl_u8(uu, g8, vdup_n_u8(74));
+		int16x8_t us = vaddq_s16(vrshrq_n_s16(vreinterpretq_s16_u16(uu), 8), vdupq_n_s16(128));
+		vst1_u8(u + i, vqmovun_s16(us));
+
+		uint16x8_t vv = vmull_u8(r8, vdup_n_u8(112));
+		vv = vmlsl_u8(vv, g8, vdup_n_u8(94));
+		vv = vmlsl_u8(vv, b8, vdup_n_u8(18));
+		int16x8_t vs = vaddq_s16(vrshrq_n_s16(vreinterpretq_s16_u16(vv), 8), vdupq_n_s16(128));
+		vst1_u8(v + i, vqmovun_s16(vs));
+	}
+	RgbToYuvScalar(r + i, g + i, b + i, y + i, u + i, v + i, n - i);
+}
+
+static void BlendNeon(const uint8_t *bg, const uint8_t *fg, const uint8_t *a, uint8_t *out, int n)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint16x8_t w = vmovl_u8(vld1_u8(a + i));
+		w = vaddq_u16(w, vshrq_n_u16(w, 7));
+		uint16x8_t inv = vsubq_u16(vdupq_n_u16(256), w);
+		uint16x8_t sum = vmulq_u16(vmovl_u8(vld1_u8(bg + i)), inv);
+		sum = vmlaq_u16(sum, vmovl_u8(vld1_u8(fg + i)), w);
+		vst1_u8(out + i, vrshrn_n_u16(sum, 8));
+	}
+	BlendScalar(bg + i, fg + i, a + i, out + i, n - i);
+}
+#endif //CPU_COMPOSITOR_NEON
+
+static CpuBlendKernels GetKernels(CpuSimdLevel level)
+{
+	CpuBlendKernels k = { RgbToYuvScalar, BlendScalar };
+#ifdef CPU_COMPOSITOR_X86
+	if (level == CPU_SIMD_SSE41)
+	{
+		k.rgb_to_yuv = RgbToYuvSse41;
+		k.blend = BlendSse41;
+	}
+	else if (level == CPU_SIMD_AVX2)
+	{
+		k.rgb_to_yuv = RgbToYuvAvx2;
+		k.blend = BlendAvx2;
+	}
+#endif
+#ifdef CPU_COMPOSITOR_NEON
+	if (level == CPU_SIMD_NEON)
+	{
+		k.rgb_to_yuv = RgbToYuvNeon;
+		k.blend = BlendNeon;
+	}
+#endif
+	return k;
+}
+
+static int64_t CpuCompositorNowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+CpuCompositor::CpuCompositor()
+{
+	m_Level = DetectSimdLevel();
+}
+
+CpuSimdLevel CpuCompositor::DetectSimdLevel()
+{
+	return CpuFeatures::DetectSimdLevel();
+}
+
+const char *CpuCompositor::SimdLevelName(CpuSimdLevel level)
+{
+	return CpuFeatures::SimdLevelName(level);
+}
+
+void CpuCompositor::SetSimdLevel(CpuSimdLevel level)
+{
+	m_Level = CpuFeatures::Clamp(level);
+}
+
+//把 src 第 row 行 [col0, col1) 解出到 ya/u/v/a 的 [0, col1 - col0); RGB 格式时 ya/u/v 分别存 R/G/B
+void CpuCompositor::UnpackRow(const CpuOsdLayer &layer, int row, int col0, int col1, uint8_t *ya, uint8_t *u,
+							  uint8_t *v, uint8_t *a)
+{
+	const uint8_t *src = layer.data + (size_t) row * layer.pitch;
+	int count = col1 - col0;
+	switch (layer.fourcc)
+	{
+		case DRM_FORMAT_RGBA5551:
+		{
+			const uint16_t *p = (const uint16_t *) src + col0;
+			for (int i = 0; i < count; i++)
+			{
+				uint16_t px = p[i];
+				uint8_t r5 = (px >> 11) & 0x1f, g5 = (px >> 6) & 0x1f, b5 = (px >> 1) & 0x1f;
+				ya[i] = (uint8_t) ((r5 << 3) | (r5 >> 2));
+				u[i] = (uint8_t) ((g5 << 3) | (g5 >> 2));
+				v[i] = (uint8_t) ((b5 << 3) | (b5 >> 2));
+				a[i] = (px & 1) ? 255 : 0;
+			}
+			break;
+		}
+		case DRM_FORMAT_ABGR8888:
+		{
+			const uint8_t *p = src + col0 * 4;
+			for (int i = 0; i < count; i++)
+			{
+				ya[i] = p[i * 4 + 0];
+				u[i] = p[i * 4 + 1];
+				v[i] = p[i * 4 + 2];
+				a[i] = p[i * 4 + 3];
+			}
+			break;
+		}
+		case DRM_FORMAT_YUYV:
+		{
+			for (int i = 0; i < count; i++)
+			{
+				int c = col0 + i;
+				const uint8_t *pair = src + (c & ~1) * 2;
+				ya[i] = src[c * 2];
+				u[i] = pair[1];
+				v[i] = pair[3];
+				a[i] = 255;
+			}
+			break;
+		}
+		default:
+			break;
+	}
+
+	int la = (int) (layer.alpha * 255.0f + 0.5f);
+	la = std::max(0, std::min(255, la));
+	if (la != 255)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			a[i] = (uint8_t) ((a[i] * la + 127) / 255);
+		}
+	}
+}
+
+int CpuCompositor::BlendLayer(const CpuNv12Target &target, const CpuOsdLayer &layer)
+{
+	int x0 = std::max(layer.dst_x, 0), x1 = std::min(layer.dst_x + layer.w, target.w);
+	int y0 = std::max(layer.dst_y, 0), y1 = std::min(layer.dst_y + layer.h, target.h);
+	if (x0 >= x1 || y0 >= y1) return 0;
+
+	bool is_rgb = layer.fourcc == DRM_FORMAT_RGBA5551 || layer.fourcc == DRM_FORMAT_ABGR8888;
+	if (!is_rgb && layer.fourcc != DRM_FORMAT_YUYV)
+	{
+		LOGCATE("CpuCompositor::BlendLayer unsupported format 0x%x", layer.fourcc);
+		return -1;
+	}
+
+	//按 2x2 色度块对齐处理, 块内未被覆盖的像素 alpha 为 0
+	int bx0 = x0 & ~1;
+	int bx1 = std::min((x1 + 1) & ~1, target.w);
+	int n = bx1 - bx0;
+	int off = x0 - bx0;
+
+	m_Scratch.resize((size_t) n * 20);
+	uint8_t *base = &m_Scratch[0];
+	uint8_t *bgu = base, *bgv = base + n;
+	uint8_t *rows[2][9];
+	for (int r = 0; r < 2; r++)
+	{
+		for (int k = 0; k < 9; k++) rows[r][k] = base + (size_t) n * (2 + r * 9 + k);
+	}
+
+	CpuBlendKernels kern = GetKernels(m_Level);
+	for (int yy = y0 & ~1; yy < y1; yy += 2)
+	{
+		uint8_t *uv_row = target.uv + (size_t) (yy / 2) * target.uv_pitch;
+		for (int i = 0; i < n; i++)
+		{
+			int c = ((bx0 + i) & ~1);
+			bgu[i] = uv_row[c];
+			bgv[i] = uv_row[c + 1];
+		}
+
+		const uint8_t *ub[2], *vb[2];
+		for (int r = 0; r < 2; r++)
+		{
+			int row = yy + r;
+			if (row < y0 || row >= y1)
+			{
+				ub[r] = bgu;
+				vb[r] = bgv;
+				continue;
+			}
+
+			uint8_t *c0 = rows[r][0], *c1 = rows[r][1], *c2 = rows[r][2], *a = rows[r][3];
+			uint8_t *y = rows[r][4], *u = rows[r][5], *v = rows[r][6];
+			memset(a, 0, n);
+			memset(c0, 0, n);
+			memset(c1, 0, n);
+			memset(c2, 0, n);
+			UnpackRow(layer, row - layer.dst_y, x0 - layer.dst_x, x1 - layer.dst_x, c0 + off, c1 + off, c2 + off, a + off);
+			if (is_rgb)
+			{
+				kern.rgb_to_yuv(c0, c1, c2, y, u, v, n);
+			}
+			else
+			{
+				y = c0;
+				u = c1;
+				v = c2;
+			}
+
+			uint8_t *y_row = target.y + (size_t) row * target.y_pitch + bx0;
+			kern.blend(y_row, y, a, y_row, n);
+			kern.blend(bgu, u, a, rows[r][7], n);
+			kern.blend(bgv, v, a, rows[r][8], n);
+			ub[r] = rows[r][7];
+			vb[r] = rows[r][8];
+		}
+
+		for (int i = 0; i + 1 < n; i += 2)
+		{
+			uv_row[bx0 + i] = (uint8_t) ((ub[0][i] + ub[0][i + 1] + ub[1][i] + ub[1][i + 1] + 2) >> 2);
+			uv_row[bx0 + i + 1] = (uint8_t) ((vb[0][i] + vb[0][i + 1] + vb[1][i] + vb[1][i + 1] + 2) >> 2);
+		}
+	}
+	return 0;
+}
+
+int CpuCompositor::Blend(const CpuNv12Target &target, const CpuOsdLayer *layers, int count)
+{
+	if ((target.w & 1) || (target.h & 1))
+	{
+		LOGCATE("CpuCompositor::Blend NV12 target %dx%d must be even", target.w, target.h);
+		return -1;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		if (BlendLayer(target, layers[i])) return -1;
+	}
+	return 0;
+}
+
+void CpuCompositor::Benchmark(const CpuNv12Target &target, const CpuOsdLayer *layers, int count, int frames)
+{
+	if (frames <= 0) return;
+
+	uint64_t pixels = 0;
+	for (int i = 0; i < count; i++)
+	{
+		int w = std::min(layers[i].dst_x + layers[i].w, target.w) - std::max(layers[i].dst_x, 0);
+		int h = std::min(layers[i].dst_y + layers[i].h, target.h) - std::max(layers[i].dst_y, 0);
+		if (w > 0 && h > 0) pixels += (uint64_t) w * h;
+	}
+
+	CpuSimdLevel saved = m_Level;
+	CpuSimdLevel best = DetectSimdLevel();
+	CpuSimdLevel levels[] = { CPU_SIMD_SCALAR, CPU_SIMD_SSE41, CPU_SIMD_AVX2, CPU_SIMD_NEON };
+	for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++)
+	{
+		SetSimdLevel(levels[l]);
+		if (m_Level != levels[l]) continue;
+
+		Blend(target, layers, count);
+		int64_t t0 = CpuCompositorNowUs();
+		for (int f = 0; f < frames; f++)
+		{
+			Blend(target, layers, count);
+		}
+		int64_t us = std::max<int64_t>(CpuCompositorNowUs() - t0, 1);
+		LOGCATE("CpuCompositor::Benchmark %s%s layers=%d frames=%d: %.1f MPix/s, %.2f ms/frame",
+				SimdLevelName(levels[l]), levels[l] == best ? "(auto)" : "", count, frames,
+				(double) pixels * frames / us, us / 1000.0 / frames);
+	}
+	m_Level = saved;
+}
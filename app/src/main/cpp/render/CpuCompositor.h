@@ -0,0 +1,70 @@
+//
+// CpuCompositor.h
+//
+
+#ifndef DRMDEMO_CPU_COMPOSITOR_H
+#define DRMDEMO_CPU_COMPOSITOR_H
+
+#include "utils/CpuFeatures.h"
+
+#include <stdint.h>
+#include <vector>
+
+//CPU 侧的 OSD 图层, 不缩放: 整张 src 贴到 (dst_x, dst_y), 超出背景的部分裁掉
+struct CpuOsdLayer
+{
+	const uint8_t *data;
+	uint32_t fourcc;        //DRM_FORMAT_RGBA5551 / DRM_FORMAT_ABGR8888 / DRM_FORMAT_YUYV
+	int pitch;
+	int w;
+	int h;
+	int dst_x;
+	int dst_y;
+	float alpha;
+};
+
+//NV12 背景, 通常直接指向 dma-buf 的映射(win.drm_viraddr)
+struct CpuNv12Target
+{
+	uint8_t *y;
+	uint8_t *uv;
+	int y_pitch;
+	int uv_pitch;
+	int w;
+	int h;
+};
+
+/*
+ * NV12 背景上的 OSD 混合, 与 Compositor 的 shader 结果一致(允许 ±1 的取整误差):
+ * RGB 按 itu_601(limited range) 转 YUV, Y 逐像素混合, UV 先逐像素混合再对 2x2 求平均.
+ * 用作 GPU 忙时的兜底、无 GPU 环境下的参考结果, 以及与 GL 路径对比带宽.
+ * 颜色矩阵和混合有 SSE4.1/AVX2/NEON 实现, 运行时按 CPU 能力选择; 不同实现的输出逐字节一致.
+ */
+class CpuCompositor
+{
+public:
+	CpuCompositor();
+
+	static CpuSimdLevel DetectSimdLevel();
+	static const char *SimdLevelName(CpuSimdLevel level);
+
+	//强制使用某一级实现(用于对比), 超出 CPU 能力时退回检测到的级别
+	void SetSimdLevel(CpuSimdLevel level);
+	CpuSimdLevel GetSimdLevel() const { return m_Level; }
+
+	//按数组顺序依次混合, 后面的在上
+	int Blend(const CpuNv12Target &target, const CpuOsdLayer *layers, int count);
+
+	//各 SIMD 级别分别跑 frames 帧, 打印 MPix/s(按 OSD 覆盖的像素计)
+	void Benchmark(const CpuNv12Target &target, const CpuOsdLayer *layers, int count, int frames);
+
+private:
+	int BlendLayer(const CpuNv12Target &target, const CpuOsdLayer &layer);
+	void UnpackRow(const CpuOsdLayer &layer, int row, int col0, int col1, uint8_t *ya, uint8_t *u, uint8_t *v,
+				   uint8_t *a);
+
+	CpuSimdLevel m_Level;
+	std::vector<uint8_t> m_Scratch;
+};
+
+#endif //DRMDEMO_CPU_COMPOSITOR_H
@@ -0,0 +1,321 @@
+//
+// EglImageCache.cpp
+//
+
+#include "EglImageCache.h"
+#include "utils/LogUtil.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include <drm/drm_fourcc.h>
+
+static const EGLint kPlaneFdAttr[DMA_BUF_MAX_PLANES] = {
+		EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE2_FD_EXT };
+static const EGLint kPlaneOffsetAttr[DMA_BUF_MAX_PLANES] = {
+		EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT };
+static const EGLint kPlanePitchAttr[DMA_BUF_MAX_PLANES] = {
+		EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT, EGL_DMA_BUF_PLANE2_PITCH_EXT };
+static const EGLint kPlaneModLoAttr[DMA_BUF_MAX_PLANES] = {
+		EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT };
+static const EGLint kPlaneModHiAttr[DMA_BUF_MAX_PLANES] = {
+		EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT };
+
+bool EglImageCache::Key::operator<(const Key &other) const
+{
+	//Key 总是先 memset 再填充, padding 为 0, 可以直接按字节比较
+	return memcmp(this, &other, sizeof(Key)) < 0;
+}
+
+EglImageCache::EglImageCache(int capacity)
+{
+	m_Capacity = capacity;
+	m_CreateImage = NULL;
+	m_DestroyImage = NULL;
+	m_ImageTargetTexture2D = NULL;
+	m_Hits = 0;
+	m_Misses = 0;
+	m_Evictions = 0;
+	m_Invalidations = 0;
+}
+
+EglImageCache::~EglImageCache()
+{
+	//析构时可能已没有 GL 上下文, GL 对象需在此之前 InvalidateAll + Purge
+	if (!m_Lru.empty() || !m_Orphans.empty() || !m_PendingDelete.empty())
+	{
+		LOGCATE("EglImageCache::~EglImageCache leaking %zu entries, %zu orphans, %zu pending",
+				m_Lru.size(), m_Orphans.size(), m_PendingDelete.size());
+	}
+}
+
+int EglImageCache::Import(EGLDisplay dpy, const DmaBufImportDesc &desc, ImportedTexture *out, bool purge)
+{
+	struct stat st;
+	if (fstat(desc.fd, &st) != 0)
+	{
+		LOGCATE("EglImageCache::Import fstat fd=%d failed", desc.fd);
+		return -1;
+	}
+
+	Key key;
+	memset(&key, 0, sizeof(key));
+	key.dev = st.st_dev;
+	key.ino = st.st_ino;
+	key.fourcc = desc.fourcc;
+	key.width = desc.width;
+	key.height = desc.height;
+	key.num_planes = desc.num_planes;
+	for (int i = 0; i < desc.num_planes && i < DMA_BUF_MAX_PLANES; i++)
+	{
+		key.offsets[i] = desc.offsets[i];
+		key.pitches[i] = desc.pitches[i];
+		key.modifiers[i] = desc.modifiers[i];
+	}
+	key.need_fbo = desc.need_fbo;
+
+	if (purge) Purge();
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		std::map<Key, EntryList::iterator>::iterator found = m_Index.find(key);
+		if (found != m_Index.end())
+		{
+			EntryList::iterator it = found->second;
+			m_Lru.splice(m_Lru.begin(), m_Lru, it);
+			it->ref++;
+			*out = it->tex;
+			m_Hits++;
+			return 0;
+		}
+		m_Misses++;
+		if (!LoadProcsLocked()) return -1;
+	}
+
+	//创建在锁外进行, 多个共享 context 的线程可以同时导入不同的 buffer
+	ImportedTexture tex;
+	if (CreateTexture(dpy, desc, &tex) != 0)
+	{
+		return -1;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::map<Key, EntryList::iterator>::iterator found = m_Index.find(key);
+	if (found != m_Index.end())
+	{
+		//另一个线程同时导入了同一个 buffer, 用先插入的那份, 自己创建的交给 Purge 删除
+		m_PendingDelete.push_back(tex);
+		found->second->ref++;
+		*out = found->second->tex;
+		return 0;
+	}
+	Entry entry;
+	entry.key = key;
+	entry.tex = tex;
+	entry.ref = 1;
+	m_Lru.push_front(entry);
+	m_Index[key] = m_Lru.begin();
+	EvictLocked();
+	*out = tex;
+	return 0;
+}
+
+void EglImageCache::Release(const ImportedTexture &tex)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (EntryList::iterator it = m_Lru.begin(); it != m_Lru.end(); ++it)
+	{
+		if (it->tex.texture_id == tex.texture_id)
+		{
+			if (it->ref > 0) it->ref--;
+			EvictLocked();
+			return;
+		}
+	}
+	for (EntryList::iterator it = m_Orphans.begin(); it != m_Orphans.end(); ++it)
+	{
+		if (it->tex.texture_id == tex.texture_id)
+		{
+			if (--it->ref <= 0)
+			{
+				m_PendingDelete.push_back(it->tex);
+				m_Orphans.erase(it);
+			}
+			return;
+		}
+	}
+}
+
+void EglImageCache::Invalidate(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) return;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	EntryList::iterator it = m_Lru.begin();
+	while (it != m_Lru.end())
+	{
+		EntryList::iterator cur = it++;
+		if (cur->key.dev == st.st_dev && cur->key.ino == st.st_ino)
+		{
+			m_Invalidations++;
+			DropLocked(cur);
+		}
+	}
+}
+
+void EglImageCache::InvalidateAll()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	while (!m_Lru.empty())
+	{
+		m_Invalidations++;
+		DropLocked(m_Lru.begin());
+	}
+}
+
+void EglImageCache::Purge()
+{
+	std::vector<ImportedTexture> pending;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_PendingDelete.empty()) return;
+		pending.swap(m_PendingDelete);
+	}
+
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		glDeleteTextures(1, &pending[i].texture_id);
+		if (pending[i].fbo_id)
+			glDeleteFramebuffers(1, &pending[i].fbo_id);
+	}
+}
+
+void EglImageCache::EvictLocked()
+{
+	//从最久未用的开始淘汰未被引用的条目, 全部被引用时允许暂时超出容量
+	EntryList::iterator it = m_Lru.end();
+	while ((int)m_Lru.size() > m_Capacity && it != m_Lru.begin())
+	{
+		EntryList::iterator cur = --it;
+		if (cur->ref == 0)
+		{
+			m_Index.erase(cur->key);
+			m_PendingDelete.push_back(cur->tex);
+			it = m_Lru.erase(cur);
+			m_Evictions++;
+		}
+	}
+}
+
+void EglImageCache::DropLocked(EntryList::iterator it)
+{
+	m_Index.erase(it->key);
+	if (it->ref > 0)
+	{
+		m_Orphans.splice(m_Orphans.end(), m_Lru, it);
+	}
+	else
+	{
+		m_PendingDelete.push_back(it->tex);
+		m_Lru.erase(it);
+	}
+}
+
+bool EglImageCache::LoadProcsLocked()
+{
+	if (m_CreateImage == NULL)
+	{
+		m_CreateImage = (PFNEGLCREATEIMAGEKHRPROC) eglGetProcAddress("eglCreateImageKHR");
+		m_DestroyImage = (PFNEGLDESTROYIMAGEKHRPROC) eglGetProcAddress("eglDestroyImageKHR");
+		m_ImageTargetTexture2D = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC) eglGetProcAddress("glEGLImageTargetTexture2DOES");
+		if (!m_CreateImage || !m_DestroyImage || !m_ImageTargetTexture2D)
+		{
+			LOGCATE("EglImageCache::CreateTexture EGL_EXT_image_dma_buf_import entry points missing");
+			m_CreateImage = NULL;
+			return false;
+		}
+	}
+	return true;
+}
+
+int EglImageCache::CreateTexture(EGLDisplay dpy, const DmaBufImportDesc &desc, ImportedTexture *out)
+{
+	EGLint attr[6 + DMA_BUF_MAX_PLANES * 10 + 1];
+	int n = 0;
+	attr[n++] = EGL_WIDTH;
+	attr[n++] = desc.width;
+	attr[n++] = EGL_HEIGHT;
+	attr[n++] = desc.height;
+	attr[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attr[n++] = (EGLint) desc.fourcc;
+	for (int i = 0; i < desc.num_planes && i < DMA_BUF_MAX_PLANES; i++)
+	{
+		attr[n++] = kPlaneFdAttr[i];
+		attr[n++] = desc.fd;
+		attr[n++] = kPlaneOffsetAttr[i];
+		attr[n++] = (EGLint) desc.offsets[i];
+		attr[n++] = kPlanePitchAttr[i];
+		attr[n++] = (EGLint) desc.pitches[i];
+		if (desc.modifiers[i] != DRM_FORMAT_MOD_INVALID)
+		{
+			attr[n++] = kPlaneModLoAttr[i];
+			attr[n++] = (EGLint) (desc.modifiers[i] & 0xffffffff);
+			attr[n++] = kPlaneModHiAttr[i];
+			attr[n++] = (EGLint) (desc.modifiers[i] >> 32);
+		}
+	}
+	attr[n++] = EGL_NONE;
+
+	EGLImageKHR img = m_CreateImage(dpy, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer) NULL, attr);
+	if (img == EGL_NO_IMAGE_KHR)
+	{
+		LOGCATE("EglImageCache::CreateTexture eglCreateImageKHR failed fourcc=0x%x %dx%d", desc.fourcc, desc.width, desc.height);
+		return -1;
+	}
+
+	out->texture_id = 0;
+	out->fbo_id = 0;
+	glGenTextures(1, &out->texture_id);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, out->texture_id);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, EGL_IMAGE_CACHE_FILTER);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, EGL_IMAGE_CACHE_FILTER);
+	m_ImageTargetTexture2D(GL_TEXTURE_EXTERNAL_OES, img);
+
+	if (desc.need_fbo)
+	{
+		glGenFramebuffers(1, &out->fbo_id);
+		glBindFramebuffer(GL_FRAMEBUFFER, out->fbo_id);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_EXTERNAL_OES, out->texture_id, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			LOGCATE("EglImageCache::CreateTexture create fbo failed!");
+		}
+	}
+
+	//纹理持有 EGLImage 的引用, image 本身可以立即销毁
+	m_DestroyImage(dpy, img);
+	return 0;
+}
+
+EglImageCacheStats EglImageCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	EglImageCacheStats stats;
+	stats.hits = m_Hits;
+	stats.misses = m_Misses;
+	stats.evictions = m_Evictions;
+	stats.invalidations = m_Invalidations;
+	stats.entries = (uint32_t) m_Lru.size();
+	return stats;
+}
+
+void EglImageCache::DumpStats()
+{
+	EglImageCacheStats stats = GetStats();
+	uint64_t total = stats.hits + stats.misses;
+	LOGCATD("EglImageCache hits=%llu misses=%llu hit_rate=%.1f%% evictions=%llu invalidations=%llu entries=%u",
+			(unsigned long long) stats.hits, (unsigned long long) stats.misses,
+			total ? 100.0 * stats.hits / total : 0.0,
+			(unsigned long long) stats.evictions, (unsigned long long) stats.invalidations, stats.entries);
+}
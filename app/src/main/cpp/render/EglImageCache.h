@@ -0,0 +1,128 @@
+//
+// EglImageCache.h
+//
+
+#ifndef DRMDEMO_EGL_IMAGE_CACHE_H
+#define DRMDEMO_EGL_IMAGE_CACHE_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#define DMA_BUF_MAX_PLANES 3
+#define EGL_IMAGE_CACHE_FILTER GL_NEAREST   //导入纹理的 MIN/MAG filter; 纹理在各模块间共享, 临时改过的要恢复成它
+
+//一次 dma-buf 导入所需的全部参数, modifier 为 DRM_FORMAT_MOD_INVALID 时不传给 EGL
+struct DmaBufImportDesc
+{
+	int fd;
+	int width;
+	int height;
+	uint32_t fourcc;
+	int num_planes;
+	uint32_t offsets[DMA_BUF_MAX_PLANES];
+	uint32_t pitches[DMA_BUF_MAX_PLANES];
+	uint64_t modifiers[DMA_BUF_MAX_PLANES];
+	int need_fbo;
+};
+
+struct ImportedTexture
+{
+	GLuint texture_id;
+	GLuint fbo_id;
+};
+
+struct EglImageCacheStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t invalidations;
+	uint32_t entries;
+};
+
+/*
+ * 以 dma-buf 身份(fstat 得到的 dev/inode) + 布局为 key 缓存 EGLImage 导入出来的纹理/FBO.
+ * 同一个 dma-buf 每帧重复导入时直接返回已有的 texture/FBO.
+ *
+ * Import/Release/Purge 必须在 GL 线程调用; Invalidate 可在任意线程调用,
+ * 对应的 GL 对象会延迟到下一次 Import/Purge 时在 GL 线程删除.
+ * 与渲染 context 共享对象的工作线程(GlWorkerPool)也可以并发 Import, 但只能导入 need_fbo=0 的条目
+ * 并传 purge=false: FBO 不跨 context 共享, 只能在渲染线程删除.
+ */
+class EglImageCache
+{
+public:
+	explicit EglImageCache(int capacity = 16);
+	~EglImageCache();
+
+	int Import(EGLDisplay dpy, const DmaBufImportDesc &desc, ImportedTexture *out, bool purge = true);
+	void Release(const ImportedTexture &tex);
+
+	//buffer 被释放/销毁前调用, 使所有以该 dma-buf 为来源的条目失效
+	void Invalidate(int fd);
+	void InvalidateAll();
+
+	//删除已失效的 GL 对象, 需在 GL 线程调用
+	void Purge();
+
+	EglImageCacheStats GetStats();
+	void DumpStats();
+
+private:
+	struct Key
+	{
+		dev_t dev;
+		ino_t ino;
+		uint32_t fourcc;
+		int width;
+		int height;
+		int num_planes;
+		uint32_t offsets[DMA_BUF_MAX_PLANES];
+		uint32_t pitches[DMA_BUF_MAX_PLANES];
+		uint64_t modifiers[DMA_BUF_MAX_PLANES];
+		int need_fbo;
+
+		bool operator<(const Key &other) const;
+	};
+
+	struct Entry
+	{
+		Key key;
+		ImportedTexture tex;
+		int ref;
+	};
+
+	typedef std::list<Entry> EntryList;
+
+	bool LoadProcsLocked();
+	int CreateTexture(EGLDisplay dpy, const DmaBufImportDesc &desc, ImportedTexture *out);
+	void EvictLocked();
+	void DropLocked(EntryList::iterator it);
+
+	int m_Capacity;
+	std::mutex m_Mutex;
+	EntryList m_Lru;                                //front 为最近使用
+	std::map<Key, EntryList::iterator> m_Index;
+	EntryList m_Orphans;                            //已失效但仍被引用的条目
+	std::vector<ImportedTexture> m_PendingDelete;
+
+	PFNEGLCREATEIMAGEKHRPROC m_CreateImage;
+	PFNEGLDESTROYIMAGEKHRPROC m_DestroyImage;
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC m_ImageTargetTexture2D;
+
+	uint64_t m_Hits;
+	uint64_t m_Misses;
+	uint64_t m_Evictions;
+	uint64_t m_Invalidations;
+};
+
+#endif //DRMDEMO_EGL_IMAGE_CACHE_H
@@ -0,0 +1,204 @@
+//
+// FramePacer.cpp
+//
+
+#include "FramePacer.h"
+#include "utils/LogUtil.h"
+#include "libsync.h"
+
+#include <GLES2/gl2.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static bool has_extension(const char *extensions, const char *name)
+{
+	if (!extensions) return false;
+	size_t len = strlen(name);
+	for (const char *p = extensions; (p = strstr(p, name)) != NULL; p += len)
+	{
+		if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+	}
+	return false;
+}
+
+static uint64_t now_us()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+FramePacer::FramePacer()
+{
+	m_Display = EGL_NO_DISPLAY;
+	m_Mode = FRAME_PACER_FINISH;
+	m_MaxInFlight = 2;
+	m_LastFenceFd = -1;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_CreateSync = NULL;
+	m_DestroySync = NULL;
+	m_ClientWaitSync = NULL;
+	m_DupNativeFenceFd = NULL;
+}
+
+FramePacer::~FramePacer()
+{
+	if (!m_InFlight.empty())
+	{
+		LOGCATE("FramePacer::~FramePacer %d frames still in flight", (int) m_InFlight.size());
+	}
+}
+
+int FramePacer::Init(EGLDisplay dpy, int max_in_flight)
+{
+	m_Display = dpy;
+	m_MaxInFlight = max_in_flight < 1 ? 1 : (max_in_flight > FRAME_PACER_MAX_IN_FLIGHT ? FRAME_PACER_MAX_IN_FLIGHT : max_in_flight);
+
+	const char *extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+	m_CreateSync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+	m_DestroySync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+	m_ClientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress("eglClientWaitSyncKHR");
+	m_DupNativeFenceFd = (PFNEGLDUPNATIVEFENCEFDANDROIDPROC) eglGetProcAddress("eglDupNativeFenceFDANDROID");
+
+	bool has_sync = m_CreateSync && m_DestroySync && m_ClientWaitSync;
+	if (has_sync && m_DupNativeFenceFd && has_extension(extensions, "EGL_ANDROID_native_fence_sync"))
+		m_Mode = FRAME_PACER_NATIVE_FENCE;
+	else if (has_sync && has_extension(extensions, "EGL_KHR_fence_sync"))
+		m_Mode = FRAME_PACER_KHR_FENCE;
+	else
+		m_Mode = FRAME_PACER_FINISH;
+
+	LOGCATE("FramePacer::Init mode=%s max_in_flight=%d", GetModeName(), m_MaxInFlight);
+	return 0;
+}
+
+void FramePacer::Destroy()
+{
+	WaitIdle();
+	if (m_LastFenceFd >= 0) close(m_LastFenceFd);
+	m_LastFenceFd = -1;
+}
+
+const char *FramePacer::GetModeName() const
+{
+	switch (m_Mode)
+	{
+		case FRAME_PACER_NATIVE_FENCE: return "native_fence";
+		case FRAME_PACER_KHR_FENCE: return "khr_fence";
+		default: return "glFinish";
+	}
+}
+
+int FramePacer::EndFrame(int *out_fence_fd)
+{
+	if (out_fence_fd) *out_fence_fd = -1;
+	m_Stats.frames++;
+
+	if (m_Mode == FRAME_PACER_FINISH)
+	{
+		glFinish();
+		return 0;
+	}
+
+	InFlight frame;
+	frame.fence_fd = -1;
+	if (m_Mode == FRAME_PACER_NATIVE_FENCE)
+	{
+		EGLint attribs[] = { EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID, EGL_NONE };
+		frame.sync = m_CreateSync(m_Display, EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+	}
+	else
+	{
+		frame.sync = m_CreateSync(m_Display, EGL_SYNC_FENCE_KHR, NULL);
+	}
+	if (frame.sync == EGL_NO_SYNC_KHR)
+	{
+		LOGCATE("FramePacer::EndFrame create sync failed 0x%x, fall back to glFinish", eglGetError());
+		glFinish();
+		return -1;
+	}
+
+	//native fence 只有 flush 之后才有 fd
+	glFlush();
+
+	if (m_Mode == FRAME_PACER_NATIVE_FENCE)
+	{
+		frame.fence_fd = m_DupNativeFenceFd(m_Display, frame.sync);
+		if (out_fence_fd && frame.fence_fd >= 0)
+		{
+			*out_fence_fd = dup(frame.fence_fd);
+			m_Stats.exported_fds++;
+		}
+		if (m_LastFenceFd >= 0) close(m_LastFenceFd);
+		m_LastFenceFd = frame.fence_fd >= 0 ? dup(frame.fence_fd) : -1;
+	}
+
+	m_InFlight.push_back(frame);
+	while ((int) m_InFlight.size() > m_MaxInFlight)
+	{
+		uint64_t start = now_us();
+		WaitOldest();
+		m_Stats.throttle_waits++;
+		m_Stats.throttle_us += now_us() - start;
+	}
+	return 0;
+}
+
+int FramePacer::RepeatFrame(int *out_fence_fd)
+{
+	m_Stats.frames++;
+	m_Stats.repeated_frames++;
+	if (out_fence_fd) *out_fence_fd = -1;
+	if (!out_fence_fd || m_LastFenceFd < 0) return -1;
+
+	//已经 signal 的 sync_file 可以重复交出去, 下游 sync_wait 会立即返回
+	*out_fence_fd = dup(m_LastFenceFd);
+	if (*out_fence_fd < 0) return -1;
+	m_Stats.exported_fds++;
+	return 0;
+}
+
+void FramePacer::WaitOldest()
+{
+	InFlight frame = m_InFlight.front();
+	m_InFlight.pop_front();
+
+	if (frame.fence_fd >= 0)
+	{
+		sync_wait(frame.fence_fd, -1);
+		close(frame.fence_fd);
+	}
+	else
+	{
+		m_ClientWaitSync(m_Display, frame.sync, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+	}
+	m_DestroySync(m_Display, frame.sync);
+}
+
+void FramePacer::WaitIdle()
+{
+	while (!m_InFlight.empty())
+	{
+		WaitOldest();
+	}
+}
+
+int FramePacer::Accumulate(int *accum_fd, int fence_fd)
+{
+	if (fence_fd < 0) return 0;
+	if (*accum_fd < 0)
+	{
+		*accum_fd = dup(fence_fd);
+		return *accum_fd >= 0 ? 0 : -1;
+	}
+	return sync_accumulate("FramePacer", accum_fd, fence_fd);
+}
+
+void FramePacer::DumpStats() const
+{
+	LOGCATE("FramePacer mode=%s frames=%llu throttle_waits=%llu throttle_ms=%.2f exported_fds=%llu repeated=%llu",
+			GetModeName(), (unsigned long long) m_Stats.frames, (unsigned long long) m_Stats.throttle_waits,
+			m_Stats.throttle_us / 1000.0, (unsigned long long) m_Stats.exported_fds,
+			(unsigned long long) m_Stats.repeated_frames);
+}
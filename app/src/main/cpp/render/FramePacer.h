@@ -0,0 +1,89 @@
+//
+// FramePacer.h
+//
+
+#ifndef DRMDEMO_FRAME_PACER_H
+#define DRMDEMO_FRAME_PACER_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+
+#define FRAME_PACER_MAX_IN_FLIGHT 3
+
+enum FramePacerMode
+{
+	FRAME_PACER_NATIVE_FENCE = 0,   //EGL_ANDROID_native_fence_sync, 可导出 sync_file fd
+	FRAME_PACER_KHR_FENCE,          //EGL_KHR_fence_sync, 只能在本进程等待
+	FRAME_PACER_FINISH,             //都不支持时退回 glFinish
+};
+
+struct FramePacerStats
+{
+	uint64_t frames;
+	uint64_t throttle_waits;    //在飞帧超过上限而阻塞的次数
+	uint64_t throttle_us;       //阻塞总时长
+	uint64_t exported_fds;
+	uint64_t repeated_frames;   //内容没有变化, 直接重发上一帧 fence 的次数
+};
+
+/*
+ * 帧节奏控制: 每帧提交后插入 fence 而不是 glFinish, 最多允许 max_in_flight 帧在 GPU 上排队,
+ * 超过时只等待最老的一帧. native fence 模式下 EndFrame 可导出 sync_file fd 交给下游(编码/显示),
+ * 下游用 sync_wait 只等它需要的那一帧.
+ * 所有接口需在 GL 线程调用.
+ */
+class FramePacer
+{
+public:
+	FramePacer();
+	~FramePacer();
+
+	int Init(EGLDisplay dpy, int max_in_flight = 2);
+	void Destroy();
+
+	//提交本帧的 GL 命令之后调用. out_fence_fd 非空时返回本帧的 sync_file fd(调用者负责 close),
+	//非 native fence 模式下返回 -1
+	int EndFrame(int *out_fence_fd = NULL);
+
+	//本帧没有提交任何 GL 命令(合成被跳过)时代替 EndFrame: 不插新的 sync, out_fence_fd 返回上一帧 fence 的副本,
+	//下游照常等待即可; 还没有导出过 fence 时返回 -1
+	int RepeatFrame(int *out_fence_fd);
+
+	//等待所有在飞帧完成, 用于 CPU 读回结果之前
+	void WaitIdle();
+
+	FramePacerMode GetMode() const { return m_Mode; }
+	const char *GetModeName() const;
+	FramePacerStats GetStats() const { return m_Stats; }
+	void DumpStats() const;
+
+	//把 fence_fd 合并进 *accum_fd (*accum_fd 为 -1 时直接接管 fence_fd 的副本), 返回 0 成功
+	static int Accumulate(int *accum_fd, int fence_fd);
+
+private:
+	struct InFlight
+	{
+		EGLSyncKHR sync;
+		int fence_fd;       //native fence 模式下自己持有的一份 fd, 用 sync_wait 等待
+	};
+
+	void WaitOldest();
+
+	EGLDisplay m_Display;
+	FramePacerMode m_Mode;
+	int m_MaxInFlight;
+	std::deque<InFlight> m_InFlight;
+	int m_LastFenceFd;      //最近一次 EndFrame 的 sync_file, 供 RepeatFrame 重发
+	FramePacerStats m_Stats;
+
+	PFNEGLCREATESYNCKHRPROC m_CreateSync;
+	PFNEGLDESTROYSYNCKHRPROC m_DestroySync;
+	PFNEGLCLIENTWAITSYNCKHRPROC m_ClientWaitSync;
+	PFNEGLDUPNATIVEFENCEFDANDROIDPROC m_DupNativeFenceFd;
+};
+
+#endif //DRMDEMO_FRAME_PACER_H
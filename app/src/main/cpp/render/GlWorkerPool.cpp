@@ -0,0 +1,260 @@
+//
+// GlWorkerPool.cpp
+//
+
+#include "GlWorkerPool.h"
+#include "utils/LogUtil.h"
+
+#include <GLES2/gl2.h>
+#include <string.h>
+#include <time.h>
+
+static bool has_extension(const char *extensions, const char *name)
+{
+	if (!extensions) return false;
+	size_t len = strlen(name);
+	for (const char *p = extensions; (p = strstr(p, name)) != NULL; p += len)
+	{
+		if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+	}
+	return false;
+}
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+GlWorkerPool::GlWorkerPool()
+{
+	m_Display = EGL_NO_DISPLAY;
+	m_ShareContext = EGL_NO_CONTEXT;
+	m_Config = NULL;
+	m_Surfaceless = false;
+	m_Starting = 0;
+	m_StartFailed = 0;
+	m_Stop = false;
+	m_CreateSync = NULL;
+	m_DestroySync = NULL;
+	m_ClientWaitSync = NULL;
+	m_WaitSync = NULL;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+GlWorkerPool::~GlWorkerPool()
+{
+	Destroy();
+}
+
+int GlWorkerPool::Init(EGLDisplay dpy, EGLContext share_context, int threads)
+{
+	Destroy();
+	if (dpy == EGL_NO_DISPLAY || share_context == EGL_NO_CONTEXT) return -1;
+	if (threads < 1) threads = 1;
+	if (threads > GL_WORKER_MAX_THREADS) threads = GL_WORKER_MAX_THREADS;
+
+	//共享 context 要用和渲染 context 相同的 config
+	EGLint config_id = 0;
+	EGLint num_config = 0;
+	eglQueryContext(dpy, share_context, EGL_CONFIG_ID, &config_id);
+	EGLint config_attribs[] = { EGL_CONFIG_ID, config_id, EGL_NONE };
+	if (!eglChooseConfig(dpy, config_attribs, &m_Config, 1, &num_config) || num_config < 1)
+	{
+		LOGCATE("GlWorkerPool::Init no config for id %d", config_id);
+		return -1;
+	}
+
+	const char *extensions = eglQueryString(dpy, EGL_EXTENSIONS);
+	m_Surfaceless = has_extension(extensions, "EGL_KHR_surfaceless_context");
+	if (has_extension(extensions, "EGL_KHR_fence_sync"))
+	{
+		m_CreateSync = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+		m_DestroySync = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+		m_ClientWaitSync = (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress("eglClientWaitSyncKHR");
+		if (!m_CreateSync || !m_DestroySync || !m_ClientWaitSync) m_CreateSync = NULL;
+	}
+	if (m_CreateSync && has_extension(extensions, "EGL_KHR_wait_sync"))
+	{
+		m_WaitSync = (PFNEGLWAITSYNCKHRPROC) eglGetProcAddress("eglWaitSyncKHR");
+	}
+
+	m_Display = dpy;
+	m_ShareContext = share_context;
+	m_Stop = false;
+	m_StartFailed = 0;
+	m_Starting = threads;
+	for (int i = 0; i < threads; i++)
+	{
+		m_Workers.push_back(std::thread(&GlWorkerPool::WorkerLoop, this, i));
+	}
+
+	int failed;
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		while (m_Starting > 0) m_DoneCond.wait(lock);
+		failed = m_StartFailed;
+	}
+	if (failed)
+	{
+		LOGCATE("GlWorkerPool::Init %d of %d worker contexts failed", failed, threads);
+		Destroy();
+		return -1;
+	}
+
+	LOGCATE("GlWorkerPool::Init threads=%d surfaceless=%d fence=%s", threads, m_Surfaceless,
+			m_WaitSync ? "server wait" : (m_CreateSync ? "client wait" : "glFinish"));
+	return 0;
+}
+
+void GlWorkerPool::Destroy()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+		m_WakeCond.notify_all();
+	}
+	for (size_t i = 0; i < m_Workers.size(); i++)
+	{
+		m_Workers[i].join();
+	}
+	m_Workers.clear();
+	m_Display = EGL_NO_DISPLAY;
+	m_ShareContext = EGL_NO_CONTEXT;
+}
+
+int GlWorkerPool::CreateWorkerContext(int index, EGLSurface *surface, EGLContext *context)
+{
+	*surface = EGL_NO_SURFACE;
+	if (!m_Surfaceless)
+	{
+		EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		*surface = eglCreatePbufferSurface(m_Display, m_Config, pbuffer_attribs);
+		if (*surface == EGL_NO_SURFACE)
+		{
+			LOGCATE("GlWorkerPool::CreateWorkerContext worker %d eglCreatePbufferSurface failed 0x%x", index, eglGetError());
+			return -1;
+		}
+	}
+
+	EGLint context_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+	*context = eglCreateContext(m_Display, m_Config, m_ShareContext, context_attribs);
+	if (*context == EGL_NO_CONTEXT || !eglMakeCurrent(m_Display, *surface, *surface, *context))
+	{
+		LOGCATE("GlWorkerPool::CreateWorkerContext worker %d create shared context failed 0x%x", index, eglGetError());
+		if (*context != EGL_NO_CONTEXT) eglDestroyContext(m_Display, *context);
+		if (*surface != EGL_NO_SURFACE) eglDestroySurface(m_Display, *surface);
+		return -1;
+	}
+	return 0;
+}
+
+void GlWorkerPool::WorkerLoop(int index)
+{
+	EGLSurface surface;
+	EGLContext context;
+	int ret = CreateWorkerContext(index, &surface, &context);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (ret < 0) m_StartFailed++;
+		m_Starting--;
+		m_DoneCond.notify_all();
+	}
+	if (ret < 0) return;
+
+	while (true)
+	{
+		GlTask *task;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			while (!m_Stop && m_Tasks.empty()) m_WakeCond.wait(lock);
+			//退出前把已提交的任务做完, 避免 Wait 永远等不到
+			if (m_Tasks.empty()) break;
+			task = m_Tasks.front();
+			m_Tasks.pop_front();
+		}
+
+		uint64_t start = now_us();
+		int result = task->run(m_Display, task->opaque);
+
+		//fence 必须 flush 出去, 其它 context 才能等到它
+		EGLSyncKHR sync = EGL_NO_SYNC_KHR;
+		if (m_CreateSync) sync = m_CreateSync(m_Display, EGL_SYNC_FENCE_KHR, NULL);
+		if (sync != EGL_NO_SYNC_KHR)
+			glFlush();
+		else
+			glFinish();
+		uint64_t run_us = now_us() - start;
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		task->result = result;
+		task->sync = sync;
+		task->run_us = run_us;
+		task->done = true;
+		m_Stats.tasks++;
+		m_Stats.run_us += run_us;
+		m_DoneCond.notify_all();
+	}
+
+	eglMakeCurrent(m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(m_Display, context);
+	if (surface != EGL_NO_SURFACE) eglDestroySurface(m_Display, surface);
+	eglReleaseThread();
+}
+
+int GlWorkerPool::Submit(GlTask *task)
+{
+	if (!task || !task->run) return -1;
+	task->result = -1;
+	task->done = false;
+	task->sync = EGL_NO_SYNC_KHR;
+	task->run_us = 0;
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Workers.empty() || m_Stop) return -1;
+	m_Tasks.push_back(task);
+	m_WakeCond.notify_one();
+	return 0;
+}
+
+int GlWorkerPool::Wait(GlTask *task)
+{
+	uint64_t start = now_us();
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		while (!task->done) m_DoneCond.wait(lock);
+	}
+
+	//有 EGL_KHR_wait_sync 时让渲染 context 的 GPU 命令流等 fence, CPU 直接返回
+	bool server_wait = false;
+	if (task->sync != EGL_NO_SYNC_KHR)
+	{
+		if (m_WaitSync && m_WaitSync(m_Display, task->sync, 0) == EGL_TRUE)
+			server_wait = true;
+		else
+			m_ClientWaitSync(m_Display, task->sync, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+		m_DestroySync(m_Display, task->sync);
+		task->sync = EGL_NO_SYNC_KHR;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Stats.wait_us += now_us() - start;
+	if (server_wait) m_Stats.server_waits++;
+	return task->result;
+}
+
+GlWorkerPoolStats GlWorkerPool::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+void GlWorkerPool::DumpStats()
+{
+	GlWorkerPoolStats stats = GetStats();
+	uint64_t n = stats.tasks ? stats.tasks : 1;
+	LOGCATE("GlWorkerPool::DumpStats threads=%d tasks=%llu run avg=%.1fus, render wait avg=%.1fus, server waits=%llu",
+			GetThreadCount(), (unsigned long long) stats.tasks, (double) stats.run_us / n,
+			(double) stats.wait_us / n, (unsigned long long) stats.server_waits);
+}
@@ -0,0 +1,104 @@
+//
+// GlWorkerPool.h
+//
+
+#ifndef DRMDEMO_GL_WORKER_POOL_H
+#define DRMDEMO_GL_WORKER_POOL_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define GL_WORKER_MAX_THREADS 8
+
+//在工作线程执行, 该线程的共享 context 已经 current
+typedef int (*GlTaskFunc)(EGLDisplay dpy, void *opaque);
+
+/*
+ * 一次提交给工作线程的 GL 任务, 由调用方持有, Wait 返回前不能释放.
+ * 任务结束后工作线程插入 fence 并 glFlush, Wait 在渲染 context 上等这个 fence,
+ * 之后任务创建/写入的纹理才能在渲染 context 里使用.
+ */
+struct GlTask
+{
+	GlTaskFunc run;
+	void *opaque;
+	int result;             //run 的返回值, Wait 之后有效
+
+	//以下由 pool 填写
+	bool done;
+	EGLSyncKHR sync;
+	uint64_t run_us;
+};
+
+struct GlWorkerPoolStats
+{
+	uint64_t tasks;
+	uint64_t run_us;            //工作线程上的执行时间总和
+	uint64_t wait_us;           //Wait 在渲染线程上阻塞的时间总和(CPU 等任务 + 等 fence)
+	uint64_t server_waits;      //用 eglWaitSyncKHR 让 GPU 等, 渲染线程不阻塞的次数
+};
+
+/*
+ * 与渲染 context 共享对象的 GL 工作线程, 用来把 dma-buf 导入(eglCreateImageKHR + 绑定纹理)
+ * 等耗时的 GL 准备工作从渲染线程挪出去并行做.
+ * 共享的只有纹理/buffer/shader 这类对象, FBO/VAO 是容器对象不共享, 任务里不要创建;
+ * 需要 FBO 的 buffer 仍在渲染线程导入.
+ * Init/Destroy/Wait 在渲染线程调用, Submit 可在任意线程调用.
+ */
+class GlWorkerPool
+{
+public:
+	GlWorkerPool();
+	~GlWorkerPool();
+
+	//share_context 为渲染线程当前的 context, 返回 0 成功
+	int Init(EGLDisplay dpy, EGLContext share_context, int threads);
+	void Destroy();
+
+	int GetThreadCount() const { return (int) m_Workers.size(); }
+
+	int Submit(GlTask *task);
+
+	//等任务完成并把它的 fence 插入当前 context 的命令流, 返回任务结果
+	int Wait(GlTask *task);
+
+	GlWorkerPoolStats GetStats();
+	void DumpStats();
+
+private:
+	GlWorkerPool(const GlWorkerPool &);
+	GlWorkerPool &operator=(const GlWorkerPool &);
+
+	void WorkerLoop(int index);
+	int CreateWorkerContext(int index, EGLSurface *surface, EGLContext *context);
+
+	EGLDisplay m_Display;
+	EGLContext m_ShareContext;
+	EGLConfig m_Config;
+	bool m_Surfaceless;
+	std::vector<std::thread> m_Workers;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WakeCond;
+	std::condition_variable m_DoneCond;
+	std::deque<GlTask *> m_Tasks;
+	int m_Starting;                     //还在创建 context 的工作线程数
+	int m_StartFailed;
+	bool m_Stop;
+
+	PFNEGLCREATESYNCKHRPROC m_CreateSync;
+	PFNEGLDESTROYSYNCKHRPROC m_DestroySync;
+	PFNEGLCLIENTWAITSYNCKHRPROC m_ClientWaitSync;
+	PFNEGLWAITSYNCKHRPROC m_WaitSync;   //EGL_KHR_wait_sync, 没有时退回 CPU 等待
+
+	GlWorkerPoolStats m_Stats;
+};
+
+#endif //DRMDEMO_GL_WORKER_POOL_H
@@ -0,0 +1,385 @@
+//
+// GpuScaler.cpp
+//
+
+#include "GpuScaler.h"
+#include "EglImageCache.h"
+#include "utils/GLUtils.h"
+#include "utils/LogUtil.h"
+
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <time.h>
+
+static const char kScalerVertexShader[] =
+		"#version 310 es \n"
+		"layout(location = 0) in vec2 vPosition;\n"
+		"layout(location = 1) in vec2 vTexCoords;\n"
+		"out vec2 texCoords;\n"
+		"void main() {\n"
+		"    texCoords = vTexCoords;\n"
+		"    gl_Position = vec4(vPosition, 0.0, 1.0);\n"
+		"}\n";
+
+static const char kScalerFragmentHeader[] =
+		"#version 310 es \n"
+		"#extension GL_OES_EGL_image_external : require \n"
+		"#extension GL_EXT_YUV_target : require \n"
+		"precision highp float;\n"
+		"yuvCscStandardEXT conv_standard = itu_601;\n"
+		"uniform vec2 srcSize;\n"       //源的像素尺寸
+		"uniform vec2 dir;\n"           //(1, 0) 水平 pass, (0, 1) 垂直 pass
+		"uniform float scale;\n"        //这一方向上 源尺寸 / 目标尺寸
+		"uniform int radius;\n"         //单侧 tap 数
+		"in vec2 texCoords;\n"
+		"out vec4 FragColor;\n";
+
+//沿 dir 方向以目标像素中心为中心, 按展宽后的核对源的像素中心逐个加权; 源用 GL_NEAREST 采样
+static const char kScalerKernelMain[] =
+		"void main() {\n"
+		"   float s = max(scale, 1.0);\n"
+		"   vec2 pos = texCoords * srcSize;\n"
+		"   float center = dot(pos, dir) - 0.5;\n"
+		"   float base = floor(center);\n"
+		"   vec3 sum = vec3(0.0);\n"
+		"   float wsum = 0.0;\n"
+		"   for (int i = 1 - radius; i <= radius; i++) {\n"
+		"       float t = base + float(i);\n"
+		"       float w = kernel((t - center) / s);\n"
+		"       vec2 p = pos * (vec2(1.0) - dir) + dir * (t + 0.5);\n"
+		"       sum += w * fetch(p / srcSize);\n"
+		"       wsum += w;\n"
+		"   }\n"
+		"   FragColor = vec4(sum / wsum, 1.0);\n"
+		"}\n";
+
+static const char kBicubicKernel[] =
+		"float kernel(float x) {\n"     //Catmull-Rom, a = -0.5
+		"   x = abs(x);\n"
+		"   if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;\n"
+		"   if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;\n"
+		"   return 0.0;\n"
+		"}\n";
+
+static const char kLanczosKernel[] =
+		"float kernel(float x) {\n"     //Lanczos3
+		"   x = abs(x);\n"
+		"   if (x < 1e-5) return 1.0;\n"
+		"   if (x >= 3.0) return 0.0;\n"
+		"   float px = 3.14159265 * x;\n"
+		"   return 3.0 * sin(px) * sin(px / 3.0) / (px * px);\n"
+		"}\n";
+
+static uint64_t now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+GpuScaler::GpuScaler()
+{
+	m_Vao = 0;
+	m_Vbo = 0;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+GpuScaler::~GpuScaler()
+{
+	if (m_Vao || !m_Levels.empty() || !m_Temps.empty())
+	{
+		LOGCATE("GpuScaler::~GpuScaler GL objects not destroyed");
+	}
+}
+
+int GpuScaler::Init()
+{
+	if (m_Vao) return 0;
+
+	//(x0,y0) (x0,y1) (x1,y1) (x1,y0), 纹理坐标 v 与 NDC y 同向, 与 QuadGeometry 一致
+	static const GLfloat quad[] = {
+			-1.0f, -1.0f, 0.0f, 0.0f,
+			-1.0f,  1.0f, 0.0f, 1.0f,
+			 1.0f,  1.0f, 1.0f, 1.0f,
+			 1.0f, -1.0f, 1.0f, 0.0f,
+	};
+	glGenVertexArrays(1, &m_Vao);
+	glGenBuffers(1, &m_Vbo);
+	glBindVertexArray(m_Vao);
+	glBindBuffer(GL_ARRAY_BUFFER, m_Vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const void *) 0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const void *) (2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(1);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return 0;
+}
+
+void GpuScaler::Destroy()
+{
+	for (std::map<int, Program>::iterator it = m_Programs.begin(); it != m_Programs.end(); ++it)
+	{
+		GLUtils::DeleteProgram(it->second.program);
+	}
+	m_Programs.clear();
+	for (size_t i = 0; i < m_Levels.size(); i++)
+	{
+		DestroySurface(&m_Levels[i]);
+	}
+	m_Levels.clear();
+	for (std::map<uint64_t, Surface>::iterator it = m_Temps.begin(); it != m_Temps.end(); ++it)
+	{
+		DestroySurface(&it->second);
+	}
+	m_Temps.clear();
+	if (m_Vao) glDeleteVertexArrays(1, &m_Vao);
+	if (m_Vbo) glDeleteBuffers(1, &m_Vbo);
+	m_Vao = m_Vbo = 0;
+}
+
+const char *GpuScaler::GetFilterName(GpuScalerFilter filter)
+{
+	switch (filter)
+	{
+		case GPU_SCALER_BICUBIC: return "bicubic";
+		case GPU_SCALER_LANCZOS: return "lanczos3";
+		default: return "bilinear";
+	}
+}
+
+GpuScaler::Program *GpuScaler::GetProgram(SourceKind kind, PassMode mode)
+{
+	int key = kind * 4 + mode;
+	std::map<int, Program>::iterator it = m_Programs.find(key);
+	if (it != m_Programs.end())
+		return &it->second;
+
+	//中间纹理里存的已经是 YUV, 只有 RGB 外部纹理需要在第一次读取时转换
+	std::string src = kScalerFragmentHeader;
+	if (kind == SOURCE_TEXTURE_2D)
+		src += "uniform highp sampler2D srcTexture;\n";
+	else
+		src += "uniform __samplerExternal2DY2YEXT srcTexture;\n";
+	if (kind == SOURCE_EXTERNAL_RGB)
+		src += "vec3 fetch(vec2 uv) { return rgb_2_yuv(texture(srcTexture, uv).xyz, conv_standard); }\n";
+	else
+		src += "vec3 fetch(vec2 uv) { return texture(srcTexture, uv).xyz; }\n";
+
+	if (mode == PASS_COPY)
+	{
+		src += "void main() {\n"
+			   "   FragColor = vec4(fetch(texCoords), 1.0);\n"
+			   "}\n";
+	}
+	else
+	{
+		src += mode == PASS_BICUBIC ? kBicubicKernel : kLanczosKernel;
+		src += kScalerKernelMain;
+	}
+
+	Program prog;
+	prog.program = GLUtils::CreateProgram(kScalerVertexShader, src.c_str());
+	if (!prog.program)
+	{
+		LOGCATE("GpuScaler::GetProgram create program failed, kind=%d mode=%d", kind, mode);
+		return NULL;
+	}
+	prog.src_size_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("srcSize"));
+	prog.dir_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("dir"));
+	prog.scale_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("scale"));
+	prog.radius_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("radius"));
+
+	glUseProgram(prog.program);
+	glUniform1i(GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("srcTexture")), 0);
+
+	return &(m_Programs[key] = prog);
+}
+
+int GpuScaler::CreateSurface(int w, int h, Surface *surface)
+{
+	surface->w = w;
+	surface->h = h;
+	glGenTextures(1, &surface->texture_id);
+	glBindTexture(GL_TEXTURE_2D, surface->texture_id);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &surface->fbo_id);
+	glBindFramebuffer(GL_FRAMEBUFFER, surface->fbo_id);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, surface->texture_id, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		LOGCATE("GpuScaler::CreateSurface %dx%d fbo incomplete", w, h);
+		DestroySurface(surface);
+		return -1;
+	}
+	return 0;
+}
+
+void GpuScaler::DestroySurface(Surface *surface)
+{
+	if (surface->fbo_id) glDeleteFramebuffers(1, &surface->fbo_id);
+	if (surface->texture_id) glDeleteTextures(1, &surface->texture_id);
+	surface->fbo_id = 0;
+	surface->texture_id = 0;
+}
+
+GpuScaler::Surface *GpuScaler::GetTemp(int w, int h)
+{
+	uint64_t key = ((uint64_t) w << 32) | (uint32_t) h;
+	std::map<uint64_t, Surface>::iterator it = m_Temps.find(key);
+	if (it != m_Temps.end())
+		return &it->second;
+
+	Surface surface;
+	if (CreateSurface(w, h, &surface) < 0) return NULL;
+	return &(m_Temps[key] = surface);
+}
+
+//逐级 2x2 box 抽取出 levels 级, 源尺寸变化时重建
+int GpuScaler::BuildPyramid(const GpuScalerSource &src, int levels)
+{
+	int w = src.w, h = src.h;
+	for (int i = 0; i < levels; i++)
+	{
+		w = std::max(w / 2, 1);
+		h = std::max(h / 2, 1);
+		if (i < (int) m_Levels.size() && (m_Levels[i].w != w || m_Levels[i].h != h))
+		{
+			for (size_t k = i; k < m_Levels.size(); k++) DestroySurface(&m_Levels[k]);
+			m_Levels.resize(i);
+		}
+		if (i >= (int) m_Levels.size())
+		{
+			Surface level;
+			if (CreateSurface(w, h, &level) < 0) return -1;
+			m_Levels.push_back(level);
+		}
+
+		//目标像素中心正好落在上一级 2x2 块的中点, 双线性采样一次即 box 平均
+		if (i == 0)
+			DrawPass(src.is_yuv ? SOURCE_EXTERNAL_YUV : SOURCE_EXTERNAL_RGB, src.texture_id, src.w, src.h,
+					 PASS_COPY, 0, m_Levels[0].fbo_id, w, h);
+		else
+			DrawPass(SOURCE_TEXTURE_2D, m_Levels[i - 1].texture_id, m_Levels[i - 1].w, m_Levels[i - 1].h,
+					 PASS_COPY, 0, m_Levels[i].fbo_id, w, h);
+		m_Stats.pyramid_passes++;
+	}
+	return 0;
+}
+
+void GpuScaler::DrawPass(SourceKind kind, GLuint texture, int src_w, int src_h, PassMode mode, int dir,
+						 GLuint fbo, int dst_w, int dst_h)
+{
+	Program *prog = GetProgram(kind, mode);
+	if (!prog) return;
+
+	GLenum target = kind == SOURCE_TEXTURE_2D ? GL_TEXTURE_2D : GL_TEXTURE_EXTERNAL_OES;
+	GLint filter = mode == PASS_COPY ? GL_LINEAR : GL_NEAREST;
+	float scale = dir == 0 ? (float) src_w / dst_w : (float) src_h / dst_h;
+	float support = mode == PASS_LANCZOS ? 3.0f : 2.0f;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, dst_w, dst_h);
+	glUseProgram(prog->program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(target, texture);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, filter);
+	glUniform2f(prog->src_size_loc, (float) src_w, (float) src_h);
+	glUniform2f(prog->dir_loc, dir == 0 ? 1.0f : 0.0f, dir == 0 ? 0.0f : 1.0f);
+	glUniform1f(prog->scale_loc, scale);
+	glUniform1i(prog->radius_loc, (int) ceilf(support * std::max(scale, 1.0f)));
+
+	glBindVertexArray(m_Vao);
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	glBindVertexArray(0);
+	m_Stats.passes++;
+}
+
+int GpuScaler::Scale(const GpuScalerSource &src, const GpuScalerOutput *outputs, int count)
+{
+	if (!m_Vao || !src.texture_id || src.w <= 0 || src.h <= 0 || count <= 0 || count > GPU_SCALER_MAX_OUTPUTS)
+		return -1;
+	uint64_t start = now_us();
+
+	//每路输出从尺寸不小于自己的最小一级开始, 剩余缩小倍数至少有一个方向 < 2
+	int levels[GPU_SCALER_MAX_OUTPUTS];
+	int max_level = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const GpuScalerOutput &out = outputs[i];
+		if (out.w <= 0 || out.h <= 0) return -1;
+		int level = 0;
+		while (level < GPU_SCALER_MAX_LEVELS && (src.w >> (level + 1)) >= out.w && (src.h >> (level + 1)) >= out.h)
+			level++;
+		levels[i] = level;
+		max_level = std::max(max_level, level);
+	}
+	int ret = max_level > 0 ? BuildPyramid(src, max_level) : 0;
+	for (int i = 0; ret == 0 && i < count; i++)
+	{
+		const GpuScalerOutput &out = outputs[i];
+		SourceKind kind = src.is_yuv ? SOURCE_EXTERNAL_YUV : SOURCE_EXTERNAL_RGB;
+		GLuint texture = src.texture_id;
+		int lw = src.w, lh = src.h;
+		if (levels[i] > 0)
+		{
+			const Surface &level = m_Levels[levels[i] - 1];
+			kind = SOURCE_TEXTURE_2D;
+			texture = level.texture_id;
+			lw = level.w;
+			lh = level.h;
+		}
+
+		bool horizontal = lw != out.w;
+		bool vertical = lh != out.h;
+		if (out.filter == GPU_SCALER_BILINEAR || (!horizontal && !vertical))
+		{
+			DrawPass(kind, texture, lw, lh, PASS_COPY, 0, out.fbo_id, out.w, out.h);
+			continue;
+		}
+
+		PassMode mode = out.filter == GPU_SCALER_LANCZOS ? PASS_LANCZOS : PASS_BICUBIC;
+		if (horizontal && vertical)
+		{
+			Surface *temp = GetTemp(out.w, lh);
+			if (!temp)
+			{
+				ret = -1;
+				continue;
+			}
+			DrawPass(kind, texture, lw, lh, mode, 0, temp->fbo_id, out.w, lh);
+			DrawPass(SOURCE_TEXTURE_2D, temp->texture_id, out.w, lh, mode, 1, out.fbo_id, out.w, out.h);
+		}
+		else
+		{
+			DrawPass(kind, texture, lw, lh, mode, horizontal ? 0 : 1, out.fbo_id, out.w, out.h);
+		}
+	}
+
+	//源纹理与 Compositor/MosaicCompositor 共享, 各 pass 改过的 filter 恢复成缓存的默认值
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, src.texture_id);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, EGL_IMAGE_CACHE_FILTER);
+	glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, EGL_IMAGE_CACHE_FILTER);
+
+	m_Stats.frames++;
+	m_Stats.submit_us += now_us() - start;
+	GLUtils::CheckGLError("GpuScaler::Scale");
+	return ret;
+}
+
+void GpuScaler::DumpStats() const
+{
+	uint64_t n = m_Stats.frames ? m_Stats.frames : 1;
+	LOGCATE("GpuScaler::DumpStats frames=%llu passes=%llu pyramid_passes=%llu levels=%zu temps=%zu submit avg=%.1fus",
+			(unsigned long long) m_Stats.frames, (unsigned long long) m_Stats.passes,
+			(unsigned long long) m_Stats.pyramid_passes, m_Levels.size(), m_Temps.size(),
+			(double) m_Stats.submit_us / n);
+}
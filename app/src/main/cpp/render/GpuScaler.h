@@ -0,0 +1,121 @@
+//
+// GpuScaler.h
+//
+
+#ifndef DRMDEMO_GPU_SCALER_H
+#define DRMDEMO_GPU_SCALER_H
+
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#define GPU_SCALER_MAX_LEVELS   6       //2x 抽取金字塔最多 6 级, 即 64 倍
+#define GPU_SCALER_MAX_OUTPUTS  8
+
+enum GpuScalerFilter
+{
+	GPU_SCALER_BILINEAR = 0,    //单 pass, 硬件双线性
+	GPU_SCALER_BICUBIC,         //可分离 Catmull-Rom, 水平/垂直各一个 pass
+	GPU_SCALER_LANCZOS,         //可分离 Lanczos3, 水平/垂直各一个 pass
+};
+
+struct GpuScalerSource
+{
+	GLuint texture_id;          //GL_TEXTURE_EXTERNAL_OES
+	int w;
+	int h;
+	int is_yuv;
+};
+
+//输出一般是以 need_fbo 导入的 NV12 dma-buf, 缩放结果直接写进去交给编码器
+struct GpuScalerOutput
+{
+	GLuint fbo_id;
+	int w;
+	int h;
+	GpuScalerFilter filter;
+};
+
+struct GpuScalerStats
+{
+	uint64_t frames;
+	uint64_t passes;
+	uint64_t pyramid_passes;
+	uint64_t submit_us;         //CPU 提交耗时累计
+};
+
+/*
+ * 把一路源缩放到若干路不同分辨率的输出(如 4K 主码流 -> 1080p/720p/CIF 子码流).
+ * 外部纹理没有 mipmap, 缩小倍数超过 2 时先用 2x2 box 逐级抽取出一个金字塔(各输出共用, 源只读一次),
+ * 每路输出从不小于自己的最小一级出发, 剩余倍数 < 2, 再按所选滤波器一次(双线性)或两次(可分离核)绘制.
+ * 核的支撑按缩小倍数展宽(多 tap), 避免剩余倍数内的混叠.
+ * 中间结果为 RGBA8 纹理, 存放 YUV 值; 需在 GL 线程调用.
+ */
+class GpuScaler
+{
+public:
+	GpuScaler();
+	~GpuScaler();
+
+	int Init();
+	void Destroy();
+
+	int Scale(const GpuScalerSource &src, const GpuScalerOutput *outputs, int count);
+
+	GpuScalerStats GetStats() const { return m_Stats; }
+	void DumpStats() const;
+
+	static const char *GetFilterName(GpuScalerFilter filter);
+
+private:
+	enum SourceKind
+	{
+		SOURCE_EXTERNAL_YUV = 0,
+		SOURCE_EXTERNAL_RGB,
+		SOURCE_TEXTURE_2D,
+	};
+
+	enum PassMode
+	{
+		PASS_COPY = 0,              //按目标尺寸采样一次, 配合 GL_LINEAR 即双线性 / 2x2 box
+		PASS_BICUBIC,
+		PASS_LANCZOS,
+	};
+
+	struct Program
+	{
+		GLuint program;
+		GLint src_size_loc;
+		GLint dir_loc;
+		GLint scale_loc;
+		GLint radius_loc;
+	};
+
+	struct Surface
+	{
+		GLuint texture_id;
+		GLuint fbo_id;
+		int w;
+		int h;
+	};
+
+	Program *GetProgram(SourceKind kind, PassMode mode);
+	Surface *GetTemp(int w, int h);
+	int CreateSurface(int w, int h, Surface *surface);
+	void DestroySurface(Surface *surface);
+	int BuildPyramid(const GpuScalerSource &src, int levels);
+	void DrawPass(SourceKind kind, GLuint texture, int src_w, int src_h, PassMode mode, int dir,
+				  GLuint fbo, int dst_w, int dst_h);
+
+	std::map<int, Program> m_Programs;      //key: kind * 4 + mode
+	GLuint m_Vao;
+	GLuint m_Vbo;
+	std::vector<Surface> m_Levels;          //m_Levels[i] 为源的 1/2^(i+1)
+	std::map<uint64_t, Surface> m_Temps;    //可分离核水平 pass 的中间结果, key: w << 32 | h
+	GpuScalerStats m_Stats;
+};
+
+#endif //DRMDEMO_GPU_SCALER_H
@@ -0,0 +1,240 @@
+//
+// GpuTimer.cpp
+//
+
+#include "GpuTimer.h"
+#include "utils/LogUtil.h"
+
+#include <EGL/egl.h>
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+GpuTimer::GpuTimer()
+{
+	m_HasQuery = false;
+	m_ActivePass = -1;
+	m_ActiveQuery = 0;
+	m_ActiveCpuStart = 0;
+	m_Disjoints = 0;
+	m_GenQueries = NULL;
+	m_DeleteQueries = NULL;
+	m_BeginQuery = NULL;
+	m_EndQuery = NULL;
+	m_GetQueryObjectuiv = NULL;
+	m_GetQueryObjectui64v = NULL;
+}
+
+GpuTimer::~GpuTimer()
+{
+}
+
+int GpuTimer::Init()
+{
+	const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+	if (extensions && strstr(extensions, "GL_EXT_disjoint_timer_query"))
+	{
+		m_GenQueries = (PFNGLGENQUERIESEXTPROC) eglGetProcAddress("glGenQueriesEXT");
+		m_DeleteQueries = (PFNGLDELETEQUERIESEXTPROC) eglGetProcAddress("glDeleteQueriesEXT");
+		m_BeginQuery = (PFNGLBEGINQUERYEXTPROC) eglGetProcAddress("glBeginQueryEXT");
+		m_EndQuery = (PFNGLENDQUERYEXTPROC) eglGetProcAddress("glEndQueryEXT");
+		m_GetQueryObjectuiv = (PFNGLGETQUERYOBJECTUIVEXTPROC) eglGetProcAddress("glGetQueryObjectuivEXT");
+		m_GetQueryObjectui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC) eglGetProcAddress("glGetQueryObjectui64vEXT");
+		m_HasQuery = m_GenQueries && m_DeleteQueries && m_BeginQuery && m_EndQuery &&
+					 m_GetQueryObjectuiv && m_GetQueryObjectui64v;
+	}
+	LOGCATE("GpuTimer::Init gpu timer %s", m_HasQuery ? "available" : "unavailable, cpu only");
+	return 0;
+}
+
+void GpuTimer::Destroy()
+{
+	if (m_HasQuery)
+	{
+		for (size_t i = 0; i < m_Pending.size(); i++)
+		{
+			m_FreeQueries.push_back(m_Pending[i].query);
+		}
+		if (!m_FreeQueries.empty())
+			m_DeleteQueries((GLsizei) m_FreeQueries.size(), &m_FreeQueries[0]);
+	}
+	m_Pending.clear();
+	m_FreeQueries.clear();
+	m_Passes.clear();
+}
+
+int GpuTimer::FindPass(const char *name)
+{
+	for (size_t i = 0; i < m_Passes.size(); i++)
+	{
+		if (m_Passes[i].name == name) return (int) i;
+	}
+	PassSamples pass;
+	pass.name = name;
+	pass.count = 0;
+	pass.gpu_next = 0;
+	pass.cpu_next = 0;
+	m_Passes.push_back(pass);
+	return (int) m_Passes.size() - 1;
+}
+
+GLuint GpuTimer::AcquireQuery()
+{
+	if (m_FreeQueries.empty())
+	{
+		//读回太慢时丢弃最老的结果, 复用它的 query
+		if (m_Pending.size() >= GPU_TIMER_MAX_PENDING)
+		{
+			GLuint query = m_Pending.front().query;
+			m_Pending.pop_front();
+			return query;
+		}
+		GLuint query = 0;
+		m_GenQueries(1, &query);
+		return query;
+	}
+	GLuint query = m_FreeQueries.back();
+	m_FreeQueries.pop_back();
+	return query;
+}
+
+void GpuTimer::Begin(const char *name)
+{
+	if (m_ActivePass >= 0) return;
+
+	m_ActivePass = FindPass(name);
+	if (m_HasQuery)
+	{
+		Poll();
+		m_ActiveQuery = AcquireQuery();
+		m_BeginQuery(GL_TIME_ELAPSED_EXT, m_ActiveQuery);
+	}
+	m_ActiveCpuStart = now_ns();
+}
+
+void GpuTimer::End()
+{
+	if (m_ActivePass < 0) return;
+
+	PassSamples &pass = m_Passes[m_ActivePass];
+	AddSample(pass.cpu_us, &pass.cpu_next, (now_ns() - m_ActiveCpuStart) / 1000.0f);
+	pass.count++;
+
+	if (m_HasQuery)
+	{
+		m_EndQuery(GL_TIME_ELAPSED_EXT);
+		Pending pending = { m_ActiveQuery, m_ActivePass };
+		m_Pending.push_back(pending);
+		m_ActiveQuery = 0;
+	}
+	m_ActivePass = -1;
+}
+
+void GpuTimer::Poll()
+{
+	if (!m_HasQuery || m_Pending.empty()) return;
+
+	//发生 disjoint(降频/抢占等)时在飞的结果都不可信, 全部丢弃
+	GLint disjoint = 0;
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+	if (disjoint)
+	{
+		m_Disjoints++;
+		while (!m_Pending.empty())
+		{
+			m_FreeQueries.push_back(m_Pending.front().query);
+			m_Pending.pop_front();
+		}
+		return;
+	}
+
+	//query 按提交顺序完成, 遇到第一个未完成的就停
+	while (!m_Pending.empty())
+	{
+		Pending &pending = m_Pending.front();
+		GLuint available = 0;
+		m_GetQueryObjectuiv(pending.query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+		if (!available) break;
+
+		GLuint64 elapsed_ns = 0;
+		m_GetQueryObjectui64v(pending.query, GL_QUERY_RESULT_EXT, &elapsed_ns);
+		PassSamples &pass = m_Passes[pending.pass];
+		AddSample(pass.gpu_us, &pass.gpu_next, elapsed_ns / 1000.0f);
+
+		m_FreeQueries.push_back(pending.query);
+		m_Pending.pop_front();
+	}
+}
+
+void GpuTimer::AddSample(std::vector<float> &ring, size_t *next, float value)
+{
+	if (ring.size() < GPU_TIMER_MAX_SAMPLES)
+	{
+		ring.push_back(value);
+		return;
+	}
+	ring[*next] = value;
+	*next = (*next + 1) % GPU_TIMER_MAX_SAMPLES;
+}
+
+void GpuTimer::Percentiles(std::vector<float> samples, double *p50, double *p95, double *p99)
+{
+	*p50 = *p95 = *p99 = 0.0;
+	if (samples.empty()) return;
+
+	std::sort(samples.begin(), samples.end());
+	size_t last = samples.size() - 1;
+	*p50 = samples[last * 50 / 100];
+	*p95 = samples[last * 95 / 100];
+	*p99 = samples[last * 99 / 100];
+}
+
+int GpuTimer::GetStats(std::vector<GpuTimerPassStats> &out)
+{
+	Poll();
+	out.clear();
+	for (size_t i = 0; i < m_Passes.size(); i++)
+	{
+		const PassSamples &pass = m_Passes[i];
+		GpuTimerPassStats stats;
+		stats.name = pass.name.c_str();
+		stats.count = pass.count;
+		stats.gpu_samples = (int) pass.gpu_us.size();
+		Percentiles(pass.gpu_us, &stats.gpu_p50_us, &stats.gpu_p95_us, &stats.gpu_p99_us);
+		Percentiles(pass.cpu_us, &stats.cpu_p50_us, &stats.cpu_p95_us, &stats.cpu_p99_us);
+		out.push_back(stats);
+	}
+	return (int) out.size();
+}
+
+void GpuTimer::DumpStats()
+{
+	std::vector<GpuTimerPassStats> stats;
+	GetStats(stats);
+	for (size_t i = 0; i < stats.size(); i++)
+	{
+		const GpuTimerPassStats &s = stats[i];
+		if (s.gpu_samples > 0)
+		{
+			LOGCATE("GpuTimer %-16s n=%llu gpu p50/p95/p99=%.1f/%.1f/%.1f us cpu submit p50/p95/p99=%.1f/%.1f/%.1f us",
+					s.name, (unsigned long long) s.count, s.gpu_p50_us, s.gpu_p95_us, s.gpu_p99_us,
+					s.cpu_p50_us, s.cpu_p95_us, s.cpu_p99_us);
+		}
+		else
+		{
+			LOGCATE("GpuTimer %-16s n=%llu gpu n/a cpu submit p50/p95/p99=%.1f/%.1f/%.1f us",
+					s.name, (unsigned long long) s.count, s.cpu_p50_us, s.cpu_p95_us, s.cpu_p99_us);
+		}
+	}
+	if (m_Disjoints)
+	{
+		LOGCATE("GpuTimer %llu disjoint events, affected samples dropped", (unsigned long long) m_Disjoints);
+	}
+}
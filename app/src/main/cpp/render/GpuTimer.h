@@ -0,0 +1,120 @@
+//
+// GpuTimer.h
+//
+
+#ifndef DRMDEMO_GPU_TIMER_H
+#define DRMDEMO_GPU_TIMER_H
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+//置 0 时 GPU_TIMER_SCOPE 展开为空, 绘制路径上不留任何计时代码
+#ifndef GPU_TIMER_ENABLE
+#define GPU_TIMER_ENABLE 1
+#endif
+
+#define GPU_TIMER_MAX_SAMPLES 1024  //每个 pass 保留最近的样本数
+#define GPU_TIMER_MAX_PENDING 64    //未读回的 query 上限, 超过时丢弃最老的
+
+struct GpuTimerPassStats
+{
+	const char *name;
+	uint64_t count;
+	int gpu_samples;        //为 0 表示没有 GPU 计时(扩展不可用)
+	double gpu_p50_us, gpu_p95_us, gpu_p99_us;
+	double cpu_p50_us, cpu_p95_us, cpu_p99_us;
+};
+
+/*
+ * 按 pass 统计耗时: GPU 时间来自 GL_EXT_disjoint_timer_query, 结果在后续几帧异步读回, 不阻塞;
+ * CPU 时间为该 pass 的命令提交耗时. 扩展不可用(如 llvmpipe)时只统计 CPU 时间.
+ * 同一时刻只能有一个 pass 在计时, Begin/End 不能嵌套. 需在 GL 线程调用.
+ */
+class GpuTimer
+{
+public:
+	GpuTimer();
+	~GpuTimer();
+
+	int Init();
+	void Destroy();
+
+	bool HasGpuTimer() const { return m_HasQuery; }
+
+	void Begin(const char *name);
+	void End();
+
+	//读回已完成的 query, Begin 时也会顺带调用
+	void Poll();
+
+	int GetStats(std::vector<GpuTimerPassStats> &out);
+	void DumpStats();
+
+private:
+	struct PassSamples
+	{
+		std::string name;
+		uint64_t count;
+		std::vector<float> gpu_us;      //环形, 满后覆盖最老的
+		std::vector<float> cpu_us;
+		size_t gpu_next;
+		size_t cpu_next;
+	};
+
+	struct Pending
+	{
+		GLuint query;
+		int pass;
+	};
+
+	int FindPass(const char *name);
+	static void AddSample(std::vector<float> &ring, size_t *next, float value);
+	static void Percentiles(std::vector<float> samples, double *p50, double *p95, double *p99);
+	GLuint AcquireQuery();
+
+	bool m_HasQuery;
+	std::vector<PassSamples> m_Passes;
+	std::deque<Pending> m_Pending;
+	std::vector<GLuint> m_FreeQueries;
+	int m_ActivePass;
+	GLuint m_ActiveQuery;
+	uint64_t m_ActiveCpuStart;
+	uint64_t m_Disjoints;
+
+	PFNGLGENQUERIESEXTPROC m_GenQueries;
+	PFNGLDELETEQUERIESEXTPROC m_DeleteQueries;
+	PFNGLBEGINQUERYEXTPROC m_BeginQuery;
+	PFNGLENDQUERYEXTPROC m_EndQuery;
+	PFNGLGETQUERYOBJECTUIVEXTPROC m_GetQueryObjectuiv;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC m_GetQueryObjectui64v;
+};
+
+//在作用域内对一个 pass 计时, timer 可以为空
+class GpuTimerScope
+{
+public:
+	GpuTimerScope(GpuTimer *timer, const char *name) : m_Timer(timer)
+	{
+		if (m_Timer) m_Timer->Begin(name);
+	}
+	~GpuTimerScope()
+	{
+		if (m_Timer) m_Timer->End();
+	}
+
+private:
+	GpuTimer *m_Timer;
+};
+
+#if GPU_TIMER_ENABLE
+#define GPU_TIMER_SCOPE(timer, name) GpuTimerScope _gpu_timer_scope(timer, name)
+#else
+#define GPU_TIMER_SCOPE(timer, name) do {} while (0)
+#endif
+
+#endif //DRMDEMO_GPU_TIMER_H
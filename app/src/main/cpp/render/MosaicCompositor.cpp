@@ -0,0 +1,462 @@
+//
+// MosaicCompositor.cpp
+//
+
+#include "MosaicCompositor.h"
+#include "EglImageCache.h"
+#include "utils/GLUtils.h"
+#include "utils/LogUtil.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <time.h>
+
+#define MOSAIC_VERTEX_FLOATS 8      //position.xy, tile uv, osd uv, (下标, osd alpha)
+
+static const char kMosaicVertexShader[] =
+		"#version 310 es \n"
+		"layout(location = 0) in vec2 vPosition;\n"     //MOSAIC_ATTRIB_POSITION
+		"layout(location = 1) in vec2 vTileCoords;\n"   //MOSAIC_ATTRIB_TILE_COORD
+		"layout(location = 2) in vec2 vOsdCoords;\n"    //MOSAIC_ATTRIB_OSD_COORD
+		"layout(location = 3) in vec2 vTileInfo;\n"     //MOSAIC_ATTRIB_TILE_INFO
+		"out vec2 tileCoords;\n"
+		"out vec2 osdCoords;\n"
+		"flat out int tileIndex;\n"
+		"flat out float osdAlpha;\n"
+		"void main() {\n"
+		"    tileCoords = vTileCoords;\n"
+		"    osdCoords = vOsdCoords;\n"
+		"    tileIndex = int(vTileInfo.x + 0.5);\n"
+		"    osdAlpha = vTileInfo.y;\n"
+		"    gl_Position = vec4(vPosition, 0.0, 1.0);\n"
+		"}\n";
+
+static const char kMosaicFragmentHeader[] =
+		"#version 310 es \n"
+		"#extension GL_OES_EGL_image_external : require \n"
+		"#extension GL_EXT_YUV_target : require \n"
+		"precision highp float;\n"
+		"yuvCscStandardEXT conv_standard = itu_601;\n"
+		"uniform __samplerExternal2DY2YEXT osdTexture;\n"
+		"in vec2 tileCoords;\n"
+		"in vec2 osdCoords;\n"
+		"flat in int tileIndex;\n"
+		"flat in float osdAlpha;\n"
+		"out vec4 FragColor;\n";
+
+static int64_t MosaicNowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+//count 格的片元着色器: 每个片元只属于一格, 按 tileIndex 分支只采样这一格的纹理.
+//外部纹理没有 mipmap, 分支内采样不受隐式导数的限制
+static std::string BuildMosaicFragmentShader(int count, uint32_t yuv_mask, int osd_is_yuv)
+{
+	std::string src = kMosaicFragmentHeader;
+	char line[256];
+
+	for (int i = 0; i < count; i++)
+	{
+		snprintf(line, sizeof(line), "uniform __samplerExternal2DY2YEXT tileTexture%d;\n", i);
+		src += line;
+	}
+	snprintf(line, sizeof(line), "uniform vec4 osdBounds[%d];\n", count);     //OSD 在 atlas 中的 uv 范围
+	src += line;
+
+	src += "void main() {\n"
+		   "   vec3 color = vec3(0.0, 0.5, 0.5);\n";
+	for (int i = 0; i < count; i++)
+	{
+		const char *sample = (yuv_mask & (1u << i)) ? "texture(tileTexture%d, tileCoords).xyz"
+													: "rgb_2_yuv(texture(tileTexture%d, tileCoords).xyz, conv_standard)";
+		std::string fmt = std::string(i == 0 ? "   if" : "   else if") + " (tileIndex == %d) color = " + sample + ";\n";
+		snprintf(line, sizeof(line), fmt.c_str(), i, i);
+		src += line;
+	}
+	src += "   vec4 b = osdBounds[tileIndex];\n"
+		   "   vec4 osd = texture(osdTexture, osdCoords);\n"
+		   "   float a = osd.a * osdAlpha * step(b.x, osdCoords.x) * step(osdCoords.x, b.z)"
+		   " * step(b.y, osdCoords.y) * step(osdCoords.y, b.w);\n";
+	if (osd_is_yuv)
+		src += "   color = mix(color, osd.xyz, a);\n";
+	else
+		src += "   color = mix(color, rgb_2_yuv(osd.xyz, conv_standard), a);\n";
+	src += "   FragColor = vec4(color, 1.0);\n"
+		   "}\n";
+	return src;
+}
+
+MosaicCompositor::MosaicCompositor()
+{
+	m_TilesPerDraw = 0;
+	m_Vao = 0;
+	m_Vbo = 0;
+	m_Ibo = 0;
+	m_Valid = false;
+	memset(&m_LastTarget, 0, sizeof(m_LastTarget));
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+MosaicCompositor::~MosaicCompositor()
+{
+	if (m_Vao || !m_Programs.empty())
+	{
+		LOGCATE("MosaicCompositor::~MosaicCompositor GL objects not destroyed");
+	}
+}
+
+int MosaicCompositor::Init(int max_tiles_per_draw)
+{
+	if (m_Vao) return 0;
+	if (max_tiles_per_draw <= 0)
+	{
+		GLint units = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+		max_tiles_per_draw = units - 1;
+	}
+	m_TilesPerDraw = std::max(1, std::min(max_tiles_per_draw, MOSAIC_MAX_TILES_PER_DRAW));
+
+	std::vector<GLushort> indices(MOSAIC_MAX_TILES * 6);
+	for (int i = 0; i < MOSAIC_MAX_TILES; i++)
+	{
+		GLushort base = (GLushort) (i * 4);
+		GLushort quad[6] = { base, (GLushort) (base + 1), (GLushort) (base + 2), base, (GLushort) (base + 2), (GLushort) (base + 3) };
+		memcpy(&indices[i * 6], quad, sizeof(quad));
+	}
+
+	glGenVertexArrays(1, &m_Vao);
+	glGenBuffers(1, &m_Vbo);
+	glGenBuffers(1, &m_Ibo);
+	glBindVertexArray(m_Vao);
+
+	GLsizei stride = MOSAIC_VERTEX_FLOATS * sizeof(GLfloat);
+	glBindBuffer(GL_ARRAY_BUFFER, m_Vbo);
+	glBufferData(GL_ARRAY_BUFFER, MOSAIC_MAX_TILES * 4 * stride, NULL, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(MOSAIC_ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, stride, (const void *) 0);
+	glVertexAttribPointer(MOSAIC_ATTRIB_TILE_COORD, 2, GL_FLOAT, GL_FALSE, stride, (const void *) (2 * sizeof(GLfloat)));
+	glVertexAttribPointer(MOSAIC_ATTRIB_OSD_COORD, 2, GL_FLOAT, GL_FALSE, stride, (const void *) (4 * sizeof(GLfloat)));
+	glVertexAttribPointer(MOSAIC_ATTRIB_TILE_INFO, 2, GL_FLOAT, GL_FALSE, stride, (const void *) (6 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(MOSAIC_ATTRIB_POSITION);
+	glEnableVertexAttribArray(MOSAIC_ATTRIB_TILE_COORD);
+	glEnableVertexAttribArray(MOSAIC_ATTRIB_OSD_COORD);
+	glEnableVertexAttribArray(MOSAIC_ATTRIB_TILE_INFO);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	m_Valid = false;
+	LOGCATD("MosaicCompositor::Init tiles_per_draw=%d", m_TilesPerDraw);
+	return 0;
+}
+
+void MosaicCompositor::Destroy()
+{
+	for (std::map<uint32_t, Program>::iterator it = m_Programs.begin(); it != m_Programs.end(); ++it)
+	{
+		GLUtils::DeleteProgram(it->second.program);
+	}
+	m_Programs.clear();
+	if (m_Vao) glDeleteVertexArrays(1, &m_Vao);
+	if (m_Vbo) glDeleteBuffers(1, &m_Vbo);
+	if (m_Ibo) glDeleteBuffers(1, &m_Ibo);
+	m_Vao = m_Vbo = m_Ibo = 0;
+	m_LastTiles.clear();
+	m_Valid = false;
+}
+
+MosaicCompositor::Program *MosaicCompositor::GetProgram(int count, uint32_t yuv_mask, int osd_is_yuv)
+{
+	uint32_t key = ((osd_is_yuv ? 1u : 0u) << 31) | ((uint32_t) count << 16) | yuv_mask;
+	std::map<uint32_t, Program>::iterator it = m_Programs.find(key);
+	if (it != m_Programs.end())
+		return &it->second;
+
+	std::string fragment = BuildMosaicFragmentShader(count, yuv_mask, osd_is_yuv);
+	Program prog;
+	prog.program = GLUtils::CreateProgram(kMosaicVertexShader, fragment.c_str());
+	if (!prog.program)
+	{
+		LOGCATE("MosaicCompositor::GetProgram create program failed, count=%d yuv_mask=0x%x", count, yuv_mask);
+		return NULL;
+	}
+	prog.osd_bounds_loc = GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("osdBounds"));
+
+	//纹理单元固定: 第 i 格用 i, OSD atlas 用 count
+	glUseProgram(prog.program);
+	for (int i = 0; i < count; i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "tileTexture%d", i);
+		glUniform1i(GLUtils::GetUniformLocation(prog.program, name), i);
+	}
+	glUniform1i(GLUtils::GetUniformLocation(prog.program, GL_UNIFORM_ID("osdTexture")), count);
+
+	return &(m_Programs[key] = prog);
+}
+
+bool MosaicCompositor::TileChanged(const MosaicTile &tile, const TileState &last) const
+{
+	return tile.texture_id != last.texture_id || tile.tex_w != last.tex_w || tile.tex_h != last.tex_h ||
+		   tile.is_yuv != last.is_yuv || tile.src_x != last.src_x || tile.src_y != last.src_y ||
+		   tile.src_w != last.src_w || tile.src_h != last.src_h || tile.version != last.version ||
+		   tile.osd_version != last.osd_version || tile.dst_x != last.dst_x || tile.dst_y != last.dst_y ||
+		   tile.dst_w != last.dst_w || tile.dst_h != last.dst_h;
+}
+
+//slot 为本格在所属批次内的下标, 顶点追加到 m_Vertices
+void MosaicCompositor::AddTile(const CompositorTarget &target, const MosaicTile &tile, int slot, const MosaicOsdSource *osd)
+{
+	int x0 = std::max(tile.dst_x, 0);
+	int y0 = std::max(tile.dst_y, 0);
+	int x1 = std::min(tile.dst_x + tile.dst_w, target.w);
+	int y1 = std::min(tile.dst_y + tile.dst_h, target.h);
+
+	int src_x = tile.src_x, src_y = tile.src_y, src_w = tile.src_w, src_h = tile.src_h;
+	if (src_w <= 0 || src_h <= 0)
+	{
+		src_x = src_y = 0;
+		src_w = tile.tex_w;
+		src_h = tile.tex_h;
+	}
+	//输出像素到输入纹理坐标的线性映射: uv = p * scale + offset
+	float tsx = (float) src_w / tile.dst_w / tile.tex_w;
+	float tsy = (float) src_h / tile.dst_h / tile.tex_h;
+	float tox = (float) src_x / tile.tex_w - tile.dst_x * tsx;
+	float toy = (float) src_y / tile.tex_h - tile.dst_y * tsy;
+
+	const OsdLabel &l = tile.osd;
+	bool has_osd = osd && osd->texture_id && l.alpha > 0.0f && l.dst_w > 0 && l.dst_h > 0;
+	float osx = 0, osy = 0, oox = 0, ooy = 0;
+	GLfloat bounds[4] = { 2.0f, 2.0f, -1.0f, -1.0f };   //空范围, 片元里 a 恒为 0
+	if (has_osd)
+	{
+		int ox = tile.dst_x + l.dst_x;
+		int oy = tile.dst_y + l.dst_y;
+		osx = (float) l.src_w / l.dst_w / osd->w;
+		osy = (float) l.src_h / l.dst_h / osd->h;
+		oox = (float) l.src_x / osd->w - ox * osx;
+		ooy = (float) l.src_y / osd->h - oy * osy;
+		bounds[0] = (float) l.src_x / osd->w;
+		bounds[1] = (float) l.src_y / osd->h;
+		bounds[2] = (float) (l.src_x + l.src_w) / osd->w;
+		bounds[3] = (float) (l.src_y + l.src_h) / osd->h;
+	}
+	m_OsdBounds.insert(m_OsdBounds.end(), bounds, bounds + 4);
+
+	//顶点顺序与 QuadGeometry 一致: (x0,y0) (x0,y1) (x1,y1) (x1,y0)
+	const int corners[4][2] = { { x0, y0 }, { x0, y1 }, { x1, y1 }, { x1, y0 } };
+	for (int i = 0; i < 4; i++)
+	{
+		float px = (float) corners[i][0];
+		float py = (float) corners[i][1];
+		GLfloat v[MOSAIC_VERTEX_FLOATS] = {
+				px / target.w * 2.0f - 1.0f, py / target.h * 2.0f - 1.0f,
+				px * tsx + tox, py * tsy + toy,
+				px * osx + oox, py * osy + ooy,
+				(float) slot, has_osd ? l.alpha : 0.0f,
+		};
+		m_Vertices.insert(m_Vertices.end(), v, v + MOSAIC_VERTEX_FLOATS);
+	}
+}
+
+int MosaicCompositor::DrawBatch(const MosaicOsdSource *osd, int first, int count)
+{
+	uint32_t yuv_mask = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (m_Dirty[first + i]->is_yuv) yuv_mask |= 1u << i;
+	}
+	Program *prog = GetProgram(count, yuv_mask, osd ? osd->is_yuv : 0);
+	if (!prog) return -1;
+
+	glUseProgram(prog->program);
+	for (int i = 0; i < count; i++)
+	{
+		//缩小时用双线性, 缓存导入的纹理默认是 NEAREST
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_EXTERNAL_OES, m_Dirty[first + i]->texture_id);
+		glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	glActiveTexture(GL_TEXTURE0 + count);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, osd ? osd->texture_id : 0);
+	glUniform4fv(prog->osd_bounds_loc, count, &m_OsdBounds[first * 4]);
+
+	glDrawElements(GL_TRIANGLES, count * 6, GL_UNSIGNED_SHORT, (const void *) (first * 6 * sizeof(GLushort)));
+	m_Stats.draws++;
+
+	//纹理对象与 Compositor/GpuScaler 共享, filter 是纹理状态, 恢复成缓存的默认值
+	for (int i = 0; i < count; i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + i);
+		glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MIN_FILTER, EGL_IMAGE_CACHE_FILTER);
+		glTexParameteri(GL_TEXTURE_EXTERNAL_OES, GL_TEXTURE_MAG_FILTER, EGL_IMAGE_CACHE_FILTER);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	return 0;
+}
+
+int MosaicCompositor::Compose(const CompositorTarget &target, const MosaicTile *tiles, int count, const MosaicOsdSource *osd)
+{
+	if (!m_Vao || count < 0 || count > MOSAIC_MAX_TILES) return -1;
+	m_Stats.frames++;
+
+	bool full = !m_Valid || (int) m_LastTiles.size() != count || target.texture_id != m_LastTarget.texture_id ||
+				target.fbo_id != m_LastTarget.fbo_id || target.w != m_LastTarget.w || target.h != m_LastTarget.h;
+	//上次画过的格 dst 变了或不再画, 旧位置露出的部分没有格会去重画, 只能整体清掉重画
+	for (int i = 0; !full && i < count; i++)
+	{
+		const MosaicTile &tile = tiles[i];
+		const TileState &last = m_LastTiles[i];
+		if (!last.texture_id) continue;
+		full = !tile.texture_id || tile.dst_x != last.dst_x || tile.dst_y != last.dst_y ||
+			   tile.dst_w != last.dst_w || tile.dst_h != last.dst_h;
+	}
+	if (full)
+	{
+		m_LastTiles.assign(count, TileState());
+		m_LastTarget = target;
+		m_Stats.full_redraws++;
+	}
+
+	//格子之间按 z 无关, 只收集需要重画的格
+	m_Dirty.clear();
+	for (int i = 0; i < count; i++)
+	{
+		const MosaicTile &tile = tiles[i];
+		if (!tile.texture_id || tile.dst_w <= 0 || tile.dst_h <= 0 || tile.tex_w <= 0 || tile.tex_h <= 0) continue;
+		if (!full && !TileChanged(tile, m_LastTiles[i]))
+		{
+			m_Stats.tiles_skipped++;
+			continue;
+		}
+		m_Dirty.push_back(&tile);
+		TileState &last = m_LastTiles[i];
+		last.texture_id = tile.texture_id;
+		last.tex_w = tile.tex_w;
+		last.tex_h = tile.tex_h;
+		last.is_yuv = tile.is_yuv;
+		last.src_x = tile.src_x;
+		last.src_y = tile.src_y;
+		last.src_w = tile.src_w;
+		last.src_h = tile.src_h;
+		last.version = tile.version;
+		last.osd_version = tile.osd_version;
+		last.dst_x = tile.dst_x;
+		last.dst_y = tile.dst_y;
+		last.dst_w = tile.dst_w;
+		last.dst_h = tile.dst_h;
+	}
+	m_Valid = true;
+
+	if (m_Dirty.empty() && !full)
+	{
+		m_Stats.idle_frames++;
+		return 0;
+	}
+
+	m_Vertices.clear();
+	m_OsdBounds.clear();
+	for (size_t i = 0; i < m_Dirty.size(); i++)
+	{
+		AddTile(target, *m_Dirty[i], (int) (i % m_TilesPerDraw), osd);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo_id);
+	glViewport(0, 0, target.w, target.h);
+	if (full)
+	{
+		//YUV 目标上 clear color 按 YUV 写入, 没有输入覆盖的区域为黑色
+		glClearColor(16.0f / 255, 0.5f, 0.5f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	if (!m_Dirty.empty())
+	{
+		glBindVertexArray(m_Vao);
+		glBindBuffer(GL_ARRAY_BUFFER, m_Vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, m_Vertices.size() * sizeof(GLfloat), &m_Vertices[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		for (size_t first = 0; first < m_Dirty.size(); first += m_TilesPerDraw)
+		{
+			int n = (int) std::min((size_t) m_TilesPerDraw, m_Dirty.size() - first);
+			if (DrawBatch(osd, (int) first, n) < 0)
+			{
+				glBindVertexArray(0);
+				m_Valid = false;
+				return -1;
+			}
+		}
+		glBindVertexArray(0);
+	}
+	m_Stats.tiles_drawn += m_Dirty.size();
+	GLUtils::CheckGLError("MosaicCompositor::Compose");
+	return (int) m_Dirty.size();
+}
+
+void MosaicCompositor::GridLayout(int count, int out_w, int out_h, MosaicTile *tiles)
+{
+	if (count <= 0) return;
+	int cols = (int) ceil(sqrt((double) count));
+	int rows = (count + cols - 1) / cols;
+	int cell_w = (out_w / cols) & ~1;
+	int cell_h = (out_h / rows) & ~1;
+	for (int i = 0; i < count; i++)
+	{
+		tiles[i].dst_x = (i % cols) * cell_w;
+		tiles[i].dst_y = (i / cols) * cell_h;
+		tiles[i].dst_w = cell_w;
+		tiles[i].dst_h = cell_h;
+	}
+}
+
+void MosaicCompositor::DumpStats() const
+{
+	uint64_t tiles = m_Stats.tiles_drawn + m_Stats.tiles_skipped;
+	LOGCATE("MosaicCompositor::DumpStats frames=%llu idle=%llu full=%llu draws=%llu tiles drawn=%llu skipped=%llu (%.1f%%)",
+			(unsigned long long) m_Stats.frames, (unsigned long long) m_Stats.idle_frames,
+			(unsigned long long) m_Stats.full_redraws, (unsigned long long) m_Stats.draws,
+			(unsigned long long) m_Stats.tiles_drawn, (unsigned long long) m_Stats.tiles_skipped,
+			tiles ? 100.0 * m_Stats.tiles_skipped / tiles : 0.0);
+}
+
+void MosaicCompositor::Benchmark(const CompositorTarget &target, const MosaicTile *tiles, int count, const MosaicOsdSource *osd, int frames)
+{
+	if (frames <= 0 || count <= 0) return;
+
+	std::vector<MosaicTile> local(tiles, tiles + count);
+	Invalidate();
+	Compose(target, &local[0], count, osd);     //shader 编译排除在计时之外
+	glFinish();
+
+	double fps[2];
+	for (int mode = 0; mode < 2; mode++)
+	{
+		int64_t t0 = MosaicNowUs();
+		for (int f = 0; f < frames; f++)
+		{
+			//mode 0: 所有输入每帧都有新帧; mode 1: 每帧只有一路更新
+			if (mode == 0)
+			{
+				for (int i = 0; i < count; i++) local[i].version++;
+			}
+			else
+			{
+				local[f % count].version++;
+			}
+			Compose(target, &local[0], count, osd);
+			glFinish();
+		}
+		fps[mode] = frames * 1000000.0 / std::max<int64_t>(MosaicNowUs() - t0, 1);
+	}
+	LOGCATE("MosaicCompositor::Benchmark %dx%d channels=%d frames=%d: all changed %.1f fps, one changed %.1f fps",
+			target.w, target.h, count, frames, fps[0], fps[1]);
+}
@@ -0,0 +1,129 @@
+//
+// MosaicCompositor.h
+//
+
+#ifndef DRMDEMO_MOSAIC_COMPOSITOR_H
+#define DRMDEMO_MOSAIC_COMPOSITOR_H
+
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include "Compositor.h"
+#include "OsdInstancedRenderer.h"
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#define MOSAIC_MAX_TILES            64
+#define MOSAIC_MAX_TILES_PER_DRAW   15      //再留一个纹理单元给 OSD atlas
+#define MOSAIC_ATTRIB_POSITION      0
+#define MOSAIC_ATTRIB_TILE_COORD    1
+#define MOSAIC_ATTRIB_OSD_COORD     2
+#define MOSAIC_ATTRIB_TILE_INFO     3       //(批次内下标, OSD alpha)
+
+//一路输入: 取 texture 中 src 区域缩放到输出的 dst 区域, 再叠加一个来自公共 atlas 的 OSD
+struct MosaicTile
+{
+	GLuint texture_id;      //GL_TEXTURE_EXTERNAL_OES
+	int tex_w;
+	int tex_h;
+	int is_yuv;
+	int src_x, src_y, src_w, src_h;
+	int dst_x, dst_y, dst_w, dst_h;
+	uint64_t version;       //输入帧序号, 与上次合成时相同且 OSD 未变时这一格不重画
+	OsdLabel osd;           //dst 相对本格左上角, alpha 为 0 表示没有 OSD
+	uint64_t osd_version;
+};
+
+struct MosaicOsdSource
+{
+	GLuint texture_id;      //OsdAtlas 的 page 纹理
+	int w;
+	int h;
+	int is_yuv;
+};
+
+struct MosaicCompositorStats
+{
+	uint64_t frames;
+	uint64_t idle_frames;       //没有任何一格变化, 没有提交绘制
+	uint64_t full_redraws;      //输出/布局变化后整体重画
+	uint64_t tiles_drawn;
+	uint64_t tiles_skipped;
+	uint64_t draws;
+};
+
+/*
+ * 多路拼接(NVR 画面分割): 每格是一个 quad, 带批次内的纹理下标, 片元按下标只采样本格的输入和 OSD,
+ * 一次 draw 最多画 MOSAIC_MAX_TILES_PER_DRAW 格, 16 路只需两次 draw.
+ * 输出直接写回 target, 不读背景; 各格互不重叠. 只重画输入帧号、裁剪区域或 OSD 变化的格,
+ * 其余格保留上一次的内容, 因此 target 必须是同一块持续使用的 buffer; 任一格的 dst 变化时整体重画.
+ * 绘制时临时把输入纹理改成 GL_LINEAR, 画完恢复为 EglImageCache 的默认 filter.
+ * 需在 GL 线程调用.
+ */
+class MosaicCompositor
+{
+public:
+	MosaicCompositor();
+	~MosaicCompositor();
+
+	int Init(int max_tiles_per_draw = 0);
+	void Destroy();
+
+	//返回本次重画的格数, 出错返回 -1. osd 为 NULL 时不叠加 OSD
+	int Compose(const CompositorTarget &target, const MosaicTile *tiles, int count, const MosaicOsdSource *osd);
+
+	//下一次 Compose 整体重画(外部改写过 target 内容时调用)
+	void Invalidate() { m_Valid = false; }
+
+	//按 ceil(sqrt(count)) 列的网格填写 tiles 的 dst, 格子宽高按 2 对齐(NV12 色度)
+	static void GridLayout(int count, int out_w, int out_h, MosaicTile *tiles);
+
+	MosaicCompositorStats GetStats() const { return m_Stats; }
+	void DumpStats() const;
+
+	//每帧所有格都变化 / 每帧只有一格变化, 各跑 frames 帧, 打印输出 fps
+	void Benchmark(const CompositorTarget &target, const MosaicTile *tiles, int count, const MosaicOsdSource *osd, int frames);
+
+private:
+	struct Program
+	{
+		GLuint program;
+		GLint osd_bounds_loc;
+	};
+
+	//上次合成时一格的全部输入, 任一项变化(含裁剪/数字变倍、输入分辨率或格式切换)都要重画
+	struct TileState
+	{
+		GLuint texture_id;
+		int tex_w;
+		int tex_h;
+		int is_yuv;
+		int src_x, src_y, src_w, src_h;
+		uint64_t version;
+		uint64_t osd_version;
+		int dst_x, dst_y, dst_w, dst_h;
+	};
+
+	Program *GetProgram(int count, uint32_t yuv_mask, int osd_is_yuv);
+	bool TileChanged(const MosaicTile &tile, const TileState &last) const;
+	void AddTile(const CompositorTarget &target, const MosaicTile &tile, int slot, const MosaicOsdSource *osd);
+	int DrawBatch(const MosaicOsdSource *osd, int first, int count);
+
+	int m_TilesPerDraw;
+	std::map<uint32_t, Program> m_Programs;    //key: osd_is_yuv << 31 | count << 16 | yuv_mask
+	GLuint m_Vao;
+	GLuint m_Vbo;
+	GLuint m_Ibo;
+	std::vector<GLfloat> m_Vertices;
+	std::vector<const MosaicTile *> m_Dirty;
+	std::vector<GLfloat> m_OsdBounds;          //每格 OSD 在 atlas 中的 uv 范围
+
+	bool m_Valid;
+	CompositorTarget m_LastTarget;
+	std::vector<TileState> m_LastTiles;
+	MosaicCompositorStats m_Stats;
+};
+
+#endif //DRMDEMO_MOSAIC_COMPOSITOR_H
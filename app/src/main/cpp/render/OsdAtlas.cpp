@@ -0,0 +1,394 @@
+//
+// OsdAtlas.cpp
+//
+
+#include "OsdAtlas.h"
+#include "buffer/DrmFormat.h"
+#include "utils/LogUtil.h"
+
+#include <drm/drm_fourcc.h>
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+#include <algorithm>
+#include <string.h>
+
+//条目之间留 1 像素, 防止线性采样时串到相邻条目
+#define OSD_ATLAS_PADDING 1
+
+static void dma_buf_sync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync;
+	sync.flags = flags;
+	//memfd 后端不支持该 ioctl, 忽略返回值
+	ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+OsdAtlas::OsdAtlas(DrmBufferPool *pool, EglImageCache *cache, uint32_t fourcc,
+				   int page_w, int page_h, int max_pages)
+{
+	m_Pool = pool;
+	m_Cache = cache;
+	m_Display = EGL_NO_DISPLAY;
+	m_Fourcc = fourcc;
+	m_Bpp = 0;
+	m_PageW = page_w;
+	m_PageH = page_h;
+	m_MaxPages = max_pages;
+	m_BytesWritten = 0;
+	m_BytesSkipped = 0;
+	m_Updates = 0;
+	m_AllocFailures = 0;
+}
+
+OsdAtlas::~OsdAtlas()
+{
+	if (!m_Pages.empty())
+	{
+		LOGCATE("OsdAtlas::~OsdAtlas %d pages not destroyed", (int) m_Pages.size());
+	}
+}
+
+int OsdAtlas::Init(EGLDisplay dpy)
+{
+	const DrmFormatInfo *info = DrmFormat::Find(m_Fourcc);
+	if (!info || info->num_planes != 1 || info->afbc == 2)
+	{
+		LOGCATE("OsdAtlas::Init unsupported format 0x%x", m_Fourcc);
+		return -1;
+	}
+	if (DrmFormat::AlignedWidth(info, m_PageW) != (uint32_t) m_PageW)
+	{
+		LOGCATE("OsdAtlas::Init page width %d not aligned for %s", m_PageW, info->name);
+		return -1;
+	}
+	m_Display = dpy;
+	m_Bpp = DrmFormat::BitsPerPixel(info) / 8;
+	return 0;
+}
+
+void OsdAtlas::Destroy()
+{
+	for (size_t i = 0; i < m_Pages.size(); i++)
+	{
+		Page &page = m_Pages[i];
+		m_Cache->Release(page.tex);
+		m_Pool->Release(page.buf);
+	}
+	m_Pages.clear();
+	m_Entries.clear();
+	m_FreeIds.clear();
+}
+
+int OsdAtlas::AddPage()
+{
+	if ((int) m_Pages.size() >= m_MaxPages) return -1;
+
+	const DrmFormatInfo *info = DrmFormat::Find(m_Fourcc);
+	DrmBuffer *buf = m_Pool->Acquire(m_PageW, m_PageH, DrmFormat::AllocBpp(info, 0), 0);
+	if (!buf)
+	{
+		LOGCATE("OsdAtlas::AddPage acquire %dx%d failed", m_PageW, m_PageH);
+		return -1;
+	}
+
+	DrmFormatLayout layout;
+	DrmFormat::GetLayout(info, m_PageW, m_PageH, &layout);
+
+	DmaBufImportDesc desc;
+	memset(&desc, 0, sizeof(desc));
+	desc.fd = buf->prime_fd;
+	desc.width = m_PageW;
+	desc.height = m_PageH;
+	desc.fourcc = m_Fourcc;
+	desc.num_planes = 1;
+	desc.pitches[0] = layout.pitches[0];
+	desc.modifiers[0] = DRM_FORMAT_MOD_INVALID;
+
+	Page page;
+	page.buf = buf;
+	page.pitch = layout.pitches[0];
+	if (m_Cache->Import(m_Display, desc, &page.tex))
+	{
+		LOGCATE("OsdAtlas::AddPage import fd=%d failed", buf->prime_fd);
+		m_Pool->Release(buf);
+		return -1;
+	}
+
+	//新 page 清零, 影子与 dma-buf 内容一致
+	page.shadow.assign((size_t) page.pitch * m_PageH, 0);
+	dma_buf_sync(buf->prime_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+	memset(buf->vir_addr, 0, page.shadow.size());
+	dma_buf_sync(buf->prime_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+
+	ResetSkyline(&page);
+	m_Pages.push_back(page);
+	LOGCATE("OsdAtlas::AddPage page %d %dx%d texture=%u", (int) m_Pages.size() - 1, m_PageW, m_PageH, page.tex.texture_id);
+	return (int) m_Pages.size() - 1;
+}
+
+void OsdAtlas::ResetSkyline(Page *page)
+{
+	SkylineNode node = { 0, 0, m_PageW };
+	page->skyline.assign(1, node);
+	page->live = 0;
+	page->used_area = 0;
+}
+
+//放在第 index 个节点起始处时的 y, 放不下返回 -1
+int OsdAtlas::SkylineFit(const Page &page, int index, int w, int h) const
+{
+	int x = page.skyline[index].x;
+	if (x + w > m_PageW) return -1;
+
+	int y = 0;
+	int width_left = w;
+	for (size_t i = index; width_left > 0; i++)
+	{
+		if (i >= page.skyline.size()) return -1;
+		y = std::max(y, page.skyline[i].y);
+		if (y + h > m_PageH) return -1;
+		width_left -= page.skyline[i].w;
+	}
+	return y;
+}
+
+//bottom-left: 取顶边最低的位置, 相同时取节点最窄的
+int OsdAtlas::SkylineInsert(Page *page, int w, int h, int *out_x, int *out_y)
+{
+	int best = -1, best_top = 0, best_w = 0, best_y = 0;
+	for (size_t i = 0; i < page->skyline.size(); i++)
+	{
+		int y = SkylineFit(*page, (int) i, w, h);
+		if (y < 0) continue;
+		int top = y + h;
+		if (best < 0 || top < best_top || (top == best_top && page->skyline[i].w < best_w))
+		{
+			best = (int) i;
+			best_top = top;
+			best_w = page->skyline[i].w;
+			best_y = y;
+		}
+	}
+	if (best < 0) return -1;
+
+	std::vector<SkylineNode> &nodes = page->skyline;
+	SkylineNode node = { nodes[best].x, best_y + h, w };
+	nodes.insert(nodes.begin() + best, node);
+
+	//裁掉被新节点覆盖的部分
+	for (size_t i = best + 1; i < nodes.size(); i++)
+	{
+		int shrink = nodes[i - 1].x + nodes[i - 1].w - nodes[i].x;
+		if (shrink <= 0) break;
+		nodes[i].x += shrink;
+		nodes[i].w -= shrink;
+		if (nodes[i].w > 0) break;
+		nodes.erase(nodes.begin() + i);
+		i--;
+	}
+
+	//合并等高的相邻节点
+	for (size_t i = 0; i + 1 < nodes.size();)
+	{
+		if (nodes[i].y == nodes[i + 1].y)
+		{
+			nodes[i].w += nodes[i + 1].w;
+			nodes.erase(nodes.begin() + i + 1);
+		}
+		else
+		{
+			i++;
+		}
+	}
+
+	*out_x = node.x;
+	*out_y = best_y;
+	return 0;
+}
+
+uint64_t OsdAtlas::SkylineArea(const Page &page)
+{
+	uint64_t area = 0;
+	for (size_t i = 0; i < page.skyline.size(); i++)
+	{
+		area += (uint64_t) page.skyline[i].w * page.skyline[i].y;
+	}
+	return area;
+}
+
+int OsdAtlas::Alloc(int w, int h)
+{
+	if (m_Bpp == 0 || w <= 0 || h <= 0) return -1;
+
+	int pw = std::min(w + OSD_ATLAS_PADDING, m_PageW);
+	int ph = std::min(h + OSD_ATLAS_PADDING, m_PageH);
+	if (w > m_PageW || h > m_PageH)
+	{
+		m_AllocFailures++;
+		return -1;
+	}
+
+	int page_index = -1, x = 0, y = 0;
+	for (size_t i = 0; i < m_Pages.size(); i++)
+	{
+		if (SkylineInsert(&m_Pages[i], pw, ph, &x, &y) == 0)
+		{
+			page_index = (int) i;
+			break;
+		}
+	}
+	if (page_index < 0)
+	{
+		page_index = AddPage();
+		if (page_index < 0 || SkylineInsert(&m_Pages[page_index], pw, ph, &x, &y))
+		{
+			m_AllocFailures++;
+			return -1;
+		}
+	}
+
+	Page &page = m_Pages[page_index];
+	page.live++;
+	page.used_area += (uint64_t) pw * ph;
+
+	Entry entry = { page_index, x, y, w, h };
+	int id;
+	if (!m_FreeIds.empty())
+	{
+		id = m_FreeIds.back();
+		m_FreeIds.pop_back();
+		m_Entries[id] = entry;
+	}
+	else
+	{
+		id = (int) m_Entries.size();
+		m_Entries.push_back(entry);
+	}
+	return id;
+}
+
+void OsdAtlas::Free(int id)
+{
+	if (id < 0 || id >= (int) m_Entries.size() || m_Entries[id].page < 0) return;
+
+	Entry &entry = m_Entries[id];
+	Page &page = m_Pages[entry.page];
+	int pw = std::min(entry.w + OSD_ATLAS_PADDING, m_PageW);
+	int ph = std::min(entry.h + OSD_ATLAS_PADDING, m_PageH);
+	page.used_area -= (uint64_t) pw * ph;
+	if (--page.live == 0)
+	{
+		ResetSkyline(&page);
+	}
+
+	entry.page = -1;
+	m_FreeIds.push_back(id);
+}
+
+int OsdAtlas::Update(int id, int x, int y, int w, int h, const void *pixels, int stride)
+{
+	if (id < 0 || id >= (int) m_Entries.size() || m_Entries[id].page < 0) return -1;
+
+	const Entry &entry = m_Entries[id];
+	if (x < 0 || y < 0 || w <= 0 || h <= 0 || x + w > entry.w || y + h > entry.h) return -1;
+
+	Page &page = m_Pages[entry.page];
+	const int row_bytes = w * m_Bpp;
+	const size_t base = (size_t) (entry.y + y) * page.pitch + (size_t) (entry.x + x) * m_Bpp;
+	const uint8_t *src = (const uint8_t *) pixels;
+	uint8_t *dst = (uint8_t *) page.buf->vir_addr;
+	int written = 0;
+	bool syncing = false;
+
+	m_Updates++;
+	for (int r = 0; r < h; r++)
+	{
+		size_t offset = base + (size_t) r * page.pitch;
+		const uint8_t *line = src + (size_t) r * stride;
+		if (memcmp(&page.shadow[offset], line, row_bytes) == 0)
+		{
+			m_BytesSkipped += row_bytes;
+			continue;
+		}
+		if (!syncing)
+		{
+			dma_buf_sync(page.buf->prime_fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE);
+			syncing = true;
+		}
+		memcpy(&page.shadow[offset], line, row_bytes);
+		memcpy(dst + offset, line, row_bytes);
+		written += row_bytes;
+	}
+	if (syncing)
+	{
+		dma_buf_sync(page.buf->prime_fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+	}
+
+	m_BytesWritten += written;
+	return written;
+}
+
+int OsdAtlas::Update(int id, const void *pixels, int stride)
+{
+	if (id < 0 || id >= (int) m_Entries.size() || m_Entries[id].page < 0) return -1;
+	return Update(id, 0, 0, m_Entries[id].w, m_Entries[id].h, pixels, stride);
+}
+
+int OsdAtlas::GetPage(int id) const
+{
+	if (id < 0 || id >= (int) m_Entries.size()) return -1;
+	return m_Entries[id].page;
+}
+
+GLuint OsdAtlas::GetPageTexture(int page) const
+{
+	if (page < 0 || page >= (int) m_Pages.size()) return 0;
+	return m_Pages[page].tex.texture_id;
+}
+
+int OsdAtlas::FillLabel(int id, int dst_x, int dst_y, float alpha, OsdLabel *label) const
+{
+	if (id < 0 || id >= (int) m_Entries.size() || m_Entries[id].page < 0) return -1;
+
+	const Entry &entry = m_Entries[id];
+	label->dst_x = dst_x;
+	label->dst_y = dst_y;
+	label->dst_w = entry.w;
+	label->dst_h = entry.h;
+	label->src_x = entry.x;
+	label->src_y = entry.y;
+	label->src_w = entry.w;
+	label->src_h = entry.h;
+	label->alpha = alpha;
+	return entry.page;
+}
+
+OsdAtlasStats OsdAtlas::GetStats() const
+{
+	OsdAtlasStats stats;
+	memset(&stats, 0, sizeof(stats));
+	stats.pages = (int) m_Pages.size();
+	stats.entries = (int) (m_Entries.size() - m_FreeIds.size());
+	for (size_t i = 0; i < m_Pages.size(); i++)
+	{
+		stats.page_area += (uint64_t) m_PageW * m_PageH;
+		stats.used_area += m_Pages[i].used_area;
+		stats.skyline_area += SkylineArea(m_Pages[i]);
+	}
+	stats.occupancy = stats.page_area ? (float) stats.used_area / stats.page_area : 0.0f;
+	stats.fragmentation = stats.skyline_area ? (float) (stats.skyline_area - stats.used_area) / stats.skyline_area : 0.0f;
+	stats.bytes_written = m_BytesWritten;
+	stats.bytes_skipped = m_BytesSkipped;
+	stats.updates = m_Updates;
+	stats.alloc_failures = m_AllocFailures;
+	return stats;
+}
+
+void OsdAtlas::DumpStats() const
+{
+	OsdAtlasStats s = GetStats();
+	LOGCATE("OsdAtlas pages=%d entries=%d occupancy=%.1f%% fragmentation=%.1f%% updates=%llu written=%llu skipped=%llu alloc_failures=%llu",
+			s.pages, s.entries, s.occupancy * 100.0f, s.fragmentation * 100.0f,
+			(unsigned long long) s.updates, (unsigned long long) s.bytes_written,
+			(unsigned long long) s.bytes_skipped, (unsigned long long) s.alloc_failures);
+}
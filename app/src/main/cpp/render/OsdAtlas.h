@@ -0,0 +1,120 @@
+//
+// OsdAtlas.h
+//
+
+#ifndef DRMDEMO_OSD_ATLAS_H
+#define DRMDEMO_OSD_ATLAS_H
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include <stdint.h>
+#include <vector>
+
+#include "buffer/DrmBufferPool.h"
+#include "EglImageCache.h"
+#include "OsdInstancedRenderer.h"
+
+struct OsdAtlasStats
+{
+	int pages;
+	int entries;
+	uint64_t page_area;         //所有 page 的像素数
+	uint64_t used_area;         //存活条目占用的像素数(含 padding)
+	uint64_t skyline_area;      //skyline 以下的像素数, 与 used_area 之差即空洞/已释放未回收的面积
+	float occupancy;            //used_area / page_area
+	float fragmentation;        //(skyline_area - used_area) / skyline_area
+	uint64_t bytes_written;     //真正写入 dma-buf 的字节数
+	uint64_t bytes_skipped;     //内容未变化而跳过的字节数
+	uint64_t updates;
+	uint64_t alloc_failures;
+};
+
+/*
+ * OSD 位图图集: 把多个小 OSD 打包进少数几张 dma-buf 纹理(page), 每个 page 用 skyline 装箱.
+ * 每个 page 保留一份 CPU 影子拷贝, Update 时逐行与影子比较, 只把变化的行写入 dma-buf,
+ * 避免读 write-combine 映射, 也避免整张重写.
+ * 条目释放后面积不会立即回收, page 内条目全部释放后整页重置.
+ *
+ * 仅支持单 plane 线性格式; Alloc(可能新建 page 并导入)/Destroy 需在 GL 线程调用.
+ */
+class OsdAtlas
+{
+public:
+	OsdAtlas(DrmBufferPool *pool, EglImageCache *cache, uint32_t fourcc,
+			 int page_w = 1024, int page_h = 512, int max_pages = 4);
+	~OsdAtlas();
+
+	int Init(EGLDisplay dpy);
+	void Destroy();
+
+	//返回条目 id, 失败返回 -1
+	int Alloc(int w, int h);
+	void Free(int id);
+
+	//用 pixels 更新条目内 (x, y, w, h) 区域, stride 为 pixels 每行字节数; 返回写入 dma-buf 的字节数
+	int Update(int id, int x, int y, int w, int h, const void *pixels, int stride);
+	int Update(int id, const void *pixels, int stride);
+
+	int GetPage(int id) const;
+	GLuint GetPageTexture(int page) const;
+	int GetPageWidth() const { return m_PageW; }
+	int GetPageHeight() const { return m_PageH; }
+
+	//把条目作为 label 贴到 (dst_x, dst_y), 大小与条目一致
+	int FillLabel(int id, int dst_x, int dst_y, float alpha, OsdLabel *label) const;
+
+	OsdAtlasStats GetStats() const;
+	void DumpStats() const;
+
+private:
+	struct SkylineNode
+	{
+		int x;
+		int y;
+		int w;
+	};
+
+	struct Page
+	{
+		DrmBuffer *buf;
+		ImportedTexture tex;
+		uint32_t pitch;
+		std::vector<uint8_t> shadow;
+		std::vector<SkylineNode> skyline;
+		int live;
+		uint64_t used_area;
+	};
+
+	struct Entry
+	{
+		int page;           //-1 表示空闲 id
+		int x, y, w, h;
+	};
+
+	int AddPage();
+	void ResetSkyline(Page *page);
+	int SkylineFit(const Page &page, int index, int w, int h) const;
+	int SkylineInsert(Page *page, int w, int h, int *out_x, int *out_y);
+	static uint64_t SkylineArea(const Page &page);
+
+	DrmBufferPool *m_Pool;
+	EglImageCache *m_Cache;
+	EGLDisplay m_Display;
+	uint32_t m_Fourcc;
+	int m_Bpp;              //每像素字节数
+	int m_PageW;
+	int m_PageH;
+	int m_MaxPages;
+
+	std::vector<Page> m_Pages;
+	std::vector<Entry> m_Entries;
+	std::vector<int> m_FreeIds;
+
+	uint64_t m_BytesWritten;
+	uint64_t m_BytesSkipped;
+	uint64_t m_Updates;
+	uint64_t m_AllocFailures;
+};
+
+#endif //DRMDEMO_OSD_ATLAS_H
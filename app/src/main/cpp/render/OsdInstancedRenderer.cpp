@@ -0,0 +1,260 @@
+//
+// OsdInstancedRenderer.cpp
+//
+
+#include "OsdInstancedRenderer.h"
+#include "utils/GLUtils.h"
+#include "utils/LogUtil.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OSD_USE_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define OSD_USE_SSE2 1
+#endif
+
+#define OSD_ATTRIB_CORNER    0
+#define OSD_ATTRIB_DST_RECT  2
+#define OSD_ATTRIB_UV_RECT   3
+#define OSD_ATTRIB_ALPHA     4
+
+static const char kOsdVertexShader[] =
+		"#version 310 es \n"
+		"layout(location = 0) in vec2 aCorner;\n"
+		"layout(location = 2) in vec4 iDstRect;\n"
+		"layout(location = 3) in vec4 iUvRect;\n"
+		"layout(location = 4) in float iAlpha;\n"
+		"out vec2 osdTexCoords;\n"
+		"out vec2 bgTexCoords;\n"
+		"flat out float osdAlpha;\n"
+		"void main() {\n"
+		"    vec2 pos = mix(iDstRect.xy, iDstRect.zw, aCorner);\n"
+		"    osdTexCoords = mix(iUvRect.xy, iUvRect.zw, aCorner);\n"
+		"    bgTexCoords = pos * 0.5 + 0.5;\n"
+		"    osdAlpha = iAlpha;\n"
+		"    gl_Position = vec4(pos, 0.0, 1.0);\n"
+		"}\n";
+
+static const char kOsdFragmentShader[] =
+		"#version 310 es \n"
+		"#extension GL_OES_EGL_image_external : require \n"
+		"#extension GL_EXT_YUV_target : require \n"
+		"precision highp float;\n"
+		"uniform __samplerExternal2DY2YEXT atlasTexture;\n"
+		"uniform __samplerExternal2DY2YEXT bgTexture;\n"
+		"yuvCscStandardEXT conv_standard = itu_601;\n"
+		"in vec2 osdTexCoords;\n"
+		"in vec2 bgTexCoords;\n"
+		"flat in float osdAlpha;\n"
+		"out vec4 FragColor;\n"
+		"void main() {\n"
+		"   vec4 osd = texture(atlasTexture, osdTexCoords);\n"
+		"   vec3 osd_yuv = %s;\n"
+		"   vec3 bg = texture(bgTexture, bgTexCoords).xyz;\n"
+		"   FragColor = vec4(mix(bg, osd_yuv, osd.a * osdAlpha), 1.0);\n"
+		"}\n";
+
+OsdInstancedRenderer::OsdInstancedRenderer()
+{
+	memset(m_Programs, 0, sizeof(m_Programs));
+	m_Vao = 0;
+	m_CornerVbo = 0;
+	m_InstanceVbo = 0;
+	m_MaxInstances = 0;
+}
+
+OsdInstancedRenderer::~OsdInstancedRenderer()
+{
+	if (m_Vao)
+	{
+		LOGCATE("OsdInstancedRenderer::~OsdInstancedRenderer not destroyed");
+	}
+}
+
+int OsdInstancedRenderer::Init(int max_instances)
+{
+	if (m_Vao) return 0;
+	if (max_instances <= 0) return -1;
+
+	m_MaxInstances = max_instances;
+	m_Instances.assign((size_t) max_instances * OSD_INSTANCE_FLOATS, 0.0f);
+
+	//单位 quad 的四个角, 按 GL_TRIANGLE_FAN 顺序
+	static const GLfloat corners[8] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f };
+
+	glGenVertexArrays(1, &m_Vao);
+	glGenBuffers(1, &m_CornerVbo);
+	glGenBuffers(1, &m_InstanceVbo);
+
+	glBindVertexArray(m_Vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_CornerVbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glVertexAttribPointer(OSD_ATTRIB_CORNER, 2, GL_FLOAT, GL_FALSE, 0, (const void *) 0);
+	glEnableVertexAttribArray(OSD_ATTRIB_CORNER);
+
+	GLsizei stride = OSD_INSTANCE_FLOATS * sizeof(GLfloat);
+	glBindBuffer(GL_ARRAY_BUFFER, m_InstanceVbo);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) m_Instances.size() * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+	glVertexAttribPointer(OSD_ATTRIB_DST_RECT, 4, GL_FLOAT, GL_FALSE, stride, (const void *) 0);
+	glVertexAttribPointer(OSD_ATTRIB_UV_RECT, 4, GL_FLOAT, GL_FALSE, stride, (const void *) (4 * sizeof(GLfloat)));
+	glVertexAttribPointer(OSD_ATTRIB_ALPHA, 1, GL_FLOAT, GL_FALSE, stride, (const void *) (8 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(OSD_ATTRIB_DST_RECT);
+	glEnableVertexAttribArray(OSD_ATTRIB_UV_RECT);
+	glEnableVertexAttribArray(OSD_ATTRIB_ALPHA);
+	glVertexAttribDivisor(OSD_ATTRIB_DST_RECT, 1);
+	glVertexAttribDivisor(OSD_ATTRIB_UV_RECT, 1);
+	glVertexAttribDivisor(OSD_ATTRIB_ALPHA, 1);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return 0;
+}
+
+void OsdInstancedRenderer::Destroy()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		if (m_Programs[i].program) GLUtils::DeleteProgram(m_Programs[i].program);
+	}
+	if (m_Vao) glDeleteVertexArrays(1, &m_Vao);
+	if (m_CornerVbo) glDeleteBuffers(1, &m_CornerVbo);
+	if (m_InstanceVbo) glDeleteBuffers(1, &m_InstanceVbo);
+	m_Vao = m_CornerVbo = m_InstanceVbo = 0;
+	m_Instances.clear();
+	m_MaxInstances = 0;
+}
+
+OsdInstancedRenderer::Program *OsdInstancedRenderer::GetProgram(int atlas_is_yuv)
+{
+	Program *prog = &m_Programs[atlas_is_yuv ? 1 : 0];
+	if (prog->program) return prog;
+
+	char fragment[sizeof(kOsdFragmentShader) + 64];
+	snprintf(fragment, sizeof(fragment), kOsdFragmentShader,
+			 atlas_is_yuv ? "osd.xyz" : "rgb_2_yuv(osd.xyz, conv_standard)");
+	prog->program = GLUtils::CreateProgram(kOsdVertexShader, fragment);
+	if (!prog->program) return NULL;
+
+	prog->bg_sampler_loc = GLUtils::GetUniformLocation(prog->program, GL_UNIFORM_ID("bgTexture"));
+	prog->atlas_sampler_loc = GLUtils::GetUniformLocation(prog->program, GL_UNIFORM_ID("atlasTexture"));
+	return prog;
+}
+
+int OsdInstancedRenderer::Draw(const CompositorTarget &target, GLuint atlas_texture, int atlas_w, int atlas_h,
+							   int atlas_is_yuv, const OsdLabel *labels, int count)
+{
+	if (count <= 0) return 0;
+	if (count > m_MaxInstances)
+	{
+		LOGCATE("OsdInstancedRenderer::Draw %d labels exceed max %d", count, m_MaxInstances);
+		count = m_MaxInstances;
+	}
+
+	Program *prog = GetProgram(atlas_is_yuv);
+	if (!prog) return -1;
+
+	BuildInstances(labels, count, target.w, target.h, atlas_w, atlas_h, &m_Instances[0]);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_InstanceVbo);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr) count * OSD_INSTANCE_FLOATS * sizeof(GLfloat), &m_Instances[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo_id);
+	glViewport(0, 0, target.w, target.h);
+	glUseProgram(prog->program);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, atlas_texture);
+	glUniform1i(prog->atlas_sampler_loc, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_EXTERNAL_OES, target.texture_id);
+	glUniform1i(prog->bg_sampler_loc, 1);
+
+	glBindVertexArray(m_Vao);
+	glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, count);
+	glBindVertexArray(0);
+	GLUtils::CheckGLError("OsdInstancedRenderer::Draw");
+	return 0;
+}
+
+/*
+ * dst: ndc = px * (2 / target) - 1, (x, y, x + w, y + h)
+ * uv : uv  = px * (1 / atlas),      (x, y, x + w, y + h)
+ * 每个 label 的 4 个 int 正好是一个向量, 一次算完一个矩形.
+ */
+void OsdInstancedRenderer::BuildInstances(const OsdLabel *labels, int count, int target_w, int target_h,
+										  int atlas_w, int atlas_h, float *out)
+{
+	const float dsx = 2.0f / target_w, dsy = 2.0f / target_h;
+	const float usx = 1.0f / atlas_w, usy = 1.0f / atlas_h;
+
+#if defined(OSD_USE_NEON)
+	const float dst_scale_f[4] = { dsx, dsy, dsx, dsy };
+	const float uv_scale_f[4] = { usx, usy, usx, usy };
+	const float32x4_t dst_scale = vld1q_f32(dst_scale_f);
+	const float32x4_t uv_scale = vld1q_f32(uv_scale_f);
+	const float32x4_t one = vdupq_n_f32(1.0f);
+	for (int i = 0; i < count; i++)
+	{
+		const OsdLabel &l = labels[i];
+		float *o = out + (size_t) i * OSD_INSTANCE_FLOATS;
+
+		int32x4_t d = vld1q_s32(&l.dst_x);
+		int32x2_t d_xy = vget_low_s32(d);
+		int32x4_t d_rect = vcombine_s32(d_xy, vadd_s32(d_xy, vget_high_s32(d)));
+		vst1q_f32(o, vsubq_f32(vmulq_f32(vcvtq_f32_s32(d_rect), dst_scale), one));
+
+		int32x4_t s = vld1q_s32(&l.src_x);
+		int32x2_t s_xy = vget_low_s32(s);
+		int32x4_t s_rect = vcombine_s32(s_xy, vadd_s32(s_xy, vget_high_s32(s)));
+		vst1q_f32(o + 4, vmulq_f32(vcvtq_f32_s32(s_rect), uv_scale));
+
+		o[8] = l.alpha;
+		o[9] = o[10] = o[11] = 0.0f;
+	}
+#elif defined(OSD_USE_SSE2)
+	const __m128 dst_scale = _mm_setr_ps(dsx, dsy, dsx, dsy);
+	const __m128 uv_scale = _mm_setr_ps(usx, usy, usx, usy);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128i hi_mask = _mm_setr_epi32(0, 0, -1, -1);
+	for (int i = 0; i < count; i++)
+	{
+		const OsdLabel &l = labels[i];
+		float *o = out + (size_t) i * OSD_INSTANCE_FLOATS;
+
+		//(x, y, w, h) -> (x, y, x, y) + (0, 0, w, h)
+		__m128i d = _mm_loadu_si128((const __m128i *) &l.dst_x);
+		__m128i d_rect = _mm_add_epi32(_mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 1, 0)), _mm_and_si128(d, hi_mask));
+		_mm_storeu_ps(o, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(d_rect), dst_scale), one));
+
+		__m128i s = _mm_loadu_si128((const __m128i *) &l.src_x);
+		__m128i s_rect = _mm_add_epi32(_mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 1, 0)), _mm_and_si128(s, hi_mask));
+		_mm_storeu_ps(o + 4, _mm_mul_ps(_mm_cvtepi32_ps(s_rect), uv_scale));
+
+		o[8] = l.alpha;
+		o[9] = o[10] = o[11] = 0.0f;
+	}
+#else
+	for (int i = 0; i < count; i++)
+	{
+		const OsdLabel &l = labels[i];
+		float *o = out + (size_t) i * OSD_INSTANCE_FLOATS;
+		o[0] = l.dst_x * dsx - 1.0f;
+		o[1] = l.dst_y * dsy - 1.0f;
+		o[2] = (l.dst_x + l.dst_w) * dsx - 1.0f;
+		o[3] = (l.dst_y + l.dst_h) * dsy - 1.0f;
+		o[4] = l.src_x * usx;
+		o[5] = l.src_y * usy;
+		o[6] = (l.src_x + l.src_w) * usx;
+		o[7] = (l.src_y + l.src_h) * usy;
+		o[8] = l.alpha;
+		o[9] = o[10] = o[11] = 0.0f;
+	}
+#endif
+}
@@ -0,0 +1,62 @@
+//
+// OsdInstancedRenderer.h
+//
+
+#ifndef DRMDEMO_OSD_INSTANCED_RENDERER_H
+#define DRMDEMO_OSD_INSTANCED_RENDERER_H
+
+#include <GLES3/gl3.h>
+#include <vector>
+
+#include "Compositor.h"
+
+//每个实例 12 个 float: dst 矩形(NDC x0,y0,x1,y1), atlas uv 矩形(u0,v0,u1,v1), alpha + 3 个填充
+#define OSD_INSTANCE_FLOATS 12
+
+//一个小 OSD(时间戳/通道名等), 从同一张 atlas 中取 src 区域贴到 dst
+struct OsdLabel
+{
+	int dst_x, dst_y, dst_w, dst_h;     //顺序不能变, BuildInstances 按 4 个 int 一组向量加载
+	int src_x, src_y, src_w, src_h;
+	float alpha;
+};
+
+/*
+ * 实例化绘制: 所有 label 共享同一张 atlas 纹理, 每个 label 一个实例,
+ * 一次 glDrawArraysInstanced 画完. 片元里读取背景做混合, 因此同一批次内的 label 不能相互重叠.
+ */
+class OsdInstancedRenderer
+{
+public:
+	OsdInstancedRenderer();
+	~OsdInstancedRenderer();
+
+	int Init(int max_instances);
+	void Destroy();
+
+	int Draw(const CompositorTarget &target, GLuint atlas_texture, int atlas_w, int atlas_h, int atlas_is_yuv,
+			 const OsdLabel *labels, int count);
+
+	//把 count 个 label 换算成实例数据写入 out(count * OSD_INSTANCE_FLOATS 个 float), NEON/SSE 可用时向量化
+	static void BuildInstances(const OsdLabel *labels, int count, int target_w, int target_h,
+							   int atlas_w, int atlas_h, float *out);
+
+private:
+	struct Program
+	{
+		GLuint program;
+		GLint bg_sampler_loc;
+		GLint atlas_sampler_loc;
+	};
+
+	Program *GetProgram(int atlas_is_yuv);
+
+	Program m_Programs[2];
+	GLuint m_Vao;
+	GLuint m_CornerVbo;
+	GLuint m_InstanceVbo;
+	int m_MaxInstances;
+	std::vector<float> m_Instances;
+};
+
+#endif //DRMDEMO_OSD_INSTANCED_RENDERER_H
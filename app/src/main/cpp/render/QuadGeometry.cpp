@@ -0,0 +1,223 @@
+//
+// QuadGeometry.cpp
+//
+
+#include "QuadGeometry.h"
+#include "utils/LogUtil.h"
+
+#include <algorithm>
+#include <string.h>
+
+#define QUAD_FLOATS (4 * 4)  //4 个顶点 * (position.xy + texcoord.xy)
+
+QuadGeometry::QuadGeometry()
+{
+	m_Vao = 0;
+	m_Vbo = 0;
+	m_Ibo = 0;
+	m_MaxQuads = 0;
+	m_Count = 0;
+	m_DirtyBegin = 0;
+	m_DirtyEnd = 0;
+	m_UploadedBytes = 0;
+}
+
+QuadGeometry::~QuadGeometry()
+{
+	if (m_Vao)
+	{
+		LOGCATE("QuadGeometry::~QuadGeometry VAO %u not destroyed", m_Vao);
+	}
+}
+
+int QuadGeometry::Init(int max_quads)
+{
+	if (m_Vao) return 0;
+	if (max_quads <= 0 || max_quads * 4 > 65536)
+	{
+		LOGCATE("QuadGeometry::Init invalid max_quads=%d", max_quads);
+		return -1;
+	}
+
+	m_MaxQuads = max_quads;
+	m_Shadow.assign((size_t) max_quads * QUAD_FLOATS, 0.0f);
+
+	//两个三角形 (0,1,2) (0,2,3), 与 GL_TRIANGLE_FAN 画出的 quad 一致
+	std::vector<GLushort> indices((size_t) max_quads * 6);
+	for (int i = 0; i < max_quads; i++)
+	{
+		GLushort base = (GLushort) (i * 4);
+		indices[i * 6 + 0] = base;
+		indices[i * 6 + 1] = base + 1;
+		indices[i * 6 + 2] = base + 2;
+		indices[i * 6 + 3] = base;
+		indices[i * 6 + 4] = base + 2;
+		indices[i * 6 + 5] = base + 3;
+	}
+
+	glGenVertexArrays(1, &m_Vao);
+	glGenBuffers(1, &m_Vbo);
+	glGenBuffers(1, &m_Ibo);
+
+	glBindVertexArray(m_Vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_Vbo);
+	glBufferData(GL_ARRAY_BUFFER, m_Shadow.size() * sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(QUAD_ATTRIB_POSITION, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const void *) 0);
+	glEnableVertexAttribArray(QUAD_ATTRIB_POSITION);
+	glVertexAttribPointer(QUAD_ATTRIB_TEXCOORD, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (const void *) (2 * sizeof(GLfloat)));
+	glEnableVertexAttribArray(QUAD_ATTRIB_TEXCOORD);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	//初始内容为 0, 第一次 Bind 时整体上传
+	m_DirtyBegin = 0;
+	m_DirtyEnd = max_quads;
+	return 0;
+}
+
+void QuadGeometry::Destroy()
+{
+	if (m_Vao) glDeleteVertexArrays(1, &m_Vao);
+	if (m_Vbo) glDeleteBuffers(1, &m_Vbo);
+	if (m_Ibo) glDeleteBuffers(1, &m_Ibo);
+	m_Vao = m_Vbo = m_Ibo = 0;
+	m_Shadow.clear();
+	m_MaxQuads = 0;
+	m_Count = 0;
+}
+
+int QuadGeometry::SetQuad(int index, const QuadRect &rect, int target_w, int target_h)
+{
+	if (index < 0 || index >= m_MaxQuads) return -1;
+
+	float u0 = (float) rect.x0 / target_w;
+	float v0 = (float) rect.y0 / target_h;
+	float u1 = (float) rect.x1 / target_w;
+	float v1 = (float) rect.y1 / target_h;
+
+	//顶点顺序与 caculate_Vertex_coordinates 一致: (x0,y0) (x0,y1) (x1,y1) (x1,y0)
+	GLfloat quad[QUAD_FLOATS] = {
+			u0 * 2.0f - 1.0f, v0 * 2.0f - 1.0f, u0, v0,
+			u0 * 2.0f - 1.0f, v1 * 2.0f - 1.0f, u0, v1,
+			u1 * 2.0f - 1.0f, v1 * 2.0f - 1.0f, u1, v1,
+			u1 * 2.0f - 1.0f, v0 * 2.0f - 1.0f, u1, v0,
+	};
+
+	GLfloat *dst = &m_Shadow[(size_t) index * QUAD_FLOATS];
+	if (memcmp(dst, quad, sizeof(quad)) != 0)
+	{
+		memcpy(dst, quad, sizeof(quad));
+		if (m_DirtyBegin >= m_DirtyEnd)
+		{
+			m_DirtyBegin = index;
+			m_DirtyEnd = index + 1;
+		}
+		else
+		{
+			m_DirtyBegin = std::min(m_DirtyBegin, index);
+			m_DirtyEnd = std::max(m_DirtyEnd, index + 1);
+		}
+	}
+	return index;
+}
+
+void QuadGeometry::Bind()
+{
+	m_UploadedBytes = 0;
+	if (m_DirtyBegin < m_DirtyEnd)
+	{
+		GLintptr offset = (GLintptr) m_DirtyBegin * QUAD_FLOATS * sizeof(GLfloat);
+		GLsizeiptr size = (GLsizeiptr) (m_DirtyEnd - m_DirtyBegin) * QUAD_FLOATS * sizeof(GLfloat);
+		glBindBuffer(GL_ARRAY_BUFFER, m_Vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, &m_Shadow[(size_t) m_DirtyBegin * QUAD_FLOATS]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		m_UploadedBytes = (int) size;
+		m_DirtyBegin = m_DirtyEnd = 0;
+	}
+	glBindVertexArray(m_Vao);
+}
+
+void QuadGeometry::Draw(int first, int count)
+{
+	if (count <= 0) return;
+	glDrawElements(GL_TRIANGLES, count * 6, GL_UNSIGNED_SHORT, (const void *) ((size_t) first * 6 * sizeof(GLushort)));
+}
+
+void QuadGeometry::Unbind()
+{
+	glBindVertexArray(0);
+}
+
+static bool CompareRectX(const QuadRect &a, const QuadRect &b)
+{
+	return a.x0 < b.x0;
+}
+
+static bool SameSpans(const std::vector<QuadRect> &a, const std::vector<QuadRect> &b)
+{
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (a[i].x0 != b[i].x0 || a[i].x1 != b[i].x1) return false;
+	}
+	return true;
+}
+
+void QuadGeometry::Disjoint(const QuadRect *rects, int count, std::vector<QuadRect> &out)
+{
+	std::vector<int> ys;
+	for (int i = 0; i < count; i++)
+	{
+		if (rects[i].x0 >= rects[i].x1 || rects[i].y0 >= rects[i].y1) continue;
+		ys.push_back(rects[i].y0);
+		ys.push_back(rects[i].y1);
+	}
+	std::sort(ys.begin(), ys.end());
+	ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+	std::vector<QuadRect> pending;  //上一行带合并后的区间, y0/y1 为行带起止
+	std::vector<QuadRect> spans;
+	for (size_t b = 0; b + 1 < ys.size(); b++)
+	{
+		int ya = ys[b];
+		int yb = ys[b + 1];
+
+		spans.clear();
+		for (int i = 0; i < count; i++)
+		{
+			const QuadRect &r = rects[i];
+			if (r.x0 < r.x1 && r.y0 <= ya && r.y1 >= yb)
+			{
+				QuadRect span = { r.x0, ya, r.x1, yb };
+				spans.push_back(span);
+			}
+		}
+		std::sort(spans.begin(), spans.end(), CompareRectX);
+
+		//合并同一行带内重叠/相接的区间
+		size_t n = 0;
+		for (size_t i = 0; i < spans.size(); i++)
+		{
+			if (n > 0 && spans[i].x0 <= spans[n - 1].x1)
+				spans[n - 1].x1 = std::max(spans[n - 1].x1, spans[i].x1);
+			else
+				spans[n++] = spans[i];
+		}
+		spans.resize(n);
+
+		//与上一行带区间完全相同且上下相接时向下延伸, 减少 quad 数
+		if (!pending.empty() && pending[0].y1 == ya && SameSpans(pending, spans))
+		{
+			for (size_t i = 0; i < pending.size(); i++) pending[i].y1 = yb;
+			continue;
+		}
+		out.insert(out.end(), pending.begin(), pending.end());
+		pending.swap(spans);
+	}
+	out.insert(out.end(), pending.begin(), pending.end());
+}
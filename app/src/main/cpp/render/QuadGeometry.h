@@ -0,0 +1,62 @@
+//
+// QuadGeometry.h
+//
+
+#ifndef DRMDEMO_QUAD_GEOMETRY_H
+#define DRMDEMO_QUAD_GEOMETRY_H
+
+#include <GLES3/gl3.h>
+#include <vector>
+
+//着色器里需用 layout(location = N) 固定下面的属性位置, VAO 才能在不同 program 间共用
+#define QUAD_ATTRIB_POSITION  0
+#define QUAD_ATTRIB_TEXCOORD  1
+
+struct QuadRect
+{
+	int x0, y0, x1, y1;
+};
+
+/*
+ * 常驻 VBO/IBO + VAO 的 quad 批次. 每个 quad 4 个顶点, 顶点为交错的 (position.xy, texcoord.xy),
+ * position 为 NDC, texcoord 为目标纹理坐标, 均由目标上的像素矩形换算.
+ * CPU 侧保留一份副本, Upload 时只把变化过的区间用 glBufferSubData 传上去.
+ */
+class QuadGeometry
+{
+public:
+	QuadGeometry();
+	~QuadGeometry();
+
+	int Init(int max_quads);
+	void Destroy();
+
+	//target_w/target_h 为目标尺寸, 返回 quad 下标, 超出容量返回 -1
+	int SetQuad(int index, const QuadRect &rect, int target_w, int target_h);
+	void SetCount(int count) { m_Count = count; }
+	int GetCount() const { return m_Count; }
+	int GetMaxQuads() const { return m_MaxQuads; }
+
+	//上传脏区间并绑定 VAO
+	void Bind();
+	void Draw(int first, int count);
+	void Unbind();
+
+	//把若干可能重叠的矩形拆成互不重叠的矩形(按行带切分并合并相同的行带), 结果追加到 out
+	static void Disjoint(const QuadRect *rects, int count, std::vector<QuadRect> &out);
+
+	int GetUploadedBytes() const { return m_UploadedBytes; }
+
+private:
+	GLuint m_Vao;
+	GLuint m_Vbo;
+	GLuint m_Ibo;
+	int m_MaxQuads;
+	int m_Count;
+	std::vector<GLfloat> m_Shadow;
+	int m_DirtyBegin;   //单位: quad
+	int m_DirtyEnd;
+	int m_UploadedBytes;
+};
+
+#endif //DRMDEMO_QUAD_GEOMETRY_H
@@ -0,0 +1,321 @@
+//
+// RenderService.cpp
+//
+
+#include "RenderService.h"
+#include "utils/LogUtil.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void update_max(std::atomic<uint64_t> &max, uint64_t value)
+{
+	uint64_t cur = max.load(std::memory_order_relaxed);
+	while (value > cur && !max.compare_exchange_weak(cur, value, std::memory_order_relaxed)) {}
+}
+
+RenderService::RenderService(size_t queue_capacity) : m_Queue(queue_capacity)
+{
+	m_Running = false;
+	m_InitResult = 0;
+	m_Stop = false;
+	m_Sleeping = false;
+	m_NextId = 0;
+	m_Display = EGL_NO_DISPLAY;
+	m_Submitted = 0;
+	m_Rejected = 0;
+	m_Completed = 0;
+	m_Wakeups = 0;
+	m_SubmitNsTotal = 0;
+	m_SubmitNsMax = 0;
+	m_LatencyNsTotal = 0;
+	m_LatencyNsMax = 0;
+	m_RunNsTotal = 0;
+}
+
+RenderService::~RenderService()
+{
+	Stop();
+}
+
+int RenderService::Start(RenderContextInit context_init, int max_in_flight)
+{
+	if (m_Running) return 0;
+
+	m_Stop = false;
+	m_InitResult = 1;
+	m_Thread = std::thread(&RenderService::RenderLoop, this, context_init, max_in_flight);
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (m_InitResult == 1) m_DoneCond.wait(lock);
+	if (m_InitResult < 0)
+	{
+		lock.unlock();
+		m_Thread.join();
+		LOGCATE("RenderService::Start init context failed");
+		return -1;
+	}
+	m_Running = true;
+	LOGCATE("RenderService::Start queue=%zu %s", m_Queue.Capacity(), context_init ? m_Pacer.GetModeName() : "headless");
+	return 0;
+}
+
+void RenderService::Stop()
+{
+	if (!m_Running) return;
+	m_Running = false;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+		m_WakeCond.notify_one();
+	}
+	m_Thread.join();
+	m_ThreadId = std::thread::id();
+}
+
+void RenderService::Wake()
+{
+	//和 RenderLoop 里设置 m_Sleeping 再检查队列配对: 两边都有 seq_cst fence, 不会双方都错过对方的写
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_Sleeping.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_WakeCond.notify_one();
+	}
+}
+
+uint64_t RenderService::Submit(RenderJobFunc run, RenderJobDone done, void *opaque, int flags)
+{
+	if (!m_Running.load(std::memory_order_relaxed) || !run) return 0;
+
+	uint64_t start = now_ns();
+	RenderJob job;
+	job.run = run;
+	job.done = done;
+	job.opaque = opaque;
+	job.flags = flags;
+	job.id = m_NextId.fetch_add(1, std::memory_order_relaxed) + 1;
+	job.submit_ns = start;
+	if (!m_Queue.TryPush(job))
+	{
+		m_Rejected.fetch_add(1, std::memory_order_relaxed);
+		return 0;
+	}
+	Wake();
+
+	uint64_t cost = now_ns() - start;
+	m_Submitted.fetch_add(1, std::memory_order_relaxed);
+	m_SubmitNsTotal.fetch_add(cost, std::memory_order_relaxed);
+	update_max(m_SubmitNsMax, cost);
+	return job.id;
+}
+
+struct FlushMarker
+{
+	bool done;
+};
+
+int RenderService::FlushJob(RenderService *service, void *opaque)
+{
+	std::lock_guard<std::mutex> lock(service->m_Mutex);
+	((FlushMarker *) opaque)->done = true;
+	service->m_DoneCond.notify_all();
+	return 0;
+}
+
+int RenderService::Flush()
+{
+	if (!m_Running || IsRenderThread()) return -1;
+
+	//队列按提交顺序执行, 标记任务执行时之前的任务都已完成
+	FlushMarker marker = { false };
+	while (!Submit(FlushJob, NULL, &marker))
+	{
+		if (!m_Running) return -1;
+		usleep(1000);
+	}
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (!marker.done) m_DoneCond.wait(lock);
+	return 0;
+}
+
+void RenderService::RunJob(RenderJob &job)
+{
+	uint64_t start = now_ns();
+	uint64_t latency = start - job.submit_ns;
+	m_LatencyNsTotal.fetch_add(latency, std::memory_order_relaxed);
+	update_max(m_LatencyNsMax, latency);
+
+	int result = job.run(this, job.opaque);
+
+	int fence_fd = -1;
+	if ((job.flags & RENDER_JOB_FENCE) && m_Display != EGL_NO_DISPLAY)
+	{
+		m_Pacer.EndFrame(&fence_fd);
+	}
+	m_RunNsTotal.fetch_add(now_ns() - start, std::memory_order_relaxed);
+	m_Completed.fetch_add(1, std::memory_order_relaxed);
+
+	if (job.done)
+	{
+		job.done(job.opaque, job.id, result, fence_fd);
+	}
+	else if (fence_fd >= 0)
+	{
+		close(fence_fd);
+	}
+}
+
+void RenderService::RenderLoop(RenderContextInit context_init, int max_in_flight)
+{
+	m_ThreadId = std::this_thread::get_id();
+
+	int init_result = 0;
+	if (context_init)
+	{
+		m_Display = context_init();
+		if (m_Display == EGL_NO_DISPLAY || m_Pacer.Init(m_Display, max_in_flight) < 0)
+		{
+			ReleaseContext();
+			init_result = -1;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_InitResult = init_result;
+		m_DoneCond.notify_all();
+	}
+	if (init_result < 0) return;
+
+	RenderJob job;
+	while (true)
+	{
+		while (m_Queue.TryPop(&job))
+		{
+			RunJob(job);
+		}
+
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_Queue.TryPop(&job))
+		{
+			m_Sleeping.store(false, std::memory_order_relaxed);
+			lock.unlock();
+			RunJob(job);
+			continue;
+		}
+		if (m_Stop)
+		{
+			//Stop 之后提交的任务(Submit 已返回 0 的除外)也在这里执行完
+			m_Sleeping.store(false, std::memory_order_relaxed);
+			break;
+		}
+		m_WakeCond.wait(lock);
+		m_Sleeping.store(false, std::memory_order_relaxed);
+		m_Wakeups.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	ReleaseContext();
+}
+
+void RenderService::ReleaseContext()
+{
+	m_Pacer.Destroy();
+	if (m_Display == EGL_NO_DISPLAY) return;
+
+	EGLContext context = eglGetCurrentContext();
+	EGLSurface draw = eglGetCurrentSurface(EGL_DRAW);
+	eglMakeCurrent(m_Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (draw != EGL_NO_SURFACE) eglDestroySurface(m_Display, draw);
+	if (context != EGL_NO_CONTEXT) eglDestroyContext(m_Display, context);
+	eglReleaseThread();
+	m_Display = EGL_NO_DISPLAY;
+}
+
+RenderServiceStats RenderService::GetStats() const
+{
+	RenderServiceStats stats;
+	stats.submitted = m_Submitted.load(std::memory_order_relaxed);
+	stats.rejected = m_Rejected.load(std::memory_order_relaxed);
+	stats.completed = m_Completed.load(std::memory_order_relaxed);
+	stats.wakeups = m_Wakeups.load(std::memory_order_relaxed);
+	stats.submit_ns_total = m_SubmitNsTotal.load(std::memory_order_relaxed);
+	stats.submit_ns_max = m_SubmitNsMax.load(std::memory_order_relaxed);
+	stats.latency_ns_total = m_LatencyNsTotal.load(std::memory_order_relaxed);
+	stats.latency_ns_max = m_LatencyNsMax.load(std::memory_order_relaxed);
+	stats.run_ns_total = m_RunNsTotal.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void RenderService::DumpStats() const
+{
+	RenderServiceStats s = GetStats();
+	uint64_t n = s.submitted ? s.submitted : 1;
+	uint64_t c = s.completed ? s.completed : 1;
+	LOGCATE("RenderService::DumpStats submitted=%llu rejected=%llu completed=%llu wakeups=%llu pending=%zu",
+			(unsigned long long) s.submitted, (unsigned long long) s.rejected, (unsigned long long) s.completed,
+			(unsigned long long) s.wakeups, m_Queue.SizeApprox());
+	LOGCATE("RenderService::DumpStats submit avg=%.2fus max=%.2fus, queue latency avg=%.2fus max=%.2fus, run avg=%.2fus",
+			s.submit_ns_total / 1000.0 / n, s.submit_ns_max / 1000.0,
+			s.latency_ns_total / 1000.0 / c, s.latency_ns_max / 1000.0, s.run_ns_total / 1000.0 / c);
+}
+
+static int benchmark_job(RenderService *service, void *opaque)
+{
+	return 0;
+}
+
+static void benchmark_done(void *opaque, uint64_t job_id, int result, int fence_fd)
+{
+	((std::atomic<uint64_t> *) opaque)->fetch_add(1, std::memory_order_relaxed);
+}
+
+static void benchmark_producer(RenderService *service, std::atomic<uint64_t> *done, int jobs, uint64_t *retries)
+{
+	for (int i = 0; i < jobs; i++)
+	{
+		//队列满时让出 CPU 重试, 统计里的 rejected 即重试次数
+		while (!service->Submit(benchmark_job, benchmark_done, done))
+		{
+			(*retries)++;
+			std::this_thread::yield();
+		}
+	}
+}
+
+int RenderService::Benchmark(int producers, int jobs)
+{
+	if (producers < 1) producers = 1;
+
+	RenderService service(1024);
+	if (service.Start(NULL) < 0) return -1;
+
+	std::atomic<uint64_t> done(0);
+	std::vector<uint64_t> retries(producers, 0);
+	std::vector<std::thread> threads;
+	uint64_t start = now_ns();
+	for (int i = 0; i < producers; i++)
+	{
+		threads.push_back(std::thread(benchmark_producer, &service, &done, jobs, &retries[i]));
+	}
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+	service.Flush();
+	uint64_t elapsed = now_ns() - start;
+
+	uint64_t expected = (uint64_t) producers * jobs;
+	LOGCATE("RenderService::Benchmark producers=%d jobs=%llu completed=%llu %.2f Mjobs/s%s", producers,
+			(unsigned long long) expected, (unsigned long long) done.load(),
+			elapsed ? expected * 1000.0 / elapsed : 0.0, done.load() == expected ? "" : " MISMATCH");
+	service.DumpStats();
+	service.Stop();
+	return done.load() == expected ? 0 : -1;
+}
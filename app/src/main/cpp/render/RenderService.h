@@ -0,0 +1,133 @@
+//
+// RenderService.h
+//
+
+#ifndef DRMDEMO_RENDER_SERVICE_H
+#define DRMDEMO_RENDER_SERVICE_H
+
+#include "FramePacer.h"
+#include "utils/MpscQueue.h"
+
+#include <EGL/egl.h>
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class RenderService;
+
+//在渲染线程执行, EGL context 已经 current; 返回值原样交给完成回调
+typedef int (*RenderJobFunc)(RenderService *service, void *opaque);
+
+//任务完成后在渲染线程调用. fence_fd 为该任务 GL 命令的 sync_file(调用者负责 close),
+//任务未要求 fence 或驱动不支持 native fence 时为 -1
+typedef void (*RenderJobDone)(void *opaque, uint64_t job_id, int result, int fence_fd);
+
+//在渲染线程创建 display/surface/context 并 make current, 失败返回 EGL_NO_DISPLAY
+typedef EGLDisplay (*RenderContextInit)();
+
+enum RenderJobFlags
+{
+	RENDER_JOB_DEFAULT = 0,
+	RENDER_JOB_FENCE = 1 << 0,      //执行后调用 FramePacer::EndFrame, 把 fence 交给完成回调
+};
+
+struct RenderJob
+{
+	RenderJobFunc run;
+	RenderJobDone done;
+	void *opaque;
+	int flags;
+	uint64_t id;                    //Submit 填写
+	uint64_t submit_ns;             //Submit 填写
+};
+
+struct RenderServiceStats
+{
+	uint64_t submitted;
+	uint64_t rejected;              //队列满, Submit 返回 0
+	uint64_t completed;
+	uint64_t wakeups;               //渲染线程从休眠中被唤醒的次数
+	uint64_t submit_ns_total;       //Submit 在调用线程上的耗时
+	uint64_t submit_ns_max;
+	uint64_t latency_ns_total;      //Submit 到开始执行
+	uint64_t latency_ns_max;
+	uint64_t run_ns_total;
+};
+
+/*
+ * 独占 EGL context 的渲染线程. 任意线程通过无锁 MPSC 队列提交任务, Submit 不加锁也不等待,
+ * 队列满时立即失败; 渲染线程按提交顺序执行, 队列空时休眠, 生产者只在它休眠时才去拿锁唤醒.
+ * 完成通过回调和可选的 fence 通知, 调用方也可以用 Flush 等已提交的任务执行完(不要在 JNI 调用里等).
+ * context_init 为 NULL 时不创建 EGL(headless), 用于在没有 GPU/JVM 的环境压测队列本身.
+ */
+class RenderService
+{
+public:
+	explicit RenderService(size_t queue_capacity = 256);
+	~RenderService();
+
+	//启动渲染线程并在其上执行 context_init, 返回 0 成功
+	int Start(RenderContextInit context_init, int max_in_flight = 2);
+	//执行完已提交的任务后退出线程, context 在渲染线程上释放
+	void Stop();
+
+	//返回任务 id(从 1 开始), 队列满或未启动时返回 0
+	uint64_t Submit(RenderJobFunc run, RenderJobDone done, void *opaque, int flags = RENDER_JOB_DEFAULT);
+
+	//等待调用前已提交的任务全部执行完, 不能在渲染线程调用. 返回 0 成功, -1 未启动或在渲染线程
+	int Flush();
+
+	bool IsRenderThread() const { return std::this_thread::get_id() == m_ThreadId; }
+	EGLDisplay GetDisplay() const { return m_Display; }
+	FramePacer *GetPacer() { return &m_Pacer; }
+
+	RenderServiceStats GetStats() const;
+	void DumpStats() const;
+
+	//headless 压测: producers 个线程各提交 jobs 个空任务, 打印吞吐和提交耗时.
+	//完成数与提交数不符(MISMATCH)或服务启动失败返回 -1
+	static int Benchmark(int producers, int jobs);
+
+private:
+	RenderService(const RenderService &);
+	RenderService &operator=(const RenderService &);
+
+	void RenderLoop(RenderContextInit context_init, int max_in_flight);
+	void RunJob(RenderJob &job);
+	void ReleaseContext();
+	void Wake();
+
+	static int FlushJob(RenderService *service, void *opaque);
+
+	MpscQueue<RenderJob> m_Queue;
+	std::thread m_Thread;
+	std::thread::id m_ThreadId;
+	std::atomic<bool> m_Running;
+	int m_InitResult;                       //1 表示渲染线程还在初始化
+	std::atomic<bool> m_Stop;
+	std::atomic<bool> m_Sleeping;
+	std::atomic<uint64_t> m_NextId;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_WakeCond;     //唤醒渲染线程
+	std::condition_variable m_DoneCond;     //Start/Flush 等待渲染线程
+
+	EGLDisplay m_Display;
+	FramePacer m_Pacer;
+
+	//统计只做 relaxed 累加, 可以在任意线程读
+	std::atomic<uint64_t> m_Submitted;
+	std::atomic<uint64_t> m_Rejected;
+	std::atomic<uint64_t> m_Completed;
+	std::atomic<uint64_t> m_Wakeups;
+	std::atomic<uint64_t> m_SubmitNsTotal;
+	std::atomic<uint64_t> m_SubmitNsMax;
+	std::atomic<uint64_t> m_LatencyNsTotal;
+	std::atomic<uint64_t> m_LatencyNsMax;
+	std::atomic<uint64_t> m_RunNsTotal;
+};
+
+#endif //DRMDEMO_RENDER_SERVICE_H
@@ -0,0 +1,402 @@
+//
+// AsyncDumpWriter.cpp
+//
+
+#include "AsyncDumpWriter.h"
+#include "LogUtil.h"
+#include "libsync.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <drm/drm_fourcc.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static uint64_t NowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+AsyncDumpWriter::AsyncDumpWriter(int max_queue, DumpDropPolicy policy)
+{
+	m_MaxQueue = max_queue > 0 ? max_queue : 1;
+	m_Policy = policy;
+	m_Mode = DUMP_FILE_RAW;
+	m_Directory = ".";
+	m_Writing = false;
+	m_Stop = false;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	m_Thread = std::thread(&AsyncDumpWriter::WriteLoop, this);
+}
+
+AsyncDumpWriter::~AsyncDumpWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_WorkCond.notify_all();
+	m_Thread.join();
+	CloseContainers();
+}
+
+int AsyncDumpWriter::SetDirectory(const char *dir)
+{
+	if (!dir || !dir[0]) return -1;
+
+	//逐级创建, 只在这里做一次
+	std::string path(dir);
+	for (size_t pos = 1; pos <= path.size(); pos++)
+	{
+		if (pos != path.size() && path[pos] != '/') continue;
+		std::string sub = path.substr(0, pos);
+		if (mkdir(sub.c_str(), 0777) < 0 && errno != EEXIST)
+		{
+			LOGCATE("AsyncDumpWriter::SetDirectory mkdir %s failed: %s", sub.c_str(), strerror(errno));
+			return -1;
+		}
+	}
+	m_Directory = path;
+	return 0;
+}
+
+uint32_t AsyncDumpWriter::NativeImageFourcc(int format)
+{
+	switch (format)
+	{
+		case IMAGE_FORMAT_RGBA: return DRM_FORMAT_ABGR8888;
+		case IMAGE_FORMAT_NV21: return DRM_FORMAT_NV21;
+		case IMAGE_FORMAT_NV12: return DRM_FORMAT_NV12;
+		case IMAGE_FORMAT_I420: return DRM_FORMAT_YUV420;
+		case IMAGE_FORMAT_YUYV: return DRM_FORMAT_YUYV;
+		case IMAGE_FORMAT_GRAY: return DRM_FORMAT_R8;
+		case IMAGE_FORMAT_I444: return DRM_FORMAT_YUV444;
+		case IMAGE_FORMAT_P010: return DRM_FORMAT_P010;
+		default: return 0;
+	}
+}
+
+void AsyncDumpWriter::DescribeNativeImage(const NativeImage *img, DumpFrameDesc *desc)
+{
+	memset(desc, 0, sizeof(*desc));
+	int row_bytes[3], rows[3];
+	desc->num_planes = NativeImageUtil::GetPlaneGeometry(img->format, img->width, img->height, row_bytes, rows);
+	desc->fourcc = NativeImageFourcc(img->format);
+	desc->width = img->width;
+	desc->height = img->height;
+	for (int i = 0; i < desc->num_planes; i++)
+	{
+		desc->planes[i].data = img->ppPlane[i];
+		desc->planes[i].stride = img->pLineSize[i];
+		desc->planes[i].row_bytes = row_bytes[i];
+		desc->planes[i].rows = rows[i];
+	}
+}
+
+void AsyncDumpWriter::Finish(Job &job)
+{
+	//被丢弃的帧没经过 WriteJob, GPU 可能还在写这块 buffer: 等 fence signal 后才能交还给调用方复用.
+	//写完的帧 fence 早已 signal, 这里立即返回
+	if (job.fence_fd >= 0)
+	{
+		if ((job.release || job.frame.IsValid()) && sync_wait(job.fence_fd, -1) < 0)
+		{
+			LOGCATE("AsyncDumpWriter::Finish wait fence for %s failed: %s", job.path.c_str(), strerror(errno));
+		}
+		close(job.fence_fd);
+	}
+	job.fence_fd = -1;
+	if (job.release) job.release(job.opaque);
+	job.release = NULL;
+	job.frame.Reset();
+}
+
+int AsyncDumpWriter::Enqueue(Job &job, uint64_t start_ns)
+{
+	Job dropped;
+	bool drop_new = false, drop_old = false;
+	bool copied = !job.copy.empty();
+	job.mode = m_Mode;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stats.submitted++;
+		if ((int) m_Queue.size() >= m_MaxQueue)
+		{
+			m_Stats.dropped++;
+			if (m_Policy == DUMP_DROP_NEWEST)
+			{
+				drop_new = true;
+			}
+			else
+			{
+				dropped = std::move(m_Queue.front());
+				m_Queue.pop_front();
+				drop_old = true;
+			}
+		}
+		if (!drop_new)
+		{
+			m_Queue.push_back(std::move(job));
+			if (m_Queue.size() > m_Stats.queue_high_water) m_Stats.queue_high_water = (uint32_t) m_Queue.size();
+		}
+	}
+	if (!drop_new) m_WorkCond.notify_one();
+
+	//release 回调不在锁里调用
+	if (drop_new) Finish(job);
+	if (drop_old) Finish(dropped);
+
+	uint64_t us = (NowNs() - start_ns) / 1000;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (copied)
+	{
+		m_Stats.copy_submitted++;
+		m_Stats.copy_us += us;
+		if (us > m_Stats.copy_max_us) m_Stats.copy_max_us = us;
+	}
+	else
+	{
+		m_Stats.submit_us += us;
+		if (us > m_Stats.submit_max_us) m_Stats.submit_max_us = us;
+	}
+	return drop_new ? -1 : 0;
+}
+
+int AsyncDumpWriter::Submit(const DumpFrameDesc &desc, const char *name, DumpReleaseCallback release, void *opaque,
+							int fence_fd)
+{
+	uint64_t start = NowNs();
+	Job job;
+	job.desc = desc;
+	job.path = m_Directory + "/" + name;
+	job.release = release;
+	job.opaque = opaque;
+	job.fence_fd = fence_fd;
+	job.timestamp_ns = start;
+	return Enqueue(job, start);
+}
+
+int AsyncDumpWriter::Submit(const NativeFrame &frame, const char *name)
+{
+	if (!frame.IsValid()) return -1;
+
+	uint64_t start = NowNs();
+	Job job;
+	DescribeNativeImage(frame.Image(), &job.desc);
+	job.path = m_Directory + "/" + name;
+	job.release = NULL;
+	job.opaque = NULL;
+	job.fence_fd = -1;
+	job.frame = frame;
+	job.timestamp_ns = start;
+	return Enqueue(job, start);
+}
+
+int AsyncDumpWriter::SubmitCopy(const DumpFrameDesc &desc, const char *name)
+{
+	uint64_t start = NowNs();
+	Job job;
+	job.desc = desc;
+	job.path = m_Directory + "/" + name;
+	job.release = NULL;
+	job.opaque = NULL;
+	job.fence_fd = -1;
+	job.timestamp_ns = start;
+
+	//连同 stride 填充整块拷贝, 排布不变, container 模式回放时仍是原来的 pitch
+	size_t total = 0;
+	for (int i = 0; i < desc.num_planes; i++) total += (size_t) desc.planes[i].stride * desc.planes[i].rows;
+	job.copy.resize(total);
+	uint8_t *dst = job.copy.data();
+	for (int i = 0; i < desc.num_planes; i++)
+	{
+		const DumpPlane &p = desc.planes[i];
+		if (p.rows) memcpy(dst, p.data, (size_t) p.stride * (p.rows - 1) + p.row_bytes);
+		job.desc.planes[i].data = dst;
+		dst += (size_t) p.stride * p.rows;
+	}
+	return Enqueue(job, start);
+}
+
+int AsyncDumpWriter::WriteJob(Job &job)
+{
+	if (job.fence_fd >= 0 && sync_wait(job.fence_fd, -1) < 0)
+	{
+		LOGCATE("AsyncDumpWriter::WriteJob wait fence for %s failed: %s", job.path.c_str(), strerror(errno));
+	}
+	return job.mode == DUMP_FILE_CONTAINER ? WriteContainer(job) : WriteRaw(job);
+}
+
+int AsyncDumpWriter::WriteRaw(Job &job)
+{
+	int fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+	{
+		LOGCATE("AsyncDumpWriter::WriteRaw open %s failed: %s", job.path.c_str(), strerror(errno));
+		return -1;
+	}
+
+	//紧凑的平面一个 iovec, 否则每行一个
+	const DumpFrameDesc &desc = job.desc;
+	struct iovec iov[IOV_MAX];
+	int count = 0;
+	int ret = 0;
+	for (int i = 0; i < desc.num_planes && ret == 0; i++)
+	{
+		const DumpPlane &p = desc.planes[i];
+		bool packed = p.stride == p.row_bytes;
+		uint32_t n = packed ? 1 : p.rows;
+		for (uint32_t r = 0; r < n && ret == 0; r++)
+		{
+			if (count == IOV_MAX)
+			{
+				ret = FrameContainerWriter::WritevFull(fd, iov, count);
+				count = 0;
+			}
+			iov[count].iov_base = (void *) (p.data + (size_t) r * p.stride);
+			iov[count].iov_len = packed ? (size_t) p.row_bytes * p.rows : p.row_bytes;
+			count++;
+		}
+	}
+	if (ret == 0) ret = FrameContainerWriter::WritevFull(fd, iov, count);
+	if (ret < 0)
+	{
+		LOGCATE("AsyncDumpWriter::WriteRaw write %s failed: %s", job.path.c_str(), strerror(errno));
+	}
+	close(fd);
+	return ret;
+}
+
+int AsyncDumpWriter::WriteContainer(Job &job)
+{
+	std::lock_guard<std::mutex> lock(m_ContainerMutex);
+	FrameContainerWriter *&container = m_Containers[job.path];
+	if (!container)
+	{
+		container = new FrameContainerWriter();
+		if (container->Open(job.path.c_str()) < 0)
+		{
+			delete container;
+			m_Containers.erase(job.path);
+			return -1;
+		}
+	}
+
+	//各平面依次紧接, offsets 按写入顺序累加, pitch 保持原 stride
+	const DumpFrameDesc &desc = job.desc;
+	FrameRecordHeader record;
+	memset(&record, 0, sizeof(record));
+	record.frame_index = desc.frame_index;
+	record.timestamp_ns = job.timestamp_ns;
+	record.fourcc = desc.fourcc;
+	record.width = desc.width;
+	record.height = desc.height;
+	record.num_planes = desc.num_planes;
+	record.modifier = desc.modifier;
+
+	struct iovec iov[DUMP_MAX_PLANES];
+	uint32_t offset = 0;
+	for (int i = 0; i < desc.num_planes; i++)
+	{
+		const DumpPlane &p = desc.planes[i];
+		record.offsets[i] = offset;
+		record.pitches[i] = p.stride;
+		iov[i].iov_base = (void *) p.data;
+		iov[i].iov_len = (size_t) p.stride * p.rows;
+		offset += (uint32_t) iov[i].iov_len;
+	}
+	return container->Append(record, iov, desc.num_planes);
+}
+
+void AsyncDumpWriter::CloseContainers()
+{
+	Flush();
+	std::lock_guard<std::mutex> lock(m_ContainerMutex);
+	for (std::map<std::string, FrameContainerWriter *>::iterator it = m_Containers.begin(); it != m_Containers.end(); ++it)
+	{
+		LOGCATE("AsyncDumpWriter::CloseContainers %s frames=%u", it->first.c_str(), it->second->GetFrameCount());
+		it->second->Close();
+		delete it->second;
+	}
+	m_Containers.clear();
+}
+
+void AsyncDumpWriter::WriteLoop()
+{
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WorkCond.wait(lock, [this] { return !m_Queue.empty() || m_Stop; });
+			//退出前写完队列里剩下的帧
+			if (m_Queue.empty()) break;
+			job = std::move(m_Queue.front());
+			m_Queue.pop_front();
+			m_Writing = true;
+		}
+
+		uint64_t start = NowNs();
+		int ret = WriteJob(job);
+		uint64_t bytes = 0;
+		for (int i = 0; i < job.desc.num_planes; i++)
+		{
+			const DumpPlane &p = job.desc.planes[i];
+			bytes += (uint64_t) (job.mode == DUMP_FILE_CONTAINER ? p.stride : p.row_bytes) * p.rows;
+		}
+		Finish(job);
+
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stats.write_us += (NowNs() - start) / 1000;
+			if (ret == 0)
+			{
+				m_Stats.written++;
+				m_Stats.bytes += bytes;
+			}
+			else
+			{
+				m_Stats.errors++;
+			}
+			m_Writing = false;
+		}
+		m_IdleCond.notify_all();
+	}
+}
+
+void AsyncDumpWriter::Flush()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_IdleCond.wait(lock, [this] { return m_Queue.empty() && !m_Writing; });
+}
+
+AsyncDumpWriterStats AsyncDumpWriter::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+void AsyncDumpWriter::DumpStats()
+{
+	AsyncDumpWriterStats s = GetStats();
+	uint64_t ref_submitted = s.submitted - s.copy_submitted;
+	LOGCATE("AsyncDumpWriter submitted=%llu written=%llu dropped=%llu errors=%llu bytes=%llu "
+			"submit avg=%.1fus max=%lluus copy submits=%llu avg=%.1fus max=%lluus write avg=%.2fms queue_high_water=%u",
+			(unsigned long long) s.submitted, (unsigned long long) s.written, (unsigned long long) s.dropped,
+			(unsigned long long) s.errors, (unsigned long long) s.bytes,
+			ref_submitted ? (double) s.submit_us / ref_submitted : 0.0, (unsigned long long) s.submit_max_us,
+			(unsigned long long) s.copy_submitted, s.copy_submitted ? (double) s.copy_us / s.copy_submitted : 0.0,
+			(unsigned long long) s.copy_max_us,
+			(s.written + s.errors) ? s.write_us / 1000.0 / (s.written + s.errors) : 0.0, s.queue_high_water);
+}
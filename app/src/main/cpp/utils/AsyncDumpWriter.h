@@ -0,0 +1,157 @@
+//
+// AsyncDumpWriter.h
+//
+
+#ifndef DRMDEMO_ASYNC_DUMP_WRITER_H
+#define DRMDEMO_ASYNC_DUMP_WRITER_H
+
+#include "NativeImagePool.h"
+#include "FrameContainer.h"
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define DUMP_MAX_PLANES 3
+
+//一个平面: rows 行, 每行 row_bytes 有效字节, 行首间隔 stride. container 模式会整块写出 stride * rows 字节
+struct DumpPlane
+{
+	const uint8_t *data;
+	uint32_t stride;
+	uint32_t row_bytes;
+	uint32_t rows;
+};
+
+struct DumpFrameDesc
+{
+	uint32_t fourcc;            //DRM fourcc
+	uint32_t width;
+	uint32_t height;
+	uint64_t modifier;          //DRM format modifier, linear 为 0
+	uint64_t frame_index;       //写进 container 的帧号
+	int num_planes;
+	DumpPlane planes[DUMP_MAX_PLANES];
+};
+
+enum DumpFileMode
+{
+	DUMP_FILE_RAW = 0,          //与原来的 dump 文件相同, 只有紧凑排列的像素, 一帧一个文件
+	DUMP_FILE_CONTAINER,        //追加到 FrameContainer 文件, 同名的帧写进同一个文件, 保留原 stride 和 modifier
+};
+
+enum DumpDropPolicy
+{
+	DUMP_DROP_NEWEST = 0,       //队列满时丢弃新提交的帧
+	DUMP_DROP_OLDEST,           //队列满时丢弃最早排队的帧, 保留最新的画面
+};
+
+//写完或被丢弃后在写线程(或 Submit 的调用线程)上调用, 调用方此后才能改写/释放 buffer.
+//带 fence 的帧被丢弃时, 先等 fence signal 再调用, 因此 Submit 在丢帧时可能阻塞到 GPU 写完
+typedef void (*DumpReleaseCallback)(void *opaque);
+
+struct AsyncDumpWriterStats
+{
+	uint64_t submitted;
+	uint64_t written;
+	uint64_t dropped;
+	uint64_t errors;
+	uint64_t bytes;
+	uint64_t submit_us;         //引用提交(Submit)在调用线程上的总耗时
+	uint64_t submit_max_us;
+	uint64_t copy_submitted;    //SubmitCopy 的次数, 也计入 submitted
+	uint64_t copy_us;           //SubmitCopy 在调用线程上的总耗时, 含拷贝, 不计入 submit_us
+	uint64_t copy_max_us;
+	uint64_t write_us;          //写线程 open + writev + close 的总耗时
+	uint32_t queue_high_water;
+};
+
+/*
+ * 异步 dump: 渲染线程只把 buffer 的引用和描述放进有界队列, 由写线程用 writev 一次写完整帧,
+ * raw 模式下有 stride 的平面按行生成 iovec, container 模式下每个平面连同 stride 填充整块写出,
+ * 都不经过中间拷贝. 目录在 SetDirectory 时创建一次.
+ * 提交的 buffer 在 release 回调之前必须保持不变; 之后马上会被改写的 buffer 用 SubmitCopy.
+ * fence_fd 为 GPU 写 buffer 的 sync_file, 写线程先等它 signal 再读, 渲染线程不用等 GPU.
+ */
+class AsyncDumpWriter
+{
+public:
+	explicit AsyncDumpWriter(int max_queue = 4, DumpDropPolicy policy = DUMP_DROP_OLDEST);
+	//写完队列里剩余的帧后退出
+	~AsyncDumpWriter();
+
+	//不存在时创建, 返回 0 成功
+	int SetDirectory(const char *dir);
+	void SetFileMode(DumpFileMode mode) { m_Mode = mode; }
+
+	//name 为目录下的文件名. 无论写入还是丢弃, release 都会被调用一次, fence_fd 的所有权交给 writer
+	int Submit(const DumpFrameDesc &desc, const char *name, DumpReleaseCallback release, void *opaque,
+			   int fence_fd = -1);
+
+	//持有 frame 的一个引用直到写完
+	int Submit(const NativeFrame &frame, const char *name);
+
+	//立即把 desc 描述的数据(连同 stride 填充)拷出来, 返回后源 buffer 可以改写; 耗时与帧大小成正比,
+	//只用于提交后马上会被改写、又等不起写线程的 buffer, 耗时单独统计在 copy_us
+	int SubmitCopy(const DumpFrameDesc &desc, const char *name);
+
+	//等待队列里已提交的帧全部写完
+	void Flush();
+
+	//Flush 后写入所有 container 的 index 并关闭, 之后同名的提交会重新创建文件
+	void CloseContainers();
+
+	AsyncDumpWriterStats GetStats();
+	void DumpStats();
+
+	//NativeImage 的格式对应的 DRM fourcc, 用于填 DumpFrameDesc
+	static uint32_t NativeImageFourcc(int format);
+	static void DescribeNativeImage(const NativeImage *img, DumpFrameDesc *desc);
+
+private:
+	struct Job
+	{
+		DumpFrameDesc desc;
+		std::string path;
+		DumpReleaseCallback release;
+		void *opaque;
+		int fence_fd;
+		NativeFrame frame;              //Submit(NativeFrame) 时持有的引用
+		std::vector<uint8_t> copy;      //SubmitCopy 的数据
+		uint64_t timestamp_ns;
+		DumpFileMode mode;              //提交时的模式, 之后 SetFileMode 不影响已排队的帧
+
+		Job() : release(NULL), opaque(NULL), fence_fd(-1), timestamp_ns(0), mode(DUMP_FILE_RAW) { memset(&desc, 0, sizeof(desc)); }
+	};
+
+	int Enqueue(Job &job, uint64_t start_ns);
+	static void Finish(Job &job);
+	int WriteJob(Job &job);
+	int WriteRaw(Job &job);
+	int WriteContainer(Job &job);
+	void WriteLoop();
+
+	int m_MaxQueue;
+	DumpDropPolicy m_Policy;
+	DumpFileMode m_Mode;
+	std::string m_Directory;
+
+	std::thread m_Thread;
+	std::mutex m_Mutex;
+	std::condition_variable m_WorkCond;
+	std::condition_variable m_IdleCond;
+	std::deque<Job> m_Queue;
+	bool m_Writing;
+	bool m_Stop;
+	AsyncDumpWriterStats m_Stats;
+
+	std::mutex m_ContainerMutex;                                //写线程追加时持有, CloseContainers 与之互斥
+	std::map<std::string, FrameContainerWriter *> m_Containers;
+};
+
+#endif //DRMDEMO_ASYNC_DUMP_WRITER_H
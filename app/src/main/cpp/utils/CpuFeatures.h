@@ -0,0 +1,55 @@
+//
+// CpuFeatures.h
+//
+
+#ifndef DRMDEMO_CPU_FEATURES_H
+#define DRMDEMO_CPU_FEATURES_H
+
+//CPU 侧 SIMD 实现的级别, CpuCompositor 与 ImageConverter 共用
+enum CpuSimdLevel
+{
+	CPU_SIMD_SCALAR = 0,
+	CPU_SIMD_SSE41,
+	CPU_SIMD_AVX2,
+	CPU_SIMD_NEON,
+};
+
+class CpuFeatures
+{
+public:
+	//x86 按 cpuid 选择; arm64 必带 NEON, 32 位 ARM 以编译选项为准
+	static CpuSimdLevel DetectSimdLevel()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return CPU_SIMD_AVX2;
+		if (__builtin_cpu_supports("sse4.1")) return CPU_SIMD_SSE41;
+		return CPU_SIMD_SCALAR;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		return CPU_SIMD_NEON;
+#else
+		return CPU_SIMD_SCALAR;
+#endif
+	}
+
+	//level 不超过本机能力时返回 level, 否则返回检测到的级别; AVX2 机器可以降到 SSE4.1 对比
+	static CpuSimdLevel Clamp(CpuSimdLevel level)
+	{
+		CpuSimdLevel best = DetectSimdLevel();
+		bool ok = level == CPU_SIMD_SCALAR || level == best || (best == CPU_SIMD_AVX2 && level == CPU_SIMD_SSE41);
+		return ok ? level : best;
+	}
+
+	static const char *SimdLevelName(CpuSimdLevel level)
+	{
+		switch (level)
+		{
+			case CPU_SIMD_SSE41: return "sse4.1";
+			case CPU_SIMD_AVX2: return "avx2";
+			case CPU_SIMD_NEON: return "neon";
+			default: return "scalar";
+		}
+	}
+};
+
+#endif //DRMDEMO_CPU_FEATURES_H
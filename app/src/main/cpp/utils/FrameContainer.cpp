@@ -0,0 +1,285 @@
+//
+// FrameContainer.cpp
+//
+
+#include "FrameContainer.h"
+#include "LogUtil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define CONTAINER_ALIGN_UP(_v) (((_v) + FRAME_CONTAINER_ALIGN - 1) & ~((uint64_t) FRAME_CONTAINER_ALIGN - 1))
+
+static const uint8_t kZeroPad[FRAME_CONTAINER_ALIGN] = { 0 };
+
+FrameContainerWriter::FrameContainerWriter()
+{
+	m_Fd = -1;
+	m_Offset = 0;
+}
+
+FrameContainerWriter::~FrameContainerWriter()
+{
+	Close();
+}
+
+int FrameContainerWriter::WritevFull(int fd, struct iovec *iov, int count)
+{
+	while (count > 0)
+	{
+		ssize_t n = writev(fd, iov, count);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+
+		while (count > 0 && (size_t) n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0)
+		{
+			iov->iov_base = (uint8_t *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+int FrameContainerWriter::Open(const char *path)
+{
+	Close();
+	m_Fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (m_Fd < 0)
+	{
+		LOGCATE("FrameContainerWriter::Open %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+
+	FrameContainerHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = FRAME_CONTAINER_MAGIC;
+	header.version = FRAME_CONTAINER_VERSION;
+	header.header_size = sizeof(header);
+
+	struct iovec iov[2] = {
+		{ &header, sizeof(header) },
+		{ (void *) kZeroPad, CONTAINER_ALIGN_UP(sizeof(header)) - sizeof(header) },
+	};
+	if (WritevFull(m_Fd, iov, 2) < 0)
+	{
+		LOGCATE("FrameContainerWriter::Open write header failed: %s", strerror(errno));
+		close(m_Fd);
+		m_Fd = -1;
+		return -1;
+	}
+	m_Offset = CONTAINER_ALIGN_UP(sizeof(header));
+	m_Index.clear();
+	return 0;
+}
+
+int FrameContainerWriter::Append(const FrameRecordHeader &record, const struct iovec *data, int count)
+{
+	if (m_Fd < 0) return -1;
+
+	std::vector<struct iovec> iov;
+	iov.reserve(count + 3);
+
+	FrameRecordHeader header = record;
+	header.magic = FRAME_RECORD_MAGIC;
+	header.header_size = sizeof(header);
+	header.data_offset = CONTAINER_ALIGN_UP(sizeof(header));
+	header.data_size = 0;
+	for (int i = 0; i < count; i++) header.data_size += data[i].iov_len;
+	header.record_size = CONTAINER_ALIGN_UP(header.data_offset + header.data_size);
+
+	struct iovec head = { &header, sizeof(header) };
+	struct iovec head_pad = { (void *) kZeroPad, header.data_offset - sizeof(header) };
+	struct iovec tail_pad = { (void *) kZeroPad, header.record_size - header.data_offset - header.data_size };
+	iov.push_back(head);
+	iov.push_back(head_pad);
+	iov.insert(iov.end(), data, data + count);
+	iov.push_back(tail_pad);
+
+	//整条记录尽量一次 writev, 超过 IOV_MAX 段时分批
+	int ret = 0;
+	for (size_t start = 0; start < iov.size() && ret == 0; start += IOV_MAX)
+	{
+		int n = (int) (iov.size() - start < IOV_MAX ? iov.size() - start : IOV_MAX);
+		ret = WritevFull(m_Fd, &iov[start], n);
+	}
+	if (ret < 0)
+	{
+		LOGCATE("FrameContainerWriter::Append frame %llu failed: %s", (unsigned long long) record.frame_index, strerror(errno));
+		return -1;
+	}
+
+	FrameIndexEntry entry = { m_Offset, header.frame_index, header.timestamp_ns };
+	m_Index.push_back(entry);
+	m_Offset += header.record_size;
+	return 0;
+}
+
+int FrameContainerWriter::Close()
+{
+	if (m_Fd < 0) return 0;
+
+	FrameIndexFooter footer;
+	footer.magic = FRAME_INDEX_MAGIC;
+	footer.frame_count = (uint32_t) m_Index.size();
+	footer.index_offset = m_Offset;
+
+	struct iovec iov[2] = {
+		{ m_Index.empty() ? NULL : &m_Index[0], m_Index.size() * sizeof(FrameIndexEntry) },
+		{ &footer, sizeof(footer) },
+	};
+	int ret = WritevFull(m_Fd, iov, 2);
+
+	//最后回填文件头, 之前中断的文件 index_offset 为 0, reader 会扫描恢复
+	FrameContainerHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = FRAME_CONTAINER_MAGIC;
+	header.version = FRAME_CONTAINER_VERSION;
+	header.header_size = sizeof(header);
+	header.frame_count = footer.frame_count;
+	header.index_offset = ret == 0 ? m_Offset : 0;
+	if (pwrite(m_Fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header)) ret = -1;
+	if (ret < 0)
+	{
+		LOGCATE("FrameContainerWriter::Close write index failed: %s", strerror(errno));
+	}
+
+	close(m_Fd);
+	m_Fd = -1;
+	m_Index.clear();
+	return ret;
+}
+
+FrameContainerReader::FrameContainerReader()
+{
+	m_Data = NULL;
+	m_Size = 0;
+	m_HasIndex = false;
+}
+
+FrameContainerReader::~FrameContainerReader()
+{
+	Close();
+}
+
+int FrameContainerReader::Open(const char *path)
+{
+	Close();
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		LOGCATE("FrameContainerReader::Open %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (uint64_t) st.st_size < sizeof(FrameContainerHeader))
+	{
+		LOGCATE("FrameContainerReader::Open %s too small", path);
+		close(fd);
+		return -1;
+	}
+	void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		LOGCATE("FrameContainerReader::Open mmap %s failed: %s", path, strerror(errno));
+		return -1;
+	}
+	m_Data = (uint8_t *) data;
+	m_Size = (size_t) st.st_size;
+
+	const FrameContainerHeader *header = (const FrameContainerHeader *) m_Data;
+	if (header->magic != FRAME_CONTAINER_MAGIC || header->version != FRAME_CONTAINER_VERSION)
+	{
+		LOGCATE("FrameContainerReader::Open %s is not a frame container", path);
+		Close();
+		return -1;
+	}
+
+	m_HasIndex = LoadIndex();
+	if (!m_HasIndex)
+	{
+		LOGCATE("FrameContainerReader::Open %s has no index, scanning records", path);
+		ScanRecords();
+	}
+	return 0;
+}
+
+void FrameContainerReader::Close()
+{
+	if (m_Data) munmap(m_Data, m_Size);
+	m_Data = NULL;
+	m_Size = 0;
+	m_HasIndex = false;
+	m_Records.clear();
+}
+
+bool FrameContainerReader::IsValidRecord(uint64_t offset) const
+{
+	if (offset % FRAME_CONTAINER_ALIGN || offset + sizeof(FrameRecordHeader) > m_Size) return false;
+	const FrameRecordHeader *r = (const FrameRecordHeader *) (m_Data + offset);
+	return r->magic == FRAME_RECORD_MAGIC && r->header_size == sizeof(FrameRecordHeader) &&
+		   r->num_planes <= FRAME_CONTAINER_MAX_PLANES && r->data_offset >= sizeof(FrameRecordHeader) &&
+		   r->data_offset <= m_Size && r->data_size <= m_Size &&
+		   r->record_size >= r->data_offset + r->data_size && r->record_size <= m_Size - offset;
+}
+
+bool FrameContainerReader::LoadIndex()
+{
+	const FrameContainerHeader *header = (const FrameContainerHeader *) m_Data;
+	if (!header->index_offset || m_Size < sizeof(FrameIndexFooter)) return false;
+
+	const FrameIndexFooter *footer = (const FrameIndexFooter *) (m_Data + m_Size - sizeof(FrameIndexFooter));
+	uint64_t index_bytes = (uint64_t) footer->frame_count * sizeof(FrameIndexEntry);
+	if (footer->magic != FRAME_INDEX_MAGIC || footer->index_offset != header->index_offset ||
+		footer->index_offset + index_bytes + sizeof(FrameIndexFooter) != m_Size)
+	{
+		return false;
+	}
+
+	const FrameIndexEntry *entries = (const FrameIndexEntry *) (m_Data + footer->index_offset);
+	m_Records.clear();
+	for (uint32_t i = 0; i < footer->frame_count; i++)
+	{
+		if (!IsValidRecord(entries[i].record_offset))
+		{
+			m_Records.clear();
+			return false;
+		}
+		m_Records.push_back(entries[i].record_offset);
+	}
+	return true;
+}
+
+void FrameContainerReader::ScanRecords()
+{
+	m_Records.clear();
+	uint64_t offset = CONTAINER_ALIGN_UP(sizeof(FrameContainerHeader));
+	while (IsValidRecord(offset))
+	{
+		m_Records.push_back(offset);
+		offset += ((const FrameRecordHeader *) (m_Data + offset))->record_size;
+	}
+}
+
+int FrameContainerReader::GetFrame(int index, FrameContainerFrame *out) const
+{
+	if (index < 0 || index >= (int) m_Records.size() || !out) return -1;
+	out->record = (const FrameRecordHeader *) (m_Data + m_Records[index]);
+	out->data = m_Data + m_Records[index] + out->record->data_offset;
+	return 0;
+}
@@ -0,0 +1,138 @@
+//
+// FrameContainer.h
+//
+
+#ifndef DRMDEMO_FRAME_CONTAINER_H
+#define DRMDEMO_FRAME_CONTAINER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <vector>
+
+#define FRAME_CONTAINER_MAGIC       0x43464b52      //"RKFC"
+#define FRAME_RECORD_MAGIC          0x52464b52      //"RKFR"
+#define FRAME_INDEX_MAGIC           0x49464b52      //"RKFI"
+#define FRAME_CONTAINER_VERSION     1
+#define FRAME_CONTAINER_MAX_PLANES  3
+#define FRAME_CONTAINER_ALIGN       64              //记录头和像素数据在文件中的对齐, mmap 后平面按 cache line 对齐
+
+/*
+ * 文件布局(小端):
+ *   FrameContainerHeader
+ *   { FrameRecordHeader, 填充, 像素数据(按记录里的 offsets/pitches 排布), 填充 } * frame_count
+ *   FrameIndexEntry * frame_count
+ *   FrameIndexFooter
+ * 像素数据保持原 buffer 的排布(含 stride 填充、afbc 数据), 回放时整块拷进同样布局的 dma-buf 即可导入.
+ * 写入中断(没有 index)的文件, reader 从头顺序扫描记录恢复.
+ */
+struct FrameContainerHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t frame_count;       //Close 时回填
+	uint32_t reserved;
+	uint64_t index_offset;      //Close 时回填, 0 表示没有 index
+};
+
+struct FrameRecordHeader
+{
+	uint32_t magic;
+	uint32_t header_size;
+	uint64_t frame_index;       //调用方给的帧号, 如回放流里的序号
+	uint64_t timestamp_ns;      //CLOCK_MONOTONIC
+	uint32_t fourcc;
+	uint32_t width;
+	uint32_t height;
+	uint32_t num_planes;
+	uint64_t modifier;          //DRM format modifier, linear 为 0
+	uint32_t offsets[FRAME_CONTAINER_MAX_PLANES];
+	uint32_t pitches[FRAME_CONTAINER_MAX_PLANES];
+	uint64_t data_offset;       //像素数据相对本记录开头的偏移
+	uint64_t data_size;
+	uint64_t record_size;       //含填充, 下一条记录的起点 = 本记录起点 + record_size
+};
+
+struct FrameIndexEntry
+{
+	uint64_t record_offset;
+	uint64_t frame_index;
+	uint64_t timestamp_ns;
+};
+
+struct FrameIndexFooter
+{
+	uint32_t magic;
+	uint32_t frame_count;
+	uint64_t index_offset;
+};
+
+//顺序追加帧, 只能在一个线程里使用
+class FrameContainerWriter
+{
+public:
+	FrameContainerWriter();
+	~FrameContainerWriter();
+
+	int Open(const char *path);
+
+	//record 中 magic/header_size/data_offset/data_size/record_size 由 writer 填写;
+	//data 为像素数据, 各段依次拼接, 其排布需与 record 的 offsets/pitches 一致
+	int Append(const FrameRecordHeader &record, const struct iovec *data, int count);
+
+	//写入 index 并回填文件头
+	int Close();
+
+	bool IsOpen() const { return m_Fd >= 0; }
+	uint32_t GetFrameCount() const { return (uint32_t) m_Index.size(); }
+
+	//写满 iov 描述的全部数据, 处理短写和 EINTR
+	static int WritevFull(int fd, struct iovec *iov, int count);
+
+private:
+	FrameContainerWriter(const FrameContainerWriter &);
+	FrameContainerWriter &operator=(const FrameContainerWriter &);
+
+	int m_Fd;
+	uint64_t m_Offset;
+	std::vector<FrameIndexEntry> m_Index;
+};
+
+struct FrameContainerFrame
+{
+	const FrameRecordHeader *record;
+	const uint8_t *data;        //指向映射内的像素数据, reader 关闭前有效
+};
+
+//整个文件只读 mmap, 帧按下标随机访问
+class FrameContainerReader
+{
+public:
+	FrameContainerReader();
+	~FrameContainerReader();
+
+	int Open(const char *path);
+	void Close();
+
+	int GetFrameCount() const { return (int) m_Records.size(); }
+	int GetFrame(int index, FrameContainerFrame *out) const;
+
+	//是否从尾部 index 打开, false 表示文件没有正常关闭, 记录是扫描出来的
+	bool HasIndex() const { return m_HasIndex; }
+
+private:
+	FrameContainerReader(const FrameContainerReader &);
+	FrameContainerReader &operator=(const FrameContainerReader &);
+
+	bool LoadIndex();
+	void ScanRecords();
+	bool IsValidRecord(uint64_t offset) const;
+
+	uint8_t *m_Data;
+	size_t m_Size;
+	bool m_HasIndex;
+	std::vector<uint64_t> m_Records;    //各记录在文件中的偏移
+};
+
+#endif //DRMDEMO_FRAME_CONTAINER_H
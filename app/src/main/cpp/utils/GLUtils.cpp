@@ -1,7 +1,13 @@
 #include "GLUtils.h"
 #include "LogUtil.h"
+#include "ProgramBinaryCache.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <cstring>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <vector>
 #include <GLES2/gl2ext.h>
 
 GLuint GLUtils::LoadShader(GLenum shaderType, const char *pSource)
@@ -37,9 +43,39 @@ GLuint GLUtils::LoadShader(GLenum shaderType, const char *pSource)
 	return shader;
 }
 
+struct UniformEntry
+{
+    uint32_t id;
+    GLint location;
+
+    bool operator<(const UniformEntry &other) const { return id < other.id; }
+};
+
+//program -> 按 id 排序的 uniform 表, 只在 GL 线程访问
+static std::map<GLuint, std::vector<UniformEntry> > s_UniformCache;
+
+static double NowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 GLuint GLUtils::CreateProgram(const char *pVertexShaderSource, const char *pFragShaderSource, GLuint &vertexShaderHandle, GLuint &fragShaderHandle)
 {
     GLuint program = 0;
+
+    //先查 program 二进制缓存, 命中时跳过编译链接
+    uint64_t cacheKey = 0;
+    vertexShaderHandle = fragShaderHandle = 0;
+    program = ProgramBinaryCache::GetInstance()->Load(pVertexShaderSource, pFragShaderSource, &cacheKey);
+    if (program)
+    {
+        CacheUniforms(program);
+        return program;
+    }
+    double compileStart = NowMs();
+
     FUN_BEGIN_TIME("GLUtils::CreateProgram")
         vertexShaderHandle = LoadShader(GL_VERTEX_SHADER, pVertexShaderSource);
         if (!vertexShaderHandle) return program;
@@ -53,6 +89,7 @@ GLuint GLUtils::CreateProgram(const char *pVertexShaderSource, const char *pFrag
             CheckGLError("glAttachShader");
             glAttachShader(program, fragShaderHandle);
             CheckGLError("glAttachShader");
+            if (cacheKey) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
             glLinkProgram(program);
             GLint linkStatus = GL_FALSE;
             glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
@@ -82,6 +119,8 @@ GLuint GLUtils::CreateProgram(const char *pVertexShaderSource, const char *pFrag
             }
         }
     FUN_END_TIME("GLUtils::CreateProgram")
+    if (program && cacheKey) ProgramBinaryCache::GetInstance()->Store(program, cacheKey, NowMs() - compileStart);
+    if (program) CacheUniforms(program);
     LOGCATE("GLUtils::CreateProgram program = %d", program);
 	return program;
 }
@@ -137,6 +176,7 @@ GLuint GLUtils::CreateProgramWithFeedback(const char *pVertexShaderSource, const
             }
         }
     FUN_END_TIME("GLUtils::CreateProgramWithFeedback")
+    if (program) CacheUniforms(program);
     LOGCATE("GLUtils::CreateProgramWithFeedback program = %d", program);
     return program;
 }
@@ -146,6 +186,7 @@ void GLUtils::DeleteProgram(GLuint &program)
     LOGCATE("GLUtils::DeleteProgram");
     if (program)
     {
+        ForgetUniforms(program);
         glUseProgram(0);
         glDeleteProgram(program);
         program = 0;
@@ -161,6 +202,70 @@ void GLUtils::CheckGLError(const char *pGLOperation)
 
 }
 
+void GLUtils::CacheUniforms(GLuint programId)
+{
+    std::vector<UniformEntry> &entries = s_UniformCache[programId];
+    entries.clear();
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    if (count <= 0 || maxLength <= 0) return;
+
+    std::vector<char> name((size_t) maxLength + 16);
+    for (GLint i = 0; i < count; i++)
+    {
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(programId, (GLuint) i, maxLength, NULL, &size, &type, &name[0]);
+        GLint location = glGetUniformLocation(programId, &name[0]);
+        if (location < 0) continue;  //uniform block 成员
+
+        //数组报告为 "name[0]", 同时登记 "name" 和每个 "name[k]"
+        char *bracket = strchr(&name[0], '[');
+        if (bracket) *bracket = '\0';
+        UniformEntry entry = { GLUniformId(&name[0]), location };
+        entries.push_back(entry);
+        if (!bracket) continue;
+
+        std::string base(&name[0]);
+        for (GLint k = 0; k < size; k++)
+        {
+            char element[16];
+            snprintf(element, sizeof(element), "[%d]", k);
+            std::string elementName = base + element;
+            UniformEntry e = { GLUniformId(elementName.c_str()), glGetUniformLocation(programId, elementName.c_str()) };
+            entries.push_back(e);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 1; i < entries.size(); i++)
+    {
+        if (entries[i].id == entries[i - 1].id && entries[i].location != entries[i - 1].location)
+            LOGCATE("GLUtils::CacheUniforms program %u uniform id 0x%08x collides", programId, entries[i].id);
+    }
+}
+
+void GLUtils::ForgetUniforms(GLuint programId)
+{
+    s_UniformCache.erase(programId);
+}
+
+GLint GLUtils::GetUniformLocation(GLuint programId, uint32_t id)
+{
+    std::map<GLuint, std::vector<UniformEntry> >::iterator it = s_UniformCache.find(programId);
+    if (it == s_UniformCache.end())
+    {
+        //不是经 GLUtils 创建的 program, 第一次访问时补建
+        CacheUniforms(programId);
+        it = s_UniformCache.find(programId);
+    }
+    const std::vector<UniformEntry> &entries = it->second;
+    UniformEntry key = { id, -1 };
+    std::vector<UniformEntry>::const_iterator e = std::lower_bound(entries.begin(), entries.end(), key);
+    return (e != entries.end() && e->id == id) ? e->location : -1;
+}
+
 GLuint GLUtils::CreateProgram(const char *pVertexShaderSource, const char *pFragShaderSource) {
     GLuint vertexShaderHandle, fragShaderHandle;
     return CreateProgram(pVertexShaderSource, pFragShaderSource, vertexShaderHandle, fragShaderHandle);
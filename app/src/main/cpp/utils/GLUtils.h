@@ -2,11 +2,28 @@
 #define _BYTE_FLOW_GL_UTILS_H_
 
 #include <GLES3/gl3.h>
+#include <stdint.h>
 #include <string>
+#include <type_traits>
+
+//glm 未随工程提供, 找不到时不编译 vec/mat 相关接口
+#if defined(__has_include)
+#if __has_include(<glm.hpp>)
 #include <glm.hpp>
+#define GLUTILS_HAS_GLM 1
+#endif
+#endif
 
 #define MATH_PI 3.1415926535897932384626433832802
 
+//uniform 名的 32 位 FNV-1a, C++11 constexpr 只能写成递归
+constexpr uint32_t GLUniformId(const char *name, uint32_t hash = 2166136261u) {
+    return *name ? GLUniformId(name + 1, (hash ^ (uint8_t) *name) * 16777619u) : hash;
+}
+
+//强制在编译期求值
+#define GL_UNIFORM_ID(name) (std::integral_constant<uint32_t, GLUniformId(name)>::value)
+
 class GLUtils {
 public:
     static GLuint LoadShader(GLenum shaderType, const char *pSource);
@@ -29,57 +46,123 @@ public:
 
     static void CheckGLError(const char *pGLOperation);
 
+    //链接后用 glGetActiveUniform 一次性解析全部 uniform 位置, CreateProgram 内会自动调用
+    static void CacheUniforms(GLuint programId);
+    static void ForgetUniforms(GLuint programId);
+
+    //id 由 GL_UNIFORM_ID("name") 在编译期算出; 数组可用 "name" 或 "name[i]", uniform block 内的返回 -1
+    static GLint GetUniformLocation(GLuint programId, uint32_t id);
+    static GLint GetUniformLocation(GLuint programId, const char *name) {
+        return GetUniformLocation(programId, GLUniformId(name));
+    }
+
     static void setBool(GLuint programId, const std::string &name, bool value) {
-        glUniform1i(glGetUniformLocation(programId, name.c_str()), (int) value);
+        glUniform1i(GetUniformLocation(programId, name.c_str()), (int) value);
+    }
+
+    static void setBool(GLuint programId, uint32_t id, bool value) {
+        glUniform1i(GetUniformLocation(programId, id), (int) value);
     }
 
     static void setInt(GLuint programId, const std::string &name, int value) {
-        glUniform1i(glGetUniformLocation(programId, name.c_str()), value);
+        glUniform1i(GetUniformLocation(programId, name.c_str()), value);
+    }
+
+    static void setInt(GLuint programId, uint32_t id, int value) {
+        glUniform1i(GetUniformLocation(programId, id), value);
     }
 
     static void setFloat(GLuint programId, const std::string &name, float value) {
-        glUniform1f(glGetUniformLocation(programId, name.c_str()), value);
+        glUniform1f(GetUniformLocation(programId, name.c_str()), value);
+    }
+
+    static void setFloat(GLuint programId, uint32_t id, float value) {
+        glUniform1f(GetUniformLocation(programId, id), value);
     }
 
+#ifdef GLUTILS_HAS_GLM
     static void setVec2(GLuint programId, const std::string &name, const glm::vec2 &value) {
-        glUniform2fv(glGetUniformLocation(programId, name.c_str()), 1, &value[0]);
+        glUniform2fv(GetUniformLocation(programId, name.c_str()), 1, &value[0]);
     }
 
+    static void setVec2(GLuint programId, uint32_t id, const glm::vec2 &value) {
+        glUniform2fv(GetUniformLocation(programId, id), 1, &value[0]);
+    }
+#endif
+
     static void setVec2(GLuint programId, const std::string &name, float x, float y) {
-        glUniform2f(glGetUniformLocation(programId, name.c_str()), x, y);
+        glUniform2f(GetUniformLocation(programId, name.c_str()), x, y);
+    }
+
+    static void setVec2(GLuint programId, uint32_t id, float x, float y) {
+        glUniform2f(GetUniformLocation(programId, id), x, y);
     }
 
+#ifdef GLUTILS_HAS_GLM
     static void setVec3(GLuint programId, const std::string &name, const glm::vec3 &value) {
-        glUniform3fv(glGetUniformLocation(programId, name.c_str()), 1, &value[0]);
+        glUniform3fv(GetUniformLocation(programId, name.c_str()), 1, &value[0]);
+    }
+
+    static void setVec3(GLuint programId, uint32_t id, const glm::vec3 &value) {
+        glUniform3fv(GetUniformLocation(programId, id), 1, &value[0]);
     }
+#endif
 
     static void setVec3(GLuint programId, const std::string &name, float x, float y, float z) {
-        glUniform3f(glGetUniformLocation(programId, name.c_str()), x, y, z);
+        glUniform3f(GetUniformLocation(programId, name.c_str()), x, y, z);
+    }
+
+    static void setVec3(GLuint programId, uint32_t id, float x, float y, float z) {
+        glUniform3f(GetUniformLocation(programId, id), x, y, z);
     }
 
+#ifdef GLUTILS_HAS_GLM
     static void setVec4(GLuint programId, const std::string &name, const glm::vec4 &value) {
-        glUniform4fv(glGetUniformLocation(programId, name.c_str()), 1, &value[0]);
+        glUniform4fv(GetUniformLocation(programId, name.c_str()), 1, &value[0]);
+    }
+
+    static void setVec4(GLuint programId, uint32_t id, const glm::vec4 &value) {
+        glUniform4fv(GetUniformLocation(programId, id), 1, &value[0]);
     }
+#endif
 
     static void setVec4(GLuint programId, const std::string &name, float x, float y, float z, float w) {
-        glUniform4f(glGetUniformLocation(programId, name.c_str()), x, y, z, w);
+        glUniform4f(GetUniformLocation(programId, name.c_str()), x, y, z, w);
     }
 
+    static void setVec4(GLuint programId, uint32_t id, float x, float y, float z, float w) {
+        glUniform4f(GetUniformLocation(programId, id), x, y, z, w);
+    }
+
+#ifdef GLUTILS_HAS_GLM
     static void setMat2(GLuint programId, const std::string &name, const glm::mat2 &mat) {
-        glUniformMatrix2fv(glGetUniformLocation(programId, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(GetUniformLocation(programId, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    }
+
+    static void setMat2(GLuint programId, uint32_t id, const glm::mat2 &mat) {
+        glUniformMatrix2fv(GetUniformLocation(programId, id), 1, GL_FALSE, &mat[0][0]);
     }
 
     static void setMat3(GLuint programId, const std::string &name, const glm::mat3 &mat) {
-        glUniformMatrix3fv(glGetUniformLocation(programId, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(GetUniformLocation(programId, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    }
+
+    static void setMat3(GLuint programId, uint32_t id, const glm::mat3 &mat) {
+        glUniformMatrix3fv(GetUniformLocation(programId, id), 1, GL_FALSE, &mat[0][0]);
     }
 
     static void setMat4(GLuint programId, const std::string &name, const glm::mat4 &mat) {
-        glUniformMatrix4fv(glGetUniformLocation(programId, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(GetUniformLocation(programId, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    }
+
+    static void setMat4(GLuint programId, uint32_t id, const glm::mat4 &mat) {
+        glUniformMatrix4fv(GetUniformLocation(programId, id), 1, GL_FALSE, &mat[0][0]);
     }
 
     static glm::vec3 texCoordToVertexCoord(glm::vec2 texCoord) {
         return glm::vec3(2 * texCoord.x - 1, 1 - 2 * texCoord.y, 0);
     }
+#endif
 
     static GLuint CreateTexture(int width, int height, GLenum type);
 };
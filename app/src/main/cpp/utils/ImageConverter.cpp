@@ -0,0 +1,836 @@
+//
+// ImageConverter.cpp
+//
+
+#include "ImageConverter.h"
+#include "LogUtil.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_CONVERTER_X86 1
+#define IMAGE_CONVERTER_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IMAGE_CONVERTER_NEON 1
+#endif
+
+#define CSC_SHIFT 13
+
+/*
+ * Q13 定点矩阵, 所有实现使用同一公式:
+ * out = clamp((c0 * a + c1 * b + c2 * c + off) >> 13, 0, 255)
+ * RGB->YUV 时 (a, b, c) = (R, G, B); YUV->RGB 时 (a, b, c) = (Y, U, V).
+ * off 已包含 Y/UV 偏移和 +4096 的四舍五入.
+ */
+struct CscCoeffs
+{
+	int16_t to_yuv[3][3];
+	int32_t to_yuv_off[3];
+	int16_t to_rgb[3][3];
+	int32_t to_rgb_off[3];
+};
+
+static int16_t ToQ13(double v)
+{
+	return (int16_t) (v >= 0 ? v * (1 << CSC_SHIFT) + 0.5 : v * (1 << CSC_SHIFT) - 0.5);
+}
+
+static void BuildCoeffs(ImageCscStandard standard, CscCoeffs *c)
+{
+	bool bt709 = standard == IMAGE_CSC_BT709_LIMITED || standard == IMAGE_CSC_BT709_FULL;
+	bool full = standard == IMAGE_CSC_BT601_FULL || standard == IMAGE_CSC_BT709_FULL;
+	double kr = bt709 ? 0.2126 : 0.299;
+	double kb = bt709 ? 0.0722 : 0.114;
+	double kg = 1.0 - kr - kb;
+	double ys = full ? 1.0 : 219.0 / 255.0;
+	double cs = full ? 1.0 : 224.0 / 255.0;
+	int yoff = full ? 0 : 16;
+	const int round = 1 << (CSC_SHIFT - 1);
+
+	double to_yuv[3][3] = {
+		{ ys * kr, ys * kg, ys * kb },
+		{ -cs * kr / (2 * (1 - kb)), -cs * kg / (2 * (1 - kb)), cs * 0.5 },
+		{ cs * 0.5, -cs * kg / (2 * (1 - kr)), -cs * kb / (2 * (1 - kr)) },
+	};
+	int yuv_base[3] = { yoff, 128, 128 };
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++) c->to_yuv[i][j] = ToQ13(to_yuv[i][j]);
+		c->to_yuv_off[i] = (yuv_base[i] << CSC_SHIFT) + round;
+	}
+
+	double to_rgb[3][3] = {
+		{ 1 / ys, 0, 2 * (1 - kr) / cs },
+		{ 1 / ys, -2 * kb * (1 - kb) / kg / cs, -2 * kr * (1 - kr) / kg / cs },
+		{ 1 / ys, 2 * (1 - kb) / cs, 0 },
+	};
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++) c->to_rgb[i][j] = ToQ13(to_rgb[i][j]);
+		c->to_rgb_off[i] = -c->to_rgb[i][0] * yoff - (c->to_rgb[i][1] + c->to_rgb[i][2]) * 128 + round;
+	}
+}
+
+typedef void (*RgbaToYuvFn)(const uint8_t *rgba, uint8_t *y, uint8_t *u, uint8_t *v, int n, const CscCoeffs &c);
+typedef void (*YuvToRgbaFn)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgba, int n,
+							const CscCoeffs &c);
+
+struct CscKernels
+{
+	RgbaToYuvFn rgba_to_yuv;
+	YuvToRgbaFn yuv_to_rgba;
+};
+
+static inline uint8_t Clamp8(int v)
+{
+	return (uint8_t) (v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static void RgbaToYuvScalar(const uint8_t *rgba, uint8_t *y, uint8_t *u, uint8_t *v, int n, const CscCoeffs &c)
+{
+	uint8_t *out[3] = { y, u, v };
+	for (int i = 0; i < n; i++)
+	{
+		int R = rgba[i * 4], G = rgba[i * 4 + 1], B = rgba[i * 4 + 2];
+		for (int k = 0; k < 3; k++)
+		{
+			out[k][i] = Clamp8((c.to_yuv[k][0] * R + c.to_yuv[k][1] * G + c.to_yuv[k][2] * B + c.to_yuv_off[k]) >> CSC_SHIFT);
+		}
+	}
+}
+
+static void YuvToRgbaScalar(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgba, int n,
+							const CscCoeffs &c)
+{
+	for (int i = 0; i < n; i++)
+	{
+		int Y = y[i], U = u[i], V = v[i];
+		for (int k = 0; k < 3; k++)
+		{
+			rgba[i * 4 + k] = Clamp8((c.to_rgb[k][0] * Y + c.to_rgb[k][1] * U + c.to_rgb[k][2] * V + c.to_rgb_off[k]) >> CSC_SHIFT);
+		}
+		rgba[i * 4 + 3] = 255;
+	}
+}
+
+#ifdef IMAGE_CONVERTER_X86
+//4 个 RGBA 像素, madd 得到每像素两段部分和, hadd 合成一个 int32
+IMAGE_CONVERTER_TARGET("sse4.1")
+static inline __m128i Dot4Sse41(__m128i px, __m128i k, __m128i off)
+{
+	__m128i lo = _mm_madd_epi16(_mm_cvtepu8_epi16(px), k);
+	__m128i hi = _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(px, 8)), k);
+	return _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), off), CSC_SHIFT);
+}
+
+IMAGE_CONVERTER_TARGET("sse4.1")
+static inline __m128i Pack16Sse41(const __m128i *s)
+{
+	return _mm_packus_epi16(_mm_packs_epi32(s[0], s[1]), _mm_packs_epi32(s[2], s[3]));
+}
+
+IMAGE_CONVERTER_TARGET("sse4.1")
+static void RgbaToYuvSse41(const uint8_t *rgba, uint8_t *y, uint8_t *u, uint8_t *v, int n, const CscCoeffs &c)
+{
+	__m128i k[3], off[3];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		k[ch] = _mm_setr_epi16(c.to_yuv[ch][0], c.to_yuv[ch][1], c.to_yuv[ch][2], 0,
+							   c.to_yuv[ch][0], c.to_yuv[ch][1], c.to_yuv[ch][2], 0);
+		off[ch] = _mm_set1_epi32(c.to_yuv_off[ch]);
+	}
+	uint8_t *out[3] = { y, u, v };
+
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i px[4];
+		for (int q = 0; q < 4; q++) px[q] = _mm_loadu_si128((const __m128i *) (rgba + (i + q * 4) * 4));
+		for (int ch = 0; ch < 3; ch++)
+		{
+			__m128i s[4];
+			for (int q = 0; q < 4; q++) s[q] = Dot4Sse41(px[q], k[ch], off[ch]);
+			_mm_storeu_si128((__m128i *) (out[ch] + i), Pack16Sse41(s));
+		}
+	}
+	RgbaToYuvScalar(rgba + i * 4, y + i, u + i, v + i, n - i, c);
+}
+
+//R/G/B 各 16 字节交织成 16 个 RGBA 像素, A = 255
+IMAGE_CONVERTER_TARGET("sse4.1")
+static inline void StoreRgba16Sse41(uint8_t *dst, __m128i r, __m128i g, __m128i b)
+{
+	const __m128i a = _mm_set1_epi8((char) 0xff);
+	__m128i rg_lo = _mm_unpacklo_epi8(r, g), rg_hi = _mm_unpackhi_epi8(r, g);
+	__m128i ba_lo = _mm_unpacklo_epi8(b, a), ba_hi = _mm_unpackhi_epi8(b, a);
+	_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(rg_lo, ba_lo));
+	_mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi16(rg_lo, ba_lo));
+	_mm_storeu_si128((__m128i *) (dst + 32), _mm_unpacklo_epi16(rg_hi, ba_hi));
+	_mm_storeu_si128((__m128i *) (dst + 48), _mm_unpackhi_epi16(rg_hi, ba_hi));
+}
+
+IMAGE_CONVERTER_TARGET("sse4.1")
+static void YuvToRgbaSse41(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgba, int n,
+						   const CscCoeffs &c)
+{
+	__m128i kyu[3], kv[3], off[3];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		kyu[ch] = _mm_setr_epi16(c.to_rgb[ch][0], c.to_rgb[ch][1], c.to_rgb[ch][0], c.to_rgb[ch][1],
+								 c.to_rgb[ch][0], c.to_rgb[ch][1], c.to_rgb[ch][0], c.to_rgb[ch][1]);
+		kv[ch] = _mm_setr_epi16(c.to_rgb[ch][2], 0, c.to_rgb[ch][2], 0, c.to_rgb[ch][2], 0, c.to_rgb[ch][2], 0);
+		off[ch] = _mm_set1_epi32(c.to_rgb_off[ch]);
+	}
+	const __m128i zero = _mm_setzero_si128();
+
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i y8 = _mm_loadu_si128((const __m128i *) (y + i));
+		__m128i u8 = _mm_loadu_si128((const __m128i *) (u + i));
+		__m128i v8 = _mm_loadu_si128((const __m128i *) (v + i));
+		//(Y, U) 与 (V, 0) 交织后每 4 像素一组做 madd
+		__m128i yu[2] = { _mm_unpacklo_epi8(y8, u8), _mm_unpackhi_epi8(y8, u8) };
+		__m128i v0[2] = { _mm_unpacklo_epi8(v8, zero), _mm_unpackhi_epi8(v8, zero) };
+		__m128i yu16[4], v16[4];
+		for (int q = 0; q < 4; q++)
+		{
+			__m128i a = yu[q >> 1], b = v0[q >> 1];
+			if (q & 1)
+			{
+				a = _mm_srli_si128(a, 8);
+				b = _mm_srli_si128(b, 8);
+			}
+			yu16[q] = _mm_cvtepu8_epi16(a);
+			v16[q] = _mm_cvtepu8_epi16(b);
+		}
+
+		__m128i rgb[3];
+		for (int ch = 0; ch < 3; ch++)
+		{
+			__m128i s[4];
+			for (int q = 0; q < 4; q++)
+			{
+				__m128i sum = _mm_add_epi32(_mm_madd_epi16(yu16[q], kyu[ch]), _mm_madd_epi16(v16[q], kv[ch]));
+				s[q] = _mm_srai_epi32(_mm_add_epi32(sum, off[ch]), CSC_SHIFT);
+			}
+			rgb[ch] = Pack16Sse41(s);
+		}
+		StoreRgba16Sse41(rgba + i * 4, rgb[0], rgb[1], rgb[2]);
+	}
+	YuvToRgbaScalar(y + i, u + i, v + i, rgba + i * 4, n - i, c);
+}
+
+//16 个 int32(两组各 8 个, 按像素顺序)压成 16 字节; packs 在 128 位 lane 内交错, 需按 64 位重排
+IMAGE_CONVERTER_TARGET("avx2")
+static inline __m128i Pack16Avx2(__m256i a, __m256i b)
+{
+	__m256i s16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+	return _mm_packus_epi16(_mm256_castsi256_si128(s16), _mm256_extracti128_si256(s16, 1));
+}
+
+//8 个 RGBA 像素的点积, hadd 在 lane 内得到 [p0 p1 p4 p5 | p2 p3 p6 p7], 重排回顺序
+IMAGE_CONVERTER_TARGET("avx2")
+static inline __m256i Dot8Avx2(const uint8_t *px, __m256i k, __m256i off)
+{
+	__m256i lo = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) px)), k);
+	__m256i hi = _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (px + 16))), k);
+	__m256i sum = _mm256_permute4x64_epi64(_mm256_hadd_epi32(lo, hi), 0xD8);
+	return _mm256_srai_epi32(_mm256_add_epi32(sum, off), CSC_SHIFT);
+}
+
+IMAGE_CONVERTER_TARGET("avx2")
+static void RgbaToYuvAvx2(const uint8_t *rgba, uint8_t *y, uint8_t *u, uint8_t *v, int n, const CscCoeffs &c)
+{
+	__m256i k[3], off[3];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		k[ch] = _mm256_setr_epi16(c.to_yuv[ch][0], c.to_yuv[ch][1], c.to_yuv[ch][2], 0,
+								  c.to_yuv[ch][0], c.to_yuv[ch][1], c.to_yuv[ch][2], 0,
+								  c.to_yuv[ch][0], c.to_yuv[ch][1], c.to_yuv[ch][2], 0,
+								  c.to_yuv[ch][0], c.to_yuv[ch][1], c.to_yuv[ch][2], 0);
+		off[ch] = _mm256_set1_epi32(c.to_yuv_off[ch]);
+	}
+	uint8_t *out[3] = { y, u, v };
+
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		const uint8_t *px = rgba + i * 4;
+		for (int ch = 0; ch < 3; ch++)
+		{
+			__m128i packed = Pack16Avx2(Dot8Avx2(px, k[ch], off[ch]), Dot8Avx2(px + 32, k[ch], off[ch]));
+			_mm_storeu_si128((__m128i *) (out[ch] + i), packed);
+		}
+	}
+	RgbaToYuvScalar(rgba + i * 4, y + i, u + i, v + i, n - i, c);
+}
+
+IMAGE_CONVERTER_TARGET("avx2")
+static void YuvToRgbaAvx2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgba, int n,
+						  const CscCoeffs &c)
+{
+	__m256i kyu[3], kv[3], off[3];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		int32_t pair_yu = (int32_t) (((uint32_t) (uint16_t) c.to_rgb[ch][1] << 16) | (uint16_t) c.to_rgb[ch][0]);
+		kyu[ch] = _mm256_set1_epi32(pair_yu);
+		kv[ch] = _mm256_set1_epi32((uint16_t) c.to_rgb[ch][2]);
+		off[ch] = _mm256_set1_epi32(c.to_rgb_off[ch]);
+	}
+	const __m128i zero = _mm_setzero_si128();
+
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i y8 = _mm_loadu_si128((const __m128i *) (y + i));
+		__m128i u8 = _mm_loadu_si128((const __m128i *) (u + i));
+		__m128i v8 = _mm_loadu_si128((const __m128i *) (v + i));
+		__m256i yu[2] = { _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(y8, u8)), _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(y8, u8)) };
+		__m256i v0[2] = { _mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, zero)), _mm256_cvtepu8_epi16(_mm_unpackhi_epi8(v8, zero)) };
+
+		__m128i rgb[3];
+		for (int ch = 0; ch < 3; ch++)
+		{
+			__m256i s[2];
+			for (int h = 0; h < 2; h++)
+			{
+				__m256i sum = _mm256_add_epi32(_mm256_madd_epi16(yu[h], kyu[ch]), _mm256_madd_epi16(v0[h], kv[ch]));
+				s[h] = _mm256_srai_epi32(_mm256_add_epi32(sum, off[ch]), CSC_SHIFT);
+			}
+			rgb[ch] = Pack16Avx2(s[0], s[1]);
+		}
+		StoreRgba16Sse41(rgba + i * 4, rgb[0], rgb[1], rgb[2]);
+	}
+	YuvToRgbaScalar(y + i, u + i, v + i, rgba + i * 4, n - i, c);
+}
+#endif //IMAGE_CONVERTER_X86
+
+#ifdef IMAGE_CONVERTER_NEON
+static inline uint8x8_t Dot8Neon(int16x8_t a, int16x8_t b, int16x8_t c, const int16_t *k, int32_t off)
+{
+	int32x4_t lo = vdupq_n_s32(off), hi = vdupq_n_s32(off);
+	lo = vmlal_n_s16(lo, vget_low_s16(a), k[0]);
+	hi = vmlal_n_s16(hi, vget_high_s16(a), k[0]);
+	lo = vmlal_n_s16(lo, vget_low_s16(b), k[1]);
+	hi = vmlal_n_s16(hi, vget_high_s16(b), k[1]);
+	lo = vmlal_n_s16(lo, vget_low_s16(c), k[2]);
+	hi = vmlal_n_s16(hi, vget_high_s16(c), k[2]);
+	int16x8_t s = vcombine_s16(vqmovn_s32(vshrq_n_s32(lo, CSC_SHIFT)), vqmovn_s32(vshrq_n_s32(hi, CSC_SHIFT)));
+	return vqmovun_s16(s);
+}
+
+static inline int16x8_t Widen(uint8x8_t v)
+{
+	return vreinterpretq_s16_u16(vmovl_u8(v));
+}
+
+static void RgbaToYuvNeon(const uint8_t *rgba, uint8_t *y, uint8_t *u, uint8_t *v, int n, const CscCoeffs &c)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		uint8x8x4_t px = vld4_u8(rgba + i * 4);
+		int16x8_t r = Widen(px.val[0]), g = Widen(px.val[1]), b = Widen(px.val[2]);
+		vst1_u8(y + i, Dot8Neon(r, g, b, c.to_yuv[0], c.to_yuv_off[0]));
+		vst1_u8(u + i, Dot8Neon(r, g, b, c.to_yuv[1], c.to_yuv_off[1]));
+		vst1_u8(v + i, Dot8Neon(r, g, b, c.to_yuv[2], c.to_yuv_off[2]));
+	}
+	RgbaToYuvScalar(rgba + i * 4, y + i, u + i, v + i, n - i, c);
+}
+
+static void YuvToRgbaNeon(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *rgba, int n,
+						  const CscCoeffs &c)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		int16x8_t Y = Widen(vld1_u8(y + i)), U = Widen(vld1_u8(u + i)), V = Widen(vld1_u8(v + i));
+		uint8x8x4_t px;
+		px.val[0] = Dot8Neon(Y, U, V, c.to_rgb[0], c.to_rgb_off[0]);
+		px.val[1] = Dot8Neon(Y, U, V, c.to_rgb[1], c.to_rgb_off[1]);
+		px.val[2] = Dot8Neon(Y, U, V, c.to_rgb[2], c.to_rgb_off[2]);
+		px.val[3] = vdup_n_u8(255);
+		vst4_u8(rgba + i * 4, px);
+	}
+	YuvToRgbaScalar(y + i, u + i, v + i, rgba + i * 4, n - i, c);
+}
+#endif //IMAGE_CONVERTER_NEON
+
+static CscKernels GetKernels(CpuSimdLevel level)
+{
+	CscKernels k = { RgbaToYuvScalar, YuvToRgbaScalar };
+#ifdef IMAGE_CONVERTER_X86
+	if (level == CPU_SIMD_SSE41)
+	{
+		k.rgba_to_yuv = RgbaToYuvSse41;
+		k.yuv_to_rgba = YuvToRgbaSse41;
+	}
+	else if (level == CPU_SIMD_AVX2)
+	{
+		k.rgba_to_yuv = RgbaToYuvAvx2;
+		k.yuv_to_rgba = YuvToRgbaAvx2;
+	}
+#endif
+#ifdef IMAGE_CONVERTER_NEON
+	if (level == CPU_SIMD_NEON)
+	{
+		k.rgba_to_yuv = RgbaToYuvNeon;
+		k.yuv_to_rgba = YuvToRgbaNeon;
+	}
+#endif
+	return k;
+}
+
+static bool IsKnownFormat(int format)
+{
+	return format >= IMAGE_FORMAT_RGBA && format <= IMAGE_FORMAT_P010;
+}
+
+static bool IsChromaSubsampledX(int format)
+{
+	int hsub, vsub;
+	NativeImageUtil::GetChromaSubsample(format, &hsub, &vsub);
+	return hsub > 1;
+}
+
+static bool IsChromaSubsampledY(int format)
+{
+	int hsub, vsub;
+	NativeImageUtil::GetChromaSubsample(format, &hsub, &vsub);
+	return vsub > 1;
+}
+
+static inline uint8_t *RowOf(const NativeImage *img, int plane, int row)
+{
+	return img->ppPlane[plane] + (size_t) row * img->pLineSize[plane];
+}
+
+static int64_t ImageConverterNowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+ImageConverter::ImageConverter()
+{
+	m_Level = CpuFeatures::DetectSimdLevel();
+	m_Neutral = NULL;
+}
+
+void ImageConverter::SetSimdLevel(CpuSimdLevel level)
+{
+	m_Level = CpuFeatures::Clamp(level);
+}
+
+const char *ImageConverter::FormatName(int format)
+{
+	switch (format)
+	{
+		case IMAGE_FORMAT_RGBA: return "RGBA";
+		case IMAGE_FORMAT_NV21: return "NV21";
+		case IMAGE_FORMAT_NV12: return "NV12";
+		case IMAGE_FORMAT_I420: return "I420";
+		case IMAGE_FORMAT_YUYV: return "YUYV";
+		case IMAGE_FORMAT_GRAY: return "GRAY";
+		case IMAGE_FORMAT_I444: return "I444";
+		case IMAGE_FORMAT_P010: return "P010";
+		default: return "unknown";
+	}
+}
+
+//第 row 行起 rows 行(1 或 2)解到 pivot; 能直接引用源平面的行不拷贝, 4:2:0 的两行共用一份上采样色度
+void ImageConverter::UnpackRows(const NativeImage *src, int row, int rows, PivotRows *pivot)
+{
+	int w = src->width;
+	for (int i = 0; i < rows; i++)
+	{
+		int line = row + i;
+		switch (src->format)
+		{
+			case IMAGE_FORMAT_RGBA:
+				pivot->rgba[i] = RowOf(src, 0, line);
+				break;
+			case IMAGE_FORMAT_GRAY:
+				pivot->y[i] = RowOf(src, 0, line);
+				pivot->u[i] = m_Neutral;
+				pivot->v[i] = m_Neutral;
+				break;
+			case IMAGE_FORMAT_I444:
+				pivot->y[i] = RowOf(src, 0, line);
+				pivot->u[i] = RowOf(src, 1, line);
+				pivot->v[i] = RowOf(src, 2, line);
+				break;
+			case IMAGE_FORMAT_YUYV:
+			{
+				const uint8_t *p = RowOf(src, 0, line);
+				uint8_t *y = pivot->y[i], *u = pivot->u[i], *v = pivot->v[i];
+				for (int x = 0; x < w; x += 2)
+				{
+					y[x] = p[x * 2];
+					y[x + 1] = p[x * 2 + 2];
+					u[x] = u[x + 1] = p[x * 2 + 1];
+					v[x] = v[x + 1] = p[x * 2 + 3];
+				}
+				break;
+			}
+			case IMAGE_FORMAT_P010:
+			{
+				const uint16_t *p = (const uint16_t *) RowOf(src, 0, line);
+				uint8_t *y = pivot->y[i];
+				for (int x = 0; x < w; x++) y[x] = (uint8_t) (p[x] >> 8);
+				break;
+			}
+			default:        //NV12/NV21/I420 的 Y 平面
+				pivot->y[i] = RowOf(src, 0, line);
+				break;
+		}
+	}
+
+	if (!IsChromaSubsampledY(src->format)) return;
+
+	uint8_t *u = pivot->u[0], *v = pivot->v[0];
+	int crow = row / 2;
+	switch (src->format)
+	{
+		case IMAGE_FORMAT_NV12:
+		case IMAGE_FORMAT_NV21:
+		{
+			const uint8_t *p = RowOf(src, 1, crow);
+			int ui = src->format == IMAGE_FORMAT_NV12 ? 0 : 1;
+			for (int x = 0; x < w; x += 2)
+			{
+				u[x] = u[x + 1] = p[x + ui];
+				v[x] = v[x + 1] = p[x + 1 - ui];
+			}
+			break;
+		}
+		case IMAGE_FORMAT_I420:
+		{
+			const uint8_t *pu = RowOf(src, 1, crow), *pv = RowOf(src, 2, crow);
+			for (int x = 0; x < w; x += 2)
+			{
+				u[x] = u[x + 1] = pu[x / 2];
+				v[x] = v[x + 1] = pv[x / 2];
+			}
+			break;
+		}
+		case IMAGE_FORMAT_P010:
+		{
+			const uint16_t *p = (const uint16_t *) RowOf(src, 1, crow);
+			for (int x = 0; x < w; x += 2)
+			{
+				u[x] = u[x + 1] = (uint8_t) (p[x] >> 8);
+				v[x] = v[x + 1] = (uint8_t) (p[x + 1] >> 8);
+			}
+			break;
+		}
+		default:
+			break;
+	}
+	pivot->u[1] = u;
+	pivot->v[1] = v;
+}
+
+//pivot 写入 dst 的第 row 行起 rows 行; 与 dst 平面同址的行跳过
+void ImageConverter::PackRows(const PivotRows &pivot, NativeImage *dst, int row, int rows)
+{
+	int w = dst->width;
+	for (int i = 0; i < rows; i++)
+	{
+		int line = row + i;
+		switch (dst->format)
+		{
+			case IMAGE_FORMAT_RGBA:
+				if (pivot.rgba[i] != RowOf(dst, 0, line)) memcpy(RowOf(dst, 0, line), pivot.rgba[i], (size_t) w * 4);
+				break;
+			case IMAGE_FORMAT_I444:
+				if (pivot.u[i] != RowOf(dst, 1, line)) memcpy(RowOf(dst, 1, line), pivot.u[i], w);
+				if (pivot.v[i] != RowOf(dst, 2, line)) memcpy(RowOf(dst, 2, line), pivot.v[i], w);
+				//fall through
+			case IMAGE_FORMAT_GRAY:
+			case IMAGE_FORMAT_NV12:
+			case IMAGE_FORMAT_NV21:
+			case IMAGE_FORMAT_I420:
+				if (pivot.y[i] != RowOf(dst, 0, line)) memcpy(RowOf(dst, 0, line), pivot.y[i], w);
+				break;
+			case IMAGE_FORMAT_YUYV:
+			{
+				uint8_t *p = RowOf(dst, 0, line);
+				const uint8_t *y = pivot.y[i], *u = pivot.u[i], *v = pivot.v[i];
+				for (int x = 0; x < w; x += 2)
+				{
+					p[x * 2] = y[x];
+					p[x * 2 + 1] = (uint8_t) ((u[x] + u[x + 1] + 1) >> 1);
+					p[x * 2 + 2] = y[x + 1];
+					p[x * 2 + 3] = (uint8_t) ((v[x] + v[x + 1] + 1) >> 1);
+				}
+				break;
+			}
+			case IMAGE_FORMAT_P010:
+			{
+				//8 位扩展到 10 位(高位复制到低位), 再放到 16 位的高 10 位
+				uint16_t *p = (uint16_t *) RowOf(dst, 0, line);
+				const uint8_t *y = pivot.y[i];
+				for (int x = 0; x < w; x++) p[x] = (uint16_t) ((y[x] << 8) | (y[x] & 0xc0));
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	if (!IsChromaSubsampledY(dst->format)) return;
+
+	//2x2 平均; 4:2:x 格式要求偶数高, 这里 rows 一定为 2
+	const uint8_t *u0 = pivot.u[0], *u1 = pivot.u[1], *v0 = pivot.v[0], *v1 = pivot.v[1];
+	int crow = row / 2;
+	switch (dst->format)
+	{
+		case IMAGE_FORMAT_NV12:
+		case IMAGE_FORMAT_NV21:
+		{
+			uint8_t *p = RowOf(dst, 1, crow);
+			int ui = dst->format == IMAGE_FORMAT_NV12 ? 0 : 1;
+			for (int x = 0; x < w; x += 2)
+			{
+				p[x + ui] = (uint8_t) ((u0[x] + u0[x + 1] + u1[x] + u1[x + 1] + 2) >> 2);
+				p[x + 1 - ui] = (uint8_t) ((v0[x] + v0[x + 1] + v1[x] + v1[x + 1] + 2) >> 2);
+			}
+			break;
+		}
+		case IMAGE_FORMAT_I420:
+		{
+			uint8_t *pu = RowOf(dst, 1, crow), *pv = RowOf(dst, 2, crow);
+			for (int x = 0; x < w; x += 2)
+			{
+				pu[x / 2] = (uint8_t) ((u0[x] + u0[x + 1] + u1[x] + u1[x + 1] + 2) >> 2);
+				pv[x / 2] = (uint8_t) ((v0[x] + v0[x + 1] + v1[x] + v1[x + 1] + 2) >> 2);
+			}
+			break;
+		}
+		case IMAGE_FORMAT_P010:
+		{
+			uint16_t *p = (uint16_t *) RowOf(dst, 1, crow);
+			for (int x = 0; x < w; x += 2)
+			{
+				int cu = (u0[x] + u0[x + 1] + u1[x] + u1[x + 1] + 2) >> 2;
+				int cv = (v0[x] + v0[x + 1] + v1[x] + v1[x + 1] + 2) >> 2;
+				p[x] = (uint16_t) ((cu << 8) | (cu & 0xc0));
+				p[x + 1] = (uint16_t) ((cv << 8) | (cv & 0xc0));
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+int ImageConverter::Convert(const NativeImage *src, NativeImage *dst, ImageCscStandard standard)
+{
+	if (!src || !dst || !src->ppPlane[0] || !dst->ppPlane[0] ||
+		src->width != dst->width || src->height != dst->height || src->width <= 0 || src->height <= 0)
+	{
+		LOGCATE("ImageConverter::Convert invalid params");
+		return -1;
+	}
+	if (!IsKnownFormat(src->format) || !IsKnownFormat(dst->format))
+	{
+		LOGCATE("ImageConverter::Convert unsupported format %d -> %d", src->format, dst->format);
+		return -1;
+	}
+
+	int w = src->width, h = src->height;
+	bool sub_x = IsChromaSubsampledX(src->format) || IsChromaSubsampledX(dst->format);
+	bool sub_y = IsChromaSubsampledY(src->format) || IsChromaSubsampledY(dst->format);
+	if ((sub_x && (w & 1)) || (sub_y && (h & 1)))
+	{
+		LOGCATE("ImageConverter::Convert %s -> %s needs even size, got %dx%d",
+				FormatName(src->format), FormatName(dst->format), w, h);
+		return -1;
+	}
+
+	if (src->format == dst->format)
+	{
+		int row_bytes[3], rows[3];
+		int planes = NativeImageUtil::GetPlaneGeometry(src->format, w, h, row_bytes, rows);
+		for (int p = 0; p < planes; p++)
+		{
+			for (int r = 0; r < rows[p]; r++) memcpy(RowOf(dst, p, r), RowOf(src, p, r), row_bytes[p]);
+		}
+		return 0;
+	}
+
+	//scratch: 两行的 Y/U/V 各 w 字节, 两行 RGBA 各 4w 字节, 一行中性色度
+	size_t aligned_w = ((size_t) w + 63) & ~(size_t) 63;
+	m_Scratch.resize(aligned_w * (6 + 8 + 1) + 64);
+	uint8_t *base = (uint8_t *) (((uintptr_t) &m_Scratch[0] + 63) & ~(uintptr_t) 63);
+	uint8_t *scratch_y[2] = { base, base + aligned_w };
+	uint8_t *scratch_u[2] = { base + aligned_w * 2, base + aligned_w * 3 };
+	uint8_t *scratch_v[2] = { base + aligned_w * 4, base + aligned_w * 5 };
+	uint8_t *scratch_rgba[2] = { base + aligned_w * 6, base + aligned_w * 10 };
+	m_Neutral = base + aligned_w * 14;
+	memset(m_Neutral, 128, w);
+
+	CscCoeffs coeffs;
+	BuildCoeffs(standard, &coeffs);
+	CscKernels kern = GetKernels(m_Level);
+	bool src_rgb = src->format == IMAGE_FORMAT_RGBA;
+	bool dst_rgb = dst->format == IMAGE_FORMAT_RGBA;
+
+	for (int row = 0; row < h; row += 2)
+	{
+		int rows = std::min(2, h - row);
+		PivotRows pivot;
+		for (int i = 0; i < 2; i++)
+		{
+			pivot.rgba[i] = scratch_rgba[i];
+			pivot.y[i] = scratch_y[i];
+			pivot.u[i] = scratch_u[i];
+			pivot.v[i] = scratch_v[i];
+		}
+		UnpackRows(src, row, rows, &pivot);
+
+		if (src_rgb)
+		{
+			//矩阵结果尽量直接写进目标平面
+			for (int i = 0; i < rows; i++)
+			{
+				int line = row + i;
+				uint8_t *y = scratch_y[i], *u = scratch_u[i], *v = scratch_v[i];
+				if (dst->format == IMAGE_FORMAT_I444)
+				{
+					u = RowOf(dst, 1, line);
+					v = RowOf(dst, 2, line);
+				}
+				if (dst->format != IMAGE_FORMAT_YUYV && dst->format != IMAGE_FORMAT_P010) y = RowOf(dst, 0, line);
+				kern.rgba_to_yuv(pivot.rgba[i], y, u, v, w, coeffs);
+				pivot.y[i] = y;
+				pivot.u[i] = u;
+				pivot.v[i] = v;
+			}
+		}
+		else if (dst_rgb)
+		{
+			for (int i = 0; i < rows; i++)
+			{
+				pivot.rgba[i] = RowOf(dst, 0, row + i);
+				kern.yuv_to_rgba(pivot.y[i], pivot.u[i], pivot.v[i], pivot.rgba[i], w, coeffs);
+			}
+		}
+		PackRows(pivot, dst, row, rows);
+	}
+	return 0;
+}
+
+//benchmark 用的图像, 行按 cache line 对齐
+static bool AllocBenchImage(int format, int w, int h, NativeImage *img)
+{
+	img->width = w;
+	img->height = h;
+	img->format = format;
+	NativeImageUtil::AllocNativeImage(img, NativeImageAlign::CacheLine());
+	return img->ppPlane[0] != nullptr;
+}
+
+static uint64_t ImageChecksum(const NativeImage *img)
+{
+	int row_bytes[3], rows[3];
+	int planes = NativeImageUtil::GetPlaneGeometry(img->format, img->width, img->height, row_bytes, rows);
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (int p = 0; p < planes; p++)
+	{
+		for (int r = 0; r < rows[p]; r++)
+		{
+			const uint8_t *row = RowOf(img, p, r);
+			for (int x = 0; x < row_bytes[p]; x++)
+			{
+				hash ^= row[x];
+				hash *= 0x100000001b3ull;
+			}
+		}
+	}
+	return hash;
+}
+
+void ImageConverter::Benchmark(int width, int height, int frames, ImageCscStandard standard)
+{
+	if (frames <= 0) return;
+
+	const int format_count = IMAGE_FORMAT_P010 - IMAGE_FORMAT_RGBA + 1;
+	NativeImage images[format_count];
+	bool ok = true;
+	for (int f = 0; f < format_count; f++) ok = AllocBenchImage(IMAGE_FORMAT_RGBA + f, width, height, &images[f]) && ok;
+
+	if (ok)
+	{
+		//RGBA 渐变作为所有格式的源内容
+		NativeImage &rgba = images[0];
+		for (int y = 0; y < height; y++)
+		{
+			uint8_t *p = RowOf(&rgba, 0, y);
+			for (int x = 0; x < width; x++)
+			{
+				p[x * 4] = (uint8_t) (x * 255 / std::max(width - 1, 1));
+				p[x * 4 + 1] = (uint8_t) (y * 255 / std::max(height - 1, 1));
+				p[x * 4 + 2] = (uint8_t) ((x + y) & 0xff);
+				p[x * 4 + 3] = 255;
+			}
+		}
+		for (int f = 1; f < format_count; f++) ok = Convert(&rgba, &images[f], standard) == 0 && ok;
+	}
+
+	if (!ok)
+	{
+		LOGCATE("ImageConverter::Benchmark %dx%d setup failed", width, height);
+	}
+	else
+	{
+		CpuSimdLevel saved = m_Level;
+		CpuSimdLevel levels[] = { CPU_SIMD_SCALAR, CPU_SIMD_SSE41, CPU_SIMD_AVX2, CPU_SIMD_NEON };
+		const double mpix = (double) width * height * frames / 1000000.0;
+		for (int s = 0; s < format_count; s++)
+		{
+			for (int d = 0; d < format_count; d++)
+			{
+				if (s == d) continue;
+				NativeImage &src = images[s];
+				NativeImage scratch;
+				if (!AllocBenchImage(IMAGE_FORMAT_RGBA + d, width, height, &scratch)) continue;
+
+				char line[256];
+				int len = snprintf(line, sizeof(line), "%s->%s", FormatName(src.format), FormatName(scratch.format));
+				uint64_t reference = 0;
+				for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++)
+				{
+					SetSimdLevel(levels[l]);
+					if (m_Level != levels[l]) continue;
+
+					Convert(&src, &scratch, standard);
+					int64_t t0 = ImageConverterNowUs();
+					for (int f = 0; f < frames; f++) Convert(&src, &scratch, standard);
+					int64_t us = std::max<int64_t>(ImageConverterNowUs() - t0, 1);
+
+					//各级别结果应逐字节一致
+					uint64_t sum = ImageChecksum(&scratch);
+					if (l == 0) reference = sum;
+					len += snprintf(line + len, sizeof(line) - len, " %s=%.1f%s", CpuFeatures::SimdLevelName(levels[l]),
+									mpix * 1000000.0 / us, sum == reference ? "" : "(MISMATCH)");
+					if (len >= (int) sizeof(line)) len = sizeof(line) - 1;
+				}
+				LOGCATE("ImageConverter %dx%d %s MPix/s", width, height, line);
+				NativeImageUtil::FreeNativeImage(&scratch);
+			}
+		}
+		m_Level = saved;
+	}
+
+	for (int f = 0; f < format_count; f++) NativeImageUtil::FreeNativeImage(&images[f]);
+}
@@ -0,0 +1,64 @@
+//
+// ImageConverter.h
+//
+
+#ifndef DRMDEMO_IMAGE_CONVERTER_H
+#define DRMDEMO_IMAGE_CONVERTER_H
+
+#include "ImageDef.h"
+#include "CpuFeatures.h"
+
+#include <stdint.h>
+#include <vector>
+
+//与 shader 中 yuvCscStandardEXT 的取值对应, BT709_FULL 只在 CPU 侧提供
+enum ImageCscStandard
+{
+	IMAGE_CSC_BT601_LIMITED = 0,    //itu_601
+	IMAGE_CSC_BT601_FULL,           //itu_601_full_range
+	IMAGE_CSC_BT709_LIMITED,        //itu_709
+	IMAGE_CSC_BT709_FULL,
+};
+
+/*
+ * NativeImage 之间的格式转换, 支持 IMAGE_FORMAT_* 中任意两种格式互转.
+ * 每两行一组: 源格式先解到全分辨率的 Y/U/V 行(或直接用 RGBA 行), 需要时过一次颜色矩阵,
+ * 再打包成目标格式, 色度下采样取 2x2(YUYV 为 2x1)平均; 能直接引用源/目标平面的行不做拷贝.
+ * 颜色矩阵为 Q13 定点, 有 SSE4.1/AVX2/NEON 实现, 运行时按 CPU 能力选择, 各实现输出逐字节一致.
+ * 中间结果为 8 位, P010 与其他格式互转时只保留高 8 位; 含 4:2:x 格式时宽高需为偶数.
+ * pLineSize 按字节计, 允许带 padding.
+ */
+class ImageConverter
+{
+public:
+	ImageConverter();
+
+	void SetSimdLevel(CpuSimdLevel level);
+	CpuSimdLevel GetSimdLevel() const { return m_Level; }
+
+	//dst 需已分配且宽高与 src 相同; 同格式时按行拷贝
+	int Convert(const NativeImage *src, NativeImage *dst, ImageCscStandard standard = IMAGE_CSC_BT601_LIMITED);
+
+	//width x height 的图在所有格式对之间各转 frames 次, 每对打印各 SIMD 级别的 MPix/s
+	void Benchmark(int width, int height, int frames, ImageCscStandard standard = IMAGE_CSC_BT601_LIMITED);
+
+	static const char *FormatName(int format);
+
+private:
+	struct PivotRows
+	{
+		uint8_t *rgba[2];
+		uint8_t *y[2];
+		uint8_t *u[2];
+		uint8_t *v[2];
+	};
+
+	void UnpackRows(const NativeImage *src, int row, int rows, PivotRows *pivot);
+	void PackRows(const PivotRows &pivot, NativeImage *dst, int row, int rows);
+
+	CpuSimdLevel m_Level;
+	std::vector<uint8_t> m_Scratch;
+	uint8_t *m_Neutral;             //全 128 的色度行, GRAY 作为源时使用
+};
+
+#endif //DRMDEMO_IMAGE_CONVERTER_H
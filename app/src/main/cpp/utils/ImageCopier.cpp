@@ -0,0 +1,337 @@
+//
+// ImageCopier.cpp
+//
+
+#include "ImageCopier.h"
+#include "LogUtil.h"
+
+#include <algorithm>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define IMAGE_COPIER_X86 1
+#elif defined(__aarch64__)
+#define IMAGE_COPIER_ARM64 1
+#endif
+
+//至少这么长的连续区域才走 streaming store, 太短的反而比 memcpy 慢
+#define NT_MIN_BYTES 256
+
+static void StreamCopy(uint8_t *dst, const uint8_t *src, size_t n)
+{
+#if defined(IMAGE_COPIER_X86)
+	size_t head = (16 - ((uintptr_t) dst & 15)) & 15;
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	n -= head;
+	for (; n >= 64; n -= 64, dst += 64, src += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *) src);
+		__m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+		__m128i d = _mm_loadu_si128((const __m128i *) (src + 48));
+		_mm_stream_si128((__m128i *) dst, a);
+		_mm_stream_si128((__m128i *) (dst + 16), b);
+		_mm_stream_si128((__m128i *) (dst + 32), c);
+		_mm_stream_si128((__m128i *) (dst + 48), d);
+	}
+	memcpy(dst, src, n);
+#elif defined(IMAGE_COPIER_ARM64)
+	for (; n >= 64; n -= 64, dst += 64, src += 64)
+	{
+		__asm__ volatile(
+			"ldp q0, q1, [%1]\n"
+			"ldp q2, q3, [%1, #32]\n"
+			"stnp q0, q1, [%0]\n"
+			"stnp q2, q3, [%0, #32]\n"
+			:
+			: "r"(dst), "r"(src)
+			: "v0", "v1", "v2", "v3", "memory");
+	}
+	memcpy(dst, src, n);
+#else
+	memcpy(dst, src, n);
+#endif
+}
+
+static inline void CopyBytes(uint8_t *dst, const uint8_t *src, size_t n, bool nt)
+{
+	if (nt && n >= NT_MIN_BYTES)
+	{
+		StreamCopy(dst, src, n);
+	}
+	else
+	{
+		memcpy(dst, src, n);
+	}
+}
+
+//streaming store 是弱序的, 行带结束后需要一次 store fence 再交给其他线程
+static inline void StreamFence()
+{
+#if defined(IMAGE_COPIER_X86)
+	_mm_sfence();
+#elif defined(IMAGE_COPIER_ARM64)
+	__asm__ volatile("dmb ishst" ::: "memory");
+#endif
+}
+
+static int64_t ImageCopierNowUs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+ImageCopier::ImageCopier(ThreadPool *pool)
+{
+	m_Pool = pool ? pool : ThreadPool::GetDefault();
+}
+
+int ImageCopier::GetRegions(const NativeImage *img, int x, int y, int w, int h,
+							size_t offsets[3], int row_bytes[3], int rows[3])
+{
+	if (!img || !img->ppPlane[0] || x < 0 || y < 0 || w <= 0 || h <= 0 ||
+		x + w > img->width || y + h > img->height)
+	{
+		return 0;
+	}
+	int hsub, vsub;
+	NativeImageUtil::GetChromaSubsample(img->format, &hsub, &vsub);
+	//右/下边缘到图像边界时允许奇数宽高, 其余必须按色度块对齐
+	bool x_ok = hsub == 1 || ((x & 1) == 0 && ((w & 1) == 0 || x + w == img->width));
+	bool y_ok = vsub == 1 || ((y & 1) == 0 && ((h & 1) == 0 || y + h == img->height));
+	if (!x_ok || !y_ok) return 0;
+
+	int skip_bytes[3] = { 0 }, skip_rows[3] = { 0 };
+	NativeImageUtil::GetPlaneGeometry(img->format, x, y, skip_bytes, skip_rows);
+	int planes = NativeImageUtil::GetPlaneGeometry(img->format, w, h, row_bytes, rows);
+	for (int i = 0; i < planes; i++)
+	{
+		offsets[i] = (size_t) skip_rows[i] * img->pLineSize[i] + skip_bytes[i];
+	}
+	return planes;
+}
+
+void ImageCopier::CopyRegions(const PlaneRegion *regions, int count, int flags)
+{
+	size_t total = 0;
+	for (int i = 0; i < count; i++) total += (size_t) regions[i].row_bytes * regions[i].rows;
+
+	int bands = 1;
+	if (!(flags & IMAGE_COPY_SINGLE_THREAD) && total >= IMAGE_COPY_PARALLEL_MIN_BYTES)
+	{
+		//每个线程两段, 缓和大小核速度不一致
+		bands = m_Pool->GetConcurrency() * 2;
+	}
+	bool nt = (flags & IMAGE_COPY_NON_TEMPORAL) != 0;
+
+	std::function<void(int)> task = [&](int index) {
+		const PlaneRegion &r = regions[index / bands];
+		int band = index % bands;
+		int row0 = (int) ((int64_t) r.rows * band / bands);
+		int row1 = (int) ((int64_t) r.rows * (band + 1) / bands);
+		if (row0 >= row1) return;
+
+		const uint8_t *src = r.src + (size_t) row0 * r.src_stride;
+		uint8_t *dst = r.dst + (size_t) row0 * r.dst_stride;
+		if (r.src_stride == r.row_bytes && r.dst_stride == r.row_bytes)
+		{
+			CopyBytes(dst, src, (size_t) r.row_bytes * (row1 - row0), nt);
+		}
+		else
+		{
+			for (int row = row0; row < row1; row++)
+			{
+				CopyBytes(dst, src, r.row_bytes, nt);
+				src += r.src_stride;
+				dst += r.dst_stride;
+			}
+		}
+		if (nt) StreamFence();
+	};
+
+	if (bands == 1)
+	{
+		for (int i = 0; i < count; i++) task(i);
+	}
+	else
+	{
+		m_Pool->ParallelFor(count * bands, task);
+	}
+}
+
+int ImageCopier::Copy(const NativeImage *src, NativeImage *dst, int flags)
+{
+	if (!src || !dst || src->format != dst->format || src->width != dst->width || src->height != dst->height)
+	{
+		LOGCATE("ImageCopier::Copy size or format mismatch");
+		return -1;
+	}
+	return CopyRect(src, 0, 0, src->width, src->height, dst, 0, 0, flags);
+}
+
+int ImageCopier::CopyRect(const NativeImage *src, int src_x, int src_y, int w, int h,
+						  NativeImage *dst, int dst_x, int dst_y, int flags)
+{
+	if (!src || !dst || src->format != dst->format)
+	{
+		LOGCATE("ImageCopier::CopyRect format mismatch");
+		return -1;
+	}
+
+	size_t src_off[3], dst_off[3];
+	int row_bytes[3], rows[3], dst_row_bytes[3], dst_rows[3];
+	int planes = GetRegions(src, src_x, src_y, w, h, src_off, row_bytes, rows);
+	int dst_planes = GetRegions(dst, dst_x, dst_y, w, h, dst_off, dst_row_bytes, dst_rows);
+	if (planes == 0 || planes != dst_planes)
+	{
+		LOGCATE("ImageCopier::CopyRect invalid rect (%d,%d %dx%d) -> (%d,%d) src %dx%d dst %dx%d",
+				src_x, src_y, w, h, dst_x, dst_y, src->width, src->height, dst->width, dst->height);
+		return -1;
+	}
+
+	PlaneRegion regions[3];
+	for (int i = 0; i < planes; i++)
+	{
+		regions[i].src = src->ppPlane[i] + src_off[i];
+		regions[i].dst = dst->ppPlane[i] + dst_off[i];
+		regions[i].src_stride = src->pLineSize[i];
+		regions[i].dst_stride = dst->pLineSize[i];
+		regions[i].row_bytes = row_bytes[i];
+		regions[i].rows = rows[i];
+	}
+	CopyRegions(regions, planes, flags);
+	return 0;
+}
+
+int ImageCopier::FillBlack(NativeImage *dst, int x, int y, int w, int h)
+{
+	if (w <= 0 || h <= 0) return 0;
+
+	size_t offsets[3];
+	int row_bytes[3], rows[3];
+	int planes = GetRegions(dst, x, y, w, h, offsets, row_bytes, rows);
+	if (planes == 0)
+	{
+		LOGCATE("ImageCopier::FillBlack invalid rect (%d,%d %dx%d)", x, y, w, h);
+		return -1;
+	}
+
+	//每个平面一个重复的字节模式, 起点都在模式的整周期上
+	for (int i = 0; i < planes; i++)
+	{
+		uint8_t pattern[4] = { 128, 128, 128, 128 };
+		int period = 1;
+		switch (dst->format)
+		{
+			case IMAGE_FORMAT_RGBA:
+				pattern[0] = pattern[1] = pattern[2] = 0;
+				pattern[3] = 255;
+				period = 4;
+				break;
+			case IMAGE_FORMAT_YUYV:
+				pattern[0] = pattern[2] = 16;
+				period = 4;
+				break;
+			case IMAGE_FORMAT_P010:
+				//小端 16 位, 值在高 10 位: Y = 16 << 8, UV = 128 << 8
+				pattern[0] = 0;
+				pattern[1] = i == 0 ? 16 : 128;
+				period = 2;
+				break;
+			default:
+				if (i == 0) pattern[0] = 16;
+				break;
+		}
+
+		uint8_t *row = dst->ppPlane[i] + offsets[i];
+		for (int r = 0; r < rows[i]; r++, row += dst->pLineSize[i])
+		{
+			if (period == 1)
+			{
+				memset(row, pattern[0], row_bytes[i]);
+				continue;
+			}
+			for (int b = 0; b < row_bytes[i]; b++) row[b] = pattern[b % period];
+		}
+	}
+	return 0;
+}
+
+int ImageCopier::Pad(const NativeImage *src, NativeImage *dst, int x, int y, int flags)
+{
+	if (!src || !dst)
+	{
+		return -1;
+	}
+	if (CopyRect(src, 0, 0, src->width, src->height, dst, x, y, flags)) return -1;
+
+	int right = x + src->width, bottom = y + src->height;
+	FillBlack(dst, 0, 0, dst->width, y);
+	FillBlack(dst, 0, bottom, dst->width, dst->height - bottom);
+	FillBlack(dst, 0, y, x, src->height);
+	FillBlack(dst, right, y, dst->width - right, src->height);
+	return 0;
+}
+
+void ImageCopier::Benchmark(int format, int width, int height, int frames)
+{
+	if (frames <= 0) return;
+
+	NativeImage src, dst, padded;
+	src.width = dst.width = padded.width = width;
+	src.height = dst.height = padded.height = height;
+	src.format = dst.format = padded.format = format;
+	NativeImageUtil::AllocNativeImage(&src, NativeImageAlign::CacheLine());
+	NativeImageUtil::AllocNativeImage(&dst, NativeImageAlign::CacheLine());
+	//stride 与 src 不同, 只能逐行拷贝
+	NativeImageUtil::AllocNativeImage(&padded, NativeImageAlign(4096, 1));
+
+	int row_bytes[3], rows[3];
+	int planes = NativeImageUtil::GetPlaneGeometry(format, width, height, row_bytes, rows);
+	if (!src.ppPlane[0] || !dst.ppPlane[0] || !padded.ppPlane[0] || planes == 0)
+	{
+		LOGCATE("ImageCopier::Benchmark %dx%d format %d setup failed", width, height, format);
+	}
+	else
+	{
+		size_t bytes = 0;
+		for (int i = 0; i < planes; i++)
+		{
+			bytes += (size_t) row_bytes[i] * rows[i];
+			for (int r = 0; r < rows[i]; r++) memset(src.ppPlane[i] + (size_t) r * src.pLineSize[i], r & 0xff, row_bytes[i]);
+		}
+
+		struct Case
+		{
+			const char *name;
+			NativeImage *dst;
+			int flags;
+		} cases[] = {
+			{ "1 thread", &dst, IMAGE_COPY_SINGLE_THREAD },
+			{ "1 thread nt", &dst, IMAGE_COPY_SINGLE_THREAD | IMAGE_COPY_NON_TEMPORAL },
+			{ "pool", &dst, IMAGE_COPY_DEFAULT },
+			{ "pool nt", &dst, IMAGE_COPY_NON_TEMPORAL },
+			{ "1 thread strided", &padded, IMAGE_COPY_SINGLE_THREAD },
+			{ "pool strided", &padded, IMAGE_COPY_DEFAULT },
+		};
+		for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+		{
+			Copy(&src, cases[c].dst, cases[c].flags);
+			int64_t t0 = ImageCopierNowUs();
+			for (int f = 0; f < frames; f++) Copy(&src, cases[c].dst, cases[c].flags);
+			int64_t us = std::max<int64_t>(ImageCopierNowUs() - t0, 1);
+			LOGCATE("ImageCopier %dx%d format=%d %-16s threads=%d %.2f GB/s", width, height, format, cases[c].name,
+					(cases[c].flags & IMAGE_COPY_SINGLE_THREAD) ? 1 : m_Pool->GetConcurrency(),
+					(double) bytes * frames / us / 1000.0);
+		}
+	}
+
+	NativeImageUtil::FreeNativeImage(&src);
+	NativeImageUtil::FreeNativeImage(&dst);
+	NativeImageUtil::FreeNativeImage(&padded);
+}
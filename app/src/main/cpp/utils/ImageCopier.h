@@ -0,0 +1,67 @@
+//
+// ImageCopier.h
+//
+
+#ifndef DRMDEMO_IMAGE_COPIER_H
+#define DRMDEMO_IMAGE_COPIER_H
+
+#include "ImageDef.h"
+#include "ThreadPool.h"
+
+#define IMAGE_COPY_PARALLEL_MIN_BYTES (1 << 20)     //小于 1MB 的拷贝不值得分线程
+
+enum ImageCopyFlags
+{
+	IMAGE_COPY_DEFAULT = 0,
+	IMAGE_COPY_NON_TEMPORAL = 1 << 0,   //streaming store 绕过 cache, 大帧拷贝不挤掉合成用的数据
+	IMAGE_COPY_SINGLE_THREAD = 1 << 1,
+};
+
+/*
+ * NativeImage 的拷贝/裁剪/填充, 按每个平面的 pLineSize 寻址.
+ * 两边行都是紧密排列时一个行带只做一次 memcpy, 否则逐行拷贝有效字节.
+ * 超过 IMAGE_COPY_PARALLEL_MIN_BYTES 的拷贝把各平面切成行带, 在线程池上并行.
+ * 含色度下采样的格式, 坐标和宽高需为偶数(YUYV 只要求水平方向).
+ */
+class ImageCopier
+{
+public:
+	//pool 为 NULL 时使用 ThreadPool::GetDefault()
+	explicit ImageCopier(ThreadPool *pool = NULL);
+
+	//格式与宽高相同的整图拷贝
+	int Copy(const NativeImage *src, NativeImage *dst, int flags = IMAGE_COPY_DEFAULT);
+
+	//src 中 (src_x, src_y, w, h) 拷到 dst 的 (dst_x, dst_y), 用于裁剪和拼图; 两边格式需相同
+	int CopyRect(const NativeImage *src, int src_x, int src_y, int w, int h,
+				 NativeImage *dst, int dst_x, int dst_y, int flags = IMAGE_COPY_DEFAULT);
+
+	//整张 src 放到 dst 的 (x, y), dst 其余区域填黑
+	int Pad(const NativeImage *src, NativeImage *dst, int x, int y, int flags = IMAGE_COPY_DEFAULT);
+
+	//矩形填黑: YUV 为 limited range 的黑(Y=16, UV=128), RGBA 为 (0, 0, 0, 255)
+	int FillBlack(NativeImage *dst, int x, int y, int w, int h);
+
+	//width x height 的 format 图, 对比单线程、多线程、多线程 + non-temporal、不同 stride 时的 GB/s
+	void Benchmark(int format, int width, int height, int frames);
+
+private:
+	struct PlaneRegion
+	{
+		const uint8_t *src;
+		uint8_t *dst;
+		int src_stride;
+		int dst_stride;
+		int row_bytes;
+		int rows;
+	};
+
+	//img 上 (x, y, w, h) 在各平面上的起始偏移和大小, 返回平面个数, 参数非法时返回 0
+	static int GetRegions(const NativeImage *img, int x, int y, int w, int h,
+						  size_t offsets[3], int row_bytes[3], int rows[3]);
+	void CopyRegions(const PlaneRegion *regions, int count, int flags);
+
+	ThreadPool *m_Pool;
+};
+
+#endif //DRMDEMO_IMAGE_COPIER_H
@@ -5,9 +5,12 @@
 #ifndef NDK_OPENGLES_3_0_IMAGEDEF_H
 #define NDK_OPENGLES_3_0_IMAGEDEF_H
 
+#include <errno.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include "stdio.h"
 #include "sys/stat.h"
 #include "stdint.h"
@@ -32,6 +35,10 @@
 #define IMAGE_FORMAT_NV12_EXT       "NV12"
 #define IMAGE_FORMAT_I420_EXT       "I420"
 
+#define NATIVE_IMAGE_CACHE_LINE     64
+#define NATIVE_IMAGE_HUGEPAGE_SIZE  (2 * 1024 * 1024)
+#define NATIVE_IMAGE_GPU_PIXEL_ALIGN 32     //与 DrmFormat 中 NV12/ABGR8888/YUYV/P010 的 pitch_align 一致
+
 typedef struct _tag_NativeRectF
 {
 	float left;
@@ -75,49 +82,148 @@ typedef struct _tag_NativeImage
 	}
 } NativeImage;
 
+//AllocNativeImage 的对齐要求, 默认不做对齐(紧密排列)
+struct NativeImageAlign
+{
+	int strideBytes;    //每个平面 pLineSize 的字节对齐, 例如 NATIVE_IMAGE_CACHE_LINE
+	int widthPixels;    //宽先按像素对齐, 例如 NATIVE_IMAGE_GPU_PIXEL_ALIGN, 多出来的列作为 padding
+	NativeImageAlign(int stride = 1, int pixels = 1)
+	{
+		strideBytes = stride;
+		widthPixels = pixels;
+	}
+
+	//SIMD 按 cache line 对齐的行
+	static NativeImageAlign CacheLine()
+	{
+		return NativeImageAlign(NATIVE_IMAGE_CACHE_LINE, 1);
+	}
+
+	//宽按 GPU 的 32 像素、pitch 按 64 字节对齐, 与 DrmBufferPool 的 dumb buffer 一致, 可直接作为 dma-buf 内容导入
+	static NativeImageAlign Gpu()
+	{
+		return NativeImageAlign(NATIVE_IMAGE_CACHE_LINE, NATIVE_IMAGE_GPU_PIXEL_ALIGN);
+	}
+};
+
 class NativeImageUtil
 {
 public:
-	static void AllocNativeImage(NativeImage *pImage)
+	//色度相对亮度的水平/垂直下采样倍数, 非 YUV 或 4:4:4 格式为 1
+	static void GetChromaSubsample(int format, int *hsub, int *vsub)
 	{
-		if (pImage->height == 0 || pImage->width == 0) return;
-
-		switch (pImage->format)
+		switch (format)
 		{
-			case IMAGE_FORMAT_RGBA:
-			{
-				pImage->ppPlane[0] = static_cast<uint8_t *>(malloc(pImage->width * pImage->height * 4));
-				pImage->pLineSize[0] = pImage->width * 4;
-				pImage->pLineSize[1] = 0;
-				pImage->pLineSize[2] = 0;
-			}
-				break;
 			case IMAGE_FORMAT_NV12:
 			case IMAGE_FORMAT_NV21:
-			{
-				pImage->ppPlane[0] = static_cast<uint8_t *>(malloc(pImage->width * pImage->height * 1.5));
-				pImage->ppPlane[1] = pImage->ppPlane[0] + pImage->width * pImage->height;
-				pImage->pLineSize[0] = pImage->width;
-				pImage->pLineSize[1] = pImage->width;
-				pImage->pLineSize[2] = 0;
-			}
-				break;
 			case IMAGE_FORMAT_I420:
-			{
-				pImage->ppPlane[0] = static_cast<uint8_t *>(malloc(pImage->width * pImage->height * 1.5));
-				pImage->ppPlane[1] = pImage->ppPlane[0] + pImage->width * pImage->height;
-				pImage->ppPlane[2] = pImage->ppPlane[1] + (pImage->width >> 1) * (pImage->height >> 1);
-				pImage->pLineSize[0] = pImage->width;
-				pImage->pLineSize[1] = pImage->width / 2;
-				pImage->pLineSize[2] = pImage->width / 2;
-			}
+			case IMAGE_FORMAT_P010:
+				*hsub = 2; *vsub = 2;
+				break;
+			case IMAGE_FORMAT_YUYV:
+				*hsub = 2; *vsub = 1;
 				break;
 			default:
-				LOGCATE("NativeImageUtil::AllocNativeImage do not support the format. Format = %d", pImage->format);
+				*hsub = 1; *vsub = 1;
 				break;
 		}
 	}
 
+	//各平面每行有效字节数与行数(不含 padding), 返回平面个数; 不支持的格式返回 0
+	static int GetPlaneGeometry(int format, int width, int height, int rowBytes[3], int rows[3])
+	{
+		int cw = (width + 1) / 2, ch = (height + 1) / 2;
+		switch (format)
+		{
+			case IMAGE_FORMAT_RGBA:
+				rowBytes[0] = width * 4; rows[0] = height;
+				return 1;
+			case IMAGE_FORMAT_YUYV:
+				rowBytes[0] = cw * 4; rows[0] = height;
+				return 1;
+			case IMAGE_FORMAT_GRAY:
+				rowBytes[0] = width; rows[0] = height;
+				return 1;
+			case IMAGE_FORMAT_NV12:
+			case IMAGE_FORMAT_NV21:
+				rowBytes[0] = width; rows[0] = height;
+				rowBytes[1] = cw * 2; rows[1] = ch;
+				return 2;
+			case IMAGE_FORMAT_P010:
+				rowBytes[0] = width * 2; rows[0] = height;
+				rowBytes[1] = cw * 4; rows[1] = ch;
+				return 2;
+			case IMAGE_FORMAT_I420:
+				rowBytes[0] = width; rows[0] = height;
+				rowBytes[1] = rowBytes[2] = cw; rows[1] = rows[2] = ch;
+				return 3;
+			case IMAGE_FORMAT_I444:
+				rowBytes[0] = rowBytes[1] = rowBytes[2] = width;
+				rows[0] = rows[1] = rows[2] = height;
+				return 3;
+			default:
+				return 0;
+		}
+	}
+
+	/*
+	 * 所有平面放在一块内存里, 首地址至少按 cache line 对齐.
+	 * 宽先按 align.widthPixels 对齐再计算各平面行字节数, 之后 pLineSize 再按 align.strideBytes 对齐.
+	 * 指定了对齐时, 后续平面的起始地址也按 max(stride 对齐, cache line) 对齐;
+	 * 默认参数下与旧版一样紧密排列, 各平面首尾相接, 可按 width * height * 1.5 这类整块大小读写.
+	 * 不少于 2MB 的图按 2MB 对齐申请并提示内核使用透明大页, 减少大帧的 TLB miss 和缺页次数.
+	 */
+	static void AllocNativeImage(NativeImage *pImage, const NativeImageAlign &align = NativeImageAlign())
+	{
+		if (pImage->height == 0 || pImage->width == 0) return;
+
+		int widthAlign = align.widthPixels > 1 ? align.widthPixels : 1;
+		int strideAlign = align.strideBytes > 1 ? align.strideBytes : 1;
+		int alignedWidth = (pImage->width + widthAlign - 1) / widthAlign * widthAlign;
+		int rowBytes[3] = {0}, rows[3] = {0};
+		int planes = GetPlaneGeometry(pImage->format, alignedWidth, pImage->height, rowBytes, rows);
+		if (planes == 0)
+		{
+			LOGCATE("NativeImageUtil::AllocNativeImage do not support the format. Format = %d", pImage->format);
+			return;
+		}
+
+		//posix_memalign 只接受 2 的幂, 其他 stride 对齐时平面起点退回 cache line 对齐
+		bool pow2 = (strideAlign & (strideAlign - 1)) == 0;
+		size_t planeAlign = pow2 && strideAlign > NATIVE_IMAGE_CACHE_LINE ? strideAlign : NATIVE_IMAGE_CACHE_LINE;
+		size_t offsetAlign = strideAlign > 1 || widthAlign > 1 ? planeAlign : 1;
+		size_t offsets[3] = {0};
+		size_t size = 0;
+		for (int i = 0; i < planes; i++)
+		{
+			pImage->pLineSize[i] = (rowBytes[i] + strideAlign - 1) / strideAlign * strideAlign;
+			offsets[i] = (size + offsetAlign - 1) / offsetAlign * offsetAlign;
+			size = offsets[i] + (size_t) pImage->pLineSize[i] * rows[i];
+		}
+
+		size_t memAlign = planeAlign;
+		if (size >= NATIVE_IMAGE_HUGEPAGE_SIZE)
+		{
+			memAlign = NATIVE_IMAGE_HUGEPAGE_SIZE;
+			size = (size + NATIVE_IMAGE_HUGEPAGE_SIZE - 1) / NATIVE_IMAGE_HUGEPAGE_SIZE * NATIVE_IMAGE_HUGEPAGE_SIZE;
+		}
+		void *mem = nullptr;
+		if (posix_memalign(&mem, memAlign, size) != 0)
+		{
+			LOGCATE("NativeImageUtil::AllocNativeImage alloc %zu bytes failed", size);
+			return;
+		}
+#ifdef MADV_HUGEPAGE
+		if (memAlign == NATIVE_IMAGE_HUGEPAGE_SIZE) madvise(mem, size, MADV_HUGEPAGE);
+#endif
+
+		for (int i = 0; i < 3; i++)
+		{
+			pImage->ppPlane[i] = i < planes ? static_cast<uint8_t *>(mem) + offsets[i] : nullptr;
+			if (i >= planes) pImage->pLineSize[i] = 0;
+		}
+	}
+
 	static void FreeNativeImage(NativeImage *pImage)
 	{
 		if (pImage == nullptr || pImage->ppPlane[0] == nullptr) return;
@@ -128,109 +234,7 @@ public:
 		pImage->ppPlane[2] = nullptr;
 	}
 
-//	static void CopyNativeImage(NativeImage *pSrcImg, NativeImage *pDstImg)
-//	{
-//	    LOGCATE("NativeImageUtil::CopyNativeImage src[w,h,format]=[%d, %d, %d], dst[w,h,format]=[%d, %d, %d]", pSrcImg->width, pSrcImg->height, pSrcImg->format, pDstImg->width, pDstImg->height, pDstImg->format);
-//        LOGCATE("NativeImageUtil::CopyNativeImage src[line0,line1,line2]=[%d, %d, %d], dst[line0,line1,line2]=[%d, %d, %d]", pSrcImg->pLineSize[0], pSrcImg->pLineSize[1], pSrcImg->pLineSize[2], pDstImg->pLineSize[0], pDstImg->pLineSize[1], pDstImg->pLineSize[2]);
-//
-//        if(pSrcImg == nullptr || pSrcImg->ppPlane[0] == nullptr) return;
-//
-//		if(pSrcImg->format != pDstImg->format ||
-//		   pSrcImg->width != pDstImg->width ||
-//		   pSrcImg->height != pDstImg->height)
-//		{
-//			LOGCATE("NativeImageUtil::CopyNativeImage invalid params.");
-//			return;
-//		}
-//
-//		if(pDstImg->ppPlane[0] == nullptr) AllocNativeImage(pDstImg);
-//
-//		switch (pSrcImg->format)
-//		{
-//			case IMAGE_FORMAT_I420:
-//			{
-//				// y plane
-//				if(pSrcImg->pLineSize[0] != pDstImg->pLineSize[0]) {
-//					for (int i = 0; i < pSrcImg->height; ++i) {
-//						memcpy(pDstImg->ppPlane[0] + i * pDstImg->pLineSize[0], pSrcImg->ppPlane[0] + i * pSrcImg->pLineSize[0], pDstImg->width);
-//					}
-//				}
-//				else
-//				{
-//					memcpy(pDstImg->ppPlane[0], pSrcImg->ppPlane[0], pDstImg->pLineSize[0] * pSrcImg->height);
-//				}
-//
-//				// u plane
-//				if(pSrcImg->pLineSize[1] != pDstImg->pLineSize[1]) {
-//					for (int i = 0; i < pSrcImg->height / 2; ++i) {
-//						memcpy(pDstImg->ppPlane[1] + i * pDstImg->pLineSize[1], pSrcImg->ppPlane[1] + i * pSrcImg->pLineSize[1], pDstImg->width / 2);
-//					}
-//				}
-//				else
-//				{
-//					memcpy(pDstImg->ppPlane[1], pSrcImg->ppPlane[1], pDstImg->pLineSize[1] * pSrcImg->height / 2);
-//				}
-//
-//				// v plane
-//				if(pSrcImg->pLineSize[2] != pDstImg->pLineSize[2]) {
-//					for (int i = 0; i < pSrcImg->height / 2; ++i) {
-//						memcpy(pDstImg->ppPlane[2] + i * pDstImg->pLineSize[2], pSrcImg->ppPlane[2] + i * pSrcImg->pLineSize[2], pDstImg->width / 2);
-//					}
-//				}
-//				else
-//				{
-//					memcpy(pDstImg->ppPlane[2], pSrcImg->ppPlane[2], pDstImg->pLineSize[2] * pSrcImg->height / 2);
-//				}
-//			}
-//			    break;
-//			case IMAGE_FORMAT_NV21:
-//			case IMAGE_FORMAT_NV12:
-//			{
-//				// y plane
-//				if(pSrcImg->pLineSize[0] != pDstImg->pLineSize[0]) {
-//					for (int i = 0; i < pSrcImg->height; ++i) {
-//						memcpy(pDstImg->ppPlane[0] + i * pDstImg->pLineSize[0], pSrcImg->ppPlane[0] + i * pSrcImg->pLineSize[0], pDstImg->width);
-//					}
-//				}
-//				else
-//				{
-//					memcpy(pDstImg->ppPlane[0], pSrcImg->ppPlane[0], pDstImg->pLineSize[0] * pSrcImg->height);
-//				}
-//
-//				// uv plane
-//				if(pSrcImg->pLineSize[1] != pDstImg->pLineSize[1]) {
-//					for (int i = 0; i < pSrcImg->height / 2; ++i) {
-//						memcpy(pDstImg->ppPlane[1] + i * pDstImg->pLineSize[1], pSrcImg->ppPlane[1] + i * pSrcImg->pLineSize[1], pDstImg->width);
-//					}
-//				}
-//				else
-//				{
-//					memcpy(pDstImg->ppPlane[1], pSrcImg->ppPlane[1], pDstImg->pLineSize[1] * pSrcImg->height / 2);
-//				}
-//			}
-//				break;
-//			case IMAGE_FORMAT_RGBA:
-//			{
-//				if(pSrcImg->pLineSize[0] != pDstImg->pLineSize[0])
-//				{
-//					for (int i = 0; i < pSrcImg->height; ++i) {
-//						memcpy(pDstImg->ppPlane[0] + i * pDstImg->pLineSize[0], pSrcImg->ppPlane[0] + i * pSrcImg->pLineSize[0], pDstImg->width * 4);
-//					}
-//				} else {
-//					memcpy(pDstImg->ppPlane[0], pSrcImg->ppPlane[0], pSrcImg->pLineSize[0] * pSrcImg->height);
-//				}
-//			}
-//				break;
-//			default:
-//			{
-//				LOGCATE("NativeImageUtil::CopyNativeImage do not support the format. Format = %d", pSrcImg->format);
-//			}
-//				break;
-//		}
-//
-//	}
-
-
+	//按 pLineSize 逐平面拷贝, 两边都是紧密排列时整平面一次 memcpy; 多线程/裁剪/填充见 ImageCopier
 	static void CopyNativeImage(NativeImage *pSrcImg, NativeImage *pDstImg)
 	{
 		if(pSrcImg == nullptr || pSrcImg->ppPlane[0] == nullptr) return;
@@ -239,55 +243,41 @@ public:
 		   pSrcImg->width != pDstImg->width ||
 		   pSrcImg->height != pDstImg->height) return;
 
+		int rowBytes[3], rows[3];
+		int planes = GetPlaneGeometry(pSrcImg->format, pSrcImg->width, pSrcImg->height, rowBytes, rows);
+		if (planes == 0)
+		{
+			LOGCATE("NativeImageUtil::CopyNativeImage do not support the format. Format = %d", pSrcImg->format);
+			return;
+		}
+
 		if(pDstImg->ppPlane[0] == nullptr) AllocNativeImage(pDstImg);
+		if(pDstImg->ppPlane[0] == nullptr) return;
 
-		switch (pSrcImg->format)
+		for (int i = 0; i < planes; i++)
 		{
-			case IMAGE_FORMAT_I420:
-			case IMAGE_FORMAT_NV21:
-			case IMAGE_FORMAT_NV12:
-			{
-				memcpy(pDstImg->ppPlane[0], pSrcImg->ppPlane[0], pSrcImg->width * pSrcImg->height * 1.5);
-			}
-				break;
-			case IMAGE_FORMAT_YUYV:
+			const uint8_t *src = pSrcImg->ppPlane[i];
+			uint8_t *dst = pDstImg->ppPlane[i];
+			if (pSrcImg->pLineSize[i] == rowBytes[i] && pDstImg->pLineSize[i] == rowBytes[i])
 			{
-				memcpy(pDstImg->ppPlane[0], pSrcImg->ppPlane[0], pSrcImg->width * pSrcImg->height * 2);
+				memcpy(dst, src, (size_t) rowBytes[i] * rows[i]);
+				continue;
 			}
-				break;
-			case IMAGE_FORMAT_RGBA:
-			{
-				memcpy(pDstImg->ppPlane[0], pSrcImg->ppPlane[0], pSrcImg->width * pSrcImg->height * 4);
-			}
-				break;
-			case IMAGE_FORMAT_GRAY:
-			{
-				memcpy(pDstImg->ppPlane[0], pSrcImg->ppPlane[0], pSrcImg->width * pSrcImg->height);
-			}
-				break;
-			case IMAGE_FORMAT_P010:
-			case IMAGE_FORMAT_I444:
-			{
-				memcpy(pDstImg->ppPlane[0], pSrcImg->ppPlane[0], pSrcImg->width * pSrcImg->height * 3);
-			}
-				break;
-			default:
+			for (int r = 0; r < rows[i]; r++)
 			{
-				LOGCATE("NativeImageUtil::CopyNativeImage do not support the format. Format = %d", pSrcImg->format);
+				memcpy(dst + (size_t) r * pDstImg->pLineSize[i], src + (size_t) r * pSrcImg->pLineSize[i], rowBytes[i]);
 			}
-				break;
 		}
-
 	}
 
-
 	static void DumpNativeImage(NativeImage *pSrcImg, const char *pPath, const char *pFileName)
 	{
 		if (pSrcImg == nullptr || pPath == nullptr || pFileName == nullptr) return;
 
-		if(access(pPath, 0) == -1)
+		//渲染线程上的 dump 请使用 AsyncDumpWriter
+		if(access(pPath, 0) == -1 && mkdir(pPath, 0777) < 0 && errno != EEXIST)
 		{
-			mkdir(pPath, 0666);
+			LOGCATE("DumpNativeImage mkdir %s failed: %s", pPath, strerror(errno));
 		}
 
 		char imgPath[256] = {0};
@@ -320,37 +310,18 @@ public:
 
 		if(fp)
 		{
-			switch (pSrcImg->format)
+			//按行写有效字节, 去掉 pLineSize 中的 padding
+			int rowBytes[3], rows[3];
+			int planes = GetPlaneGeometry(pSrcImg->format, pSrcImg->width, pSrcImg->height, rowBytes, rows);
+			if (planes == 0)
 			{
-				case IMAGE_FORMAT_I420:
-				{
-					fwrite(pSrcImg->ppPlane[0],
-						   static_cast<size_t>(pSrcImg->width * pSrcImg->height), 1, fp);
-					fwrite(pSrcImg->ppPlane[1],
-						   static_cast<size_t>((pSrcImg->width >> 1) * (pSrcImg->height >> 1)), 1, fp);
-					fwrite(pSrcImg->ppPlane[2],
-							static_cast<size_t>((pSrcImg->width >> 1) * (pSrcImg->height >> 1)),1,fp);
-					break;
-				}
-				case IMAGE_FORMAT_NV21:
-				case IMAGE_FORMAT_NV12:
-				{
-					fwrite(pSrcImg->ppPlane[0],
-						   static_cast<size_t>(pSrcImg->width * pSrcImg->height), 1, fp);
-					fwrite(pSrcImg->ppPlane[1],
-						   static_cast<size_t>(pSrcImg->width * (pSrcImg->height >> 1)), 1, fp);
-					break;
-				}
-				case IMAGE_FORMAT_RGBA:
-				{
-					fwrite(pSrcImg->ppPlane[0],
-						   static_cast<size_t>(pSrcImg->width * pSrcImg->height * 4), 1, fp);
-					break;
-				}
-				default:
+				LOGCATE("DumpNativeImage default");
+			}
+			for (int i = 0; i < planes; i++)
+			{
+				for (int r = 0; r < rows[i]; r++)
 				{
-					LOGCATE("DumpNativeImage default");
-					break;
+					fwrite(pSrcImg->ppPlane[i] + (size_t) r * pSrcImg->pLineSize[i], static_cast<size_t>(rowBytes[i]), 1, fp);
 				}
 			}
 
@@ -0,0 +1,113 @@
+//
+// MpscQueue.h
+//
+
+#ifndef DRMDEMO_MPSC_QUEUE_H
+#define DRMDEMO_MPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#define MPSC_CACHE_LINE 64
+
+/*
+ * 有界无锁队列, 多生产者单消费者. 每个槽带一个序号: 生产者 CAS 抢到 tail 后写入数据,
+ * 再把槽的序号推进到 pos + 1 表示可读; 消费者读完后推进到 pos + capacity 表示可再写.
+ * 不分配内存, 满时 TryPush 直接返回 false, 由调用方决定丢弃还是重试.
+ * T 需可拷贝, 容量向上取整到 2 的幂.
+ */
+template <typename T>
+class MpscQueue
+{
+public:
+	explicit MpscQueue(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity) size <<= 1;
+		m_Mask = size - 1;
+		m_Slots = std::vector<Slot>(size);
+		for (size_t i = 0; i < size; i++) m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+		m_Head.store(0, std::memory_order_relaxed);
+		m_Tail.store(0, std::memory_order_relaxed);
+	}
+
+	size_t Capacity() const { return m_Mask + 1; }
+
+	//任意线程调用
+	bool TryPush(const T &value)
+	{
+		size_t pos = m_Tail.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot &slot = m_Slots[pos & m_Mask];
+			size_t seq = slot.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+			if (diff == 0)
+			{
+				if (m_Tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					slot.value = value;
+					slot.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;   //满
+			}
+			else
+			{
+				pos = m_Tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	//只能在消费者线程调用
+	bool TryPop(T *value)
+	{
+		size_t pos = m_Head.load(std::memory_order_relaxed);
+		Slot &slot = m_Slots[pos & m_Mask];
+		size_t seq = slot.sequence.load(std::memory_order_acquire);
+		if ((intptr_t) seq - (intptr_t) (pos + 1) < 0) return false;
+
+		*value = slot.value;
+		slot.sequence.store(pos + m_Mask + 1, std::memory_order_release);
+		m_Head.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	//近似值, 只用于统计
+	size_t SizeApprox() const
+	{
+		size_t tail = m_Tail.load(std::memory_order_relaxed);
+		size_t head = m_Head.load(std::memory_order_relaxed);
+		return tail > head ? tail - head : 0;
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		T value;
+
+		Slot() : sequence(0), value() {}
+		Slot(const Slot &other) : sequence(other.sequence.load()), value(other.value) {}
+	};
+
+	MpscQueue(const MpscQueue &);
+	MpscQueue &operator=(const MpscQueue &);
+
+	size_t m_Mask;
+	std::vector<Slot> m_Slots;
+	//生产者和消费者的计数各占一个 cache line, 避免 false sharing. 用显式填充而不是 alignas:
+	//gnu++11 下 new 不保证扩展对齐, 填充与对象起始地址无关, 堆上/栈上都成立
+	char m_Pad0[MPSC_CACHE_LINE];
+	std::atomic<size_t> m_Tail;
+	char m_Pad1[MPSC_CACHE_LINE - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> m_Head;
+	char m_Pad2[MPSC_CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+#endif //DRMDEMO_MPSC_QUEUE_H
@@ -0,0 +1,244 @@
+//
+// NativeImagePool.cpp
+//
+
+#include "NativeImagePool.h"
+#include "LogUtil.h"
+
+#include <algorithm>
+
+NativeFrame::NativeFrame(const NativeFrame &other) : m_Slot(other.m_Slot)
+{
+	if (m_Slot) m_Slot->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+NativeFrame &NativeFrame::operator=(const NativeFrame &other)
+{
+	if (this != &other)
+	{
+		if (other.m_Slot) other.m_Slot->refs.fetch_add(1, std::memory_order_relaxed);
+		Reset();
+		m_Slot = other.m_Slot;
+	}
+	return *this;
+}
+
+NativeFrame &NativeFrame::operator=(NativeFrame &&other)
+{
+	if (this != &other)
+	{
+		Reset();
+		m_Slot = other.m_Slot;
+		other.m_Slot = NULL;
+	}
+	return *this;
+}
+
+void NativeFrame::Reset()
+{
+	NativeFrameSlot *slot = m_Slot;
+	m_Slot = NULL;
+	if (!slot || slot->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+	//持锁读 owner 并回收, 池的析构要等回收做完才能继续; 池已经析构时 owner 为 NULL
+	{
+		std::lock_guard<std::mutex> lock(NativeImagePool::OwnerMutex());
+		NativeImagePool *owner = slot->owner.load(std::memory_order_relaxed);
+		if (owner)
+		{
+			owner->Recycle(slot);
+			return;
+		}
+	}
+	NativeImagePool::FreeSlot(slot);
+}
+
+std::mutex &NativeImagePool::OwnerMutex()
+{
+	static std::mutex mutex;
+	return mutex;
+}
+
+NativeImagePool::NativeImagePool(const NativeImageAlign &align, int max_cached_per_key, uint64_t max_cached_bytes)
+{
+	m_Align = align;
+	m_MaxCachedPerKey = max_cached_per_key;
+	m_MaxCachedBytes = max_cached_bytes;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+NativeImagePool::~NativeImagePool()
+{
+	//先拿 OwnerMutex: 其它线程正在 Recycle 时等它做完, 之后的最后一个引用看到 owner 为 NULL
+	std::lock_guard<std::mutex> owner_lock(OwnerMutex());
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (std::map<Key, KeyPool>::iterator it = m_Pools.begin(); it != m_Pools.end(); ++it)
+	{
+		FreeIdleLocked(it->second, 0);
+	}
+	//还在外面的帧由最后一个引用者释放
+	for (size_t i = 0; i < m_All.size(); i++) m_All[i]->owner.store(NULL, std::memory_order_relaxed);
+	if (!m_All.empty())
+	{
+		LOGCATE("NativeImagePool::~NativeImagePool %zu frames still in use", m_All.size());
+	}
+}
+
+NativeFrameSlot *NativeImagePool::AllocSlot(int format, int width, int height)
+{
+	NativeFrameSlot *slot = new NativeFrameSlot();
+	slot->image.format = format;
+	slot->image.width = width;
+	slot->image.height = height;
+	slot->refs = 0;
+	slot->owner = this;
+	NativeImageUtil::AllocNativeImage(&slot->image, m_Align);
+	if (!slot->image.ppPlane[0])
+	{
+		delete slot;
+		return NULL;
+	}
+
+	int row_bytes[3], rows[3];
+	int planes = NativeImageUtil::GetPlaneGeometry(format, width, height, row_bytes, rows);
+	slot->bytes = 0;
+	for (int i = 0; i < planes; i++) slot->bytes += (size_t) slot->image.pLineSize[i] * rows[i];
+	return slot;
+}
+
+void NativeImagePool::FreeSlot(NativeFrameSlot *slot)
+{
+	NativeImageUtil::FreeNativeImage(&slot->image);
+	delete slot;
+}
+
+void NativeImagePool::FreeIdleLocked(KeyPool &pool, size_t keep)
+{
+	//最久未用的在前面
+	size_t count = pool.idle.size() > keep ? pool.idle.size() - keep : 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		NativeFrameSlot *slot = pool.idle[i];
+		m_All.erase(std::find(m_All.begin(), m_All.end(), slot));
+		m_Stats.cached_bytes -= slot->bytes;
+		m_Stats.frees++;
+		m_Stats.trimmed++;
+		FreeSlot(slot);
+	}
+	pool.idle.erase(pool.idle.begin(), pool.idle.begin() + count);
+}
+
+int NativeImagePool::Preallocate(int format, int width, int height, int count)
+{
+	int done = 0;
+	for (int i = 0; i < count; i++)
+	{
+		NativeFrameSlot *slot = AllocSlot(format, width, height);
+		if (!slot) break;
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		KeyPool &pool = m_Pools[Key{ format, width, height }];
+		pool.idle.push_back(slot);
+		pool.high_water = std::max(pool.high_water, (int) pool.idle.size() + pool.in_use);
+		m_All.push_back(slot);
+		m_Stats.allocations++;
+		m_Stats.cached_bytes += slot->bytes;
+		done++;
+	}
+	if (done < count)
+	{
+		LOGCATE("NativeImagePool::Preallocate format=%d %dx%d only %d/%d frames", format, width, height, done, count);
+	}
+	return done;
+}
+
+NativeFrame NativeImagePool::Acquire(int format, int width, int height)
+{
+	Key key = { format, width, height };
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		KeyPool &pool = m_Pools[key];
+		if (!pool.idle.empty())
+		{
+			NativeFrameSlot *slot = pool.idle.back();
+			pool.idle.pop_back();
+			pool.in_use++;
+			pool.high_water = std::max(pool.high_water, pool.in_use);
+			m_Stats.cached_bytes -= slot->bytes;
+			m_Stats.hits++;
+			slot->refs = 1;
+			return NativeFrame(slot);
+		}
+		m_Stats.misses++;
+	}
+
+	//大帧的 malloc 可能触发大量缺页, 不持锁
+	NativeFrameSlot *slot = AllocSlot(format, width, height);
+	if (!slot)
+	{
+		LOGCATE("NativeImagePool::Acquire format=%d %dx%d alloc failed", format, width, height);
+		return NativeFrame();
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	KeyPool &pool = m_Pools[key];
+	pool.in_use++;
+	pool.high_water = std::max(pool.high_water, pool.in_use);
+	m_All.push_back(slot);
+	m_Stats.allocations++;
+	slot->refs = 1;
+	return NativeFrame(slot);
+}
+
+void NativeImagePool::Recycle(NativeFrameSlot *slot)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	KeyPool &pool = m_Pools[Key{ slot->image.format, slot->image.width, slot->image.height }];
+	pool.in_use--;
+	pool.idle.push_back(slot);
+	m_Stats.cached_bytes += slot->bytes;
+
+	if ((int) pool.idle.size() > m_MaxCachedPerKey)
+	{
+		FreeIdleLocked(pool, m_MaxCachedPerKey);
+	}
+	for (std::map<Key, KeyPool>::iterator it = m_Pools.begin();
+		 it != m_Pools.end() && m_Stats.cached_bytes > m_MaxCachedBytes; ++it)
+	{
+		FreeIdleLocked(it->second, 0);
+	}
+}
+
+void NativeImagePool::Trim()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (std::map<Key, KeyPool>::iterator it = m_Pools.begin(); it != m_Pools.end(); ++it)
+	{
+		KeyPool &pool = it->second;
+		FreeIdleLocked(pool, (size_t) std::max(pool.high_water - pool.in_use, 0));
+		pool.high_water = pool.in_use;
+	}
+}
+
+NativeImagePoolStats NativeImagePool::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	NativeImagePoolStats stats = m_Stats;
+	stats.in_use = 0;
+	stats.cached = 0;
+	for (std::map<Key, KeyPool>::iterator it = m_Pools.begin(); it != m_Pools.end(); ++it)
+	{
+		stats.in_use += it->second.in_use;
+		stats.cached += (uint32_t) it->second.idle.size();
+	}
+	return stats;
+}
+
+void NativeImagePool::DumpStats()
+{
+	NativeImagePoolStats s = GetStats();
+	LOGCATE("NativeImagePool allocations=%llu frees=%llu hits=%llu misses=%llu trimmed=%llu in_use=%u cached=%u cached_bytes=%llu",
+			(unsigned long long) s.allocations, (unsigned long long) s.frees, (unsigned long long) s.hits,
+			(unsigned long long) s.misses, (unsigned long long) s.trimmed, s.in_use, s.cached,
+			(unsigned long long) s.cached_bytes);
+}
@@ -0,0 +1,140 @@
+//
+// NativeImagePool.h
+//
+
+#ifndef DRMDEMO_NATIVE_IMAGE_POOL_H
+#define DRMDEMO_NATIVE_IMAGE_POOL_H
+
+#include "ImageDef.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class NativeImagePool;
+
+//池里的一块图像内存, 引用计数归零后回到所属的池
+struct NativeFrameSlot
+{
+	NativeImage image;
+	std::atomic<int> refs;
+	std::atomic<NativeImagePool *> owner;   //池先于帧销毁时置 NULL, 最后一个引用直接释放内存. 读写都持 NativeImagePool::OwnerMutex
+	size_t bytes;
+};
+
+/*
+ * 引用计数的 NativeImage. 拷贝增加引用(多个阶段共享只读数据), move 只转移所有权,
+ * 在流水线各阶段之间传递时应使用 std::move. 引用计数为原子操作, 可跨线程释放.
+ */
+class NativeFrame
+{
+public:
+	NativeFrame() : m_Slot(NULL) {}
+	~NativeFrame() { Reset(); }
+
+	NativeFrame(const NativeFrame &other);
+	NativeFrame &operator=(const NativeFrame &other);
+	NativeFrame(NativeFrame &&other) : m_Slot(other.m_Slot) { other.m_Slot = NULL; }
+	NativeFrame &operator=(NativeFrame &&other);
+
+	bool IsValid() const { return m_Slot != NULL; }
+	NativeImage *Image() { return m_Slot ? &m_Slot->image : NULL; }
+	const NativeImage *Image() const { return m_Slot ? &m_Slot->image : NULL; }
+	NativeImage *operator->() { return Image(); }
+	const NativeImage *operator->() const { return Image(); }
+
+	int GetRefCount() const { return m_Slot ? m_Slot->refs.load() : 0; }
+	//只有唯一持有者时才应该改写像素
+	bool IsUnique() const { return GetRefCount() == 1; }
+
+	void Reset();
+
+private:
+	friend class NativeImagePool;
+	explicit NativeFrame(NativeFrameSlot *slot) : m_Slot(slot) {}
+
+	NativeFrameSlot *m_Slot;
+};
+
+struct NativeImagePoolStats
+{
+	uint64_t allocations;       //真正调用 AllocNativeImage 的次数, 稳态下应不再增长
+	uint64_t frees;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t trimmed;           //Trim/超出上限时释放的空闲帧
+	uint32_t in_use;
+	uint32_t cached;
+	uint64_t cached_bytes;
+};
+
+/*
+ * 按 (format, width, height) 复用 NativeImage, 内存按 align 对齐分配.
+ * 空闲帧后进先出, 刚释放的帧 cache 更热. 每个 key 记录上次 Trim 以来同时在用的最大帧数(高水位),
+ * Trim 时只保留 高水位 - 在用 个空闲帧, 其余释放, 然后以当前在用数开始新的统计周期.
+ * 单 key 空闲帧数或总空闲字节超过上限时, 在回收时立即释放.
+ */
+class NativeImagePool
+{
+public:
+	explicit NativeImagePool(const NativeImageAlign &align = NativeImageAlign::CacheLine(),
+							 int max_cached_per_key = 8, uint64_t max_cached_bytes = 256ull * 1024 * 1024);
+	~NativeImagePool();
+
+	//预先分配 count 帧放入空闲列表, 并把该 key 的高水位至少抬到 count; 返回成功分配的帧数
+	int Preallocate(int format, int width, int height, int count);
+
+	//分配失败时返回无效帧
+	NativeFrame Acquire(int format, int width, int height);
+
+	void Trim();
+
+	NativeImagePoolStats GetStats();
+	void DumpStats();
+
+private:
+	friend class NativeFrame;
+
+	struct Key
+	{
+		int format;
+		int width;
+		int height;
+		bool operator<(const Key &o) const
+		{
+			if (format != o.format) return format < o.format;
+			if (width != o.width) return width < o.width;
+			return height < o.height;
+		}
+	};
+
+	struct KeyPool
+	{
+		std::vector<NativeFrameSlot *> idle;
+		int in_use;
+		int high_water;
+		KeyPool() : in_use(0), high_water(0) {}
+	};
+
+	//池析构与其它线程上最后一个引用的释放之间交接 owner 用的锁, 所有池共用, 生命周期比任何池都长.
+	//加锁顺序: OwnerMutex 在前, m_Mutex 在后
+	static std::mutex &OwnerMutex();
+
+	NativeFrameSlot *AllocSlot(int format, int width, int height);
+	static void FreeSlot(NativeFrameSlot *slot);
+	void Recycle(NativeFrameSlot *slot);
+	void FreeIdleLocked(KeyPool &pool, size_t keep);
+
+	NativeImageAlign m_Align;
+	int m_MaxCachedPerKey;
+	uint64_t m_MaxCachedBytes;
+
+	std::mutex m_Mutex;
+	std::map<Key, KeyPool> m_Pools;
+	std::vector<NativeFrameSlot *> m_All;       //所有存活的 slot, 析构时用来处理仍在外面的帧
+	NativeImagePoolStats m_Stats;
+};
+
+#endif //DRMDEMO_NATIVE_IMAGE_POOL_H
@@ -0,0 +1,233 @@
+//
+// ProgramBinaryCache.cpp
+//
+
+#include "ProgramBinaryCache.h"
+#include "LogUtil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define PROGRAM_CACHE_MAGIC   0x4E494250  //"PBIN"
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+	uint64_t checksum;      //binary 的 FNV-1a, 用于发现截断/损坏
+	float compile_ms;
+	uint32_t reserved;
+};
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t *) data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static const uint64_t kFnvOffset = 0xcbf29ce484222325ull;
+
+static double now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+ProgramBinaryCache *ProgramBinaryCache::GetInstance()
+{
+	static ProgramBinaryCache *instance = new ProgramBinaryCache();
+	return instance;
+}
+
+ProgramBinaryCache::ProgramBinaryCache()
+{
+	m_Enabled = false;
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+int ProgramBinaryCache::SetDirectory(const char *dir)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Enabled = false;
+	if (!dir) return 0;
+
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	if (formats <= 0)
+	{
+		LOGCATE("ProgramBinaryCache::SetDirectory driver has no program binary formats");
+		return -1;
+	}
+	//新装的机器上父目录可能还不存在, 逐级创建
+	std::string path(dir);
+	for (size_t pos = 1; pos <= path.size(); pos++)
+	{
+		if (pos != path.size() && path[pos] != '/') continue;
+		std::string sub = path.substr(0, pos);
+		if (mkdir(sub.c_str(), 0755) < 0 && errno != EEXIST)
+		{
+			LOGCATE("ProgramBinaryCache::SetDirectory mkdir %s failed: %s", sub.c_str(), strerror(errno));
+			return -1;
+		}
+	}
+
+	const char *renderer = (const char *) glGetString(GL_RENDERER);
+	const char *version = (const char *) glGetString(GL_VERSION);
+	m_DriverId = std::string(renderer ? renderer : "") + "|" + (version ? version : "");
+	m_Dir = dir;
+	m_Enabled = true;
+	LOGCATE("ProgramBinaryCache::SetDirectory %s driver=%s", dir, m_DriverId.c_str());
+	return 0;
+}
+
+std::string ProgramBinaryCache::PathFor(uint64_t key) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) key);
+	return m_Dir + name;
+}
+
+GLuint ProgramBinaryCache::Load(const char *vertex_source, const char *fragment_source, uint64_t *key)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	*key = 0;
+	if (!m_Enabled) return 0;
+
+	//源码之间用 '\0' 分隔, 避免拼接后碰撞
+	uint64_t hash = kFnvOffset;
+	hash = fnv1a(hash, vertex_source, strlen(vertex_source) + 1);
+	hash = fnv1a(hash, fragment_source, strlen(fragment_source) + 1);
+	hash = fnv1a(hash, m_DriverId.c_str(), m_DriverId.size());
+	*key = hash;
+
+	double start = now_ms();
+	std::string path = PathFor(hash);
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+	{
+		m_Stats.misses++;
+		return 0;
+	}
+
+	ProgramCacheHeader header;
+	std::vector<uint8_t> binary;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+				 header.magic == PROGRAM_CACHE_MAGIC && header.version == PROGRAM_CACHE_VERSION &&
+				 header.key == hash && header.length > 0;
+	if (valid)
+	{
+		binary.resize(header.length);
+		valid = fread(&binary[0], 1, binary.size(), file) == binary.size() &&
+				fnv1a(kFnvOffset, &binary[0], binary.size()) == header.checksum;
+	}
+	fclose(file);
+
+	GLuint program = 0;
+	if (valid)
+	{
+		program = glCreateProgram();
+		glProgramBinary(program, header.format, &binary[0], (GLsizei) binary.size());
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE)
+		{
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+
+	if (!program)
+	{
+		//驱动升级后格式不兼容等情况, 删掉旧文件, 调用者会走源码编译并重新保存
+		LOGCATE("ProgramBinaryCache::Load %s rejected, recompile from source", path.c_str());
+		unlink(path.c_str());
+		m_Stats.misses++;
+		m_Stats.load_failures++;
+		return 0;
+	}
+
+	double load_ms = now_ms() - start;
+	double saved_ms = header.compile_ms - load_ms;
+	m_Stats.hits++;
+	m_Stats.saved_ms += saved_ms;
+	LOGCATE("ProgramBinaryCache::Load %016llx program=%u load=%.2fms compile=%.2fms saved=%.2fms",
+			(unsigned long long) hash, program, load_ms, header.compile_ms, saved_ms);
+	return program;
+}
+
+void ProgramBinaryCache::Store(GLuint program, uint64_t key, double compile_ms)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (!m_Enabled || !program || !key) return;
+
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	std::vector<uint8_t> binary((size_t) length);
+	GLenum format = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(program, length, &written, &format, &binary[0]);
+	if (written <= 0) return;
+
+	ProgramCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.version = PROGRAM_CACHE_VERSION;
+	header.key = key;
+	header.format = format;
+	header.length = (uint32_t) written;
+	header.checksum = fnv1a(kFnvOffset, &binary[0], (size_t) written);
+	header.compile_ms = (float) compile_ms;
+
+	//先写临时文件, fsync 后 rename, 保证读者看到的要么是旧文件要么是完整的新文件
+	std::string path = PathFor(key);
+	char tmp_path[512];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", path.c_str(), (int) getpid());
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		LOGCATE("ProgramBinaryCache::Store open %s failed: %s", tmp_path, strerror(errno));
+		return;
+	}
+	bool ok = write(fd, &header, sizeof(header)) == (ssize_t) sizeof(header) &&
+			  write(fd, &binary[0], (size_t) written) == (ssize_t) written &&
+			  fsync(fd) == 0;
+	close(fd);
+	if (!ok || rename(tmp_path, path.c_str()) != 0)
+	{
+		LOGCATE("ProgramBinaryCache::Store write %s failed: %s", path.c_str(), strerror(errno));
+		unlink(tmp_path);
+		return;
+	}
+	m_Stats.stores++;
+}
+
+ProgramBinaryCacheStats ProgramBinaryCache::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	return m_Stats;
+}
+
+void ProgramBinaryCache::DumpStats()
+{
+	ProgramBinaryCacheStats s = GetStats();
+	LOGCATE("ProgramBinaryCache hits=%u misses=%u stores=%u load_failures=%u saved=%.2fms",
+			s.hits, s.misses, s.stores, s.load_failures, s.saved_ms);
+}
@@ -0,0 +1,59 @@
+//
+// ProgramBinaryCache.h
+//
+
+#ifndef DRMDEMO_PROGRAM_BINARY_CACHE_H
+#define DRMDEMO_PROGRAM_BINARY_CACHE_H
+
+#include <GLES3/gl3.h>
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+
+struct ProgramBinaryCacheStats
+{
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t stores;
+	uint32_t load_failures;     //文件损坏或驱动拒绝, 已退回源码编译
+	double saved_ms;            //命中时: 记录的编译耗时 - 加载耗时, 累计
+};
+
+/*
+ * program 二进制磁盘缓存, 由 GLUtils::CreateProgram 使用.
+ * key 为 (顶点 shader, 片元 shader, GL_RENDERER, GL_VERSION) 的 64 位 FNV-1a,
+ * 驱动或源码变化后 key 随之变化, 旧文件不会再被命中.
+ * 文件先写到临时文件再 rename, 进程中途退出不会留下半个文件.
+ * 未设置目录或驱动不支持二进制格式时不生效.
+ */
+class ProgramBinaryCache
+{
+public:
+	static ProgramBinaryCache *GetInstance();
+
+	//目录不存在时创建, 需在 GL 上下文当前后调用; dir 为 NULL 时关闭缓存
+	int SetDirectory(const char *dir);
+	bool IsEnabled() const { return m_Enabled; }
+
+	//命中时返回已链接的 program, 否则返回 0, *key 用于随后的 Store
+	GLuint Load(const char *vertex_source, const char *fragment_source, uint64_t *key);
+	//源码编译成功后保存, compile_ms 为这次编译+链接耗时
+	void Store(GLuint program, uint64_t key, double compile_ms);
+
+	ProgramBinaryCacheStats GetStats();
+	void DumpStats();
+
+private:
+	ProgramBinaryCache();
+
+	std::string PathFor(uint64_t key) const;
+
+	std::mutex m_Mutex;
+	bool m_Enabled;
+	std::string m_Dir;
+	std::string m_DriverId;     //GL_RENDERER + GL_VERSION
+	ProgramBinaryCacheStats m_Stats;
+};
+
+#endif //DRMDEMO_PROGRAM_BINARY_CACHE_H
@@ -0,0 +1,100 @@
+//
+// ThreadPool.cpp
+//
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threads)
+{
+	m_Fn = NULL;
+	m_Count = 0;
+	m_Next = 0;
+	m_Pending = 0;
+	m_Generation = 0;
+	m_Stop = false;
+
+	if (threads < 0)
+	{
+		int cores = (int) std::thread::hardware_concurrency();
+		threads = std::min(std::max(cores - 1, 0), 3);
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		m_Workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+	}
+	m_WakeCond.notify_all();
+	for (size_t i = 0; i < m_Workers.size(); i++) m_Workers[i].join();
+}
+
+ThreadPool *ThreadPool::GetDefault()
+{
+	static ThreadPool *instance = new ThreadPool();
+	return instance;
+}
+
+void ThreadPool::RunTasks()
+{
+	for (;;)
+	{
+		int i = m_Next.fetch_add(1);
+		if (i >= m_Count) break;
+		(*m_Fn)(i);
+	}
+}
+
+void ThreadPool::WorkerLoop()
+{
+	uint64_t seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WakeCond.wait(lock, [&] { return m_Stop || m_Generation != seen; });
+			if (m_Stop) return;
+			seen = m_Generation;
+		}
+
+		RunTasks();
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_Pending == 0) m_DoneCond.notify_one();
+	}
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)> &fn)
+{
+	if (count <= 0) return;
+	if (count == 1 || m_Workers.empty())
+	{
+		for (int i = 0; i < count; i++) fn(i);
+		return;
+	}
+
+	std::lock_guard<std::mutex> call_lock(m_CallMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Fn = &fn;
+		m_Count = count;
+		m_Next = 0;
+		m_Pending = (int) m_Workers.size();
+		m_Generation++;
+	}
+	m_WakeCond.notify_all();
+
+	RunTasks();
+
+	//等所有工作线程退出 RunTasks, 之后 fn 才能析构
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_DoneCond.wait(lock, [&] { return m_Pending == 0; });
+	m_Fn = NULL;
+}
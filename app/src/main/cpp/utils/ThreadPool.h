@@ -0,0 +1,54 @@
+//
+// ThreadPool.h
+//
+
+#ifndef DRMDEMO_THREAD_POOL_H
+#define DRMDEMO_THREAD_POOL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * 固定数量的工作线程, 只提供阻塞式的 ParallelFor: 调用线程也参与执行, 全部完成后返回.
+ * 同一时刻只跑一个 ParallelFor, 多个调用者会排队.
+ * 用于拷贝/转换这类按行切块的 CPU 工作, 不适合放长时间阻塞的任务.
+ */
+class ThreadPool
+{
+public:
+	//threads 为额外的工作线程数, <0 时按 CPU 核数选择(最多 3 个, 加上调用线程共 4 路)
+	explicit ThreadPool(int threads = -1);
+	~ThreadPool();
+
+	//总并行度, 含调用线程
+	int GetConcurrency() const { return (int) m_Workers.size() + 1; }
+
+	//对 [0, count) 的每个 i 调用一次 fn(i), 顺序不定
+	void ParallelFor(int count, const std::function<void(int)> &fn);
+
+	//进程内共享的默认线程池
+	static ThreadPool *GetDefault();
+
+private:
+	void WorkerLoop();
+	void RunTasks();
+
+	std::vector<std::thread> m_Workers;
+	std::mutex m_CallMutex;             //串行化 ParallelFor 调用
+	std::mutex m_Mutex;
+	std::condition_variable m_WakeCond;
+	std::condition_variable m_DoneCond;
+	const std::function<void(int)> *m_Fn;
+	int m_Count;
+	std::atomic<int> m_Next;
+	int m_Pending;                      //尚未完成的工作线程数
+	uint64_t m_Generation;
+	bool m_Stop;
+};
+
+#endif //DRMDEMO_THREAD_POOL_H
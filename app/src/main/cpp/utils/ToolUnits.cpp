@@ -11,6 +11,7 @@
 #include <fstream>
 #include "stdlib.h"
 #include <unistd.h>
+#include <sys/stat.h>
 
 int ToolUnits::SaveData(char *szFileName, unsigned char *iBuf,
 		unsigned int iLen) {
@@ -43,15 +44,12 @@ int ToolUnits::SaveDataApp(char *szFileName, unsigned char *iBuf,
 }
 
 int ToolUnits::GetDataSize(char *szFileName) {
-	FILE *fp;
-	fp = fopen(szFileName, ("rb"));
-	if (!fp) {
+	//ֻСشļ
+	struct stat st;
+	if (stat(szFileName, &st) < 0) {
 		return 0;
 	}
-	fseek(fp, 0, SEEK_END);
-	int size = ftell(fp);
-	fclose(fp);
-	return size;
+	return (int) st.st_size;
 }
 
 int ToolUnits::ReadData(char *szFileName, unsigned char *oBuf, int iLen) {